@@ -0,0 +1,128 @@
+#include <algorithm>    // std::generate
+#include <cstdlib>      // std::rand
+#include "benchmark.h"
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "modified_helmholtz.h"
+
+using namespace exafmm_t;
+
+typedef std::vector<std::pair<std::string, std::string>> Params;
+
+real_t random_real() {
+  return real_t(std::rand()) / RAND_MAX;
+}
+
+// P2P of a leaf of n sources on a leaf of n targets in a unit cube, with the SoA coordinates built once as by the tree
+template <typename T, typename FmmT>
+void bench_P2P(BenchmarkSuite& suite, FmmT& fmm, std::string kernel, int n) {
+  RealVec src_coord(3*n), trg_coord(3*n);
+  std::generate(src_coord.begin(), src_coord.end(), random_real);
+  std::generate(trg_coord.begin(), trg_coord.end(), random_real);
+  AlignedVec src_soa = transpose_coord(src_coord);
+  AlignedVec trg_soa = transpose_coord(trg_coord, TRG_PAD);
+  SoACoord src(src_soa, n), trg(trg_soa, n);
+  std::vector<T> src_value(n, T(1));
+  std::vector<T> potential(n, T(0)), gradient(4*n, T(0));
+  Params params = {{"kernel", kernel}, {"n", std::to_string(n)}};
+  suite.run("P2P potential", params, [&]() { fmm.potential_P2P(src, src_value, trg, potential); });
+  suite.run("P2P gradient", params, [&]() { fmm.gradient_P2P(src, src_value, trg, gradient); });
+}
+
+// complex 8x8 matrix times the vectors of 2 interactions at one frequency, the kernel of hadamard_product()
+void bench_matmult(BenchmarkSuite& suite) {
+  AlignedVec M(2*NCHILD*NCHILD), in(4*NCHILD), out(4*NCHILD, 0);
+  std::generate(M.begin(), M.end(), random_real);
+  std::generate(in.begin(), in.end(), random_real);
+  long long flop = 2 * 8*8*8;
+  long long bytes = sizeof(real_t) * (2*NCHILD*NCHILD + 2*2*NCHILD + 2*4*NCHILD);   // M, inputs, outputs read and written
+  suite.run("matmult_8x8x2", Params(), [&]() {
+    real_t* M_ = &M[0];
+    real_t* IN0 = &in[0];
+    real_t* IN1 = &in[2*NCHILD];
+    real_t* OUT0 = &out[0];
+    real_t* OUT1 = &out[2*NCHILD];
+    matmult_8x8x2(M_, IN0, IN1, OUT0, OUT1);
+  }, nullptr, flop, bytes);
+}
+
+// FFT and inverse FFT of the M2L of nnodes parent nodes
+void bench_fft(BenchmarkSuite& suite, int p, int nnodes) {
+  LaplaceFmm fmm(p, 64);
+  int nequiv = NCHILD * fmm.nsurf;
+  size_t fft_size = 2 * NCHILD * fmm.nfreq;
+  std::vector<size_t> offset(nnodes);
+  for (int i=0; i<nnodes; i++) offset[i] = i * nequiv;
+  RealVec up_equiv(nnodes*nequiv), dn_equiv(nnodes*nequiv, 0), scale(nnodes, 1);
+  std::generate(up_equiv.begin(), up_equiv.end(), random_real);
+  AlignedVec fft_in(nnodes*fft_size), fft_out(nnodes*fft_size);
+  std::generate(fft_out.begin(), fft_out.end(), random_real);
+  Params params = {{"p", std::to_string(p)}, {"nodes", std::to_string(nnodes)}};
+  suite.run("fft_up_equiv", params, [&]() { fmm.fft_up_equiv(offset, up_equiv, fft_in); });
+  suite.run("ifft_dn_check", params, [&]() { fmm.ifft_dn_check(offset, scale, fft_out, dn_equiv); });
+}
+
+// matrix-vector operators of a Laplace tree, and the construction of the tree and its lists
+void bench_tree(BenchmarkSuite& suite, Args& args) {
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, args.distribution, 0);
+  Bodies<real_t> targets = init_targets<real_t>(args.numBodies, args.distribution, 5);
+  LaplaceFmm fmm(args.P, args.ncrit);
+  Params params = {{"n", std::to_string(args.numBodies)}, {"p", std::to_string(args.P)},
+                   {"ncrit", std::to_string(args.ncrit)}, {"distribution", args.distribution},
+                   {"threads", std::to_string(args.threads)}};
+
+  Bodies<real_t> src, trg;
+  NodePtrs<real_t> leafs, nonleafs;
+  Nodes<real_t> nodes;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  auto reset = [&]() {
+    src = sources;
+    trg = targets;
+    leafs.clear();
+    nonleafs.clear();
+  };
+  auto build = [&]() { nodes = build_tree(src, trg, leafs, nonleafs, fmm); };
+  auto balance = [&]() { balance_tree(nodes, src, trg, leafs, nonleafs, fmm); };
+  auto lists = [&]() {
+    set_colleagues(nodes);
+    build_list(nodes, fmm);
+  };
+  suite.run("build_tree", params, build, reset);
+  suite.run("balance_tree", params, balance, [&]() { reset(); build(); });
+  suite.run("build_list", params, lists, [&]() { reset(); build(); balance(); });
+
+  fmm.precompute();
+  suite.run("P2M", params, [&]() { fmm.P2M(leafs); });
+  suite.run("M2M", params, [&]() { fmm.M2M_levels(nodes); });
+  suite.run("L2L", params, [&]() { fmm.L2L_levels(nodes); });
+  suite.run("L2P", params, [&]() { fmm.L2P(leafs); });
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+  std::srand(0);
+  BenchmarkSuite suite(args.warmup, args.repetitions);
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  ModifiedHelmholtzFmm modified_helmholtz(args.P, args.ncrit, 10);
+  int leaf_sizes[] = {16, 64, 256, 1024};
+  for (int i=0; i<4; i++) {
+    bench_P2P<real_t>(suite, laplace, "laplace", leaf_sizes[i]);
+    bench_P2P<complex_t>(suite, helmholtz, "helmholtz", leaf_sizes[i]);
+    bench_P2P<real_t>(suite, modified_helmholtz, "modified_helmholtz", leaf_sizes[i]);
+  }
+  bench_matmult(suite);
+  int orders[] = {4, 6, 8, 10};
+  for (int i=0; i<4; i++)
+    bench_fft(suite, orders[i], 64);
+  bench_tree(suite, args);
+
+  if (*args.output) suite.write(args.output);
+  return 0;
+}
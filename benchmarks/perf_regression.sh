@@ -0,0 +1,4 @@
+#!/bin/sh
+# rerun the configurations of the baseline and fail if a phase is slower beyond the threshold, PERF_BASELINE
+# selects the baseline of this machine, otherwise the committed one is calibrated, see "make perf-baseline"
+./scaling --baseline "${PERF_BASELINE:-${srcdir:-.}/baseline.json}" --repetitions 10 --threshold "${PERF_THRESHOLD:-0.2}"
@@ -0,0 +1,435 @@
+#include <cstdio>
+#include <cstdlib>
+#include <map>
+#include <sstream>
+#include <getopt.h>
+#include "benchmark.h"
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "modified_helmholtz.h"
+#include "tree_statistics.h"
+
+using namespace exafmm_t;
+
+typedef std::vector<std::pair<std::string, std::string>> Params;
+
+static struct option scaling_options[] = {
+  {"baseline",     required_argument, 0, 'b'},
+  {"ncrit",        required_argument, 0, 'c'},
+  {"distribution", required_argument, 0, 'd'},
+  {"wavenumber",   required_argument, 0, 'k'},
+  {"kernel",       required_argument, 0, 'K'},
+  {"mode",         required_argument, 0, 'm'},
+  {"numBodies",    required_argument, 0, 'n'},
+  {"output",       required_argument, 0, 'o'},
+  {"P",            required_argument, 0, 'P'},
+  {"repetitions",  required_argument, 0, 'r'},
+  {"threshold",    required_argument, 0, 't'},
+  {"threads",      required_argument, 0, 'T'},
+  {"warmup",       required_argument, 0, 'w'},
+  {0, 0, 0, 0}
+};
+
+//! Sweep of the scaling study, the list options are comma separated and every combination is run.
+class Sweep {
+public:
+  std::string baseline;        //!< Results to rerun and compare with, instead of the lists
+  std::vector<int> ncrits;
+  std::vector<std::string> distributions;
+  double k;
+  std::string kernel;
+  bool is_weak;                //!< Whether numBodies is per thread
+  std::vector<int> numBodies;
+  std::string output;
+  std::vector<int> orders;
+  int repetitions;
+  double threshold;            //!< Tolerated relative slowdown of the median time compared to the baseline
+  std::vector<int> threads;
+  int warmup;
+
+private:
+  void usage(char * name) {
+    fprintf(stderr,
+            "Usage: %s [options]\n"
+            "Long option (short option)       : Description (Default value)\n"
+            " --baseline (-b)                 : JSON results to rerun and compare with, exits with 1 if slower (none)\n"
+            "                                   or if measured elsewhere without a calibration to scale its times\n"
+            " --ncrit (-c) list               : Number of bodies per leaf node (64)\n"
+            " --distribution (-d) list [c/s/p]: cube, sphere, plummer (c)\n"
+            " --wavenumber (-k)               : Wavenumber of Helmholtz kernels (%f)\n"
+            " --kernel (-K)                   : laplace, helmholtz, modified_helmholtz (%s)\n"
+            " --mode (-m) [strong/weak]       : Fixed total number of bodies, or number of bodies per thread (strong)\n"
+            " --numBodies (-n) list           : Number of bodies, per thread in weak mode (100000)\n"
+            " --output (-o)                   : Output file, .csv or .json, or prefix of both (none)\n"
+            " --P (-P) list                   : Order of expansion (4)\n"
+            " --repetitions (-r)              : Timed evaluations per configuration (%d)\n"
+            " --threshold (-t)                : Tolerated slowdown compared to the baseline (%g)\n"
+            " --threads (-T) list             : Numbers of threads (powers of 2 up to %d)\n"
+            " --warmup (-w)                   : Untimed evaluations per configuration (%d)\n",
+            name, k, kernel.c_str(), repetitions, threshold, omp_get_max_threads(), warmup);
+  }
+
+  static std::vector<std::string> split(const char * arg) {
+    std::vector<std::string> items;
+    std::stringstream ss(arg);
+    std::string item;
+    while (std::getline(ss, item, ','))
+      if (!item.empty()) items.push_back(item);
+    return items;
+  }
+
+  static std::vector<int> parseInts(const char * arg) {
+    std::vector<std::string> items = split(arg);
+    std::vector<int> values;
+    for (size_t i=0; i<items.size(); i++) values.push_back(atoi(items[i].c_str()));
+    return values;
+  }
+
+  static std::vector<std::string> parseDistributions(const char * arg) {
+    std::vector<std::string> items = split(arg);
+    std::vector<std::string> values;
+    for (size_t i=0; i<items.size(); i++) {
+      switch (items[i][0]) {
+        case 'c': values.push_back("cube"); break;
+        case 's': values.push_back("sphere"); break;
+        case 'p': values.push_back("plummer"); break;
+        default:
+          fprintf(stderr, "invalid distribution %s\n", items[i].c_str());
+          abort();
+      }
+    }
+    return values;
+  }
+
+public:
+  Sweep(int argc, char ** argv) :
+    ncrits(1, 64),
+    distributions(1, "cube"),
+    k(20),
+    kernel("laplace"),
+    is_weak(false),
+    numBodies(1, 100000),
+    orders(1, 4),
+    repetitions(3),
+    threshold(0.1),
+    warmup(1) {
+    for (int t=1; t<omp_get_max_threads(); t*=2) threads.push_back(t);
+    threads.push_back(omp_get_max_threads());
+    while (1) {
+      int option_index;
+      int c = getopt_long(argc, argv, "b:c:d:k:K:m:n:o:P:r:t:T:w:", scaling_options, &option_index);
+      if (c == -1) break;
+      switch (c) {
+        case 'b':
+          baseline = optarg;
+          break;
+        case 'c':
+          ncrits = parseInts(optarg);
+          break;
+        case 'd':
+          distributions = parseDistributions(optarg);
+          break;
+        case 'k':
+          k = atof(optarg);
+          break;
+        case 'K':
+          kernel = optarg;
+          break;
+        case 'm':
+          is_weak = std::string(optarg) == "weak";
+          break;
+        case 'n':
+          numBodies = parseInts(optarg);
+          break;
+        case 'o':
+          output = optarg;
+          break;
+        case 'P':
+          orders = parseInts(optarg);
+          break;
+        case 'r':
+          repetitions = atoi(optarg);
+          break;
+        case 't':
+          threshold = atof(optarg);
+          break;
+        case 'T':
+          threads = parseInts(optarg);
+          break;
+        case 'w':
+          warmup = atoi(optarg);
+          break;
+        default:
+          usage(argv[0]);
+          exit(0);
+      }
+    }
+  }
+};
+
+// phases of an evaluation, in the order of the passes
+const char* phases[] = {"P2M", "M2M", "P2L", "M2P", "P2P", "M2L", "L2L", "L2P"};
+const int nphases = 8;
+
+/**
+ * @brief Build the tree of a configuration and evaluate it warmup + repetitions times, then add the
+ * time of the evaluations and of each phase to the suite. The peak memory covers the bodies, the tree,
+ * the precomputed operators and the evaluations.
+ */
+template <typename T, typename FmmT>
+void run_config(BenchmarkSuite& suite, FmmT& fmm, const Params& params, int nbodies, const char* distribution) {
+  bool is_reset = reset_peak_memory();
+  Bodies<T> sources = init_sources<T>(nbodies, distribution, 0);
+  Bodies<T> targets = init_targets<T>(nbodies, distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  start("tree");
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  double tree_time = stop("tree", false);
+  start("precompute");
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  double precompute_time = stop("precompute", false);
+
+  for (int i=0; i<suite.warmup; i++) {
+    fmm.clear_values(nodes);
+    fmm.upward_pass(nodes, leafs, false);
+    fmm.downward_pass(nodes, leafs, false);
+  }
+  std::vector<double> times;
+  std::vector<std::vector<double>> phase_times(nphases);
+  for (int r=0; r<suite.repetitions; r++) {
+    fmm.clear_values(nodes);
+    start("evaluate");
+    fmm.upward_pass(nodes, leafs, false);
+    fmm.downward_pass(nodes, leafs, false);
+    times.push_back(stop("evaluate", false));
+    for (int i=0; i<nphases; i++) phase_times[i].push_back(fmm.phase_counters[phases[i]].time);
+  }
+  RealVec error = fmm.verify(leafs, true);
+
+  // counts are those of the last evaluation
+  Counters counts;
+  for (int i=0; i<nphases; i++) counts += fmm.phase_counters[phases[i]].counters;
+  BenchmarkResult& result = suite.add("evaluate", params, times, counts.total_flop(), counts.total_bytes());
+  result.set_metric("peak_memory_mb", peak_memory() / 1e6);
+  result.set_metric("is_peak_memory_reset", is_reset);
+  result.set_metric("potential_error", error[0]);
+  result.set_metric("gradient_error", error[1]);
+  result.set_metric("tree_time", tree_time);
+  result.set_metric("precompute_time", precompute_time);
+  result.set_metric("depth", fmm.depth);
+  result.set_metric("nodes", nodes.size());
+  result.set_metric("leafs", leafs.size());
+  TreeStatistics tree = tree_statistics(nodes, fmm);
+  result.set_metric("mean_leaf_sources", tree.leaf_sources.mean());
+  result.set_metric("mean_P2P_list", tree.P2P_lengths.mean());
+  result.set_metric("mean_M2L_list", tree.M2L_lengths.mean());
+  result.set_metric("estimated_flop", tree.total_flop());
+  for (int i=0; i<nphases; i++) {
+    Counters& phase = fmm.phase_counters[phases[i]].counters;
+    suite.add(std::string("phase ") + phases[i], params, phase_times[i], phase.total_flop(), phase.total_bytes());
+  }
+}
+
+/**
+ * @brief Add the speedup and the parallel efficiency of each result relative to the result of the same
+ * benchmark and configuration with the fewest threads, normally 1. In strong scaling the efficiency is
+ * t_ref * threads_ref / (t * threads), in weak scaling it is t_ref / t.
+ */
+void add_efficiency(BenchmarkSuite& suite) {
+  std::map<std::string, size_t> reference;   // benchmark and parameters other than threads -> result
+  std::vector<std::string> keys;
+  for (size_t i=0; i<suite.results.size(); i++) {
+    BenchmarkResult& result = suite.results[i];
+    std::string key = result.name;
+    for (size_t j=0; j<result.params.size(); j++)
+      if (result.params[j].first != "threads" && result.params[j].first != "bodies")
+        key += ";" + result.params[j].first + "=" + result.params[j].second;
+    keys.push_back(key);
+    auto it = reference.find(key);
+    if (it == reference.end() || atoi(result.param("threads").c_str()) < atoi(suite.results[it->second].param("threads").c_str()))
+      reference[key] = i;
+  }
+  for (size_t i=0; i<suite.results.size(); i++) {
+    BenchmarkResult& result = suite.results[i];
+    const BenchmarkResult& ref = suite.results[reference[keys[i]]];
+    double threads = atof(result.param("threads").c_str());
+    double ref_threads = atof(ref.param("threads").c_str());
+    double speedup = result.stats.median > 0 ? ref.stats.median / result.stats.median : 0;
+    result.set_metric("speedup", speedup);
+    result.set_metric("efficiency", result.param("mode") == "weak" ? speedup : speedup * ref_threads / threads);
+  }
+}
+
+//! Value of a parameter, empty if there is none by this name.
+std::string value(const Params& params, const std::string& key) {
+  for (size_t i=0; i<params.size(); i++)
+    if (params[i].first == key) return params[i].second;
+  return std::string();
+}
+
+//! Configurations of the sweep, every combination of its lists.
+std::vector<Params> configurations(const Sweep& sweep) {
+  std::vector<Params> configs;
+  for (size_t n=0; n<sweep.numBodies.size(); n++) {
+    for (size_t d=0; d<sweep.distributions.size(); d++) {
+      for (size_t p=0; p<sweep.orders.size(); p++) {
+        for (size_t c=0; c<sweep.ncrits.size(); c++) {
+          for (size_t t=0; t<sweep.threads.size(); t++) {
+            int nthreads = sweep.threads[t];
+            int nbodies = sweep.is_weak ? sweep.numBodies[n] * nthreads : sweep.numBodies[n];
+            Params params = {{"kernel", sweep.kernel}, {"mode", sweep.is_weak ? "weak" : "strong"},
+                             {"n", std::to_string(sweep.numBodies[n])}, {"bodies", std::to_string(nbodies)},
+                             {"distribution", sweep.distributions[d]}, {"p", std::to_string(sweep.orders[p])},
+                             {"ncrit", std::to_string(sweep.ncrits[c])}, {"threads", std::to_string(nthreads)}};
+            if (sweep.kernel != "laplace") params.push_back(std::make_pair("wavenumber", std::to_string(sweep.k)));
+            configs.push_back(params);
+          }
+        }
+      }
+    }
+  }
+  return configs;
+}
+
+//! Run the configuration given by its parameters.
+void run_configuration(BenchmarkSuite& suite, const Params& params) {
+  std::string kernel = value(params, "kernel");
+  std::string distribution = value(params, "distribution");
+  int nbodies = atoi(value(params, "bodies").c_str());
+  int p = atoi(value(params, "p").c_str());
+  int ncrit = atoi(value(params, "ncrit").c_str());
+  double k = atof(value(params, "wavenumber").c_str());
+  omp_set_num_threads(atoi(value(params, "threads").c_str()));
+  if (kernel == "laplace") {
+    LaplaceFmm fmm(p, ncrit);
+    run_config<real_t>(suite, fmm, params, nbodies, distribution.c_str());
+  } else if (kernel == "helmholtz") {
+    HelmholtzFmm fmm(p, ncrit, complex_t(k));
+    run_config<complex_t>(suite, fmm, params, nbodies, distribution.c_str());
+  } else if (kernel == "modified_helmholtz") {
+    ModifiedHelmholtzFmm fmm(p, ncrit, k);
+    run_config<real_t>(suite, fmm, params, nbodies, distribution.c_str());
+  } else {
+    fprintf(stderr, "invalid kernel %s\n", kernel.c_str());
+    abort();
+  }
+}
+
+//! Single-threaded reference kernel, whose time relates the speed of the machine and build to those of a baseline.
+void run_calibration(BenchmarkSuite& suite) {
+  LaplaceFmm fmm(4, 64);
+  int n = 1024;
+  RealVec src_coord(3*n), trg_coord(3*n), src_value(n), trg_value(4*n);
+  seed_rand48(0);
+  for (int i=0; i<3*n; i++) {
+    src_coord[i] = next_rand48();
+    trg_coord[i] = next_rand48();
+  }
+  for (int i=0; i<n; i++) src_value[i] = next_rand48() - 0.5;
+  Params params = {{"kernel", "laplace"}, {"sources", std::to_string(n)}, {"targets", std::to_string(n)}, {"threads", "1"}};
+  suite.run("calibration", params, [&]() { fmm.gradient_P2P(src_coord, src_value, trg_coord, trg_value); });
+}
+
+/**
+ * @brief Compare the results with those of the baseline. A baseline measured on another machine or build is
+ * calibrated: its times are scaled by the ratio of the calibration times, and the threshold is doubled as the
+ * calibration only approximates the relative speed of the evaluations.
+ *
+ * @return 1 if a benchmark is slower beyond the threshold, or if the baseline was measured elsewhere and
+ * has no calibration, 0 otherwise.
+ */
+int compare_baseline(const BenchmarkSuite& suite, const BenchmarkSuite& baseline, double threshold) {
+  double scale = 1;
+  if (suite.context != baseline.context) {
+    std::cout << std::endl << "The baseline was measured on another machine or build:" << std::endl;
+    for (size_t i=0; i<baseline.context.size(); i++)
+      std::cout << "  baseline " << baseline.context[i].first << ": " << baseline.context[i].second << std::endl;
+    for (size_t i=0; i<suite.context.size(); i++)
+      std::cout << "  current  " << suite.context[i].first << ": " << suite.context[i].second << std::endl;
+    const BenchmarkResult* current = nullptr;
+    for (size_t i=0; i<suite.results.size(); i++)
+      if (suite.results[i].name == "calibration") current = &suite.results[i];
+    const BenchmarkResult* base = current ? baseline.find(*current) : nullptr;
+    if (!base || base->stats.median <= 0) {
+      std::cout << "ERROR: the baseline has no calibration, measure one for this machine with \"make perf-baseline\""
+                << " or select it with PERF_BASELINE" << std::endl;
+      return 1;
+    }
+    scale = current->stats.median / base->stats.median;
+    threshold *= 2;
+    std::cout << "The baseline times are calibrated by " << std::fixed << std::setprecision(3) << scale << std::endl;
+  }
+  int nregressions = 0;
+  std::cout << std::endl << "benchmark : baseline current ratio (threshold " << threshold << ")" << std::endl;
+  for (size_t i=0; i<suite.results.size(); i++) {
+    const BenchmarkResult& result = suite.results[i];
+    const BenchmarkResult* found = baseline.find(result);
+    if (!found || result.name == "calibration") continue;
+    BenchmarkResult base = *found;
+    for (size_t j=0; j<base.times.size(); j++) base.times[j] *= scale;
+    base.stats = summarize(base.times);
+    Comparison comparison = compare(base, result, threshold);
+    std::string label = result.name;
+    for (size_t j=0; j<result.params.size(); j++)
+      label += " " + result.params[j].first + "=" + result.params[j].second;
+    std::cout << label << " : " << std::scientific << std::setprecision(3) << base.stats.median << " "
+              << result.stats.median << " " << std::fixed << std::setprecision(2) << comparison.ratio
+              << (comparison.change > 0 ? "  REGRESSION" : comparison.change < 0 ? "  improved" : "") << std::endl;
+    if (comparison.change > 0) nregressions++;
+  }
+  std::cout << nregressions << " regression(s)" << std::endl;
+  return nregressions ? 1 : 0;
+}
+
+int main(int argc, char **argv) {
+  Sweep sweep(argc, argv);
+  init_rel_coord();
+  BenchmarkSuite suite(sweep.warmup, sweep.repetitions);
+  BenchmarkSuite baseline;
+  std::vector<Params> configs;
+  if (sweep.baseline.empty()) {
+    configs = configurations(sweep);
+  } else {
+    if (!baseline.read(sweep.baseline)) {
+      fprintf(stderr, "cannot read the baseline %s\n", sweep.baseline.c_str());
+      return 2;
+    }
+    for (size_t i=0; i<baseline.results.size(); i++)
+      if (baseline.results[i].name == "evaluate") configs.push_back(baseline.results[i].params);
+  }
+  run_calibration(suite);
+  for (size_t i=0; i<configs.size(); i++) run_configuration(suite, configs[i]);
+  add_efficiency(suite);
+
+  std::cout << std::endl << "bodies distribution p ncrit threads : time speedup efficiency memory(MB) error" << std::endl;
+  for (size_t i=0; i<suite.results.size(); i++) {
+    const BenchmarkResult& result = suite.results[i];
+    if (result.name != "evaluate") continue;
+    std::cout << result.param("bodies") << " " << result.param("distribution") << " " << result.param("p") << " "
+              << result.param("ncrit") << " " << result.param("threads") << " : "
+              << std::scientific << std::setprecision(3) << result.stats.median << " "
+              << std::fixed << std::setprecision(2) << result.metric("speedup") << " " << result.metric("efficiency") << " "
+              << result.metric("peak_memory_mb") << " " << std::scientific << result.metric("potential_error") << std::endl;
+  }
+
+  std::string& output = sweep.output;
+  if (!output.empty()) {
+    bool is_file = output.size() >= 5 && (output.compare(output.size()-4, 4, ".csv") == 0
+                                          || output.compare(output.size()-5, 5, ".json") == 0);
+    if (is_file) {
+      suite.write(output);
+    } else {
+      suite.write(output + ".csv");
+      suite.write(output + ".json");
+    }
+  }
+  return sweep.baseline.empty() ? 0 : compare_baseline(suite, baseline, sweep.threshold);
+}
@@ -14,8 +14,12 @@ namespace exafmm_t {
     {"wavenumber",   required_argument, 0, 'k'},
     {"maxlevel",     required_argument, 0, 'l'},
     {"numBodies",    required_argument, 0, 'n'},
+    {"output",       required_argument, 0, 'o'},
     {"P",            required_argument, 0, 'P'},
+    {"potential",    no_argument,       0, 'p'},
+    {"repetitions",  required_argument, 0, 'r'},
     {"threads",      required_argument, 0, 'T'},
+    {"warmup",       required_argument, 0, 'w'},
     {0, 0, 0, 0}
   };
 
@@ -26,8 +30,12 @@ namespace exafmm_t {
     double k;
     int maxlevel;
     int numBodies;
+    const char * output;
     int P;
+    int potential_only;
+    int repetitions;
     int threads;
+    int warmup;
 
   private:
     void usage(char * name) {
@@ -39,16 +47,24 @@ namespace exafmm_t {
           " --wavenumber (-k)             : Wavenumber of Helmholtz kernel (%f)\n"
           " --maxlevel (-l)               : Max level of tree (%d) (only applies to non-adaptive tree)\n"
 	      " --numBodies (-n)              : Number of bodies (%d)\n"
+	      " --output (-o)                 : Output file of benchmarks, .csv or .json (%s)\n"
 	      " --P (-P)                      : Order of expansion (%d)\n"
-	      " --threads (-T)                : Number of threads (%d)\n",
+	      " --potential (-p)              : Evaluate potentials only, skip gradients (%d)\n"
+	      " --repetitions (-r)            : Timed repetitions of benchmarks (%d)\n"
+	      " --threads (-T)                : Number of threads (%d)\n"
+	      " --warmup (-w)                 : Untimed warmup runs of benchmarks (%d)\n",
 	      name,
 	      ncrit,
           distribution,
           k,
           maxlevel,
 	      numBodies,
+	      output,
 	      P,
-	      threads);
+	      potential_only,
+	      repetitions,
+	      threads,
+	      warmup);
     }
 
     const char * parseDistribution(const char * arg) {
@@ -70,11 +86,15 @@ namespace exafmm_t {
       k(20),
       maxlevel(5),
       numBodies(1000000),
+      output(""),
       P(4),
-      threads(omp_get_max_threads()) {
+      potential_only(0),
+      repetitions(5),
+      threads(omp_get_max_threads()),
+      warmup(1) {
       while (1) {
         int option_index;
-        int c = getopt_long(argc, argv, "c:d:k:l:n:P:T:", long_options, &option_index);
+        int c = getopt_long(argc, argv, "c:d:k:l:n:o:P:pr:T:w:", long_options, &option_index);
         if (c == -1) break;
         switch (c) {
           case 'c':
@@ -92,12 +112,24 @@ namespace exafmm_t {
           case 'n':
             numBodies = atoi(optarg);
             break;
+          case 'o':
+            output = optarg;
+            break;
           case 'P':
             P = atoi(optarg);
             break;
+          case 'p':
+            potential_only = 1;
+            break;
+          case 'r':
+            repetitions = atoi(optarg);
+            break;
           case 'T':
             threads = atoi(optarg);
             break;
+          case 'w':
+            warmup = atoi(optarg);
+            break;
           default:
             usage(argv[0]);
             exit(0);
@@ -117,6 +149,8 @@ namespace exafmm_t {
                 << std::setw(stringLength)
                 << "maxlevel" << " : " << maxlevel << std::endl
                 << std::setw(stringLength)
+                << "potential_only" << " : " << potential_only << std::endl
+                << std::setw(stringLength)
                 << "threads" << " : " << threads << std::endl
                 << std::setw(stringLength)
                 << "wavenumber" << " : " << k << std::endl;
@@ -0,0 +1,514 @@
+#ifndef benchmark_h
+#define benchmark_h
+#include <algorithm>    // std::sort
+#include <chrono>
+#include <cctype>       // std::isspace
+#include <cmath>
+#include <cstdio>       // std::sscanf
+#include <cstdlib>      // std::strtod
+#include <fstream>
+#include <functional>
+#include <iomanip>
+#include <iostream>
+#include <sstream>
+#include <string>
+#include <thread>       // std::thread::hardware_concurrency
+#include <utility>      // std::pair
+#include <vector>
+#include <sys/resource.h>   // getrusage
+#include "counters.h"
+
+namespace exafmm_t {
+  //! Summary statistics of repeated measurements.
+  struct Statistics {
+    int n;            //!< Number of samples
+    double min;
+    double max;
+    double mean;
+    double median;
+    double stddev;    //!< Sample standard deviation
+    double ci_low;    //!< Lower bound of the 95% confidence interval of the median
+    double ci_high;   //!< Upper bound of the 95% confidence interval of the median
+  };
+
+  /**
+   * @brief Summarize samples. The confidence interval of the median uses the order statistics at ranks
+   * n/2 -+ 0.98*sqrt(n), which holds whatever the distribution of the noise, e.g. the long tail of
+   * interrupted runs. With less than 6 samples it is the whole range of the samples.
+   */
+  inline Statistics summarize(std::vector<double> samples) {
+    Statistics stats = {int(samples.size()), 0, 0, 0, 0, 0, 0, 0};
+    if (samples.empty()) return stats;
+    std::sort(samples.begin(), samples.end());
+    int n = samples.size();
+    stats.min = samples[0];
+    stats.max = samples[n-1];
+    for (int i=0; i<n; i++) stats.mean += samples[i];
+    stats.mean /= n;
+    for (int i=0; i<n; i++) stats.stddev += (samples[i]-stats.mean) * (samples[i]-stats.mean);
+    stats.stddev = n > 1 ? std::sqrt(stats.stddev / (n-1)) : 0;
+    stats.median = n % 2 ? samples[n/2] : 0.5 * (samples[n/2-1] + samples[n/2]);
+    int half_width = std::ceil(0.98 * std::sqrt(double(n)));
+    stats.ci_low = samples[std::max(0, (n-1)/2 - half_width)];
+    stats.ci_high = samples[std::min(n-1, n/2 + half_width)];
+    return stats;
+  }
+
+  /**
+   * @brief Reset the peak resident memory of the process, so that peak_memory() measures the following code.
+   * It needs Linux 4.0 or later.
+   *
+   * @return Whether the peak was reset, otherwise peak_memory() is the peak since the start of the process.
+   */
+  inline bool reset_peak_memory() {
+    std::ofstream file("/proc/self/clear_refs");
+    file << "5";
+    file.flush();
+    return bool(file);
+  }
+
+  //! Peak resident memory of the process in bytes, since the last reset_peak_memory() if it succeeded.
+  inline long long peak_memory() {
+    std::ifstream file("/proc/self/status");
+    std::string line;
+    while (std::getline(file, line)) {
+      long long kbytes;
+      if (std::sscanf(line.c_str(), "VmHWM: %lld kB", &kbytes) == 1) return kbytes * 1024;
+    }
+    struct rusage usage;
+    getrusage(RUSAGE_SELF, &usage);
+    return (long long)usage.ru_maxrss * 1024;   // kilobytes on Linux
+  }
+
+  //! Description of the machine and the build: times measured in different contexts are not comparable.
+  inline std::vector<std::pair<std::string, std::string>> machine_context() {
+    std::string cpu = "unknown";
+    std::ifstream file("/proc/cpuinfo");
+    std::string line;
+    while (std::getline(file, line)) {
+      size_t colon = line.find(':');
+      if (line.compare(0, 10, "model name") == 0 && colon != std::string::npos) {
+        size_t begin = line.find_first_not_of(" \t", colon+1);
+        if (begin != std::string::npos) cpu = line.substr(begin);
+        break;
+      }
+    }
+    std::vector<std::pair<std::string, std::string>> context;
+    context.push_back(std::make_pair("cpu", cpu));
+    context.push_back(std::make_pair("processors", std::to_string(std::thread::hardware_concurrency())));
+#if defined(__VERSION__)
+    context.push_back(std::make_pair("compiler", std::string(__VERSION__)));
+#endif
+#if FLOAT
+    context.push_back(std::make_pair("precision", "float"));
+#else
+    context.push_back(std::make_pair("precision", "double"));
+#endif
+    return context;
+  }
+
+  //! Measurements of a benchmark.
+  struct BenchmarkResult {
+    std::string name;                                          //!< Name of the benchmark
+    std::vector<std::pair<std::string, std::string>> params;   //!< Parameters of the configuration, in order
+    std::vector<double> times;                                 //!< Seconds per call of each repetition
+    Statistics stats;                                          //!< Summary of times
+    long long calls;                                           //!< Calls per repetition
+    long long flop;                                            //!< Flops per call, counted by add_flop() or given
+    long long bytes;                                           //!< Bytes per call, counted by add_bytes() or given
+    std::vector<std::pair<std::string, double>> metrics;       //!< Other measurements, e.g. efficiency or error, in order
+
+    //! GFLOP/s of the median time, 0 if no flop is counted.
+    double gflops() const {
+      return stats.median > 0 ? flop / stats.median * 1e-9 : 0;
+    }
+
+    //! GB/s of the median time, 0 if no byte is counted.
+    double gbytes() const {
+      return stats.median > 0 ? bytes / stats.median * 1e-9 : 0;
+    }
+
+    //! Value of a parameter, empty if the result has none by this name.
+    std::string param(const std::string& key) const {
+      for (size_t i=0; i<params.size(); i++)
+        if (params[i].first == key) return params[i].second;
+      return std::string();
+    }
+
+    //! Value of a metric, 0 if the result has none by this name.
+    double metric(const std::string& key) const {
+      for (size_t i=0; i<metrics.size(); i++)
+        if (metrics[i].first == key) return metrics[i].second;
+      return 0;
+    }
+
+    //! Set a metric, replacing the one with the same name.
+    void set_metric(const std::string& key, double value) {
+      for (size_t i=0; i<metrics.size(); i++) {
+        if (metrics[i].first == key) {
+          metrics[i].second = value;
+          return;
+        }
+      }
+      metrics.push_back(std::make_pair(key, value));
+    }
+  };
+
+  //! Comparison of a benchmark with its baseline.
+  struct Comparison {
+    double ratio;   //!< Median time relative to the baseline
+    int change;     //!< 1 if slower beyond the threshold, -1 if faster beyond it, 0 otherwise
+  };
+
+  /**
+   * @brief Compare the times of a benchmark with those of its baseline. A change is only reported if the
+   * ratio of the medians exceeds the threshold and the confidence intervals of the medians do not overlap,
+   * so that the noise of the runs is not taken for a change.
+   *
+   * @param threshold Relative change of the median that is tolerated, e.g. 0.1 for 10%.
+   */
+  inline Comparison compare(const BenchmarkResult& baseline, const BenchmarkResult& current, double threshold) {
+    Comparison comparison = {0, 0};
+    if (baseline.stats.median <= 0) return comparison;
+    comparison.ratio = current.stats.median / baseline.stats.median;
+    if (comparison.ratio > 1 + threshold && current.stats.ci_low > baseline.stats.ci_high)
+      comparison.change = 1;
+    else if (comparison.ratio < 1 / (1 + threshold) && current.stats.ci_high < baseline.stats.ci_low)
+      comparison.change = -1;
+    return comparison;
+  }
+
+  /**
+   * @brief Runner of microbenchmarks. Each benchmark is called warmup times, then timed for a number of
+   * repetitions. Calls shorter than min_time are repeated within a repetition and the time per call is kept,
+   * so short kernels are not dominated by the resolution of the clock. Flops and bytes per call are taken
+   * from the counters of add_flop() and add_bytes(), unless given.
+   */
+  class BenchmarkSuite {
+  public:
+    int warmup;          //!< Untimed calls before the repetitions
+    int repetitions;     //!< Timed repetitions
+    double min_time;     //!< Minimum time of a repetition in seconds
+    bool verbose;        //!< Whether to print each result
+    std::vector<BenchmarkResult> results;   //!< Results in the order of the runs
+    std::vector<std::pair<std::string, std::string>> context;   //!< Machine and build of the results
+
+    BenchmarkSuite(int warmup_=1, int repetitions_=5, double min_time_=1e-3, bool verbose_=true) :
+      warmup(warmup_), repetitions(repetitions_), min_time(min_time_), verbose(verbose_), context(machine_context()) {}
+
+    /**
+     * @brief Run a benchmark.
+     *
+     * @param name Name of the benchmark.
+     * @param params Parameters of the configuration.
+     * @param body Benchmarked call.
+     * @param setup Untimed call before each call of body, e.g. to restore its input; each repetition is then a single call.
+     * @param flop Flops per call, -1 to count them with add_flop().
+     * @param bytes Bytes per call, -1 to count them with add_bytes().
+     * @return Result, also appended to results.
+     */
+    BenchmarkResult& run(const std::string& name, const std::vector<std::pair<std::string, std::string>>& params,
+                         const std::function<void()>& body, const std::function<void()>& setup=nullptr,
+                         long long flop=-1, long long bytes=-1) {
+      BenchmarkResult result;
+      result.name = name;
+      result.params = params;
+      for (int i=0; i<warmup; i++) {
+        if (setup) setup();
+        body();
+      }
+      // calibrate the number of calls per repetition
+      long long calls = 1;
+      if (!setup) {
+        while (true) {
+          double time = measure(body, calls);
+          if (time >= min_time || calls >= (1LL<<30)) break;
+          calls *= time > 0 ? std::max(2LL, (long long)(std::min(min_time / time * 1.2, 1e3))) : 1000;
+        }
+      }
+      result.calls = calls;
+      Counters begin = read_counters();
+      for (int r=0; r<repetitions; r++) {
+        if (setup) setup();
+        result.times.push_back(measure(body, calls) / calls);
+      }
+      Counters counts = read_counters() - begin;
+      long long ncalls = std::max(1LL, calls * repetitions);
+      result.flop = flop >= 0 ? flop : counts.total_flop() / ncalls;
+      result.bytes = bytes >= 0 ? bytes : counts.total_bytes() / ncalls;
+      result.stats = summarize(result.times);
+      if (verbose) print_result(result);
+      results.push_back(result);
+      return results.back();
+    }
+
+    //! Add a benchmark whose times per call are measured by the caller, e.g. the phases of an evaluation.
+    BenchmarkResult& add(const std::string& name, const std::vector<std::pair<std::string, std::string>>& params,
+                         const std::vector<double>& times, long long flop=0, long long bytes=0) {
+      BenchmarkResult result;
+      result.name = name;
+      result.params = params;
+      result.times = times;
+      result.calls = 1;
+      result.flop = flop;
+      result.bytes = bytes;
+      result.stats = summarize(times);
+      if (verbose) print_result(result);
+      results.push_back(result);
+      return results.back();
+    }
+
+    //! Result of the same benchmark and parameters, nullptr if there is none.
+    const BenchmarkResult* find(const BenchmarkResult& other) const {
+      for (size_t i=0; i<results.size(); i++)
+        if (results[i].name == other.name && results[i].params == other.params) return &results[i];
+      return nullptr;
+    }
+
+    //! Results as JSON: {"context": {...}, "benchmarks": [{"name", "params": {...}, "times", "median", ...}]}.
+    std::string to_json() const {
+      std::ostringstream os;
+      os << std::setprecision(9);
+      os << "{\"context\": {";
+      for (size_t j=0; j<context.size(); j++)
+        os << (j ? ", " : "") << "\"" << escape(context[j].first) << "\": \"" << escape(context[j].second) << "\"";
+      os << "},\n\"benchmarks\": [";
+      for (size_t i=0; i<results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        const Statistics& stats = result.stats;
+        os << (i ? ",\n" : "\n") << "  {\"name\": \"" << escape(result.name) << "\", \"params\": {";
+        for (size_t j=0; j<result.params.size(); j++)
+          os << (j ? ", " : "") << "\"" << escape(result.params[j].first) << "\": \"" << escape(result.params[j].second) << "\"";
+        os << "}, \"times\": [";
+        for (size_t j=0; j<result.times.size(); j++)
+          os << (j ? ", " : "") << result.times[j];
+        os << "], \"calls\": " << result.calls << ", \"min\": " << stats.min << ", \"max\": " << stats.max
+           << ", \"mean\": " << stats.mean << ", \"median\": " << stats.median << ", \"stddev\": " << stats.stddev
+           << ", \"ci_low\": " << stats.ci_low << ", \"ci_high\": " << stats.ci_high
+           << ", \"flop\": " << result.flop << ", \"bytes\": " << result.bytes
+           << ", \"gflops\": " << result.gflops() << ", \"gbytes\": " << result.gbytes() << ", \"metrics\": {";
+        for (size_t j=0; j<result.metrics.size(); j++)
+          os << (j ? ", " : "") << "\"" << escape(result.metrics[j].first) << "\": " << result.metrics[j].second;
+        os << "}}";
+      }
+      os << "\n]}";
+      return os.str();
+    }
+
+    //! Results as CSV, one row per benchmark, the parameters and the metrics as "key=value;..." columns.
+    std::string to_csv() const {
+      std::ostringstream os;
+      os << std::setprecision(9);
+      os << "name,params,repetitions,calls,min,median,mean,max,stddev,ci_low,ci_high,flop,bytes,gflops,gbytes,metrics\n";
+      for (size_t i=0; i<results.size(); i++) {
+        const BenchmarkResult& result = results[i];
+        const Statistics& stats = result.stats;
+        os << result.name << ",";
+        for (size_t j=0; j<result.params.size(); j++)
+          os << (j ? ";" : "") << result.params[j].first << "=" << result.params[j].second;
+        os << "," << stats.n << "," << result.calls << "," << stats.min << "," << stats.median << ","
+           << stats.mean << "," << stats.max << "," << stats.stddev << "," << stats.ci_low << "," << stats.ci_high << ","
+           << result.flop << "," << result.bytes << "," << result.gflops() << "," << result.gbytes() << ",";
+        for (size_t j=0; j<result.metrics.size(); j++)
+          os << (j ? ";" : "") << result.metrics[j].first << "=" << result.metrics[j].second;
+        os << "\n";
+      }
+      return os.str();
+    }
+
+    //! Write the results to a file, as CSV if its name ends with .csv and as JSON otherwise.
+    void write(const std::string& filename) const {
+      std::ofstream file(filename);
+      bool is_csv = filename.size() >= 4 && filename.compare(filename.size()-4, 4, ".csv") == 0;
+      file << (is_csv ? to_csv() : to_json() + "\n");
+    }
+
+    /**
+     * @brief Read the results and the context of a JSON file written by write(), e.g. to compare with them.
+     * The statistics are recomputed from the times.
+     *
+     * @return Whether the file could be read, otherwise results and context are left unchanged.
+     */
+    bool read(const std::string& filename) {
+      std::ifstream file(filename);
+      if (!file) return false;
+      std::stringstream buffer;
+      buffer << file.rdbuf();
+      JsonParser parser(buffer.str());
+      std::vector<BenchmarkResult> read_results;
+      std::vector<std::pair<std::string, std::string>> read_context;
+      bool is_read = parser.object([&](const std::string& key) {
+        if (key == "context") return parser.string_object(read_context);
+        if (key != "benchmarks") return parser.skip();
+        return parser.array([&]() {
+          BenchmarkResult result;
+          result.calls = 1;
+          result.flop = 0;
+          result.bytes = 0;
+          bool is_result = parser.object([&](const std::string& field) {
+            double value;
+            if (field == "name") return parser.string(result.name);
+            if (field == "params") return parser.string_object(result.params);
+            if (field == "times") return parser.array([&]() {
+              if (!parser.number(value)) return false;
+              result.times.push_back(value);
+              return true;
+            });
+            if (field == "metrics") return parser.object([&](const std::string& metric) {
+              if (!parser.number(value)) return false;
+              result.metrics.push_back(std::make_pair(metric, value));
+              return true;
+            });
+            if (field == "calls" || field == "flop" || field == "bytes") {
+              if (!parser.number(value)) return false;
+              (field == "calls" ? result.calls : field == "flop" ? result.flop : result.bytes) = (long long)value;
+              return true;
+            }
+            return parser.skip();
+          });
+          result.stats = summarize(result.times);
+          read_results.push_back(result);
+          return is_result;
+        });
+      });
+      if (!is_read || !parser.end()) return false;
+      results = read_results;
+      context = read_context;
+      return true;
+    }
+
+  private:
+    //! Reader of the subset of JSON written by to_json(), without unicode escapes.
+    class JsonParser {
+    public:
+      explicit JsonParser(const std::string& text_) : text(text_), pos(0) {}
+
+      //! Parse an object, calling member(key) to parse the value of each member.
+      bool object(const std::function<bool(const std::string&)>& member) {
+        if (!consume('{')) return false;
+        if (consume('}')) return true;
+        do {
+          std::string key;
+          if (!string(key) || !consume(':') || !member(key)) return false;
+        } while (consume(','));
+        return consume('}');
+      }
+
+      //! Parse an array, calling element() to parse each element.
+      bool array(const std::function<bool()>& element) {
+        if (!consume('[')) return false;
+        if (consume(']')) return true;
+        do {
+          if (!element()) return false;
+        } while (consume(','));
+        return consume(']');
+      }
+
+      //! Parse an object of strings.
+      bool string_object(std::vector<std::pair<std::string, std::string>>& members) {
+        return object([&](const std::string& key) {
+          std::string value;
+          if (!string(value)) return false;
+          members.push_back(std::make_pair(key, value));
+          return true;
+        });
+      }
+
+      bool string(std::string& value) {
+        if (!consume('"')) return false;
+        value.clear();
+        while (pos < text.size() && text[pos] != '"') {
+          if (text[pos] == '\\' && ++pos == text.size()) return false;
+          value += text[pos++];
+        }
+        return pos++ < text.size();
+      }
+
+      bool number(double& value) {
+        skip_space();
+        const char* begin = text.c_str() + pos;
+        char* end;
+        value = std::strtod(begin, &end);
+        pos += end - begin;
+        return end != begin;
+      }
+
+      //! Parse and discard any value.
+      bool skip() {
+        skip_space();
+        if (pos >= text.size()) return false;
+        std::string s;
+        double d;
+        switch (text[pos]) {
+          case '{': return object([&](const std::string&) { return skip(); });
+          case '[': return array([&]() { return skip(); });
+          case '"': return string(s);
+          case 't': return literal("true");
+          case 'f': return literal("false");
+          case 'n': return literal("null");
+          default: return number(d);
+        }
+      }
+
+      //! Whether only spaces are left.
+      bool end() {
+        skip_space();
+        return pos == text.size();
+      }
+
+    private:
+      std::string text;
+      size_t pos;
+
+      void skip_space() {
+        while (pos < text.size() && std::isspace((unsigned char)text[pos])) pos++;
+      }
+
+      bool consume(char c) {
+        skip_space();
+        if (pos >= text.size() || text[pos] != c) return false;
+        pos++;
+        return true;
+      }
+
+      bool literal(const std::string& word) {
+        if (text.compare(pos, word.size(), word) != 0) return false;
+        pos += word.size();
+        return true;
+      }
+    };
+
+    //! Seconds of a number of calls.
+    static double measure(const std::function<void()>& body, long long calls) {
+      std::chrono::steady_clock::time_point begin = std::chrono::steady_clock::now();
+      for (long long c=0; c<calls; c++) body();
+      return std::chrono::duration<double>(std::chrono::steady_clock::now() - begin).count();
+    }
+
+    //! Print a result on one line, leaving the format of std::cout unchanged.
+    static void print_result(const BenchmarkResult& result) {
+      std::string label = result.name;
+      for (size_t j=0; j<result.params.size(); j++)
+        label += " " + result.params[j].first + "=" + result.params[j].second;
+      std::ios_base::fmtflags flags = std::cout.flags();
+      std::streamsize precision = std::cout.precision();
+      std::cout << std::left << std::setw(48) << label << std::right << std::scientific << std::setprecision(3)
+                << " median " << result.stats.median << " s  [" << result.stats.ci_low << ", " << result.stats.ci_high << "]";
+      if (result.flop > 0) std::cout << "  " << std::fixed << std::setprecision(2) << result.gflops() << " GFLOP/s";
+      if (result.bytes > 0) std::cout << "  " << std::fixed << std::setprecision(2) << result.gbytes() << " GB/s";
+      std::cout << std::endl;
+      std::cout.flags(flags);
+      std::cout.precision(precision);
+    }
+
+    static std::string escape(const std::string& s) {
+      std::string escaped;
+      for (size_t i=0; i<s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\') escaped += '\\';
+        escaped += s[i];
+      }
+      return escaped;
+    }
+  };
+}  // end namespace exafmm_t
+#endif
@@ -27,11 +27,11 @@ namespace exafmm_t {
         rel_coord[2] = ((i/9)%3)*4-4-(octant & 4?2:0)+1;
         int c_hash = hash(rel_coord);
         if (isleaf) {
-          int idx1 = HASH_LUT[P2P0_Type][c_hash];
+          int idx1 = hash_lut(P2P0_Type)[c_hash];
           if (idx1>=0)
             n->P2P_list.push_back(pc);
         }
-        int idx2 = HASH_LUT[P2L_Type][c_hash];
+        int idx2 = hash_lut(P2L_Type)[c_hash];
         if (idx2>=0) {
           if (isleaf && n->ntrgs<=fmm.nsurf)
             n->P2P_list.push_back(pc);
@@ -61,11 +61,11 @@ namespace exafmm_t {
         rel_coord[2] = ((i/9)%3)-1;
         int c_hash = hash(rel_coord);
         if (col->is_leaf && isleaf) {
-          int idx1 = HASH_LUT[P2P1_Type][c_hash];
+          int idx1 = hash_lut(P2P1_Type)[c_hash];
           if (idx1>=0)
             n->P2P_list.push_back(col);
         } else if (!col->is_leaf && !isleaf) {
-          int idx2 = HASH_LUT[M2L_Type][c_hash];
+          int idx2 = hash_lut(M2L_Type)[c_hash];
           if (idx2>=0)
             n->M2L_list[idx2] = col;
         }
@@ -94,8 +94,8 @@ namespace exafmm_t {
           rel_coord[1] = ((i/3)%3)*4-4+(j & 2?2:0)-1;
           rel_coord[2] = ((i/9)%3)*4-4+(j & 4?2:0)-1;
           int c_hash = hash(rel_coord);
-          int idx1 = HASH_LUT[P2P2_Type][c_hash];
-          int idx2 = HASH_LUT[M2P_Type][c_hash];
+          int idx1 = hash_lut(P2P2_Type)[c_hash];
+          int idx2 = hash_lut(M2P_Type)[c_hash];
           if (idx1>=0) {
             assert(col->children[j]->is_leaf); //2:1 balanced
             n->P2P_list.push_back(cc);
@@ -125,7 +125,7 @@ namespace exafmm_t {
     #pragma omp parallel for
     for(size_t i=0; i<nodes.size(); i++) {
       Node<T>* node = &nodes[i];
-      node->M2L_list.resize(REL_COORD[M2L_Type].size(), nullptr);
+      node->M2L_list.resize(rel_coord(M2L_Type).size(), nullptr);
       build_list_parent_level(node, fmm);   // P2P0 & P2L
       build_list_current_level(node);  // P2P1 & M2L
 #if NON_ADAPTIVE
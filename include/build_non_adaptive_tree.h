@@ -96,8 +96,8 @@ namespace exafmm_t {
     node->idx = int(node-&nodes[0]);  // current node's index in nodes
     node->nsrcs = source_end - source_begin;
     node->ntrgs = target_end - target_begin;
-    node->up_equiv.resize(fmm.nsurf, (T)(0.));
-    node->dn_equiv.resize(fmm.nsurf, (T)(0.));
+    node->up_equiv.resize(fmm.nsurf*fmm.nrhs, (T)(0.));
+    node->dn_equiv.resize(fmm.nsurf*fmm.nrhs, (T)(0.));
     ivec3 iX = get3DIndex(node->x, node->level, fmm.x0, fmm.r0);
     node->key = getKey(iX, node->level);
 
@@ -110,7 +110,7 @@ namespace exafmm_t {
     //! If node is a leaf
     if (node->level == fmm.depth) {
       node->is_leaf = true;
-      node->trg_value.resize(node->ntrgs*4, (T)(0.));   // initialize target result vector
+      node->trg_value.resize(node->ntrgs*fmm.ntrg_values()*fmm.nrhs, (T)(0.));   // initialize target result vector
       leafs.push_back(node);
       // Copy sources and targets' coords and values to leafs
       Body<T>* first_source = sources + source_begin;
@@ -120,7 +120,7 @@ namespace exafmm_t {
           node->src_coord.push_back(B->X[d]);
         }
         node->isrcs.push_back(B->ibody);
-        node->src_value.push_back(B->q);
+        node->src_value.insert(node->src_value.end(), fmm.nrhs, B->q);  // same charge for every right-hand side until set_charges()
       }
       for (Body<T>* B=first_target; B<first_target+node->ntrgs; ++B) {
         for (int d=0; d<3; ++d) {
@@ -128,6 +128,7 @@ namespace exafmm_t {
         }
         node->itrgs.push_back(B->ibody);
       }
+      transpose_leaf(node);
       return;
     }
     // Sort bodies and save in buffer
@@ -190,6 +191,7 @@ namespace exafmm_t {
     build_tree(&sources[0], 0, sources.size(),
                &targets[0], 0, targets.size(),
                &nodes[0], nodes, leafs, nonleafs, fmm);
+    fmm.nonleafs_setup(nodes);
     return nodes;
   }
 }
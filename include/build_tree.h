@@ -86,8 +86,8 @@ namespace exafmm_t {
     node->idx = int(node-&nodes[0]);  // current node's index in nodes
     node->nsrcs = source_end - source_begin;
     node->ntrgs = target_end - target_begin;
-    node->up_equiv.resize(fmm.nsurf, (T)(0.));
-    node->dn_equiv.resize(fmm.nsurf, (T)(0.));
+    node->up_equiv.resize(fmm.nsurf*fmm.nrhs, (T)(0.));
+    node->dn_equiv.resize(fmm.nsurf*fmm.nrhs, (T)(0.));
     ivec3 iX = get3DIndex(node->x, node->level, fmm.x0, fmm.r0);
     node->key = getKey(iX, node->level);
 
@@ -101,7 +101,7 @@ namespace exafmm_t {
     }
     if (node->nsrcs<=fmm.ncrit && node->ntrgs<=fmm.ncrit && is_leaf_key) {
       node->is_leaf = true;
-      node->trg_value.resize(node->ntrgs*4, (T)(0.));   // initialize target result vector
+      node->trg_value.resize(node->ntrgs*fmm.ntrg_values()*fmm.nrhs, (T)(0.));   // initialize target result vector
       if (node->nsrcs || node->ntrgs)
         leafs.push_back(node);
       if (direction) {
@@ -124,7 +124,7 @@ namespace exafmm_t {
             node->src_coord.push_back(B->X[d]);
           }
           node->isrcs.push_back(B->ibody);
-          node->src_value.push_back(B->q);
+          node->src_value.insert(node->src_value.end(), fmm.nrhs, B->q);  // same charge for every right-hand side until set_charges()
         }
         for (Body<T>* B=first_target; B<first_target+node->ntrgs; ++B) {
           for (int d=0; d<3; ++d) {
@@ -132,6 +132,7 @@ namespace exafmm_t {
           }
           node->itrgs.push_back(B->ibody);
         }
+        transpose_leaf(node);
       }
       return;
     }
@@ -191,10 +192,11 @@ namespace exafmm_t {
     nodes[0].r = fmm.r0;
     nodes[0].level = 0;
     nodes.reserve((sources.size()+targets.size()) * (32/fmm.ncrit+1));
-    build_tree(&sources[0], &sources_buffer[0], 0, sources.size(), 
-               &targets[0], &targets_buffer[0], 0, targets.size(),
+    build_tree(sources.data(), sources_buffer.data(), 0, sources.size(),   // data() also holds without sources or targets
+               targets.data(), targets_buffer.data(), 0, targets.size(),
                &nodes[0], nodes, leafs, nonleafs,
                leafkeys, fmm);
+    fmm.nonleafs_setup(nodes);
     return nodes;
   }
 
@@ -305,7 +307,7 @@ namespace exafmm_t {
    * @param keys Vector of the set of Morton keys of nodes at each level after 2:1 balancing
    * @return Vector of leaf keys at each level
    */
-  Keys find_leaf_keys(const Keys& keys) {
+  inline Keys find_leaf_keys(const Keys& keys) {
     std::set<uint64_t>::iterator it;
     Keys leafkeys(keys.size());
     for (int l=keys.size()-1; l>=1; --l) {
@@ -0,0 +1,339 @@
+#ifndef counters_h
+#define counters_h
+#include <atomic>
+#include <cstdint>
+#include <map>
+#include <mutex>
+#include <utility>      // std::pair
+#include <vector>
+#include "perf_counters.h"
+
+namespace exafmm_t {
+  //! Operator to which the counted flops and bytes are attributed
+  typedef enum {
+    Other_Op = 0,
+    P2P_Op = 1,
+    P2M_Op = 2,
+    M2M_Op = 3,
+    M2L_FFT_Op = 4,
+    M2L_Hadamard_Op = 5,
+    M2L_IFFT_Op = 6,
+    L2L_Op = 7,
+    L2P_Op = 8,
+    M2P_Op = 9,
+    P2L_Op = 10,
+    Op_Count = 11
+  } Op_Type;
+
+  //! Name of an operator.
+  inline const char* op_name(int op) {
+    static const char* names[Op_Count] = {"Other", "P2P", "P2M", "M2M", "M2L FFT", "M2L Hadamard", "M2L IFFT",
+                                          "L2L", "L2P", "M2P", "P2L"};
+    return op >= 0 && op < Op_Count ? names[op] : "Unknown";
+  }
+
+  //! Snapshot of the flop and byte counters of each operator.
+  struct Counters {
+    long long flop[Op_Count];    //!< Floating point operations
+    long long bytes[Op_Count];   //!< Bytes read and written by the kernels, estimated from their operands
+
+    Counters() {
+      for (int op=0; op<Op_Count; op++) {
+        flop[op] = 0;
+        bytes[op] = 0;
+      }
+    }
+
+    long long total_flop() const {
+      long long total = 0;
+      for (int op=0; op<Op_Count; op++) total += flop[op];
+      return total;
+    }
+
+    long long total_bytes() const {
+      long long total = 0;
+      for (int op=0; op<Op_Count; op++) total += bytes[op];
+      return total;
+    }
+
+    //! Counts between two snapshots.
+    Counters operator-(const Counters& other) const {
+      Counters diff;
+      for (int op=0; op<Op_Count; op++) {
+        diff.flop[op] = flop[op] - other.flop[op];
+        diff.bytes[op] = bytes[op] - other.bytes[op];
+      }
+      return diff;
+    }
+
+    Counters& operator+=(const Counters& other) {
+      for (int op=0; op<Op_Count; op++) {
+        flop[op] += other.flop[op];
+        bytes[op] += other.bytes[op];
+      }
+      return *this;
+    }
+  };
+
+  //! Time and counts of a phase of an evaluation.
+  struct PhaseCounters {
+    double time;          //!< Elapsed time in seconds
+    Counters counters;    //!< Counts of all threads during the phase
+    PerfValues perf;      //!< Hardware counts during the phase, invalid unless perf_counters() is enabled
+
+    PhaseCounters() : time(0) {}
+
+    //! Achieved GFLOP/s.
+    double gflops() const {
+      return time > 0 ? counters.total_flop() / time * 1e-9 : 0;
+    }
+
+    //! Achieved GB/s.
+    double gbytes() const {
+      return time > 0 ? counters.total_bytes() / time * 1e-9 : 0;
+    }
+  };
+
+  /**
+   * @brief Counters of a thread. Only the owning thread updates them, with a relaxed load and store instead of
+   * an atomic read-modify-write, and the padding keeps the counters of different threads on different cache lines.
+   * Other threads only read them.
+   */
+  struct ThreadCounters {
+    char padding0[64];
+    std::atomic<long long> flop[Op_Count];
+    std::atomic<long long> bytes[Op_Count];
+    char padding1[64];
+
+    ThreadCounters() {
+      for (int op=0; op<Op_Count; op++) {
+        flop[op].store(0, std::memory_order_relaxed);
+        bytes[op].store(0, std::memory_order_relaxed);
+      }
+    }
+  };
+
+  class CounterRegistry;
+
+  //! Counter registries alive in the process, and the totals of the destroyed ones.
+  struct RegistryTable {
+    std::mutex mutex;
+    uint64_t next_id;
+    std::map<uint64_t, CounterRegistry*> live;
+    Counters retired;
+
+    RegistryTable() : next_id(0) {}
+  };
+
+  //! Registry table of the process.
+  inline RegistryTable& registry_table() {
+    static RegistryTable* table = new RegistryTable();   // never destroyed, threads may exit after main
+    return *table;
+  }
+
+  //! Counters of the calling thread in each registry it counted in, keyed by the id of the registry.
+  struct ThreadSlots {
+    std::vector<std::pair<uint64_t, ThreadCounters*>> slots;
+
+    //! Hand the counters back to the registries that are still alive, for the next new thread.
+    ~ThreadSlots();
+    //! Drop the slots of destroyed registries.
+    void prune();
+  };
+
+  //! Slots of the calling thread.
+  inline ThreadSlots& thread_slots() {
+    thread_local ThreadSlots slots;
+    return slots;
+  }
+
+  /**
+   * @brief Counters of the threads that count in one registry, e.g. the operators of one FMM instance. The counters
+   * of a thread that exits are kept and handed to the next new thread, so the totals never decrease and the number
+   * of blocks is the peak number of threads. A copy counts from zero, and a destroyed registry adds its totals to
+   * the process totals of read_counters().
+   */
+  class CounterRegistry {
+  public:
+    CounterRegistry() {
+      RegistryTable& table = registry_table();
+      std::lock_guard<std::mutex> lock(table.mutex);
+      id = table.next_id++;
+      table.live[id] = this;
+    }
+
+    CounterRegistry(const CounterRegistry&) : CounterRegistry() {}
+
+    CounterRegistry& operator=(const CounterRegistry&) {
+      return *this;
+    }
+
+    ~CounterRegistry() {
+      Counters totals = read();
+      RegistryTable& table = registry_table();
+      {
+        std::lock_guard<std::mutex> lock(table.mutex);
+        table.live.erase(id);
+        table.retired += totals;
+      }
+      for (size_t t=0; t<threads.size(); t++) delete threads[t];
+    }
+
+    //! Counters of the calling thread.
+    ThreadCounters& this_thread() {
+      ThreadSlots& slots = thread_slots();
+      for (size_t i=0; i<slots.slots.size(); i++) {
+        if (slots.slots[i].first == id) return *slots.slots[i].second;
+      }
+      slots.prune();
+      slots.slots.push_back(std::make_pair(id, acquire()));
+      return *slots.slots.back().second;
+    }
+
+    //! Sum of the counters of all threads.
+    Counters read() {
+      Counters sum;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t t=0; t<threads.size(); t++) {
+        for (int op=0; op<Op_Count; op++) {
+          sum.flop[op] += threads[t]->flop[op].load(std::memory_order_relaxed);
+          sum.bytes[op] += threads[t]->bytes[op].load(std::memory_order_relaxed);
+        }
+      }
+      return sum;
+    }
+
+    //! Number of threads that have counted.
+    size_t size() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return threads.size();
+    }
+
+  private:
+    friend struct ThreadSlots;
+    uint64_t id;                             //!< Key of the registry in the registry table and the thread slots
+    std::mutex mutex;
+    std::vector<ThreadCounters*> threads;    //!< Counters of all threads, freed with the registry
+    std::vector<ThreadCounters*> released;   //!< Counters of the threads that exited
+
+    ThreadCounters* acquire() {
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!released.empty()) {
+        ThreadCounters* counters = released.back();
+        released.pop_back();
+        return counters;
+      }
+      threads.push_back(new ThreadCounters());
+      return threads.back();
+    }
+
+    void release(ThreadCounters* counters) {
+      std::lock_guard<std::mutex> lock(mutex);
+      released.push_back(counters);
+    }
+  };
+
+  inline ThreadSlots::~ThreadSlots() {
+    RegistryTable& table = registry_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    for (size_t i=0; i<slots.size(); i++) {
+      auto registry = table.live.find(slots[i].first);
+      if (registry != table.live.end()) registry->second->release(slots[i].second);
+    }
+  }
+
+  inline void ThreadSlots::prune() {
+    RegistryTable& table = registry_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    size_t n = 0;
+    for (size_t i=0; i<slots.size(); i++) {
+      if (table.live.count(slots[i].first)) slots[n++] = slots[i];
+    }
+    slots.resize(n);
+  }
+
+  //! Registry of the counts outside the operators of an FMM instance.
+  inline CounterRegistry& counter_registry() {
+    static CounterRegistry* registry = new CounterRegistry();   // never destroyed, threads may exit after main
+    return *registry;
+  }
+
+  //! Operator the calling thread is running, to which add_flop() and add_bytes() attribute their counts.
+  inline int& current_op() {
+    thread_local int op = Other_Op;
+    return op;
+  }
+
+  //! Registry the calling thread counts in, nullptr for counter_registry().
+  inline CounterRegistry*& current_registry() {
+    thread_local CounterRegistry* registry = nullptr;
+    return registry;
+  }
+
+  //! Attribute the counts of the calling thread to an operator, and optionally a registry, during the lifetime of the object.
+  class OpScope {
+  public:
+    explicit OpScope(int op) : previous(current_op()), previous_registry(current_registry()) {
+      current_op() = op;
+    }
+    OpScope(int op, CounterRegistry& registry) : previous(current_op()), previous_registry(current_registry()) {
+      current_op() = op;
+      current_registry() = &registry;
+    }
+    ~OpScope() {
+      current_op() = previous;
+      current_registry() = previous_registry;
+    }
+
+    OpScope(const OpScope&) = delete;
+    OpScope& operator=(const OpScope&) = delete;
+
+  private:
+    int previous;
+    CounterRegistry* previous_registry;
+  };
+
+  //! Counters of the calling thread in its current registry.
+  inline ThreadCounters& this_thread_counters() {
+    CounterRegistry* registry = current_registry();
+    return (registry ? *registry : counter_registry()).this_thread();
+  }
+
+  //! Count flops of the current operator in the calling thread.
+  inline void add_flop(long long n) {
+    std::atomic<long long>& flop = this_thread_counters().flop[current_op()];
+    flop.store(flop.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  //! Count bytes moved by the current operator in the calling thread.
+  inline void add_bytes(long long n) {
+    std::atomic<long long>& bytes = this_thread_counters().bytes[current_op()];
+    bytes.store(bytes.load(std::memory_order_relaxed) + n, std::memory_order_relaxed);
+  }
+
+  //! Counters of all registries, threads and operators of the process, subtract two snapshots to count an interval.
+  inline Counters read_counters() {
+    RegistryTable& table = registry_table();
+    std::lock_guard<std::mutex> lock(table.mutex);
+    Counters sum = table.retired;
+    for (auto it=table.live.begin(); it!=table.live.end(); ++it)
+      sum += it->second->read();
+    return sum;
+  }
+
+  //! Total flops counted by get_flop() are relative to this snapshot.
+  inline std::atomic<long long>& flop_baseline() {
+    static std::atomic<long long> baseline(0);
+    return baseline;
+  }
+
+  //! Number of flops counted in all threads since the last reset_flop().
+  inline long long get_flop() {
+    return read_counters().total_flop() - flop_baseline();
+  }
+
+  inline void reset_flop() {
+    flop_baseline() = read_counters().total_flop();
+  }
+}
+#endif
@@ -3,6 +3,25 @@
 #include "exafmm_t.h"
 
 namespace exafmm_t {
+  //! State of the drand48() sequence of the calling thread, so threads can generate bodies concurrently.
+  inline unsigned short* rand48_state() {
+    thread_local unsigned short state[3] = {0x330E, 0, 0};
+    return state;
+  }
+
+  //! Seed the sequence of the calling thread, as srand48().
+  inline void seed_rand48(long seed) {
+    unsigned short* state = rand48_state();
+    state[0] = 0x330E;
+    state[1] = seed & 0xFFFF;
+    state[2] = (seed >> 16) & 0xFFFF;
+  }
+
+  //! Next number of the sequence of the calling thread, uniform in [0, 1) as drand48().
+  inline double next_rand48() {
+    return erand48(rand48_state());
+  }
+
   /**
    * @brief Generate uniform distribution in a cube from 0 to 1.
    * 
@@ -14,10 +33,10 @@ namespace exafmm_t {
   template <typename T>
   Bodies<T> cube(int numBodies, int seed) {
     Bodies<T> bodies(numBodies);
-    srand48(seed);
+    seed_rand48(seed);
     for (int b=0; b<numBodies; b++) {
       for (int d=0; d<3; d++) {
-        bodies[b].X[d] = drand48();
+        bodies[b].X[d] = next_rand48();
       }
     }
     return bodies;
@@ -34,10 +53,10 @@ namespace exafmm_t {
   template <typename T>
   Bodies<T> sphere(int numBodies, int seed) {
     Bodies<T> bodies(numBodies);
-    srand48(seed);
+    seed_rand48(seed);
     for (int b=0; b<numBodies; b++) {
       for (int d=0; d<3; d++) {
-        bodies[b].X[d] = drand48() * 2 - 1;
+        bodies[b].X[d] = next_rand48() * 2 - 1;
       }
       real_t r = std::sqrt(norm(bodies[b].X));
       bodies[b].X /= r;
@@ -56,13 +75,13 @@ namespace exafmm_t {
   template <typename T>
   Bodies<T> plummer(int numBodies, int seed) {
     Bodies<T> bodies(numBodies);
-    srand48(seed);
+    seed_rand48(seed);
     int i = 0;
     int Xmax = 0;
     while (i < numBodies) {
-      real_t X1 = drand48();
-      real_t X2 = drand48();
-      real_t X3 = drand48();
+      real_t X1 = next_rand48();
+      real_t X2 = next_rand48();
+      real_t X3 = next_rand48();
       real_t R = 1.0 / sqrt( (pow(X1, -2.0 / 3.0) - 1.0) );
       if (R < 100) {
         real_t Z = (1.0 - 2.0 * X2) * R;
@@ -130,17 +149,17 @@ namespace exafmm_t {
   Bodies<T> init_sources(int numBodies, const char* distribution, int seed) {
     Bodies<T> bodies = init_targets<T>(numBodies, distribution, seed);
     for (int b=0; b<numBodies; ++b) {
-      bodies[b].q = drand48() - 0.5;
+      bodies[b].q = next_rand48() - 0.5;
     }
     return bodies;
   }
 
   // Template specialization of init_source for complex type
   template <>
-  Bodies<complex_t> init_sources(int numBodies, const char* distribution, int seed) {
+  inline Bodies<complex_t> init_sources(int numBodies, const char* distribution, int seed) {
     Bodies<complex_t> bodies = init_targets<complex_t>(numBodies, distribution, seed);
     for (int b=0; b<numBodies; ++b) {
-      bodies[b].q = complex_t(drand48()-0.5, drand48()-0.5);
+      bodies[b].q = complex_t(next_rand48()-0.5, next_rand48()-0.5);
     }
     return bodies;
   }
@@ -0,0 +1,520 @@
+#ifndef distributed_fmm_h
+#define distributed_fmm_h
+#include <mpi.h>
+#include <string>
+#include <vector>
+#include "exafmm_t.h"
+#include "build_list.h"
+#include "build_tree.h"
+#include "geometry.h"
+#include "partition.h"
+#include "timer.h"
+
+namespace exafmm_t {
+  //! Cell of a local essential tree, its bodies follow those of the previous cells in the body stream.
+  struct LetCell {
+    vec3 x;                  //!< Center of the sender's node
+    real_t r;                //!< Radius of the sender's node
+    int nbodies;             //!< Number of bodies
+    bool is_equiv;           //!< Whether the bodies are the upward equivalent charges of the node, or its sources
+  };
+
+  /**
+   * @brief Distributed-memory FMM. The bodies are partitioned over the ranks of a communicator along a Hilbert curve,
+   * and each rank evaluates the potentials of its own targets on a local tree of its own sources and targets, to
+   * which the local essential trees (LET) received from the other ranks are added before the L2L pass.
+   *
+   * The LET a rank sends to a receiver is the coarsest set of its nodes that the receiver can use: a node whose
+   * distance to the bounding box of the receiver's targets is at least 3 times its radius (well separated as
+   * in the M2L list) is sent as its upward equivalent charges located on its upward equivalent surface, or as
+   * its sources if they are fewer, and the sources of the other leaves are sent as they are. The receiver adds
+   * a cell to the downward check potentials of its coarsest nodes that are well separated from the cell, and
+   * evaluates it directly on the leaves that are not, see add_let().
+   *
+   * The LET is sent with non-blocking transfers posted right after the local upward pass, and the local P2L,
+   * M2P, P2P and M2L run while they are in flight, testing them between the phases so the transfers progress.
+   * Only the time spent waiting for them afterwards is exposed.
+   *
+   * @tparam T Value type of sources and targets (real or complex).
+   * @tparam FmmT FMM class, e.g. LaplaceFmm.
+   */
+  template <typename T, typename FmmT>
+  class DistributedFmm {
+  public:
+    FmmT fmm;                          //!< FMM instance of the local tree
+    MPI_Comm comm;                     //!< Communicator
+    int rank;                          //!< Rank in comm
+    int nranks;                        //!< Number of ranks in comm
+    std::vector<uint64_t> splitters;   //!< Hilbert key ranges of the ranks, see sample_splitters()
+    Nodes<T> nodes;                    //!< Nodes of the local tree of the own sources and targets
+    NodePtrs<T> leafs;                 //!< Leaves of the local tree
+    NodePtrs<T> nonleafs;              //!< Nonleaves of the local tree
+    size_t nlet;                       //!< Number of bodies received in the LET of the last evaluation
+    double comm_time;                  //!< Exposed communication time of the last evaluation in seconds
+    double overlap_time;               //!< Time of the local evaluation overlapping the LET transfers in seconds
+    std::vector<double> costs;         //!< Measured P2P, M2L and LET time of each target in the last evaluation in seconds
+    int precomputed_depth;             //!< Tree depth of the matrices of fmm, -1 if not precomputed for the current box
+
+    /**
+     * @brief Construct a distributed FMM. The trees of all ranks are precomputed for the deepest one, so the ranks
+     * share the precomputation file of fmm_, which rank 0 writes once per depth and box.
+     *
+     * @param fmm_ FMM instance, only single right-hand side (nrhs = 1) is supported.
+     * @param comm_ Communicator.
+     */
+    DistributedFmm(const FmmT& fmm_, MPI_Comm comm_=MPI_COMM_WORLD) :
+      fmm(fmm_), comm(comm_), nlet(0), comm_time(0), overlap_time(0), precomputed_depth(-1) {
+      MPI_Comm_rank(comm, &rank);
+      MPI_Comm_size(comm, &nranks);
+      assert(fmm.nrhs == 1);
+      init_rel_coord();
+    }
+
+    /**
+     * @brief Set the global bounding box and redistribute the bodies, so each rank owns the sources and targets
+     * of a contiguous piece of the Hilbert curve with the same number of bodies.
+     *
+     * @param sources Local sources, replaced by the sources owned by the calling rank.
+     * @param targets Local targets, replaced by the targets owned by the calling rank.
+     * @param verbose Whether to print the number of owned bodies.
+     */
+    void partition(Bodies<T>& sources, Bodies<T>& targets, bool verbose=true) {
+      partition(sources, targets, std::vector<double>(), std::vector<double>(), verbose);
+    }
+
+    /**
+     * @brief Repartition the bodies with the costs measured by the last evaluation, if the cost of a rank
+     * exceeds the average by more than a threshold. Each target weighs its measured cost and the sources
+     * follow the cells of the targets, so the ranks own pieces of the Hilbert curve with the same cost.
+     * Meant for iterative and time-stepping workloads, where the costs change slowly between evaluations.
+     *
+     * @param sources Sources owned by the calling rank, redistributed if the bodies migrate.
+     * @param targets Targets of the last evaluation, redistributed if the bodies migrate.
+     * @param threshold Tolerated imbalance, see imbalance().
+     * @param verbose Whether to print the imbalance.
+     * @return Whether the bodies migrated.
+     */
+    bool repartition(Bodies<T>& sources, Bodies<T>& targets, double threshold=0.1, bool verbose=true) {
+      assert(costs.size() == targets.size());
+      double ratio = imbalance();
+      if (verbose && rank == 0) print("Cost Imbalance", ratio);
+      if (ratio <= threshold) return false;
+      partition(sources, targets, std::vector<double>(sources.size(), 0), costs, verbose);
+      costs.clear();
+      return true;
+    }
+
+    //! Ratio of the maximum over the average cost of the ranks minus one, measured by the last evaluation.
+    double imbalance() {
+      double local = 0, global[2];
+      for (size_t i=0; i<costs.size(); i++) local += costs[i];
+      MPI_Allreduce(&local, &global[0], 1, MPI_DOUBLE, MPI_MAX, comm);
+      MPI_Allreduce(&local, &global[1], 1, MPI_DOUBLE, MPI_SUM, comm);
+      return global[1] > 0 ? global[0] * nranks / global[1] - 1 : 0;
+    }
+
+    /**
+     * @brief Evaluate the potentials (and gradients) of the local targets induced by the sources of all ranks.
+     * partition() must be called first.
+     *
+     * @param sources Sources owned by the calling rank.
+     * @param targets Targets owned by the calling rank, p (and F) are set.
+     * @param verbose Whether to print timings on rank 0 and the exposed communication time of every rank.
+     */
+    void evaluate(const Bodies<T>& sources, Bodies<T>& targets, bool verbose=true) {
+      bool is_verbose = verbose && rank == 0;
+      for (size_t i=0; i<targets.size(); i++) {
+        targets[i].p = T(0.);
+        targets[i].F = vec<3,T>(T(0.));
+      }
+      costs.assign(targets.size(), 0);
+      comm_time = 0;
+      double time = MPI_Wtime();
+      std::vector<real_t> boxes = target_boxes(targets);
+      comm_time += MPI_Wtime() - time;
+
+      // local tree and upward pass of the own sources
+      start("Build Local Tree");
+      build(sources, targets);
+      stop("Build Local Tree", is_verbose);
+      if (!sources.empty()) fmm.upward_pass(nodes, leafs, is_verbose);
+
+      // post the LET transfers
+      start("Build LET");
+      std::vector<std::vector<LetCell>> send_cells;
+      std::vector<Bodies<T>> send_bodies;
+      local_essential_trees(boxes, send_cells, send_bodies);
+      stop("Build LET", is_verbose);
+      VectorExchange<LetCell> cell_exchange;
+      BodyExchange<T> body_exchange;
+      time = MPI_Wtime();
+      cell_exchange.post(send_cells, comm);
+      body_exchange.post(send_bodies, comm);
+      comm_time += MPI_Wtime() - time;
+
+      // interactions of the own sources while the LET is in flight
+      time = MPI_Wtime();
+      double p2p_time = 0, m2l_time = 0;
+      if (!sources.empty() && !targets.empty()) {
+        auto test = [&]() { cell_exchange.test(); body_exchange.test(); };
+        start("P2L");
+        fmm.P2L(nodes);
+        test();
+        stop("P2L", is_verbose);
+        start("M2P");
+        fmm.M2P(leafs);
+        test();
+        stop("M2P", is_verbose);
+        start("P2P");
+        double t = MPI_Wtime();
+        fmm.P2P(leafs);
+        p2p_time = MPI_Wtime() - t;
+        test();
+        stop("P2P", is_verbose);
+        start("M2L");
+        t = MPI_Wtime();
+        fmm.M2L(nodes);
+        m2l_time = MPI_Wtime() - t;
+        test();
+        stop("M2L", is_verbose);
+      }
+      overlap_time = MPI_Wtime() - time;
+
+      // remote contributions once the LET has arrived
+      time = MPI_Wtime();
+      std::vector<LetCell>& cells = cell_exchange.wait();
+      Bodies<T>& let = body_exchange.wait();
+      comm_time += MPI_Wtime() - time;
+      nlet = let.size();
+      if (!nodes.empty() && !targets.empty()) {
+        start("LET");
+        add_let(cells, let);
+        stop("LET", is_verbose);
+        start("L2L");
+        fmm.L2L_levels(nodes);
+        stop("L2L", is_verbose);
+        start("L2P");
+        if (fmm.l2p_matrix.empty())
+          fmm.L2P(leafs);
+        else
+          fmm.L2P_cached(leafs);
+        stop("L2P", is_verbose);
+        add_values(leafs, targets);
+        record_costs(p2p_time, m2l_time);
+      }
+      if (verbose) print_comm_time();
+    }
+
+    //! Print the exposed communication and overlapped computation times of every rank on rank 0.
+    void print_comm_time() {
+      double times[2] = {comm_time, overlap_time};
+      std::vector<double> all_times(2*nranks);
+      MPI_Gather(times, 2, MPI_DOUBLE, all_times.data(), 2, MPI_DOUBLE, 0, comm);
+      if (rank != 0) return;
+      for (int r=0; r<nranks; r++) {
+        print("Rank " + std::to_string(r) + " Exposed Comm", all_times[2*r]);
+        print("Rank " + std::to_string(r) + " Overlapped", all_times[2*r+1]);
+      }
+    }
+
+  private:
+    //! Bounding boxes of the targets of all ranks, given by the min and max corners, an empty box has min > max.
+    std::vector<real_t> target_boxes(const Bodies<T>& targets) {
+      real_t local[6];
+      std::vector<real_t> boxes(6*nranks);
+      for (int d=0; d<3; d++) {
+        local[d] = std::numeric_limits<real_t>::max();
+        local[d+3] = -std::numeric_limits<real_t>::max();
+      }
+      for (size_t b=0; b<targets.size(); b++) {
+        for (int d=0; d<3; d++) {
+          local[d] = std::min(local[d], targets[b].X[d]);
+          local[d+3] = std::max(local[d+3], targets[b].X[d]);
+        }
+      }
+      MPI_Allgather(local, 6, mpi_real_type(), boxes.data(), 6, mpi_real_type(), comm);
+      return boxes;
+    }
+
+    /**
+     * @brief Build the local tree of the sources and targets numbered locally, with its lists and M2L data, empty
+     * without bodies. Collective, the matrices are precomputed for the deepest tree of all ranks, see precompute().
+     */
+    void build(const Bodies<T>& sources, const Bodies<T>& targets) {
+      nodes.clear();
+      leafs.clear();
+      nonleafs.clear();
+      int depth = 0;
+      Bodies<T> sources_ = sources;
+      Bodies<T> targets_ = targets;
+      if (!sources.empty() || !targets.empty()) {
+        for (size_t i=0; i<sources_.size(); i++) sources_[i].ibody = i;
+        for (size_t i=0; i<targets_.size(); i++) targets_[i].ibody = i;
+        nodes = build_tree(sources_, targets_, leafs, nonleafs, fmm);
+        balance_tree(nodes, sources_, targets_, leafs, nonleafs, fmm);
+        depth = fmm.depth;
+      }
+      precompute(fmm, depth, precomputed_depth);
+      if (nodes.empty()) return;
+      set_colleagues(nodes);
+      build_list(nodes, fmm);
+      fmm.M2L_setup(nonleafs);
+    }
+
+    /**
+     * @brief Set the depth of an FMM instance to the deepest tree of all ranks and precompute its matrices if the
+     * depth changed. Rank 0 writes the precomputation file and the other ranks read it once it is complete.
+     *
+     * @param fmm_ FMM instance.
+     * @param depth Depth of the local tree.
+     * @param precomputed_depth_ Depth of the current matrices of fmm_, updated.
+     */
+    void precompute(FmmT& fmm_, int depth, int& precomputed_depth_) {
+      MPI_Allreduce(MPI_IN_PLACE, &depth, 1, MPI_INT, MPI_MAX, comm);
+      fmm_.depth = depth;
+      if (depth == precomputed_depth_) return;
+      if (rank == 0) fmm_.precompute();
+      MPI_Barrier(comm);
+      if (rank != 0) fmm_.precompute();
+      precomputed_depth_ = depth;
+    }
+
+    //! Partition with the weights of the bodies, unit weights if empty.
+    void partition(Bodies<T>& sources, Bodies<T>& targets, const std::vector<double>& source_weights,
+                   const std::vector<double>& target_weights, bool verbose) {
+      start("Partition");
+      get_global_bounds(sources, targets, fmm.x0, fmm.r0, comm);
+      precomputed_depth = -1;   // the matrices depend on the box
+      splitters = exafmm_t::partition(sources, targets, fmm.x0, fmm.r0, comm, source_weights, target_weights);
+      stop("Partition", verbose && rank == 0);
+      if (verbose && rank == 0) {
+        print("Local Sources", sources.size());
+        print("Local Targets", targets.size());
+      }
+    }
+
+    /**
+     * @brief Split the measured P2P and M2L times of the own sources over the targets in proportion to their
+     * interactions, see add_costs(). The P2P interactions of a leaf are its pairs of targets and sources, the
+     * M2L interactions of a node are the sources in its M2L list.
+     */
+    void record_costs(double p2p_time, double m2l_time) {
+      std::vector<double> p2p_work(nodes.size(), 0), m2l_work(nodes.size(), 0);
+      for (size_t i=0; i<nodes.size(); i++) {
+        Node<T>* node = &nodes[i];
+        if (node->ntrgs == 0) continue;
+        for (size_t j=0; j<node->P2P_list.size(); j++)
+          p2p_work[i] += double(node->ntrgs) * node->P2P_list[j]->nsrcs;
+        for (size_t j=0; j<node->M2L_list.size(); j++)
+          if (node->M2L_list[j]) m2l_work[i]++;   // the list has a slot for each relative position
+      }
+      add_costs(p2p_work, p2p_time);
+      add_costs(m2l_work, m2l_time);
+    }
+
+    /**
+     * @brief Split a measured time over the targets in proportion to the work of the nodes. The work of a node is
+     * shared by the leaves under it in proportion to their targets, and the cost of a leaf by its targets evenly.
+     *
+     * @param work Work of each node of the local tree.
+     * @param time Measured time in seconds.
+     */
+    void add_costs(const std::vector<double>& work, double time) {
+      std::vector<double> leaf_work(leafs.size(), 0);
+      double total = 0;
+      for (size_t i=0; i<leafs.size(); i++) {
+        Node<T>* leaf = leafs[i];
+        if (leaf->ntrgs == 0) continue;
+        for (Node<T>* node=leaf; node; node=node->parent)
+          leaf_work[i] += work[node->idx] * leaf->ntrgs / node->ntrgs;
+        total += leaf_work[i];
+      }
+      if (total == 0) return;
+      for (size_t i=0; i<leafs.size(); i++) {
+        Node<T>* leaf = leafs[i];
+        for (int j=0; j<leaf->ntrgs; j++)
+          costs[leaf->itrgs[j]] += time * leaf_work[i] / total / leaf->ntrgs;
+      }
+    }
+
+    //! Add the values of the targets in the leaves of a tree to the targets.
+    void add_values(NodePtrs<T>& leafs_, Bodies<T>& targets) {
+      int nvalues = fmm.ntrg_values();
+      for (size_t i=0; i<leafs_.size(); i++) {
+        Node<T>* leaf = leafs_[i];
+        for (int j=0; j<leaf->ntrgs; j++) {
+          Body<T>& target = targets[leaf->itrgs[j]];
+          target.p += leaf->trg_value[nvalues*j];
+          for (int d=0; d<3 && nvalues>1; d++)
+            target.F[d] += leaf->trg_value[nvalues*j+d+1];
+        }
+      }
+    }
+
+    /**
+     * @brief Collect the LET of the local tree sent to each rank, after the upward pass.
+     *
+     * @param boxes Bounding boxes of the targets of all ranks, see target_boxes().
+     * @param cells LET cells sent to each rank.
+     * @param bodies Bodies of the cells sent to each rank, in the order of the cells.
+     */
+    void local_essential_trees(const std::vector<real_t>& boxes, std::vector<std::vector<LetCell>>& cells,
+                               std::vector<Bodies<T>>& bodies) {
+      cells.assign(nranks, std::vector<LetCell>());
+      bodies.assign(nranks, Bodies<T>());
+      if (nodes.empty()) return;
+      real_t c[3] = {0.0};
+      std::vector<RealVec> up_equiv_surf(fmm.depth+1);
+      for (int level=0; level<=fmm.depth; level++)
+        up_equiv_surf[level] = surface(fmm.p, fmm.r0, level, c, 1.05);
+      for (int r=0; r<nranks; r++) {
+        const real_t* box = &boxes[6*r];
+        if (r == rank || box[0] > box[3]) continue;
+        collect_let(&nodes[0], box, up_equiv_surf, cells[r], bodies[r]);
+      }
+    }
+
+    /**
+     * @brief Add the LET received from the other ranks to the local tree, after its M2L: a cell is evaluated on the
+     * downward check surfaces of the coarsest nodes whose downward equivalent surface it lies outside of, and
+     * directly on the targets of the leaves it is too close to. Cells of equivalent charges also stay outside
+     * the upward check surface of their node, where the charges represent its sources. The measured time is
+     * added to the costs of the targets in proportion to the pairs of bodies and check or target points.
+     *
+     * @param cells Received LET cells.
+     * @param bodies Bodies of the cells, in the order of the cells.
+     */
+    void add_let(const std::vector<LetCell>& cells, const Bodies<T>& bodies) {
+      if (cells.empty()) return;
+      std::vector<size_t> offsets(cells.size()+1, 0);
+      for (size_t i=0; i<cells.size(); i++)
+        offsets[i+1] = offsets[i] + cells[i].nbodies;
+      assert(offsets.back() == bodies.size());
+      std::vector<std::vector<int>> far(nodes.size()), near(nodes.size());
+      for (size_t i=0; i<cells.size(); i++)
+        assign_let(&nodes[0], cells[i], i, far, near);
+
+      NodePtrs<T> targets;
+      for (size_t i=0; i<nodes.size(); i++)
+        if (!far[i].empty() || !near[i].empty()) targets.push_back(&nodes[i]);
+      real_t c[3] = {0.0};
+      std::vector<RealVec> dn_check_surf(fmm.depth+1);
+      for (int level=0; level<=fmm.depth; level++)
+        dn_check_surf[level] = surface(fmm.p, fmm.r0, level, c, 1.05);
+      double time = MPI_Wtime();
+      fmm.parallel_for(targets.size(), [&](size_t i) {
+        Node<T>* node = targets[i];
+        for (int is_near=0; is_near<2; is_near++) {
+          std::vector<int>& list = is_near ? near[node->idx] : far[node->idx];
+          if (list.empty()) continue;
+          RealVec src_coord;
+          std::vector<T> src_value;
+          for (size_t j=0; j<list.size(); j++) {
+            for (size_t b=offsets[list[j]]; b<offsets[list[j]+1]; b++) {
+              for (int d=0; d<3; d++)
+                src_coord.push_back(bodies[b].X[d]);
+              src_value.push_back(bodies[b].q);
+            }
+          }
+          if (is_near) {
+            fmm.evaluate_P2P(src_coord, src_value, node->trg_coord, node->trg_value);
+          } else {
+            RealVec trg_check_coord(fmm.nsurf*3);
+            for (int k=0; k<fmm.nsurf; k++)
+              for (int d=0; d<3; d++)
+                trg_check_coord[3*k+d] = dn_check_surf[node->level][3*k+d] + node->x[d];
+            fmm.potential_P2P(src_coord, src_value, trg_check_coord, node->dn_equiv);
+          }
+        }
+      });
+      time = MPI_Wtime() - time;
+
+      std::vector<double> work(nodes.size(), 0);
+      for (size_t i=0; i<targets.size(); i++) {
+        Node<T>* node = targets[i];
+        for (size_t j=0; j<far[node->idx].size(); j++)
+          work[node->idx] += double(cells[far[node->idx][j]].nbodies) * fmm.nsurf;
+        for (size_t j=0; j<near[node->idx].size(); j++)
+          work[node->idx] += double(cells[near[node->idx][j]].nbodies) * node->ntrgs;
+      }
+      add_costs(work, time);
+    }
+
+    //! Append a LET cell to the far list of the coarsest nodes with targets that are well separated from it, or to the near list of the leaves.
+    void assign_let(Node<T>* node, const LetCell& cell, int icell,
+                    std::vector<std::vector<int>>& far, std::vector<std::vector<int>>& near) {
+      if (node->ntrgs == 0) return;
+      real_t dist = 0;
+      for (int d=0; d<3; d++)
+        dist = std::max(dist, std::abs(cell.x[d] - node->x[d]));
+      bool is_far = dist >= 2.95 * node->r + (cell.is_equiv ? 1.05 : 1) * cell.r;
+      if (cell.is_equiv) is_far = is_far && dist >= 1.05 * node->r + 2.95 * cell.r;
+      if (is_far) {
+        far[node->idx].push_back(icell);
+      } else if (node->is_leaf) {
+        near[node->idx].push_back(icell);
+      } else {
+        for (size_t c=0; c<node->children.size(); c++)
+          assign_let(node->children[c], cell, icell, far, near);
+      }
+    }
+
+    //! Max-norm distance from the center of a node to a box given by its min and max corners.
+    static real_t distance(const Node<T>* node, const real_t* box) {
+      real_t dist = 0;
+      for (int d=0; d<3; d++)
+        dist = std::max(dist, std::max(box[d] - node->x[d], node->x[d] - box[d+3]));
+      return dist;
+    }
+
+    //! Append the sources of the leaves under a node.
+    static void append_sources(const Node<T>* node, Bodies<T>& let) {
+      if (node->nsrcs == 0) return;
+      if (node->is_leaf) {
+        for (int i=0; i<node->nsrcs; i++) {
+          Body<T> body;
+          body.ibody = node->isrcs[i];
+          for (int d=0; d<3; d++)
+            body.X[d] = node->src_coord[3*i+d];
+          body.q = node->src_value[i];
+          let.push_back(body);
+        }
+        return;
+      }
+      for (size_t c=0; c<node->children.size(); c++)
+        append_sources(node->children[c], let);
+    }
+
+    //! Append the LET of a subtree for a receiver whose targets lie in box.
+    void collect_let(const Node<T>* node, const real_t* box, const std::vector<RealVec>& up_equiv_surf,
+                     std::vector<LetCell>& cells, Bodies<T>& let) {
+      if (node->nsrcs == 0) return;
+      bool is_far = distance(node, box) >= 3 * node->r;
+      LetCell cell;
+      cell.x = node->x;
+      cell.r = node->r;
+      if (is_far && node->nsrcs > fmm.nsurf) {
+        cell.nbodies = fmm.nsurf;
+        cell.is_equiv = true;
+        for (int k=0; k<fmm.nsurf; k++) {
+          Body<T> body;
+          body.ibody = -1;
+          for (int d=0; d<3; d++)
+            body.X[d] = up_equiv_surf[node->level][3*k+d] + node->x[d];
+          body.q = node->up_equiv[k];
+          let.push_back(body);
+        }
+        cells.push_back(cell);
+      } else if (node->is_leaf || (is_far && node->nsrcs <= fmm.nsurf)) {
+        cell.nbodies = node->nsrcs;
+        cell.is_equiv = false;
+        append_sources(node, let);
+        cells.push_back(cell);
+      } else {
+        for (size_t c=0; c<node->children.size(); c++)
+          collect_let(node->children[c], box, up_equiv_surf, cells, let);
+      }
+    }
+  };
+}  // end namespace exafmm_t
+#endif
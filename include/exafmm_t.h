@@ -6,6 +6,7 @@
 #include <complex>
 #include <fftw3.h>
 #include <iostream>
+#include <mutex>
 #include <omp.h>
 #include <set>
 #include <vector>
@@ -102,7 +103,6 @@ namespace exafmm_t {
   template <typename T>
   struct Node {
     size_t idx;                                 //!< Index in the octree
-    size_t idx_M2L;                             //!< Index in global M2L interaction list
     bool is_leaf;                               //!< Whether the node is leaf
     int ntrgs;                                  //!< Number of targets
     int nsrcs;                                  //!< Number of sources
@@ -122,6 +122,8 @@ namespace exafmm_t {
     std::vector<int> itrgs;                     //!< Vector of initial target numbering
     RealVec src_coord;                          //!< Vector of coordinates of sources in the node
     RealVec trg_coord;                          //!< Vector of coordinates of targets in the node
+    AlignedVec src_coord_soa;                   //!< src_coord in SoA layout, built with the leaf by transpose_leaf()
+    AlignedVec trg_coord_soa;                   //!< trg_coord in SoA layout padded to TRG_PAD, built with the leaf by transpose_leaf()
     std::vector<T> src_value;                   //!< Vector of charges of sources in the node
     std::vector<T> trg_value;                   //!< Vector of potentials and gradients of targets in the node
     std::vector<T> up_equiv;                    //!< Upward check potentials / Upward equivalent densities
@@ -142,9 +144,41 @@ namespace exafmm_t {
     std::vector<size_t> interaction_count_offset;
   };
 
-  // Relative coordinates and interaction lists
-  std::vector<std::vector<ivec3>> REL_COORD;  //!< Vector of possible relative coordinates (inner) of each interaction type (outer)
-  std::vector<std::vector<int>> HASH_LUT;     //!< Vector of hash Lookup tables (inner) of relative positions for each interaction type (outer)
-  std::vector<std::vector<int>> M2L_INDEX_MAP;  //!< [M2L_relpos_idx][octant] -> M2L_Helper_relpos_idx
+  //! Symmetric P2P setup data
+  struct P2PData {
+    std::vector<std::vector<int>> colors;       // leaf indices grouped by color, leaves of the same color are processed concurrently
+    std::vector<std::vector<int>> mutual_list;  // [leaf][j]: leaves evaluated together with this leaf once for both sides
+    std::vector<std::vector<int>> oneway_list;  // [leaf][j]: leaves that only act on this leaf (including itself)
+  };
+
+  //! Mutex serializing the creation and destruction of FFTW plans, which are not thread-safe
+  inline std::mutex& fft_planner_mutex() {
+    static std::mutex mutex;
+    return mutex;
+  }
+
+  /**
+   * @brief Flops of an execution of an FFT plan, as reported by the FFT library, or estimated as 5 n log2(n)
+   * per complex transform and half of it per real transform if the library does not report them.
+   *
+   * @param plan FFT plan.
+   * @param n Number of points of a transform.
+   * @param howmany Number of transforms of the plan.
+   * @param is_complex Whether the transforms are complex-to-complex.
+   */
+  inline long long fft_plan_flop(const fft_plan& plan, int n, int howmany, bool is_complex) {
+    double add, mul, fma;
+    fft_flops(plan, &add, &mul, &fma);
+    long long nflop = add + mul + 2*fma;
+    if (nflop == 0) nflop = (is_complex ? 5 : 2.5) * n * std::log2(double(n)) * howmany;
+    return nflop;
+  }
+
+  //! Relative coordinates and interaction lists, built once by rel_coord_tables() and read-only afterwards
+  struct RelCoordTables {
+    std::vector<std::vector<ivec3>> rel_coord;    //!< Vector of possible relative coordinates (inner) of each interaction type (outer)
+    std::vector<std::vector<int>> hash_lut;       //!< Vector of hash Lookup tables (inner) of relative positions for each interaction type (outer)
+    std::vector<std::vector<int>> m2l_index_map;  //!< [M2L_relpos_idx][octant] -> M2L_Helper_relpos_idx
+  };
 }
 #endif
@@ -0,0 +1,208 @@
+#ifndef executor_h
+#define executor_h
+#include <algorithm>    // std::max
+#include <atomic>
+#include <condition_variable>
+#include <deque>
+#include <functional>   // std::function
+#include <memory>       // std::unique_ptr
+#include <mutex>
+#include <thread>
+#include <vector>
+#include <omp.h>
+
+namespace exafmm_t {
+  //! Parallel backend of the FMM operators.
+  class Executor {
+  public:
+    virtual ~Executor() {}
+
+    //! Maximum number of threads running a loop.
+    virtual int num_threads() const = 0;
+
+    /**
+     * @brief Call body(i) for all i in [0, n) in parallel, and return after all calls complete.
+     * Calls may be nested, i.e. body may call parallel_for() of the same executor.
+     *
+     * @param n Number of iterations.
+     * @param body Loop body, iterations must be independent.
+     */
+    virtual void parallel_for(size_t n, const std::function<void(size_t)>& body) = 0;
+  };
+
+  //! Executor running loops on OpenMP threads.
+  class OpenMPExecutor : public Executor {
+  public:
+    /**
+     * @brief Construct an OpenMP executor.
+     *
+     * @param nthreads_ Maximum number of threads, 0 for the OpenMP default at the time of each loop.
+     * @param is_contiguous_ Whether thread t runs the t-th of num_threads() contiguous ranges of iterations
+     *                       instead of a dynamic schedule, so a loop over the same items always maps an item
+     *                       to the same thread (used by NUMA placement).
+     */
+    explicit OpenMPExecutor(int nthreads_=0, bool is_contiguous_=false) :
+      nthreads(nthreads_), is_contiguous(is_contiguous_) {}
+
+    int num_threads() const {
+      return nthreads > 0 ? std::min(nthreads, omp_get_max_threads()) : omp_get_max_threads();
+    }
+
+    void parallel_for(size_t n, const std::function<void(size_t)>& body) {
+      int nthreads_ = num_threads();
+      if (is_contiguous) {
+#pragma omp parallel num_threads(nthreads_)
+        {
+          size_t t = omp_get_thread_num(), nt = omp_get_num_threads();
+          for (size_t i=n*t/nt; i<n*(t+1)/nt; i++)
+            body(i);
+        }
+        return;
+      }
+#pragma omp parallel for schedule(dynamic) num_threads(nthreads_)
+      for (size_t i=0; i<n; i++)
+        body(i);
+    }
+
+  private:
+    int nthreads;        //!< Maximum number of threads, 0 if not limited
+    bool is_contiguous;  //!< Whether each thread runs one contiguous range of iterations
+  };
+
+  /**
+   * @brief Executor running loops on its own pool of threads, independent of OpenMP.
+   * A loop is split into chunks, which are pushed to the deques of the workers. A worker pops chunks from
+   * the back of its own deque and steals from the front of the others when it runs out. The calling thread
+   * runs chunks as well until its loop completes, so nested loops cannot deadlock.
+   */
+  class ThreadPoolExecutor : public Executor {
+  public:
+    /**
+     * @brief Start the workers of the pool.
+     *
+     * @param nthreads_ Number of threads including the calling thread, 0 for the number of hardware threads.
+     */
+    explicit ThreadPoolExecutor(int nthreads_=0) : is_stopped(false), npending(0) {
+      nthreads = nthreads_ > 0 ? nthreads_ : std::max(1, int(std::thread::hardware_concurrency()));
+      for (int i=0; i<nthreads; i++)
+        queues.emplace_back(new Queue());
+      for (int i=1; i<nthreads; i++)
+        workers.emplace_back(&ThreadPoolExecutor::work, this, i);
+    }
+
+    ~ThreadPoolExecutor() {
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+        is_stopped = true;
+      }
+      wakeup.notify_all();
+      for (size_t i=0; i<workers.size(); i++)
+        workers[i].join();
+    }
+
+    ThreadPoolExecutor(const ThreadPoolExecutor&) = delete;
+    ThreadPoolExecutor& operator=(const ThreadPoolExecutor&) = delete;
+
+    int num_threads() const {
+      return nthreads;
+    }
+
+    void parallel_for(size_t n, const std::function<void(size_t)>& body) {
+      if (n == 0) return;
+      int self = (current_pool() == this) ? current_index() : 0;
+      size_t nchunks = std::min(n, size_t(4*nthreads));
+      Job job;
+      job.body = &body;
+      job.remaining = nchunks;
+      for (size_t c=0; c<nchunks; c++) {
+        Chunk chunk = {&job, n*c/nchunks, n*(c+1)/nchunks};
+        // a worker keeps the chunks of its nested loops, other threads spread them over all workers
+        Queue& queue = *queues[self > 0 ? self : c % nthreads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        queue.chunks.push_back(chunk);
+        npending++;
+      }
+      {
+        std::lock_guard<std::mutex> lock(mutex);
+      }
+      wakeup.notify_all();
+      while (job.remaining > 0) {
+        if (!run_one(self)) std::this_thread::yield();
+      }
+    }
+
+  private:
+    struct Job {
+      const std::function<void(size_t)>* body;
+      std::atomic<size_t> remaining;   //!< Number of chunks not completed yet
+    };
+
+    struct Chunk {
+      Job* job;
+      size_t begin;
+      size_t end;
+    };
+
+    struct Queue {
+      std::mutex mutex;
+      std::deque<Chunk> chunks;
+    };
+
+    int nthreads;
+    std::vector<std::unique_ptr<Queue>> queues;   //!< Deque of each worker, queue 0 belongs to the calling threads
+    std::vector<std::thread> workers;
+    std::mutex mutex;                   //!< Protects the sleep of idle workers
+    std::condition_variable wakeup;
+    bool is_stopped;
+    std::atomic<size_t> npending;       //!< Number of chunks in the deques
+
+    //! Pool of the current thread, nullptr if it is not a worker.
+    static const ThreadPoolExecutor*& current_pool() {
+      thread_local const ThreadPoolExecutor* pool = nullptr;
+      return pool;
+    }
+
+    //! Index of the current thread in its pool.
+    static int& current_index() {
+      thread_local int index = 0;
+      return index;
+    }
+
+    //! Run a chunk from the back of the own deque or from the front of another one, return false if all are empty.
+    bool run_one(int self) {
+      Chunk chunk;
+      bool is_found = false;
+      for (int k=0; k<nthreads && !is_found; k++) {
+        Queue& queue = *queues[(self+k) % nthreads];
+        std::lock_guard<std::mutex> lock(queue.mutex);
+        if (queue.chunks.empty()) continue;
+        if (k == 0) {
+          chunk = queue.chunks.back();
+          queue.chunks.pop_back();
+        } else {
+          chunk = queue.chunks.front();
+          queue.chunks.pop_front();
+        }
+        npending--;
+        is_found = true;
+      }
+      if (!is_found) return false;
+      for (size_t i=chunk.begin; i<chunk.end; i++)
+        (*chunk.job->body)(i);
+      chunk.job->remaining--;
+      return true;
+    }
+
+    void work(int index) {
+      current_pool() = this;
+      current_index() = index;
+      while (true) {
+        if (run_one(index)) continue;
+        std::unique_lock<std::mutex> lock(mutex);
+        wakeup.wait(lock, [this]() { return is_stopped || npending > 0; });
+        if (is_stopped && npending == 0) return;
+      }
+    }
+  };
+}  // end namespace exafmm_t
+#endif
@@ -1,5 +1,6 @@
 #ifndef fmm_h
 #define fmm_h
+#include <algorithm>    // std::lower_bound
 #include <cstring>      // std::memset
 #include <fstream>      // std::ofstream
 #include <type_traits>  // std::is_same
@@ -20,6 +21,7 @@ namespace exafmm_t {
     std::vector<std::vector<std::vector<T>>> matrix_L2L;
 
     std::vector<M2LData> m2ldata;
+    std::vector<std::vector<AlignedVec>> matrix_M2L_levels;   //!< [level][relative position] M2L matrices loaded by load_M2L_matrix()
 
     /* constructors */
     Fmm() {}
@@ -38,8 +40,8 @@ namespace exafmm_t {
       matrix_M2M.resize(depth_+1);
       matrix_L2L.resize(depth_+1);
       for (int level=0; level<=depth_; ++level) {
-        matrix_M2M[level].resize(REL_COORD[M2M_Type].size(), std::vector<T>(nsurf_*nsurf_));
-        matrix_L2L[level].resize(REL_COORD[L2L_Type].size(), std::vector<T>(nsurf_*nsurf_));
+        matrix_M2M[level].resize(rel_coord(M2M_Type).size(), std::vector<T>(nsurf_*nsurf_));
+        matrix_L2L[level].resize(rel_coord(L2L_Type).size(), std::vector<T>(nsurf_*nsurf_));
       }
     }
 
@@ -50,11 +52,11 @@ namespace exafmm_t {
       for (int level=0; level<=this->depth; level++) {
         RealVec parent_up_check_surf = surface(this->p, this->r0, level, parent_coord, 2.95);
         real_t s = this->r0 * powf(0.5, level+1);
-        int npos = REL_COORD[M2M_Type].size();  // number of relative positions
+        int npos = rel_coord(M2M_Type).size();  // number of relative positions
 #pragma omp parallel for
         for(int i=0; i<npos; i++) {
           // compute kernel matrix
-          ivec3& coord = REL_COORD[M2M_Type][i];
+          const ivec3& coord = rel_coord(M2M_Type)[i];
           real_t child_coord[3] = {parent_coord[0] + coord[0]*s,
                                    parent_coord[1] + coord[1]*s,
                                    parent_coord[2] + coord[2]*s};
@@ -104,8 +106,8 @@ namespace exafmm_t {
       int& nsurf_ = this->nsurf;
       int& depth_ = this->depth;
       size_t size_M2L = this->nfreq * 2 * NCHILD * NCHILD;
-      size_t file_size = (2*REL_COORD[M2M_Type].size()+4) * nsurf_ * nsurf_ * (depth_+1) * sizeof(T) 
-                       + REL_COORD[M2L_Type].size() * size_M2L * depth_ * sizeof(real_t)
+      size_t file_size = (2*rel_coord(M2M_Type).size()+4) * nsurf_ * nsurf_ * (depth_+1) * sizeof(T) 
+                       + rel_coord(M2L_Type).size() * size_M2L * depth_ * sizeof(real_t)
                        + 1 * sizeof(real_t);   // +1 denotes r0
       std::ifstream file(this->filename, std::ifstream::binary);
       if (file.good()) {
@@ -139,6 +141,7 @@ namespace exafmm_t {
     
     //! Precompute
     void precompute() {
+      matrix_M2L_levels.clear();
       initialize_matrix();
       load_matrix();
       if (!this->is_precomputed) {
@@ -154,7 +157,9 @@ namespace exafmm_t {
 
     //! P2M operator
     void P2M(NodePtrs<T>& leafs) {
+      OpScope scope(P2M_Op, this->counters);
       int& nsurf_ = this->nsurf;
+      int& nrhs_ = this->nrhs;
       real_t c[3] = {0,0,0};
       std::vector<RealVec> up_check_surf;
       up_check_surf.resize(this->depth+1);
@@ -162,8 +167,7 @@ namespace exafmm_t {
         up_check_surf[level].resize(nsurf_*3);
         up_check_surf[level] = surface(this->p, this->r0, level, c, 2.95);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<leafs.size(); i++) {
+      this->parallel_for(leafs.size(), [&](size_t i) {
         Node<T>* leaf = leafs[i];
         int level = leaf->level;
         // calculate upward check potential induced by sources' charges
@@ -173,20 +177,24 @@ namespace exafmm_t {
           check_coord[3*k+1] = up_check_surf[level][3*k+1] + leaf->x[1];
           check_coord[3*k+2] = up_check_surf[level][3*k+2] + leaf->x[2];
         }
-        this->potential_P2P(leaf->src_coord, leaf->src_value,
-                            check_coord, leaf->up_equiv);
-        std::vector<T> buffer(nsurf_);
-        std::vector<T> equiv(nsurf_);
-        gemv(nsurf_, nsurf_, &(matrix_UC2E_U[level][0]), &(leaf->up_equiv[0]), &buffer[0]);
-        gemv(nsurf_, nsurf_, &(matrix_UC2E_V[level][0]), &buffer[0], &equiv[0]);
-        for (int k=0; k<nsurf_; k++)
+        AlignedVec src_buffer;
+        AlignedVec check = transpose_coord(check_coord, TRG_PAD);
+        this->potential_P2P_multi(this->source_soa(leaf, src_buffer), leaf->src_value,
+                                  SoACoord(check, nsurf_), leaf->up_equiv, nrhs_);
+        std::vector<T> buffer(nsurf_*nrhs_);
+        std::vector<T> equiv(nsurf_*nrhs_);
+        matmul(nsurf_, nrhs_, nsurf_, &(matrix_UC2E_U[level][0]), &(leaf->up_equiv[0]), &buffer[0]);
+        matmul(nsurf_, nrhs_, nsurf_, &(matrix_UC2E_V[level][0]), &buffer[0], &equiv[0]);
+        for (int k=0; k<nsurf_*nrhs_; k++)
           leaf->up_equiv[k] = equiv[k];
-      }
+      });
     }
 
     //! L2P operator
     void L2P(NodePtrs<T>& leafs) {
+      OpScope scope(L2P_Op, this->counters);
       int& nsurf_ = this->nsurf;
+      int& nrhs_ = this->nrhs;
       real_t c[3] = {0,0,0};
       std::vector<RealVec> dn_equiv_surf;
       dn_equiv_surf.resize(this->depth+1);
@@ -194,16 +202,15 @@ namespace exafmm_t {
         dn_equiv_surf[level].resize(nsurf_*3);
         dn_equiv_surf[level] = surface(this->p, this->r0, level, c, 2.95);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<leafs.size(); i++) {
+      this->parallel_for(leafs.size(), [&](size_t i) {
         Node<T>* leaf = leafs[i];
         int level = leaf->level;
         // down check surface potential -> equivalent surface charge
-        std::vector<T> buffer(nsurf_);
-        std::vector<T> equiv(nsurf_);
-        gemv(nsurf_, nsurf_, &(matrix_DC2E_U[level][0]), &(leaf->dn_equiv[0]), &buffer[0]);
-        gemv(nsurf_, nsurf_, &(matrix_DC2E_V[level][0]), &buffer[0], &equiv[0]);
-        for (int k=0; k<nsurf_; k++)
+        std::vector<T> buffer(nsurf_*nrhs_);
+        std::vector<T> equiv(nsurf_*nrhs_);
+        matmul(nsurf_, nrhs_, nsurf_, &(matrix_DC2E_U[level][0]), &(leaf->dn_equiv[0]), &buffer[0]);
+        matmul(nsurf_, nrhs_, nsurf_, &(matrix_DC2E_V[level][0]), &buffer[0], &equiv[0]);
+        for (int k=0; k<nsurf_*nrhs_; k++)
           leaf->dn_equiv[k] = equiv[k];
         // equivalent surface charge -> target potential
         RealVec equiv_coord(nsurf_*3);
@@ -212,60 +219,113 @@ namespace exafmm_t {
           equiv_coord[3*k+1] = dn_equiv_surf[level][3*k+1] + leaf->x[1];
           equiv_coord[3*k+2] = dn_equiv_surf[level][3*k+2] + leaf->x[2];
         }
-        this->gradient_P2P(equiv_coord, leaf->dn_equiv,
-                           leaf->trg_coord, leaf->trg_value);
-      }
+        AlignedVec trg_buffer;
+        AlignedVec equiv_soa = transpose_coord(equiv_coord);
+        this->evaluate_P2P(SoACoord(equiv_soa, nsurf_), leaf->dn_equiv,
+                           this->target_soa(leaf, trg_buffer), leaf->trg_value);
+      });
     }
 
-    //! M2M operator
-    void M2M(Node<T>* node) {
+    //! M2M operator of a single non-leaf node, its children's upward equivalent charges must be ready
+    void M2M_node(Node<T>* node) {
+      OpScope scope(M2M_Op, this->counters);
       int& nsurf_ = this->nsurf;
-      if (node->is_leaf) return;
-      for (int octant=0; octant<8; octant++) {
-        if (node->children[octant])
-#pragma omp task untied
-          M2M(node->children[octant]);
-      }
-#pragma omp taskwait
+      int& nrhs_ = this->nrhs;
       for (int octant=0; octant<8; octant++) {
         if (node->children[octant]) {
           Node<T>* child = node->children[octant];
-          std::vector<T> buffer(nsurf_);
+          std::vector<T> buffer(nsurf_*nrhs_);
           int level = node->level;
-          gemv(nsurf_, nsurf_, &(matrix_M2M[level][octant][0]), &child->up_equiv[0], &buffer[0]);
-          for (int k=0; k<nsurf_; k++) {
+          matmul(nsurf_, nrhs_, nsurf_, &(matrix_M2M[level][octant][0]), &child->up_equiv[0], &buffer[0]);
+          for (int k=0; k<nsurf_*nrhs_; k++) {
             node->up_equiv[k] += buffer[k];
           }
         }
       }
     }
   
-    //! L2L operator
-    void L2L(Node<T>* node) {
+    //! L2L operator of a single non-leaf node, its downward check potential must be ready
+    void L2L_node(Node<T>* node) {
+      OpScope scope(L2L_Op, this->counters);
       int& nsurf_ = this->nsurf;
-      if (node->is_leaf) return;
+      int& nrhs_ = this->nrhs;
       for (int octant=0; octant<8; octant++) {
         if (node->children[octant]) {
           Node<T>* child = node->children[octant];
-          std::vector<T> buffer(nsurf_);
+          std::vector<T> buffer(nsurf_*nrhs_);
           int level = node->level;
-          gemv(nsurf_, nsurf_, &(matrix_L2L[level][octant][0]), &node->dn_equiv[0], &buffer[0]);
-          for (int k=0; k<nsurf_; k++)
+          matmul(nsurf_, nrhs_, nsurf_, &(matrix_L2L[level][octant][0]), &node->dn_equiv[0], &buffer[0]);
+          for (int k=0; k<nsurf_*nrhs_; k++)
             child->dn_equiv[k] += buffer[k];
         }
       }
-      for (int octant=0; octant<8; octant++) {
-        if (node->children[octant])
-#pragma omp task untied
-          L2L(node->children[octant]);
+    }
+
+    /**
+     * @brief Compute the M2L setup data of target nodes of the same level.
+     *
+     * @param trg_nodes Vector of pointers to target (non-leaf) nodes of the same level.
+     * @param is_source Whether a node (by index) is included as a source, all nodes are included if it is empty.
+     * @return M2L setup data, the offsets index the arrays of all nodes.
+     */
+    M2LData M2L_data(const NodePtrs<T>& trg_nodes, const std::vector<bool>& is_source=std::vector<bool>()) const {
+      int nsurf_ = this->nsurf;
+      int nrhs_ = this->nrhs;
+      int npos = rel_coord(M2L_Type).size();  // number of M2L relative positions
+
+      // construct M2L source nodes
+      std::set<Node<T>*> src_nodes_;
+      for (size_t i=0; i<trg_nodes.size(); i++) {
+        NodePtrs<T>& M2L_list = trg_nodes[i]->M2L_list;
+        for (int k=0; k<npos; k++) {
+          if (M2L_list[k] && (is_source.empty() || is_source[M2L_list[k]->idx]))
+            src_nodes_.insert(M2L_list[k]);
+        }
+      }
+      NodePtrs<T> src_nodes(src_nodes_.begin(), src_nodes_.end());   // sorted by address
+      // prepare the indices of src_nodes & trg_nodes in all_up_equiv & all_dn_equiv
+      M2LData data;
+      data.fft_offset.resize(src_nodes.size());     // displacement in all_up_equiv
+      data.ifft_offset.resize(trg_nodes.size());    // displacement in all_dn_equiv
+      for (size_t i=0; i<src_nodes.size(); i++) {
+        data.fft_offset[i] = src_nodes[i]->children[0]->idx * nsurf_ * nrhs_;
+      }
+      for (size_t i=0; i<trg_nodes.size(); i++) {
+        data.ifft_offset[i] = trg_nodes[i]->children[0]->idx * nsurf_ * nrhs_;
+      }
+
+      // calculate interaction_offset_f & interaction_count_offset
+      size_t nblk_trg = trg_nodes.size() * sizeof(real_t) / CACHE_SIZE;
+      if (nblk_trg==0) nblk_trg = 1;
+      size_t interaction_count_offset_ = 0;
+      size_t fft_size = 2 * NCHILD * this->nfreq * nrhs_;   // fft chunks of all right-hand sides of a node
+      for (size_t iblk_trg=0; iblk_trg<nblk_trg; iblk_trg++) {
+        size_t blk_start = (trg_nodes.size()* iblk_trg   ) / nblk_trg;
+        size_t blk_end   = (trg_nodes.size()*(iblk_trg+1)) / nblk_trg;
+        for (int k=0; k<npos; k++) {
+          for (size_t i=blk_start; i<blk_end; i++) {
+            NodePtrs<T>& M2L_list = trg_nodes[i]->M2L_list;
+            if (M2L_list[k] && (is_source.empty() || is_source[M2L_list[k]->idx])) {
+              size_t isrc = std::lower_bound(src_nodes.begin(), src_nodes.end(), M2L_list[k]) - src_nodes.begin();
+              data.interaction_offset_f.push_back(isrc * fft_size);   // src_node's displacement in fft_in
+              data.interaction_offset_f.push_back(  i  * fft_size);   // trg_node's displacement in fft_out
+              interaction_count_offset_++;
+            }
+          }
+          data.interaction_count_offset.push_back(interaction_count_offset_);
+        }
       }
-#pragma omp taskwait
+      return data;
     }
 
-    void M2L_setup(NodePtrs<T>& nonleafs) {
-      int& nsurf_ = this->nsurf;
+    /**
+     * @brief Setup the M2L interactions of target nodes at each level.
+     *
+     * @param nonleafs Vector of pointers to target (non-leaf) nodes.
+     * @param is_source Whether a node (by index) is included as a source, all nodes are included if it is empty.
+     */
+    void M2L_setup(NodePtrs<T>& nonleafs, const std::vector<bool>& is_source=std::vector<bool>()) {
       int& depth_ = this->depth;
-      int npos = REL_COORD[M2L_Type].size();  // number of M2L relative positions
       m2ldata.resize(depth_);                  // initialize m2ldata
 
       // construct lists of target nodes for M2L operator at each level
@@ -273,67 +333,15 @@ namespace exafmm_t {
       for (size_t i=0; i<nonleafs.size(); i++) {
         trg_nodes[nonleafs[i]->level].push_back(nonleafs[i]);
       }
-
       // prepare for m2ldata for each level
       for (int l=0; l<depth_; l++) {
-        // construct M2L source nodes for current level
-        std::set<Node<T>*> src_nodes_;
-        for (size_t i=0; i<trg_nodes[l].size(); i++) {
-          NodePtrs<T>& M2L_list = trg_nodes[l][i]->M2L_list;
-          for (int k=0; k<npos; k++) {
-            if (M2L_list[k])
-              src_nodes_.insert(M2L_list[k]);
-          }
-        }
-        NodePtrs<T> src_nodes;
-        auto it = src_nodes_.begin();
-        for (; it!=src_nodes_.end(); it++) {
-          src_nodes.push_back(*it);
-        }
-        // prepare the indices of src_nodes & trg_nodes in all_up_equiv & all_dn_equiv
-        std::vector<size_t> fft_offset(src_nodes.size());       // displacement in all_up_equiv
-        std::vector<size_t> ifft_offset(trg_nodes[l].size());  // displacement in all_dn_equiv
-        for (size_t i=0; i<src_nodes.size(); i++) {
-          fft_offset[i] = src_nodes[i]->children[0]->idx * nsurf_;
-        }
-        for (size_t i=0; i<trg_nodes[l].size(); i++) {
-          ifft_offset[i] = trg_nodes[l][i]->children[0]->idx * nsurf_;
-        }
-
-        // calculate interaction_offset_f & interaction_count_offset
-        std::vector<size_t> interaction_offset_f;
-        std::vector<size_t> interaction_count_offset;
-        for (size_t i=0; i<src_nodes.size(); i++) {
-          src_nodes[i]->idx_M2L = i;  // node_id: node's index in src_nodes list
-        }
-        size_t nblk_trg = trg_nodes[l].size() * sizeof(real_t) / CACHE_SIZE;
-        if (nblk_trg==0) nblk_trg = 1;
-        size_t interaction_count_offset_ = 0;
-        size_t fft_size = 2 * NCHILD * this->nfreq;
-        for (size_t iblk_trg=0; iblk_trg<nblk_trg; iblk_trg++) {
-          size_t blk_start = (trg_nodes[l].size()* iblk_trg   ) / nblk_trg;
-          size_t blk_end   = (trg_nodes[l].size()*(iblk_trg+1)) / nblk_trg;
-          for (int k=0; k<npos; k++) {
-            for (size_t i=blk_start; i<blk_end; i++) {
-              NodePtrs<T>& M2L_list = trg_nodes[l][i]->M2L_list;
-              if (M2L_list[k]) {
-                interaction_offset_f.push_back(M2L_list[k]->idx_M2L * fft_size);   // src_node's displacement in fft_in
-                interaction_offset_f.push_back(        i           * fft_size);   // trg_node's displacement in fft_out
-                interaction_count_offset_++;
-              }
-            }
-            interaction_count_offset.push_back(interaction_count_offset_);
-          }
-        }
-        m2ldata[l].fft_offset = fft_offset;
-        m2ldata[l].ifft_offset = ifft_offset;
-        m2ldata[l].interaction_offset_f = interaction_offset_f;
-        m2ldata[l].interaction_count_offset = interaction_count_offset;
+        m2ldata[l] = M2L_data(trg_nodes[l], is_source);
       }
     }
 
   void hadamard_product(std::vector<size_t>& interaction_count_offset, std::vector<size_t>& interaction_offset_f,
-                        AlignedVec& fft_in, AlignedVec& fft_out, std::vector<AlignedVec>& matrix_M2L) {
+                        AlignedVec& fft_in, AlignedVec& fft_out, size_t nchunks_out, std::vector<AlignedVec>& matrix_M2L) {
+      OpScope scope(M2L_Hadamard_Op, this->counters);
       size_t fft_size = 2 * NCHILD * this->nfreq;
       AlignedVec zero_vec0(fft_size, 0.);
       AlignedVec zero_vec1(fft_size, 0.);
@@ -341,37 +349,38 @@ namespace exafmm_t {
       size_t npos = matrix_M2L.size();
       size_t nblk_inter = interaction_count_offset.size();   // num of blocks of interactions
       size_t nblk_trg = nblk_inter / npos;                   // num of blocks based on trg_nodes
-      int BLOCK_SIZE = CACHE_SIZE * 2 / sizeof(real_t);
+      int nrhs_ = this->nrhs;
+      int BLOCK_SIZE = CACHE_SIZE * 2 / sizeof(real_t) * nrhs_;
       std::vector<real_t*> IN_(BLOCK_SIZE*nblk_inter);
       std::vector<real_t*> OUT_(BLOCK_SIZE*nblk_inter);
 
       // initialize fft_out with zero
-#pragma omp parallel for
-      for (size_t i=0; i<fft_out.capacity()/fft_size; ++i) {
+      this->parallel_for(nchunks_out, [&](size_t i) {
         std::memset(fft_out.data()+i*fft_size, 0, fft_size*sizeof(real_t));
-      }
+      });
       
-#pragma omp parallel for
-      for (size_t iblk_inter=0; iblk_inter<nblk_inter; iblk_inter++) {
+      this->parallel_for(nblk_inter, [&](size_t iblk_inter) {
         size_t interaction_count_offset0 = (iblk_inter==0 ? 0 : interaction_count_offset[iblk_inter-1]);
         size_t interaction_count_offset1 = interaction_count_offset[iblk_inter];
         size_t interaction_count = interaction_count_offset1 - interaction_count_offset0;
+        // each interaction is applied to the fft chunks of all right-hand sides, which are adjacent in fft_in & fft_out
         for (size_t j=0; j<interaction_count; j++) {
-          IN_ [BLOCK_SIZE*iblk_inter+j] = &fft_in[interaction_offset_f[(interaction_count_offset0+j)*2+0]];
-          OUT_[BLOCK_SIZE*iblk_inter+j] = &fft_out[interaction_offset_f[(interaction_count_offset0+j)*2+1]];
+          for (int r=0; r<nrhs_; r++) {
+            IN_ [BLOCK_SIZE*iblk_inter+j*nrhs_+r] = &fft_in[interaction_offset_f[(interaction_count_offset0+j)*2+0] + r*fft_size];
+            OUT_[BLOCK_SIZE*iblk_inter+j*nrhs_+r] = &fft_out[interaction_offset_f[(interaction_count_offset0+j)*2+1] + r*fft_size];
+          }
         }
-        IN_ [BLOCK_SIZE*iblk_inter+interaction_count] = &zero_vec0[0];
-        OUT_[BLOCK_SIZE*iblk_inter+interaction_count] = &zero_vec1[0];
-      }
+        IN_ [BLOCK_SIZE*iblk_inter+interaction_count*nrhs_] = &zero_vec0[0];
+        OUT_[BLOCK_SIZE*iblk_inter+interaction_count*nrhs_] = &zero_vec1[0];
+      });
 
       for (size_t iblk_trg=0; iblk_trg<nblk_trg; iblk_trg++) {
-#pragma omp parallel for
-        for (int k=0; k<this->nfreq; k++) {
+        this->parallel_for(this->nfreq, [&](size_t k) {
           for (size_t ipos=0; ipos<npos; ipos++) {
             size_t iblk_inter = iblk_trg*npos + ipos;
             size_t interaction_count_offset0 = (iblk_inter==0 ? 0 : interaction_count_offset[iblk_inter-1]);
             size_t interaction_count_offset1 = interaction_count_offset[iblk_inter];
-            size_t interaction_count = interaction_count_offset1 - interaction_count_offset0;
+            size_t interaction_count = (interaction_count_offset1 - interaction_count_offset0) * nrhs_;
             real_t** IN = &IN_[BLOCK_SIZE*iblk_inter];
             real_t** OUT= &OUT_[BLOCK_SIZE*iblk_inter];
             real_t* M = &matrix_M2L[ipos][k*2*NCHILD*NCHILD]; // k-th freq's (row) offset in matrix_M2L
@@ -384,25 +393,64 @@ namespace exafmm_t {
               matmult_8x8x2(M_, IN0, IN1, OUT0, OUT1);
             }
           }
-        }
+        });
       }
+      // add flop, each interaction reads half of an 8x8 complex matrix shared by a pair, its input and updates its output
+      size_t ninteractions = (interaction_offset_f.size()/2) * this->nfreq * nrhs_;
+      add_flop((long long)(8*8*8)*ninteractions);
+      add_bytes((long long)sizeof(real_t)*(NCHILD*NCHILD+6*NCHILD)*ninteractions);
     }
 
     void fft_up_equiv(std::vector<size_t>& fft_offset, std::vector<T>& all_up_equiv, AlignedVec& fft_in) {}
 
     void ifft_dn_check(std::vector<size_t>& ifft_offset, AlignedVec& fft_out, std::vector<T>& all_dn_equiv) {}
 
+    /**
+     * @brief FFT, Hadamard product and IFFT of the M2L setup data of a level on gathered equivalent charges,
+     * which are added to the gathered check potentials.
+     *
+     * @param data M2L setup data.
+     * @param matrix_M2L M2L matrices of the level.
+     * @param all_up_equiv Gathered upward equivalent charges.
+     * @param all_dn_equiv Gathered downward check potentials.
+     * @param fft_in Buffer of the transformed charges.
+     * @param fft_out Buffer of the transformed check potentials.
+     * @param is_phase Whether the Hadamard product is recorded as a phase, which only one thread may do at a time.
+     */
+    void M2L_convolve(M2LData& data, std::vector<AlignedVec>& matrix_M2L,
+                      std::vector<T>& all_up_equiv, std::vector<T>& all_dn_equiv,
+                      AlignedVec& fft_in, AlignedVec& fft_out, bool is_phase=true) {
+      int fft_size = 2 * NCHILD * this->nfreq;
+      fft_in.reserve(data.fft_offset.size()*fft_size*this->nrhs);
+      fft_out.reserve(data.ifft_offset.size()*fft_size*this->nrhs);
+      {
+        ProfileScope scope("fft_up_equiv");
+        fft_up_equiv(data.fft_offset, all_up_equiv, fft_in);
+      }
+      if (is_phase) this->start_phase("hadamard_product");   // a phase of its own, summed over the levels
+      hadamard_product(data.interaction_count_offset,
+                       data.interaction_offset_f,
+                       fft_in, fft_out, data.ifft_offset.size()*this->nrhs, matrix_M2L);
+      if (is_phase) this->stop_phase("hadamard_product", false);
+      {
+        ProfileScope scope("ifft_dn_check");
+        ifft_dn_check(data.ifft_offset, fft_out, all_dn_equiv);
+      }
+    }
+
     void M2L(Nodes<T>& nodes) {
-      int& nsurf_ = this->nsurf;
       int& nfreq_ = this->nfreq;
+      int nequiv = this->nsurf * this->nrhs;   // equivalent charges of all right-hand sides per node
       int fft_size = 2 * NCHILD * nfreq_;
       int nnodes = nodes.size();
-      int npos = REL_COORD[M2L_Type].size();   // number of relative positions
+      int npos = rel_coord(M2L_Type).size();   // number of relative positions
 
       // allocate memory
-      std::vector<T> all_up_equiv, all_dn_equiv;
-      all_up_equiv.reserve(nnodes*nsurf_);
-      all_dn_equiv.reserve(nnodes*nsurf_);
+      std::vector<T> up_equiv, dn_equiv;
+      std::vector<T>& all_up_equiv = this->m2l_buffer(this->m2l_up_equiv, up_equiv);
+      std::vector<T>& all_dn_equiv = this->m2l_buffer(this->m2l_dn_equiv, dn_equiv);
+      all_up_equiv.reserve(nnodes*nequiv);
+      all_dn_equiv.reserve(nnodes*nequiv);
       std::vector<AlignedVec> matrix_M2L(npos, AlignedVec(fft_size*NCHILD, 0));
 
       // setup ifstream of M2L precomputation matrix
@@ -413,43 +461,97 @@ namespace exafmm_t {
       ifile.seekg(fsize - this->depth*npos*msize, ifile.beg);   // go to the start of M2L section
       
       // collect all upward equivalent charges
-#pragma omp parallel for collapse(2)
-      for (int i=0; i<nnodes; ++i) {
-        for (int j=0; j<nsurf_; ++j) {
-          all_up_equiv[i*nsurf_+j] = nodes[i].up_equiv[j];
-          all_dn_equiv[i*nsurf_+j] = nodes[i].dn_equiv[j];
+      this->parallel_for(nnodes, [&](size_t i) {
+        for (int j=0; j<nequiv; ++j) {
+          all_up_equiv[i*nequiv+j] = nodes[i].up_equiv[j];
+          all_dn_equiv[i*nequiv+j] = nodes[i].dn_equiv[j];
         }
-      }
+      });
       // FFT-accelerate M2L
       for (int l=0; l<this->depth; ++l) {
         // load M2L matrix for current level
         for (int i=0; i<npos; ++i) {
           ifile.read(reinterpret_cast<char*>(matrix_M2L[i].data()), msize);
         }
+        ProfileScope level_scope("level " + std::to_string(l));
         AlignedVec fft_in, fft_out;
-        fft_in.reserve(m2ldata[l].fft_offset.size()*fft_size);
-        fft_out.reserve(m2ldata[l].ifft_offset.size()*fft_size);
-        fft_up_equiv(m2ldata[l].fft_offset, all_up_equiv, fft_in);
-        hadamard_product(m2ldata[l].interaction_count_offset, 
-                         m2ldata[l].interaction_offset_f, 
-                         fft_in, fft_out, matrix_M2L);
-        ifft_dn_check(m2ldata[l].ifft_offset, fft_out, all_dn_equiv);
+        M2L_convolve(m2ldata[l], matrix_M2L, all_up_equiv, all_dn_equiv,
+                     this->m2l_buffer(this->m2l_fft_in, fft_in), this->m2l_buffer(this->m2l_fft_out, fft_out));
       }
       // update all downward check potentials
-#pragma omp parallel for collapse(2)
-      for (int i=0; i<nnodes; ++i) {
-        for (int j=0; j<nsurf_; ++j) {
-          nodes[i].dn_equiv[j] = all_dn_equiv[i*nsurf_+j];
+      this->parallel_for(nnodes, [&](size_t i) {
+        for (int j=0; j<nequiv; ++j) {
+          nodes[i].dn_equiv[j] = all_dn_equiv[i*nequiv+j];
         }
-      }
+      });
       ifile.close();   // close ifstream
     }
+
+    /**
+     * @brief M2L matrices of a level, read from the precomputation file on the first call and kept in
+     * matrix_M2L_levels for later calls. M2L() streams the matrices instead, to keep only one level in memory.
+     * Concurrent calls are serialized.
+     *
+     * @param level Level of the target nodes.
+     * @return M2L matrices of each relative position.
+     */
+    std::vector<AlignedVec>& load_M2L_matrix(int level) {
+      int npos = rel_coord(M2L_Type).size();
+      size_t msize = NCHILD * NCHILD * this->nfreq * 2 * sizeof(real_t);   // size in bytes for each M2L matrix
+      static std::mutex mutex;
+      std::lock_guard<std::mutex> lock(mutex);
+      matrix_M2L_levels.resize(this->depth);
+      std::vector<AlignedVec>& matrix_M2L = matrix_M2L_levels[level];
+      if (matrix_M2L.empty()) {
+        matrix_M2L.resize(npos, AlignedVec(msize/sizeof(real_t)));
+        std::ifstream ifile(this->filename, std::ifstream::binary);
+        ifile.seekg(0, ifile.end);
+        size_t fsize = ifile.tellg();
+        ifile.seekg(fsize - (this->depth-level)*npos*msize, ifile.beg);   // go to the matrices of the level
+        for (int i=0; i<npos; ++i) {
+          ifile.read(reinterpret_cast<char*>(matrix_M2L[i].data()), msize);
+        }
+      }
+      return matrix_M2L;
+    }
+
+    /**
+     * @brief M2L operator restricted to the given target nodes and the marked source nodes, the M2L setup of the
+     * whole tree is kept. Only the children of the sources and of the targets are gathered and scattered, and the
+     * M2L matrices of the levels involved are read from the precomputation file once, see load_M2L_matrix().
+     */
+    void M2L_subset(Nodes<T>& nodes, NodePtrs<T>& targets, const std::vector<bool>& is_source) {
+      std::vector<NodePtrs<T>> trg_nodes(this->depth);
+      for (size_t i=0; i<targets.size(); i++) {
+        trg_nodes[targets[i]->level].push_back(targets[i]);
+      }
+      for (int l=0; l<this->depth; ++l) {
+        M2LData data = M2L_data(trg_nodes[l], is_source);
+        if (data.interaction_offset_f.empty()) continue;
+        std::vector<T> up_equiv, dn_equiv;
+        AlignedVec fft_in, fft_out;
+        std::vector<size_t> trg_children = this->M2L_gather(nodes, data, up_equiv, dn_equiv);
+        M2L_convolve(data, load_M2L_matrix(l), up_equiv, dn_equiv, fft_in, fft_out);
+        this->M2L_scatter(nodes, trg_children, dn_equiv);
+      }
+    }
+
+    //! The M2L matrices of the level are kept in memory by load_M2L_matrix().
+    void M2L_group(Nodes<T>& nodes, NodePtrs<T>& targets) {
+      M2LData data = M2L_data(targets);
+      if (data.interaction_offset_f.empty()) return;
+      std::vector<T> up_equiv, dn_equiv;
+      AlignedVec fft_in, fft_out;
+      std::vector<size_t> trg_children = this->M2L_gather(nodes, data, up_equiv, dn_equiv);
+      M2L_convolve(data, load_M2L_matrix(targets[0]->level), up_equiv, dn_equiv, fft_in, fft_out, false);
+      this->M2L_scatter(nodes, trg_children, dn_equiv);
+    }
   };
   
   /** Below are member function specializations
    */
   template <>
-  void Fmm<real_t>::precompute_check2equiv() {
+  inline void Fmm<real_t>::precompute_check2equiv() {
     real_t c[3] = {0, 0, 0};
     int& nsurf_ = this->nsurf;
 #pragma omp parallel for
@@ -482,7 +584,7 @@ namespace exafmm_t {
   }
 
   template <>
-  void Fmm<complex_t>::precompute_check2equiv() {
+  inline void Fmm<complex_t>::precompute_check2equiv() {
     real_t c[3] = {0, 0, 0};
     int& nsurf_ = this->nsurf;
 #pragma omp parallel for
@@ -522,27 +624,29 @@ namespace exafmm_t {
 
   //! member function specialization for real type
   template <>
-  void Fmm<real_t>::precompute_M2L(std::ofstream& file) {
+  inline void Fmm<real_t>::precompute_M2L(std::ofstream& file) {
     int n1 = this->p * 2;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
     int fft_size = 2 * nfreq_ * NCHILD * NCHILD;
-    std::vector<RealVec> matrix_M2L_Helper(REL_COORD[M2L_Helper_Type].size(),
+    std::vector<RealVec> matrix_M2L_Helper(rel_coord(M2L_Helper_Type).size(),
                                            RealVec(2*nfreq_));
-    std::vector<AlignedVec> matrix_M2L(REL_COORD[M2L_Type].size(), AlignedVec(fft_size));
+    std::vector<AlignedVec> matrix_M2L(rel_coord(M2L_Type).size(), AlignedVec(fft_size));
     // create fft plan
     RealVec fftw_in(nconv_);
     RealVec fftw_out(2*nfreq_);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_dft_r2c(3, dim, fftw_in.data(), reinterpret_cast<fft_complex*>(fftw_out.data()), FFTW_ESTIMATE);
+    lock.unlock();
     RealVec trg_coord(3,0);
     for (int l=1; l<this->depth+1; ++l) {
       // compute M2L kernel matrix, perform DFT
 #pragma omp parallel for
-      for (size_t i=0; i<REL_COORD[M2L_Helper_Type].size(); ++i) {
+      for (size_t i=0; i<rel_coord(M2L_Helper_Type).size(); ++i) {
         real_t coord[3];
         for (int d=0; d<3; d++) {
-          coord[d] = REL_COORD[M2L_Helper_Type][i][d] * this->r0 * powf(0.5, l-1);  // relative coords
+          coord[d] = rel_coord(M2L_Helper_Type)[i][d] * this->r0 * powf(0.5, l-1);  // relative coords
         }
         RealVec conv_coord = convolution_grid(this->p, this->r0, l, coord);   // convolution grid
         RealVec conv_value(nconv_);   // potentials on convolution grid
@@ -551,9 +655,9 @@ namespace exafmm_t {
       }
       // convert M2L_Helper to M2L and reorder data layout to improve locality
 #pragma omp parallel for
-      for (size_t i=0; i<REL_COORD[M2L_Type].size(); ++i) {
+      for (size_t i=0; i<rel_coord(M2L_Type).size(); ++i) {
         for (int j=0; j<NCHILD*NCHILD; j++) {   // loop over child's relative positions
-          int child_rel_idx = M2L_INDEX_MAP[i][j];
+          int child_rel_idx = m2l_index_map()[i][j];
           if (child_rel_idx != -1) {
             for (int k=0; k<nfreq_; k++) {   // loop over frequencies
               int new_idx = k*(2*NCHILD*NCHILD) + 2*j;
@@ -569,35 +673,38 @@ namespace exafmm_t {
       }
     }
     // destroy fftw plan
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   //! member function specialization for complex type
   template <>
-  void Fmm<complex_t>::precompute_M2L(std::ofstream& file) {
+  inline void Fmm<complex_t>::precompute_M2L(std::ofstream& file) {
     int n1 = this->p * 2;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
     int fft_size = 2 * nfreq_ * NCHILD * NCHILD;
-    std::vector<RealVec> matrix_M2L_Helper(REL_COORD[M2L_Helper_Type].size(),
+    std::vector<RealVec> matrix_M2L_Helper(rel_coord(M2L_Helper_Type).size(),
                                            RealVec(2*nfreq_));
-    std::vector<AlignedVec> matrix_M2L(REL_COORD[M2L_Type].size(), AlignedVec(fft_size));
+    std::vector<AlignedVec> matrix_M2L(rel_coord(M2L_Type).size(), AlignedVec(fft_size));
     // create fft plan
     RealVec fftw_in(nconv_);
     RealVec fftw_out(2*nfreq_);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_dft(3, dim,
                                  reinterpret_cast<fft_complex*>(fftw_in.data()),
                                  reinterpret_cast<fft_complex*>(fftw_out.data()),
                                  FFTW_FORWARD, FFTW_ESTIMATE);
+    lock.unlock();
     RealVec trg_coord(3,0);
     for (int l=1; l<this->depth+1; ++l) {
       // compute M2L kernel matrix, perform DFT
 #pragma omp parallel for
-      for (size_t i=0; i<REL_COORD[M2L_Helper_Type].size(); ++i) {
+      for (size_t i=0; i<rel_coord(M2L_Helper_Type).size(); ++i) {
         real_t coord[3];
         for (int d=0; d<3; d++) {
-          coord[d] = REL_COORD[M2L_Helper_Type][i][d] * this->r0 * powf(0.5, l-1);  // relative coords
+          coord[d] = rel_coord(M2L_Helper_Type)[i][d] * this->r0 * powf(0.5, l-1);  // relative coords
         }
         RealVec conv_coord = convolution_grid(this->p, this->r0, l, coord);   // convolution grid
         ComplexVec conv_value(nconv_);   // potentials on convolution grid
@@ -607,9 +714,9 @@ namespace exafmm_t {
       }
       // convert M2L_Helper to M2L and reorder data layout to improve locality
 #pragma omp parallel for
-      for (size_t i=0; i<REL_COORD[M2L_Type].size(); ++i) {
+      for (size_t i=0; i<rel_coord(M2L_Type).size(); ++i) {
         for (int j=0; j<NCHILD*NCHILD; j++) {   // loop over child's relative positions
-          int child_rel_idx = M2L_INDEX_MAP[i][j];
+          int child_rel_idx = m2l_index_map()[i][j];
           if (child_rel_idx != -1) {
             for (int k=0; k<nfreq_; k++) {   // loop over frequencies
               int new_idx = k*(2*NCHILD*NCHILD) + 2*j;
@@ -625,11 +732,13 @@ namespace exafmm_t {
       }
     }
     // destroy fftw plan
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   template <>
-  void Fmm<real_t>::fft_up_equiv(std::vector<size_t>& fft_offset, RealVec& all_up_equiv, AlignedVec& fft_in) {
+  inline void Fmm<real_t>::fft_up_equiv(std::vector<size_t>& fft_offset, RealVec& all_up_equiv, AlignedVec& fft_in) {
+    OpScope scope(M2L_FFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -640,37 +749,47 @@ namespace exafmm_t {
     AlignedVec fftw_in(nconv_ * NCHILD);
     AlignedVec fftw_out(fft_size);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft_r2c(3, dim, NCHILD,
                                           (real_t*)&fftw_in[0], nullptr, 1, nconv_,
                                           (fft_complex*)(&fftw_out[0]), nullptr, 1, nfreq_, 
                                           FFTW_ESTIMATE);
-
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<fft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, false);   // flops of an execution of the plan
+    long long nbytes = sizeof(real_t)*NCHILD*nsurf_ + sizeof(real_t)*fft_size;   // read up_equiv, write fft_in
+
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(fft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer(fft_size, 0);
       RealVec equiv_t(NCHILD*nconv_, 0.);
 
-      real_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's up_equiv in all_up_equiv, size=8*nsurf_
-      real_t* up_equiv_f = &fft_in[fft_size*node_idx];   // offset ptr of node_idx in fft_in vector, size=fftsize
+      real_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's up_equiv in all_up_equiv, size=8*nsurf_*nrhs_
+      real_t* up_equiv_f = &fft_in[fft_size*idx_rhs];   // offset ptr of node_idx's r-th rhs in fft_in vector, size=fftsize
 
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          equiv_t[idx+j*nconv_] = up_equiv[j*nsurf_+k];
+          equiv_t[idx+j*nconv_] = up_equiv[(j*nsurf_+k)*nrhs_+r];
       }
       fft_execute_dft_r2c(plan, &equiv_t[0], (fft_complex*)&buffer[0]);
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nfreq_; k++) {
         for (int j=0; j<NCHILD; j++) {
           up_equiv_f[2*(NCHILD*k+j)+0] = buffer[2*(nfreq_*j+k)+0];
           up_equiv_f[2*(NCHILD*k+j)+1] = buffer[2*(nfreq_*j+k)+1];
         }
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   template <>
-  void Fmm<complex_t>::fft_up_equiv(std::vector<size_t>& fft_offset, ComplexVec& all_up_equiv, AlignedVec& fft_in) {
+  inline void Fmm<complex_t>::fft_up_equiv(std::vector<size_t>& fft_offset, ComplexVec& all_up_equiv, AlignedVec& fft_in) {
+    OpScope scope(M2L_FFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -682,36 +801,46 @@ namespace exafmm_t {
     AlignedVec fftw_out(fft_size);
     int dim[3] = {n1, n1, n1};
 
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft(3, dim, NCHILD, reinterpret_cast<fft_complex*>(&fftw_in[0]),
                                       nullptr, 1, nconv_, (fft_complex*)(&fftw_out[0]), nullptr, 1, nfreq_, 
                                       FFTW_FORWARD, FFTW_ESTIMATE);
-
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<fft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, true);   // flops of an execution of the plan
+    long long nbytes = sizeof(complex_t)*NCHILD*nsurf_ + sizeof(real_t)*fft_size;   // read up_equiv, write fft_in
+
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(fft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer(fft_size, 0);
       ComplexVec equiv_t(NCHILD*nconv_, complex_t(0.,0.));
 
-      complex_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's up_equiv in all_up_equiv, size=8*nsurf_
-      real_t* up_equiv_f = &fft_in[fft_size*node_idx];   // offset ptr of node_idx in fft_in vector, size=fftsize
+      complex_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's up_equiv in all_up_equiv, size=8*nsurf_*nrhs_
+      real_t* up_equiv_f = &fft_in[fft_size*idx_rhs];   // offset ptr of node_idx's r-th rhs in fft_in vector, size=fftsize
 
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          equiv_t[idx+j*nconv_] = up_equiv[j*nsurf_+k];
+          equiv_t[idx+j*nconv_] = up_equiv[(j*nsurf_+k)*nrhs_+r];
       }
       fft_execute_dft(plan, reinterpret_cast<fft_complex*>(&equiv_t[0]), (fft_complex*)&buffer[0]);
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nfreq_; k++) {
         for (int j=0; j<NCHILD; j++) {
           up_equiv_f[2*(NCHILD*k+j)+0] = buffer[2*(nfreq_*j+k)+0];
           up_equiv_f[2*(NCHILD*k+j)+1] = buffer[2*(nfreq_*j+k)+1];
         }
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   template <>
-  void Fmm<real_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, AlignedVec& fft_out, RealVec& all_dn_equiv) {
+  inline void Fmm<real_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, AlignedVec& fft_out, RealVec& all_dn_equiv) {
+    OpScope scope(M2L_IFFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -723,34 +852,44 @@ namespace exafmm_t {
     AlignedVec fftw_out(nconv_ * NCHILD);
     int dim[3] = {n1, n1, n1};
 
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft_c2r(3, dim, NCHILD,
                     (fft_complex*)(&fftw_in[0]), nullptr, 1, nfreq_, 
                     (real_t*)(&fftw_out[0]), nullptr, 1, nconv_, 
                     FFTW_ESTIMATE);
-
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<ifft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, false);   // flops of an execution of the plan
+    long long nbytes = sizeof(real_t)*fft_size + 2*sizeof(real_t)*NCHILD*nsurf_;   // read fft_out, update dn_equiv
+
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(ifft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer0(fft_size, 0);
       RealVec buffer1(fft_size, 0);
-      real_t* dn_check_f = &fft_out[fft_size*node_idx];  // offset ptr for node_idx in fft_out vector, size=fftsize
-      real_t* dn_equiv = &all_dn_equiv[ifft_offset[node_idx]];  // offset ptr for node_idx's child's dn_equiv in all_dn_equiv, size=numChilds * nsurf_
+      real_t* dn_check_f = &fft_out[fft_size*idx_rhs];  // offset ptr for node_idx's r-th rhs in fft_out vector, size=fftsize
+      real_t* dn_equiv = &all_dn_equiv[ifft_offset[node_idx]];  // offset ptr for node_idx's child's dn_equiv in all_dn_equiv, size=numChilds * nsurf_ * nrhs_
       for (int k=0; k<nfreq_; k++)
         for (int j=0; j<NCHILD; j++) {
           buffer0[2*(nfreq_*j+k)+0] = dn_check_f[2*(NCHILD*k+j)+0];
           buffer0[2*(nfreq_*j+k)+1] = dn_check_f[2*(NCHILD*k+j)+1];
         }
       fft_execute_dft_c2r(plan, (fft_complex*)&buffer0[0], (real_t*)(&buffer1[0]));
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          dn_equiv[nsurf_*j+k] += buffer1[idx+j*nconv_];
+          dn_equiv[(nsurf_*j+k)*nrhs_+r] += buffer1[idx+j*nconv_];
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
   
   template <>
-  void Fmm<complex_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, AlignedVec& fft_out, ComplexVec& all_dn_equiv) {
+  inline void Fmm<complex_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, AlignedVec& fft_out, ComplexVec& all_dn_equiv) {
+    OpScope scope(M2L_IFFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -762,15 +901,21 @@ namespace exafmm_t {
     ComplexVec fftw_out(nconv_*NCHILD);
     int dim[3] = {n1, n1, n1};
 
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft(3, dim, NCHILD, (fft_complex*)(&fftw_in[0]), nullptr, 1, nfreq_, 
                                       reinterpret_cast<fft_complex*>(&fftw_out[0]), nullptr, 1, nconv_, 
                                       FFTW_BACKWARD, FFTW_ESTIMATE);
-
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<ifft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, true);   // flops of an execution of the plan
+    long long nbytes = sizeof(real_t)*fft_size + 2*sizeof(complex_t)*NCHILD*nsurf_;   // read fft_out, update dn_equiv
+
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(ifft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer0(fft_size, 0);
       ComplexVec buffer1(NCHILD*nconv_, 0);
-      real_t* dn_check_f = &fft_out[fft_size*node_idx];
+      real_t* dn_check_f = &fft_out[fft_size*idx_rhs];
       complex_t* dn_equiv = &all_dn_equiv[ifft_offset[node_idx]];
       for (int k=0; k<nfreq_; k++)
         for (int j=0; j<NCHILD; j++) {
@@ -778,12 +923,15 @@ namespace exafmm_t {
           buffer0[2*(nfreq_*j+k)+1] = dn_check_f[2*(NCHILD*k+j)+1];
         }
       fft_execute_dft(plan, (fft_complex*)&buffer0[0], reinterpret_cast<fft_complex*>(&buffer1[0]));
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          dn_equiv[nsurf_*j+k]+=buffer1[idx+j*nconv_];
+          dn_equiv[(nsurf_*j+k)*nrhs_+r]+=buffer1[idx+j*nconv_];
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
 }  // end namespace
@@ -1,8 +1,17 @@
 #ifndef fmm_base_h
 #define fmm_base_h
-#include <algorithm>    // std::fill
+#include <algorithm>    // std::copy, std::fill
+#include <map>          // std::map
+#include <memory>       // std::shared_ptr
+#include <set>          // std::set
+#include <type_traits>  // std::conditional
+#include <unordered_map>  // std::unordered_map
 #include "exafmm_t.h"
+#include "executor.h"
 #include "geometry.h"
+#include "hilbert.h"
+#include "numa_placement.h"
+#include "task_graph.h"
 #include "timer.h"
 
 namespace exafmm_t {
@@ -10,6 +19,9 @@ namespace exafmm_t {
   template <typename T>
   class FmmBase {
   public:
+    //! Single precision counterpart of T, used to store cached P2P matrices
+    typedef typename std::conditional<std::is_same<T, real_t>::value, float, std::complex<float>>::type single_t;
+
     int p;                 //!< Order of expansion
     int nsurf;             //!< Number of points on equivalent / check surface
     int nconv;             //!< Number of points on convolution grid
@@ -20,9 +32,34 @@ namespace exafmm_t {
     vec3 x0;               //!< Coordinates of the center of root box
     bool is_precomputed;   //!< Whether the matrix file is found
     bool is_real;          //!< Whether template parameter T is real_t
+    bool is_symmetric;     //!< Whether P2P evaluates each pair of leaves once (sources coincide with targets)
+    bool is_potential_only;  //!< Whether only potentials are evaluated at targets, set before building the tree
+    int nrhs;              //!< Number of right-hand sides (charge vectors) evaluated in one pass, set before building the tree
+    double near_thread_fraction;  //!< Share of threads running P2P in evaluate_concurrent(), tuned by each call
     std::string filename;  //!< File name of the precomputation matrices
+    std::shared_ptr<Executor> executor;  //!< Parallel backend of the evaluation loops, may be shared by several FMM instances
+    P2PData p2pdata;       //!< Leaf pairs and coloring used by symmetric P2P
+    std::vector<std::pair<Node<T>*, int>> src_location;  //!< Leaf and position in the leaf of each source (initial numbering), used by evaluate_delta()
+    std::unordered_map<uint64_t, Node<T>*> leaf_map;     //!< Leaves indexed by key, used by query()
+    std::vector<NodePtrs<T>> nonleaf_levels;              //!< Non-leaf nodes grouped by level, cached by nonleafs_setup()
+    const Node<T>* nonleaf_tree;                          //!< First node of the tree grouped in nonleaf_levels
+    size_t nonleaf_tree_size;                             //!< Number of nodes of the tree grouped in nonleaf_levels
+    bool keeps_m2l_buffers;                               //!< Whether M2L() keeps its buffers across passes, set by numa_setup()
+    std::vector<T> m2l_up_equiv;                          //!< Gathered upward equivalent charges of M2L(), if kept
+    std::vector<T> m2l_dn_equiv;                          //!< Gathered downward check potentials of M2L(), if kept
+    AlignedVec m2l_fft_in;                                //!< Transformed upward equivalent charges of M2L(), if kept
+    AlignedVec m2l_fft_out;                               //!< Transformed downward check potentials of M2L(), if kept
+    std::vector<std::vector<T>> p2p_matrix;               //!< [leaf] cached column-major P2P matrix of the leaf's P2P_list, empty if not cached
+    std::vector<std::vector<single_t>> p2p_matrix_single; //!< [leaf] same as p2p_matrix, stored in single precision
+    std::vector<std::vector<T>> p2m_matrix;               //!< [leaf] cached column-major operator from sources to upward equivalent charges, empty if not cached
+    std::vector<std::vector<T>> l2p_matrix;               //!< [leaf] cached column-major operator from downward check potentials to targets, empty if not cached
+    CounterRegistry counters;                             //!< Flop and byte counters of the operators of this instance
+    std::map<std::string, PhaseCounters> phase_counters;  //!< Time and counts of each phase, summed since the start of the last upward_pass()
+    std::map<std::string, PhaseCounters> phase_begin;     //!< Counters at the start of the open phases
 
-    FmmBase() {}
+    FmmBase() : is_symmetric(false), is_potential_only(false), nrhs(1), near_thread_fraction(0.5),
+                executor(std::make_shared<OpenMPExecutor>()), nonleaf_tree(nullptr), nonleaf_tree_size(0),
+                keeps_m2l_buffers(false) {}
 
     FmmBase(int p_, int ncrit_, std::string filename_=std::string()) :
       p(p_), ncrit(ncrit_), filename(filename_)
@@ -33,6 +70,56 @@ namespace exafmm_t {
       is_real = std::is_same<T, real_t>::value;
       nfreq = is_real ? n1*n1*(n1/2+1) : nconv;
       is_precomputed = false;
+      is_symmetric = false;
+      is_potential_only = false;
+      nrhs = 1;
+      near_thread_fraction = 0.5;
+      executor = std::make_shared<OpenMPExecutor>();
+      nonleaf_tree = nullptr;
+      nonleaf_tree_size = 0;
+      keeps_m2l_buffers = false;
+    }
+
+    /**
+     * @brief Run the evaluation loops on an external executor, e.g. a thread pool shared with the application.
+     *
+     * @param executor_ Executor, must outlive the passes of this instance.
+     */
+    void set_executor(std::shared_ptr<Executor> executor_) {
+      executor = executor_;
+    }
+
+    /**
+     * @brief Limit the number of OpenMP threads running the evaluation loops of this instance.
+     *
+     * @param nthreads Maximum number of threads, 0 to remove the limit.
+     */
+    void set_num_threads(int nthreads) {
+      executor = std::make_shared<OpenMPExecutor>(nthreads);
+    }
+
+    //! Call body(i) for all i in [0, n) on the executor, the counts of the workers are attributed to the caller's operator in this instance.
+    void parallel_for(size_t n, const std::function<void(size_t)>& body) {
+      int op = current_op();
+      executor->parallel_for(n, [&](size_t i) {
+        OpScope scope(op, counters);
+        body(i);
+      });
+    }
+
+    //! Number of values stored per target in trg_value: potential, followed by gradient unless in potential-only mode.
+    int ntrg_values() const {
+      return is_potential_only ? 1 : 4;
+    }
+
+    /**
+     * @brief Buffer of M2L(): once numa_setup() has been called, the kept one, whose pages stay where the threads
+     * of the first pass touched them, otherwise the temporary one. M2L() only reserves room in the buffers, so the
+     * loops writing them place their pages.
+     */
+    template <typename V>
+    V& m2l_buffer(V& kept, V& temporary) {
+      return keeps_m2l_buffers ? kept : temporary;
     }
 
     virtual void potential_P2P(RealVec& src_coord, std::vector<T>& src_value,
@@ -40,14 +127,274 @@ namespace exafmm_t {
 
     virtual void gradient_P2P(RealVec& src_coord, std::vector<T>& src_value,
                               RealVec& trg_coord, std::vector<T>& trg_value) = 0;
+
+    /**
+     * @brief Compute potentials at targets induced by sources directly, with the coordinates in SoA layout,
+     * e.g. the copies built with each leaf by transpose_leaf(). The default implementation converts them
+     * back to AoS layout for potential_P2P(), kernels override it to read them directly.
+     *
+     * @param src Coordinates of sources.
+     * @param src_value Vector of charges of sources.
+     * @param trg Coordinates of targets, padded to a multiple of TRG_PAD.
+     * @param trg_value Vector of potentials of targets.
+     */
+    virtual void potential_P2P(const SoACoord& src, std::vector<T>& src_value,
+                               const SoACoord& trg, std::vector<T>& trg_value) {
+      RealVec src_coord = src.aos();
+      RealVec trg_coord = trg.aos();
+      potential_P2P(src_coord, src_value, trg_coord, trg_value);
+    }
+
+    //! Compute potentials and gradients at targets induced by sources directly, with the coordinates in SoA layout.
+    virtual void gradient_P2P(const SoACoord& src, std::vector<T>& src_value,
+                              const SoACoord& trg, std::vector<T>& trg_value) {
+      RealVec src_coord = src.aos();
+      RealVec trg_coord = trg.aos();
+      gradient_P2P(src_coord, src_value, trg_coord, trg_value);
+    }
+
+    /**
+     * @brief Compute potentials at targets induced by sources directly for multiple right-hand sides.
+     * The default implementation calls potential_P2P() once per right-hand side,
+     * kernels override it to reuse the distance computations across right-hand sides.
+     *
+     * @param src_coord Vector of coordinates of sources.
+     * @param src_value Vector of charges of sources, src_value[s*nrhs+r] is the r-th charge of source s.
+     * @param trg_coord Vector of coordinates of targets.
+     * @param trg_value Vector of potentials of targets, trg_value[t*nrhs+r] is the r-th potential of target t.
+     * @param nrhs Number of right-hand sides.
+     */
+    virtual void potential_P2P_multi(RealVec& src_coord, std::vector<T>& src_value,
+                                     RealVec& trg_coord, std::vector<T>& trg_value, int nrhs) {
+      if (nrhs == 1) {
+        potential_P2P(src_coord, src_value, trg_coord, trg_value);
+      } else {
+        AlignedVec src = transpose_coord(src_coord);
+        AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+        P2P_per_rhs(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value, nrhs, 1);
+      }
+    }
+
+    /**
+     * @brief Compute potentials and gradients at targets induced by sources directly for multiple right-hand sides.
+     *
+     * @param src_coord Vector of coordinates of sources.
+     * @param src_value Vector of charges of sources, src_value[s*nrhs+r] is the r-th charge of source s.
+     * @param trg_coord Vector of coordinates of targets.
+     * @param trg_value Vector of potentials and gradients of targets, trg_value[4*(t*nrhs+r)+d] is the r-th result of target t.
+     * @param nrhs Number of right-hand sides.
+     */
+    virtual void gradient_P2P_multi(RealVec& src_coord, std::vector<T>& src_value,
+                                    RealVec& trg_coord, std::vector<T>& trg_value, int nrhs) {
+      if (nrhs == 1) {
+        gradient_P2P(src_coord, src_value, trg_coord, trg_value);
+      } else {
+        AlignedVec src = transpose_coord(src_coord);
+        AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+        P2P_per_rhs(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value, nrhs, 4);
+      }
+    }
+
+    //! potential_P2P_multi() with the coordinates in SoA layout.
+    virtual void potential_P2P_multi(const SoACoord& src, std::vector<T>& src_value,
+                                     const SoACoord& trg, std::vector<T>& trg_value, int nrhs) {
+      if (nrhs == 1)
+        potential_P2P(src, src_value, trg, trg_value);
+      else
+        P2P_per_rhs(src, src_value, trg, trg_value, nrhs, 1);
+    }
+
+    //! gradient_P2P_multi() with the coordinates in SoA layout.
+    virtual void gradient_P2P_multi(const SoACoord& src, std::vector<T>& src_value,
+                                    const SoACoord& trg, std::vector<T>& trg_value, int nrhs) {
+      if (nrhs == 1)
+        gradient_P2P(src, src_value, trg, trg_value);
+      else
+        P2P_per_rhs(src, src_value, trg, trg_value, nrhs, 4);
+    }
+
+    //! Evaluate each right-hand side separately with potential_P2P() (nvalues = 1) or gradient_P2P() (nvalues = 4).
+    void P2P_per_rhs(const SoACoord& src, std::vector<T>& src_value,
+                     const SoACoord& trg, std::vector<T>& trg_value, int nrhs, int nvalues) {
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      std::vector<T> src_value_(nsrcs);
+      std::vector<T> trg_value_(ntrgs*nvalues);
+      for (int r=0; r<nrhs; r++) {
+        for (int s=0; s<nsrcs; s++)
+          src_value_[s] = src_value[s*nrhs+r];
+        std::fill(trg_value_.begin(), trg_value_.end(), 0.);
+        if (nvalues == 1)
+          potential_P2P(src, src_value_, trg, trg_value_);
+        else
+          gradient_P2P(src, src_value_, trg, trg_value_);
+        for (int t=0; t<ntrgs; t++) {
+          for (int d=0; d<nvalues; d++)
+            trg_value[nvalues*(t*nrhs+r)+d] += trg_value_[nvalues*t+d];
+        }
+      }
+    }
+
+    /**
+     * @brief Compute the values stored in trg_value at targets induced by sources directly
+     * for all right-hand sides, skipping gradients in potential-only mode.
+     *
+     * @param src_coord Vector of coordinates of sources.
+     * @param src_value Vector of charges of sources.
+     * @param trg_coord Vector of coordinates of targets.
+     * @param trg_value Vector of potentials (and gradients) of targets.
+     */
+    void evaluate_P2P(RealVec& src_coord, std::vector<T>& src_value,
+                      RealVec& trg_coord, std::vector<T>& trg_value) {
+      if (is_potential_only)
+        potential_P2P_multi(src_coord, src_value, trg_coord, trg_value, nrhs);
+      else
+        gradient_P2P_multi(src_coord, src_value, trg_coord, trg_value, nrhs);
+    }
+
+    //! evaluate_P2P() with the coordinates in SoA layout.
+    void evaluate_P2P(const SoACoord& src, std::vector<T>& src_value,
+                      const SoACoord& trg, std::vector<T>& trg_value) {
+      if (is_potential_only)
+        potential_P2P_multi(src, src_value, trg, trg_value, nrhs);
+      else
+        gradient_P2P_multi(src, src_value, trg, trg_value, nrhs);
+    }
+
+    /**
+     * @brief Sources of a node in SoA layout: the copy built by transpose_leaf(), or for nodes without
+     * one, e.g. temporary nodes, a transposition stored in buffer.
+     */
+    SoACoord source_soa(Node<T>* node, AlignedVec& buffer) {
+      int n = node->src_coord.size() / 3;
+      if (node->src_coord_soa.size() == size_t(3*n))
+        return SoACoord(node->src_coord_soa, n);
+      buffer = transpose_coord(node->src_coord);
+      return SoACoord(buffer, n);
+    }
+
+    //! Targets of a node in SoA layout padded to TRG_PAD, as source_soa().
+    SoACoord target_soa(Node<T>* node, AlignedVec& buffer) {
+      int n = node->trg_coord.size() / 3;
+      if (node->trg_coord_soa.size() == size_t(3*((n+TRG_PAD-1)/TRG_PAD*TRG_PAD)))
+        return SoACoord(node->trg_coord_soa, n);
+      buffer = transpose_coord(node->trg_coord, TRG_PAD);
+      return SoACoord(buffer, n);
+    }
+
+    /**
+     * @brief Set the charges of all right-hand sides in leafs.
+     *
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param charges Charges in the initial numbering of sources, charges[i*nrhs+r] is the r-th charge of source i.
+     */
+    void set_charges(NodePtrs<T>& leafs, const std::vector<T>& charges) {
+      parallel_for(leafs.size(), [&](size_t i) {
+        Node<T>* leaf = leafs[i];
+        std::vector<int>& isrcs = leaf->isrcs;
+        leaf->src_value.resize(isrcs.size()*nrhs);
+        for (size_t j=0; j<isrcs.size(); j++) {
+          for (int r=0; r<nrhs; r++)
+            leaf->src_value[j*nrhs+r] = charges[isrcs[j]*nrhs+r];
+        }
+      });
+    }
+
+    /**
+     * @brief Zero the equivalent charges and target values of all nodes, so that the tree can be
+     * evaluated again, e.g. after set_charges().
+     *
+     * @param nodes Tree.
+     */
+    void clear_values(Nodes<T>& nodes) {
+      parallel_for(nodes.size(), [&](size_t i) {
+        std::fill(nodes[i].up_equiv.begin(), nodes[i].up_equiv.end(), T(0.));
+        std::fill(nodes[i].dn_equiv.begin(), nodes[i].dn_equiv.end(), T(0.));
+        std::fill(nodes[i].trg_value.begin(), nodes[i].trg_value.end(), T(0.));
+      });
+    }
+
+    /**
+     * @brief Compute potentials and gradients between two groups of bodies that are both
+     * sources and targets. Kernels with G(x,y) = G(y,x) override it to evaluate each pair once.
+     *
+     * @param coord0 Vector of coordinates of the first group.
+     * @param value0 Vector of charges of the first group.
+     * @param result0 Vector of potentials and gradients of the first group.
+     * @param coord1 Vector of coordinates of the second group.
+     * @param value1 Vector of charges of the second group.
+     * @param result1 Vector of potentials and gradients of the second group.
+     */
+    virtual void gradient_P2P_mutual(RealVec& coord0, std::vector<T>& value0, std::vector<T>& result0,
+                                     RealVec& coord1, std::vector<T>& value1, std::vector<T>& result1) {
+      gradient_P2P(coord1, value1, coord0, result0);
+      gradient_P2P(coord0, value0, coord1, result1);
+    }
+
     //! M2L operator.
     virtual void M2L(Nodes<T>& nodes) = 0;
 
-    //! M2M operator.
-    virtual void M2M(Node<T>* node) = 0;
+    //! M2L operator restricted to the given target nodes and the marked source nodes.
+    virtual void M2L_subset(Nodes<T>& nodes, NodePtrs<T>& targets, const std::vector<bool>& is_source) = 0;
+
+    /**
+     * @brief M2L operator of a group of target nodes of the same level, computing its setup on the fly and
+     * gathering only the children of its targets and sources, see M2L_gather(). Only the children of the targets
+     * are written, so groups of different targets can run concurrently, e.g. as tasks of evaluate_tasks().
+     *
+     * @param nodes Vector of all nodes.
+     * @param targets Target (non-leaf) nodes of the same level.
+     */
+    virtual void M2L_group(Nodes<T>& nodes, NodePtrs<T>& targets) = 0;
+
+    /**
+     * @brief Gather the upward equivalent charges of the children of the M2L sources and the downward check
+     * potentials of the children of the M2L targets of a setup into compact arrays, and rebase the offsets of the
+     * setup onto these arrays. A partial M2L then only touches the nodes it involves instead of all nodes.
+     *
+     * @param nodes Vector of all nodes.
+     * @param data M2L setup data, whose offsets index the arrays of all nodes on entry.
+     * @param up_equiv Compact upward equivalent charges, NCHILD nodes per source.
+     * @param dn_equiv Compact downward check potentials, NCHILD nodes per target.
+     * @return Index of the first child of each target, to pass to M2L_scatter().
+     */
+    std::vector<size_t> M2L_gather(Nodes<T>& nodes, M2LData& data, std::vector<T>& up_equiv, std::vector<T>& dn_equiv) {
+      size_t nequiv = nsurf * nrhs;
+      up_equiv.resize(data.fft_offset.size()*NCHILD*nequiv);
+      dn_equiv.resize(data.ifft_offset.size()*NCHILD*nequiv);
+      for (size_t i=0; i<data.fft_offset.size(); i++) {
+        size_t first_child = data.fft_offset[i] / nequiv;   // the children of a node are adjacent in nodes
+        for (int c=0; c<NCHILD; c++)
+          std::copy(nodes[first_child+c].up_equiv.begin(), nodes[first_child+c].up_equiv.end(),
+                    up_equiv.begin()+(i*NCHILD+c)*nequiv);
+        data.fft_offset[i] = i * NCHILD * nequiv;
+      }
+      std::vector<size_t> trg_children(data.ifft_offset.size());
+      for (size_t i=0; i<data.ifft_offset.size(); i++) {
+        trg_children[i] = data.ifft_offset[i] / nequiv;
+        for (int c=0; c<NCHILD; c++)
+          std::copy(nodes[trg_children[i]+c].dn_equiv.begin(), nodes[trg_children[i]+c].dn_equiv.end(),
+                    dn_equiv.begin()+(i*NCHILD+c)*nequiv);
+        data.ifft_offset[i] = i * NCHILD * nequiv;
+      }
+      return trg_children;
+    }
+
+    //! Scatter the compact downward check potentials of M2L_gather() back to the children of the targets.
+    void M2L_scatter(Nodes<T>& nodes, const std::vector<size_t>& trg_children, const std::vector<T>& dn_equiv) {
+      size_t nequiv = nsurf * nrhs;
+      for (size_t i=0; i<trg_children.size(); i++) {
+        for (int c=0; c<NCHILD; c++)
+          std::copy(dn_equiv.begin()+(i*NCHILD+c)*nequiv, dn_equiv.begin()+(i*NCHILD+c+1)*nequiv,
+                    nodes[trg_children[i]+c].dn_equiv.begin());
+      }
+    }
+
+    //! M2M operator of a single non-leaf node.
+    virtual void M2M_node(Node<T>* node) = 0;
 
-    //! L2L operator.
-    virtual void L2L(Node<T>* node) = 0;
+    //! L2L operator of a single non-leaf node.
+    virtual void L2L_node(Node<T>* node) = 0;
     
     //! P2M operator.
     virtual void P2M(NodePtrs<T>& leafs) = 0;
@@ -78,23 +425,396 @@ namespace exafmm_t {
     /* the following kernels do not use precomputation matrices
      * thus can be defined in the base class */
 
-    //! P2P operator.
-    void P2P(NodePtrs<T>& leafs) {
+    /**
+     * @brief Setup symmetric P2P, which evaluates each unordered pair of neighboring leaves once
+     * and scatters equal and opposite contributions to both leaves.
+     *
+     * It is only enabled for real kernels and when the sources in every leaf coincide with its targets.
+     * Leaves are colored such that no two leaves of the same color write to a common leaf,
+     * so that each color can be processed in parallel without atomics.
+     *
+     * @param leafs Vector of pointers to leaf nodes.
+     * @return Whether symmetric P2P is enabled.
+     */
+    bool P2P_setup(NodePtrs<T>& leafs) {
+      is_symmetric = false;
+      p2pdata = P2PData();
+      if (!is_real) return false;
+      for (size_t i=0; i<leafs.size(); i++) {
+        if (leafs[i]->src_coord != leafs[i]->trg_coord) return false;
+      }
+      int nleafs = leafs.size();
+      std::map<Node<T>*, int> leaf_index;
+      for (int i=0; i<nleafs; i++) {
+        leaf_index[leafs[i]] = i;
+      }
+      std::vector<std::set<Node<T>*>> P2P_sets(nleafs);
+      for (int i=0; i<nleafs; i++) {
+        NodePtrs<T>& P2P_list = leafs[i]->P2P_list;
+        P2P_sets[i].insert(P2P_list.begin(), P2P_list.end());
+      }
+      // split interactions into mutual pairs (owned by the leaf with smaller index) and one-way interactions
+      p2pdata.mutual_list.resize(nleafs);
+      p2pdata.oneway_list.resize(nleafs);
+      for (int i=0; i<nleafs; i++) {
+        for (Node<T>* source : P2P_sets[i]) {
+          auto it = leaf_index.find(source);
+          if (it == leaf_index.end()) {   // source is not among leafs
+            p2pdata = P2PData();
+            return false;
+          }
+          int j = it->second;
+          bool is_mutual = (j != i) && P2P_sets[j].count(leafs[i]);
+          if (!is_mutual)
+            p2pdata.oneway_list[i].push_back(j);
+          else if (i < j)
+            p2pdata.mutual_list[i].push_back(j);
+        }
+      }
+      // writers[j]: leaves whose evaluation writes to leaf j
+      std::vector<std::vector<int>> writers(nleafs);
+      for (int i=0; i<nleafs; i++) {
+        writers[i].push_back(i);
+        for (int j : p2pdata.mutual_list[i])
+          writers[j].push_back(i);
+      }
+      // greedy coloring: leaves sharing a written leaf get different colors
+      std::vector<int> color(nleafs, -1);
+      int ncolors = 0;
+      for (int i=0; i<nleafs; i++) {
+        std::set<int> forbidden;
+        std::vector<int> written(1, i);
+        written.insert(written.end(), p2pdata.mutual_list[i].begin(), p2pdata.mutual_list[i].end());
+        for (int j : written) {
+          for (int k : writers[j]) {
+            if (color[k] >= 0) forbidden.insert(color[k]);
+          }
+        }
+        int c = 0;
+        while (forbidden.count(c)) c++;
+        color[i] = c;
+        ncolors = std::max(ncolors, c+1);
+      }
+      p2pdata.colors.resize(ncolors);
+      for (int i=0; i<nleafs; i++) {
+        p2pdata.colors[color[i]].push_back(i);
+      }
+      is_symmetric = true;
+      return true;
+    }
+
+    /**
+     * @brief Assemble and cache the P2P matrix of each target leaf, which maps the charges of all sources
+     * in its P2P_list to its trg_value, for repeated evaluations on a fixed geometry. Leaves are cached
+     * in order until the memory budget is used up, the rest are still evaluated with the P2P kernels.
+     * Set leafs to the same vector passed to P2P(), an empty budget removes the cache.
+     *
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param budget Memory budget in bytes.
+     * @param tolerance Relative accuracy required by the caller, matrices are stored in single precision if it is at least 1e-6.
+     * @param verbose Whether to print the memory used and the share of near-field interactions cached.
+     * @return Memory used by the cached matrices in bytes.
+     */
+    size_t P2P_cache_setup(NodePtrs<T>& leafs, size_t budget, double tolerance=0, bool verbose=true) {
+      bool is_single = tolerance >= 1e-6 && !std::is_same<T, single_t>::value;
+      size_t entry_size = is_single ? sizeof(single_t) : sizeof(T);
+      int nvalues = ntrg_values();
+      p2p_matrix.clear();
+      p2p_matrix_single.clear();
+      if (budget == 0) return 0;
+      p2p_matrix.resize(leafs.size());
+      p2p_matrix_single.resize(leafs.size());
+      // select leaves in order until the budget is used up
+      std::vector<size_t> ncols(leafs.size(), 0);
+      std::vector<bool> is_cached(leafs.size(), false);
+      size_t bytes = 0, nentries = 0, nentries_cached = 0;
+      for (size_t i=0; i<leafs.size(); i++) {
+        NodePtrs<T>& sources = leafs[i]->P2P_list;
+        for (size_t j=0; j<sources.size(); j++)
+          ncols[i] += sources[j]->nsrcs;
+        size_t size = leafs[i]->ntrgs * ncols[i];
+        nentries += size;
+        if (size && bytes + size*nvalues*entry_size <= budget) {
+          is_cached[i] = true;
+          bytes += size*nvalues*entry_size;
+          nentries_cached += size;
+        }
+      }
+      // the column of a source is its field at the targets with a unit charge
+#pragma omp parallel for schedule(dynamic)
+      for (size_t i=0; i<leafs.size(); i++) {
+        if (!is_cached[i]) continue;
+        Node<T>* target = leafs[i];
+        int nrows = target->ntrgs * nvalues;
+        std::vector<T> matrix(nrows*ncols[i], T(0.));
+        RealVec src_coord(3);
+        std::vector<T> src_value(1, T(1.));
+        size_t col = 0;
+        NodePtrs<T>& sources = target->P2P_list;
+        for (size_t j=0; j<sources.size(); j++) {
+          for (int s=0; s<sources[j]->nsrcs; s++, col++) {
+            for (int d=0; d<3; d++)
+              src_coord[d] = sources[j]->src_coord[3*s+d];
+            std::vector<T> column(nrows, T(0.));
+            if (is_potential_only)
+              potential_P2P(src_coord, src_value, target->trg_coord, column);
+            else
+              gradient_P2P(src_coord, src_value, target->trg_coord, column);
+            std::copy(column.begin(), column.end(), matrix.begin()+col*nrows);
+          }
+        }
+        if (is_single)
+          p2p_matrix_single[i].assign(matrix.begin(), matrix.end());
+        else
+          p2p_matrix[i].swap(matrix);
+      }
+      if (verbose) {
+        print("P2P Cache Memory (MB)", bytes/1e6);
+        print("P2P Cache Coverage", double(nentries_cached)/std::max(nentries, size_t(1)));
+        print("P2P Cache Single", int(is_single));
+      }
+      return bytes;
+    }
+
+    //! y += A*x for a column-major m by n matrix A and nrhs right-hand sides, x[j*nrhs+r] and y[r*m+i]; A may be stored in lower precision.
+    template <typename MatT>
+    void P2P_matvec(int m, int n, const MatT* A, const T* x, T* y) {
+      for (int r=0; r<nrhs; r++) {
+        T* y_ = y + r*m;
+        for (int j=0; j<n; j++) {
+          const MatT* a = A + size_t(j)*m;
+          T xj = x[j*nrhs+r];
+          for (int i=0; i<m; i++)
+            y_[i] += T(a[i]) * xj;
+        }
+      }
+      add_flop(2LL * m * n * nrhs * (is_real ? 1 : 4));
+      add_bytes((long long)sizeof(MatT)*m*n + (long long)sizeof(T)*(n+2*m)*nrhs);
+    }
+
+    /**
+     * @brief Precompute and cache the fused P2M operator (check-to-equivalent conversion times the kernel
+     * from sources to the upward check surface) and the fused L2P operator (kernel from the downward
+     * equivalent surface to targets times the check-to-equivalent conversion) of each leaf, so that the
+     * P2M and L2P of later evaluations on the same geometry are dense matrix-vector products.
+     * The columns are obtained by applying P2M() and L2P() to unit vectors, so precompute() must be called first.
+     * Leaves are cached in order until the memory budget is used up. With a cached L2P operator, the dn_equiv
+     * of a leaf keeps the downward check potential after the downward pass.
+     *
+     * @param leafs Vector of pointers to leaf nodes, the same as the one passed to upward_pass() and downward_pass().
+     * @param budget Memory budget in bytes, 0 removes the cache.
+     * @param max_leaf_size Leaves with more sources (P2M) or targets (L2P) than this are not cached.
+     * @param verbose Whether to print the memory used and the share of leaves cached.
+     * @return Memory used by the cached operators in bytes.
+     */
+    size_t P2M_L2P_cache_setup(NodePtrs<T>& leafs, size_t budget, int max_leaf_size=1<<30, bool verbose=true) {
+      int nvalues = ntrg_values();
+      p2m_matrix.clear();
+      l2p_matrix.clear();
+      if (budget == 0) return 0;
+      p2m_matrix.resize(leafs.size());
+      l2p_matrix.resize(leafs.size());
+      int nrhs_ = nrhs;
+      nrhs = 1;   // the operators are the same for all right-hand sides
+      size_t bytes = 0;
+      int np2m = 0, nl2p = 0;
+      for (size_t i=0; i<leafs.size(); i++) {
+        Node<T>* leaf = leafs[i];
+        size_t p2m_size = size_t(nsurf) * leaf->nsrcs;
+        if (leaf->nsrcs && leaf->nsrcs <= max_leaf_size && bytes + p2m_size*sizeof(T) <= budget) {
+          // column j is the upward equivalent charge of a unit charge at source j
+          Nodes<T> columns(leaf->nsrcs);
+          NodePtrs<T> column_ptrs(leaf->nsrcs);
+          for (int j=0; j<leaf->nsrcs; j++) {
+            columns[j].level = leaf->level;
+            columns[j].x = leaf->x;
+            columns[j].src_coord.assign(leaf->src_coord.begin()+3*j, leaf->src_coord.begin()+3*(j+1));
+            columns[j].src_value.assign(1, T(1.));
+            columns[j].up_equiv.assign(nsurf, T(0.));
+            column_ptrs[j] = &columns[j];
+          }
+          P2M(column_ptrs);
+          for (int j=0; j<leaf->nsrcs; j++)
+            p2m_matrix[i].insert(p2m_matrix[i].end(), columns[j].up_equiv.begin(), columns[j].up_equiv.end());
+          bytes += p2m_size*sizeof(T);
+          np2m++;
+        }
+        size_t l2p_size = size_t(nsurf) * leaf->ntrgs * nvalues;
+        if (leaf->ntrgs && leaf->ntrgs <= max_leaf_size && bytes + l2p_size*sizeof(T) <= budget) {
+          // column k is the result at the targets of a unit downward check potential at point k
+          Nodes<T> columns(nsurf);
+          NodePtrs<T> column_ptrs(nsurf);
+          for (int k=0; k<nsurf; k++) {
+            columns[k].level = leaf->level;
+            columns[k].x = leaf->x;
+            columns[k].trg_coord = leaf->trg_coord;
+            columns[k].trg_value.assign(leaf->ntrgs*nvalues, T(0.));
+            columns[k].dn_equiv.assign(nsurf, T(0.));
+            columns[k].dn_equiv[k] = T(1.);
+            column_ptrs[k] = &columns[k];
+          }
+          L2P(column_ptrs);
+          for (int k=0; k<nsurf; k++)
+            l2p_matrix[i].insert(l2p_matrix[i].end(), columns[k].trg_value.begin(), columns[k].trg_value.end());
+          bytes += l2p_size*sizeof(T);
+          nl2p++;
+        }
+      }
+      nrhs = nrhs_;
+      if (verbose) {
+        print("P2M/L2P Cache Memory (MB)", bytes/1e6);
+        print("P2M Cached Leaves", double(np2m)/std::max(leafs.size(), size_t(1)));
+        print("L2P Cached Leaves", double(nl2p)/std::max(leafs.size(), size_t(1)));
+      }
+      return bytes;
+    }
+
+    //! P2M operator using the operators cached by P2M_L2P_cache_setup(), leaves without one use P2M().
+    //! leafs may be a contiguous part of the cached leaves starting at ibegin.
+    void P2M_cached(NodePtrs<T>& leafs, size_t ibegin=0) {
+      OpScope scope(P2M_Op, counters);
+      assert(ibegin+leafs.size() <= p2m_matrix.size());
+      NodePtrs<T> uncached;
+      for (size_t i=0; i<leafs.size(); i++) {
+        if (p2m_matrix[ibegin+i].empty())
+          uncached.push_back(leafs[i]);
+      }
+      parallel_for(leafs.size(), [&](size_t i) {
+        if (p2m_matrix[ibegin+i].empty()) return;
+        Node<T>* leaf = leafs[i];
+        std::vector<T> y(nsurf*nrhs, T(0.));
+        P2P_matvec(nsurf, leaf->nsrcs, p2m_matrix[ibegin+i].data(), leaf->src_value.data(), y.data());
+        for (int k=0; k<nsurf; k++) {
+          for (int r=0; r<nrhs; r++)
+            leaf->up_equiv[k*nrhs+r] = y[r*nsurf+k];
+        }
+      });
+      P2M(uncached);
+    }
+
+    //! L2P operator using the operators cached by P2M_L2P_cache_setup(), leaves without one use L2P().
+    //! leafs may be a contiguous part of the cached leaves starting at ibegin.
+    void L2P_cached(NodePtrs<T>& leafs, size_t ibegin=0) {
+      OpScope scope(L2P_Op, counters);
+      assert(ibegin+leafs.size() <= l2p_matrix.size());
+      int nvalues = ntrg_values();
+      NodePtrs<T> uncached;
+      for (size_t i=0; i<leafs.size(); i++) {
+        if (l2p_matrix[ibegin+i].empty())
+          uncached.push_back(leafs[i]);
+      }
+      parallel_for(leafs.size(), [&](size_t i) {
+        if (l2p_matrix[ibegin+i].empty()) return;
+        Node<T>* leaf = leafs[i];
+        int nrows = leaf->ntrgs * nvalues;
+        std::vector<T> y(nrows*nrhs, T(0.));
+        P2P_matvec(nrows, nsurf, l2p_matrix[ibegin+i].data(), leaf->dn_equiv.data(), y.data());
+        for (int t=0; t<leaf->ntrgs; t++) {
+          for (int r=0; r<nrhs; r++) {
+            for (int d=0; d<nvalues; d++)
+              leaf->trg_value[nvalues*(t*nrhs+r)+d] += y[r*nrows+t*nvalues+d];
+          }
+        }
+      });
+      L2P(uncached);
+    }
+
+    //! P2P operator using the matrices cached by P2P_cache_setup(), leafs may be a contiguous part of the cached leaves starting at ibegin.
+    void P2P_cached(NodePtrs<T>& leafs, size_t ibegin=0) {
+      OpScope scope(P2P_Op, counters);
+      assert(ibegin+leafs.size() <= p2p_matrix.size());
+      int nvalues = ntrg_values();
+      parallel_for(leafs.size(), [&](size_t i) {
+        Node<T>* target = leafs[i];
+        NodePtrs<T>& sources = target->P2P_list;
+        if (p2p_matrix[ibegin+i].empty() && p2p_matrix_single[ibegin+i].empty()) {
+          AlignedVec src_buffer, trg_buffer;
+          SoACoord trg = target_soa(target, trg_buffer);
+          for (size_t j=0; j<sources.size(); j++)
+            evaluate_P2P(source_soa(sources[j], src_buffer), sources[j]->src_value, trg, target->trg_value);
+          return;
+        }
+        // gather the charges of all sources, then scatter the results to the layout of trg_value
+        std::vector<T> x;
+        for (size_t j=0; j<sources.size(); j++)
+          x.insert(x.end(), sources[j]->src_value.begin(), sources[j]->src_value.end());
+        int ncols = x.size() / nrhs;
+        int nrows = target->ntrgs * nvalues;
+        std::vector<T> y(nrows*nrhs, T(0.));
+        if (p2p_matrix[ibegin+i].empty())
+          P2P_matvec(nrows, ncols, p2p_matrix_single[ibegin+i].data(), x.data(), y.data());
+        else
+          P2P_matvec(nrows, ncols, p2p_matrix[ibegin+i].data(), x.data(), y.data());
+        for (int t=0; t<target->ntrgs; t++) {
+          for (int r=0; r<nrhs; r++) {
+            for (int d=0; d<nvalues; d++)
+              target->trg_value[nvalues*(t*nrhs+r)+d] += y[r*nrows+t*nvalues+d];
+          }
+        }
+      });
+    }
+
+    /**
+     * @brief Symmetric P2P operator, each mutual pair of leaves is evaluated once.
+     *
+     * @param leafs Vector of pointers to leaf nodes, the same as the one passed to P2P_setup().
+     */
+    void P2P_symmetric(NodePtrs<T>& leafs) {
+      OpScope scope(P2P_Op, counters);
+      for (size_t c=0; c<p2pdata.colors.size(); c++) {
+        std::vector<int>& group = p2pdata.colors[c];
+        parallel_for(group.size(), [&](size_t i) {
+          Node<T>* target = leafs[group[i]];
+          AlignedVec src_buffer, trg_buffer;
+          SoACoord trg = target_soa(target, trg_buffer);
+          std::vector<int>& oneway_list = p2pdata.oneway_list[group[i]];
+          for (size_t j=0; j<oneway_list.size(); j++) {
+            Node<T>* source = leafs[oneway_list[j]];
+            gradient_P2P(source_soa(source, src_buffer), source->src_value, trg, target->trg_value);
+          }
+          std::vector<int>& mutual_list = p2pdata.mutual_list[group[i]];
+          for (size_t j=0; j<mutual_list.size(); j++) {
+            Node<T>* source = leafs[mutual_list[j]];
+            gradient_P2P_mutual(target->src_coord, target->src_value, target->trg_value,
+                                source->src_coord, source->src_value, source->trg_value);
+          }
+        });
+      }
+    }
+
+    /**
+     * @brief P2P operator.
+     *
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param is_source Whether a node (by index) is included as a source, all nodes are included if it is empty.
+     */
+    void P2P(NodePtrs<T>& leafs, const std::vector<bool>& is_source=std::vector<bool>()) {
+      OpScope scope(P2P_Op, counters);
+      if (!p2p_matrix.empty() && is_source.empty()) {
+        P2P_cached(leafs);
+        return;
+      }
+      if (is_symmetric && !is_potential_only && nrhs == 1 && is_source.empty()) {
+        P2P_symmetric(leafs);
+        return;
+      }
       NodePtrs<T>& targets = leafs;
-#pragma omp parallel for
-      for (size_t i=0; i<targets.size(); i++) {
+      parallel_for(targets.size(), [&](size_t i) {
         Node<T>* target = targets[i];
+        AlignedVec src_buffer, trg_buffer;
+        SoACoord trg = target_soa(target, trg_buffer);
         NodePtrs<T>& sources = target->P2P_list;
         for (size_t j=0; j<sources.size(); j++) {
           Node<T>* source = sources[j];
-          gradient_P2P(source->src_coord, source->src_value,
-                       target->trg_coord, target->trg_value);
+          if (!is_source.empty() && !is_source[source->idx]) continue;
+          evaluate_P2P(source_soa(source, src_buffer), source->src_value, trg, target->trg_value);
         }
-      }
+      });
     }
 
-    //! M2P operator.
-    void M2P(NodePtrs<T>& leafs) {
+    //! M2P operator, is_source restricts the source nodes as in P2P().
+    void M2P(NodePtrs<T>& leafs, const std::vector<bool>& is_source=std::vector<bool>()) {
+      OpScope scope(M2P_Op, counters);
       NodePtrs<T>& targets = leafs;
       real_t c[3] = {0.0};
       std::vector<RealVec> up_equiv_surf;
@@ -103,29 +823,38 @@ namespace exafmm_t {
         up_equiv_surf[level].resize(nsurf*3);
         up_equiv_surf[level] = surface(p, r0, level, c, 1.05);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<targets.size(); i++) {
+      parallel_for(targets.size(), [&](size_t i) {
         Node<T>* target = targets[i];
+        AlignedVec trg_buffer;
+        SoACoord trg = target_soa(target, trg_buffer);
+        AlignedVec src_equiv_coord(nsurf*3);   // SoA layout
         NodePtrs<T>& sources = target->M2P_list;
         for (size_t j=0; j<sources.size(); j++) {
           Node<T>* source = sources[j];
-          RealVec src_equiv_coord(nsurf*3);
+          if (!is_source.empty() && !is_source[source->idx]) continue;
           int level = source->level;
           // source node's equiv coord = relative equiv coord + node's center
           for (int k=0; k<nsurf; k++) {
-            src_equiv_coord[3*k+0] = up_equiv_surf[level][3*k+0] + source->x[0];
-            src_equiv_coord[3*k+1] = up_equiv_surf[level][3*k+1] + source->x[1];
-            src_equiv_coord[3*k+2] = up_equiv_surf[level][3*k+2] + source->x[2];
+            src_equiv_coord[k] = up_equiv_surf[level][3*k+0] + source->x[0];
+            src_equiv_coord[k+nsurf] = up_equiv_surf[level][3*k+1] + source->x[1];
+            src_equiv_coord[k+2*nsurf] = up_equiv_surf[level][3*k+2] + source->x[2];
           }
-          gradient_P2P(src_equiv_coord, source->up_equiv,
-                       target->trg_coord, target->trg_value);
+          evaluate_P2P(SoACoord(src_equiv_coord, nsurf), source->up_equiv, trg, target->trg_value);
         }
-      }
+      });
     }
 
-    //! P2L operator.
-    void P2L(Nodes<T>& nodes) {
-      Nodes<T>& targets = nodes;
+    //! P2L operator, is_source restricts the source nodes as in P2P().
+    void P2L(Nodes<T>& nodes, const std::vector<bool>& is_source=std::vector<bool>()) {
+      NodePtrs<T> targets(nodes.size());
+      for (size_t i=0; i<nodes.size(); i++)
+        targets[i] = &nodes[i];
+      P2L(targets, is_source);
+    }
+
+    //! P2L operator on the given target nodes.
+    void P2L(NodePtrs<T>& targets, const std::vector<bool>& is_source=std::vector<bool>()) {
+      OpScope scope(P2L_Op, counters);
       real_t c[3] = {0.0};
       std::vector<RealVec> dn_check_surf;
       dn_check_surf.resize(depth+1);
@@ -133,12 +862,12 @@ namespace exafmm_t {
         dn_check_surf[level].resize(nsurf*3);
         dn_check_surf[level] = surface(p, r0, level, c, 1.05);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<targets.size(); i++) {
-        Node<T>* target = &targets[i];
+      parallel_for(targets.size(), [&](size_t i) {
+        Node<T>* target = targets[i];
         NodePtrs<T>& sources = target->P2L_list;
         for (size_t j=0; j<sources.size(); j++) {
           Node<T>* source = sources[j];
+          if (!is_source.empty() && !is_source[source->idx]) continue;
           RealVec trg_check_coord(nsurf*3);
           int level = target->level;
           // target node's check coord = relative check coord + node's center
@@ -147,12 +876,91 @@ namespace exafmm_t {
             trg_check_coord[3*k+1] = dn_check_surf[level][3*k+1] + target->x[1];
             trg_check_coord[3*k+2] = dn_check_surf[level][3*k+2] + target->x[2];
           }
-          potential_P2P(source->src_coord, source->src_value,
-                        trg_check_coord, target->dn_equiv);
+          potential_P2P_multi(source->src_coord, source->src_value,
+                              trg_check_coord, target->dn_equiv, nrhs);
         }
-      }
+      });
     }
     
+    //! Group the non-leaf nodes of a tree by level, the tree builders call it once the tree is final.
+    void nonleafs_setup(Nodes<T>& nodes) {
+      nonleaf_levels.clear();
+      for (size_t i=0; i<nodes.size(); i++) {
+        if (nodes[i].is_leaf) continue;
+        if (nodes[i].level >= int(nonleaf_levels.size())) nonleaf_levels.resize(nodes[i].level+1);
+        nonleaf_levels[nodes[i].level].push_back(&nodes[i]);
+      }
+      nonleaf_tree = nodes.data();
+      nonleaf_tree_size = nodes.size();
+    }
+
+    /**
+     * @brief Non-leaf nodes grouped by level, cached with the tree. The levels are regrouped when nodes is
+     * not the tree of the cache, a tree refined or coarsened in place must call nonleafs_setup() again.
+     */
+    const std::vector<NodePtrs<T>>& nonleafs_by_level(Nodes<T>& nodes) {
+      if (nodes.data() != nonleaf_tree || nodes.size() != nonleaf_tree_size)
+        nonleafs_setup(nodes);
+      return nonleaf_levels;
+    }
+
+    //! M2M operator of all non-leaf nodes, level by level from the bottom, each level is a loop on the executor.
+    void M2M_levels(Nodes<T>& nodes) {
+      const std::vector<NodePtrs<T>>& levels = nonleafs_by_level(nodes);
+      for (int l=int(levels.size())-1; l>=0; l--) {
+        const NodePtrs<T>& level = levels[l];
+        parallel_for(level.size(), [&](size_t i) {
+          M2M_node(level[i]);
+        });
+      }
+    }
+
+    //! L2L operator of all non-leaf nodes, level by level from the root, each level is a loop on the executor.
+    void L2L_levels(Nodes<T>& nodes) {
+      const std::vector<NodePtrs<T>>& levels = nonleafs_by_level(nodes);
+      for (size_t l=0; l<levels.size(); l++) {
+        const NodePtrs<T>& level = levels[l];
+        parallel_for(level.size(), [&](size_t i) {
+          L2L_node(level[i]);
+        });
+      }
+    }
+
+    //! Start a phase: its timer and profiler scope as start(), and a snapshot of the counters.
+    void start_phase(const std::string& name) {
+      PhaseCounters& begin = phase_begin[name];
+      begin.counters = counters.read();
+      begin.perf = perf_counters().read();
+      start(name);
+    }
+
+    /**
+     * @brief Stop a phase and add its time and the counts since start_phase() to phase_counters.
+     * Only the operators of this instance are counted, not concurrent evaluations of other instances.
+     *
+     * @return Elapsed time in seconds.
+     */
+    double stop_phase(const std::string& name, bool verbose=true) {
+      double time = stop(name, verbose);
+      PerfValues perf = perf_counters().read();
+      PhaseCounters& begin = phase_begin[name];
+      PhaseCounters& phase = phase_counters[name];
+      phase.time += time;
+      phase.counters += counters.read() - begin.counters;
+      phase.perf += perf - begin.perf;
+      if (verbose) {
+        print(name + " GFLOP/s", phase.gflops());
+        print(name + " GB/s", phase.gbytes());
+        if (phase.perf.valid[Instructions_Event] && phase.perf.valid[Cycles_Event])
+          print(name + " IPC", phase.perf.ipc());
+        for (int e=L1D_Miss_Event; e<Event_Count; e++) {
+          if (phase.perf.valid[e])
+            print(name + " " + event_name(e), phase.perf.value[e]);
+        }
+      }
+      return time;
+    }
+
     /**
      * @brief Evaluate upward equivalent charges for all nodes in a post-order traversal.
      * 
@@ -160,14 +968,16 @@ namespace exafmm_t {
      * @param leafs Vector of pointers to leaf nodes.
      */   
     void upward_pass(Nodes<T>& nodes, NodePtrs<T>& leafs, bool verbose=true) {
-      start("P2M");
-      P2M(leafs);
-      stop("P2M", verbose);
-      start("M2M");
-#pragma omp parallel
-#pragma omp single nowait
-      M2M(&nodes[0]);
-      stop("M2M", verbose);
+      phase_counters.clear();
+      start_phase("P2M");
+      if (p2m_matrix.empty())
+        P2M(leafs);
+      else
+        P2M_cached(leafs);
+      stop_phase("P2M", verbose);
+      start_phase("M2M");
+      M2M_levels(nodes);
+      stop_phase("M2M", verbose);
     }
 
     /**
@@ -177,33 +987,717 @@ namespace exafmm_t {
      * @param leafs Vector of pointers to leaf nodes.
      */   
     void downward_pass(Nodes<T>& nodes, NodePtrs<T>& leafs, bool verbose=true) {
-      start("P2L");
+      start_phase("P2L");
       P2L(nodes);
-      stop("P2L", verbose);
+      stop_phase("P2L", verbose);
+      start_phase("M2P");
+      M2P(leafs);
+      stop_phase("M2P", verbose);
+      start_phase("P2P");
+      P2P(leafs);
+      stop_phase("P2P", verbose);
+      start_phase("M2L");
+      M2L(nodes);
+      stop_phase("M2L", verbose);
+      start_phase("L2L");
+      L2L_levels(nodes);
+      stop_phase("L2L", verbose);
+      start_phase("L2P");
+      if (l2p_matrix.empty())
+        L2P(leafs);
+      else
+        L2P_cached(leafs);
+      stop_phase("L2P", verbose);
+    }
+
+    /**
+     * @brief Evaluate the upward and downward passes as one task graph instead of a sequence of phases.
+     * P2M runs on chunks of leaves, M2M level by level as soon as the level below is done, and P2L on chunks
+     * of nodes. The M2L of a level runs on chunks of its non-leaves (M2L_group()) as soon as the M2M of the level
+     * below and P2L are done, so the M2L near the leaves overlaps the M2M near the root. L2L runs level by level
+     * from the root once the M2L into the level is done, M2P on chunks of leaves once the upward pass is done,
+     * and L2P once L2L is done. P2P on a chunk of leaves only waits for the tasks writing the same targets,
+     * half of the chunks before M2P and half after, so it fills the cores left idle near the root. An M2L chunk
+     * transforms the sources it needs, so sources shared by two chunks of a level are transformed twice.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param nchunks Number of chunks of leaves, 0 for 4 chunks per thread.
+     * @param verbose Whether to print the time of the graph.
+     */
+    void evaluate_tasks(Nodes<T>& nodes, NodePtrs<T>& leafs, int nchunks=0, bool verbose=true) {
+      if (nchunks <= 0) nchunks = 4 * omp_get_max_threads();
+      nchunks = std::max(1, std::min(nchunks, int(leafs.size())));
+      std::vector<NodePtrs<T>> leaf_chunks(nchunks);
+      std::vector<size_t> chunk_begin(nchunks);
+      for (int c=0; c<nchunks; c++) {
+        chunk_begin[c] = leafs.size() * c / nchunks;
+        size_t chunk_end = leafs.size() * (c+1) / nchunks;
+        leaf_chunks[c].assign(leafs.begin()+chunk_begin[c], leafs.begin()+chunk_end);
+      }
+      // chunks of non-leaf nodes of each level and of P2L targets
+      std::vector<NodePtrs<T>> level_nodes = nonleafs_by_level(nodes);
+      level_nodes.resize(depth+1);
+      NodePtrs<T> p2l_targets;
+      for (size_t i=0; i<nodes.size(); i++) {
+        if (!nodes[i].P2L_list.empty()) p2l_targets.push_back(&nodes[i]);
+      }
+      auto split = [nchunks](NodePtrs<T>& ptrs) {
+        int n = std::min(nchunks, int(ptrs.size()));
+        std::vector<NodePtrs<T>> chunks(n);
+        for (int c=0; c<n; c++)
+          chunks[c].assign(ptrs.begin()+ptrs.size()*c/n, ptrs.begin()+ptrs.size()*(c+1)/n);
+        return chunks;
+      };
+      std::vector<std::vector<NodePtrs<T>>> level_chunks(depth+1);
+      for (int l=0; l<=depth; l++)
+        level_chunks[l] = split(level_nodes[l]);
+      std::vector<NodePtrs<T>> p2l_chunks = split(p2l_targets);
+      auto P2P_chunk = [&](int c) {
+        OpScope scope(P2P_Op, counters);
+        if (!p2p_matrix.empty()) {
+          P2P_cached(leaf_chunks[c], chunk_begin[c]);
+          return;
+        }
+        NodePtrs<T>& targets = leaf_chunks[c];
+        AlignedVec src_buffer, trg_buffer;
+        for (size_t i=0; i<targets.size(); i++) {
+          SoACoord trg = target_soa(targets[i], trg_buffer);
+          NodePtrs<T>& sources = targets[i]->P2P_list;
+          for (size_t j=0; j<sources.size(); j++)
+            evaluate_P2P(source_soa(sources[j], src_buffer), sources[j]->src_value, trg, targets[i]->trg_value);
+        }
+      };
+
+      start("Task Graph");
+      TaskGraph graph;
+      // P2M and M2M, up_done[l] waits for the upward equivalent charges of the levels l and below
+      std::vector<int> up_done(depth+2);
+      int level_done = graph.add([]() {});
+      for (int c=0; c<nchunks; c++) {
+        int task = graph.add([&, c]() {
+          if (p2m_matrix.empty())
+            P2M(leaf_chunks[c]);
+          else
+            P2M_cached(leaf_chunks[c], chunk_begin[c]);
+        });
+        graph.depend(task, level_done);
+      }
+      up_done[depth+1] = level_done;
+      for (int l=depth; l>=0; l--) {
+        if (!level_chunks[l].empty()) {
+          int done = graph.add([]() {});
+          for (size_t k=0; k<level_chunks[l].size(); k++) {
+            int task = graph.add([&, l, k]() {
+              for (size_t i=0; i<level_chunks[l][k].size(); i++)
+                M2M_node(level_chunks[l][k][i]);
+            });
+            graph.depend(level_done, task);
+            graph.depend(task, done);
+          }
+          level_done = done;
+        }
+        up_done[l] = level_done;
+      }
+      // P2L, then M2L of each level once the children of its sources are done
+      int p2l_done = graph.add([]() {});
+      for (size_t k=0; k<p2l_chunks.size(); k++)
+        graph.depend(graph.add([&, k]() { P2L(p2l_chunks[k]); }), p2l_done);
+      std::vector<int> m2l_done(depth+1, -1);
+      for (int l=0; l<=depth; l++) {
+        if (level_chunks[l].empty()) continue;
+        m2l_done[l] = graph.add([]() {});
+        for (size_t k=0; k<level_chunks[l].size(); k++) {
+          int task = graph.add([&, l, k]() { M2L_group(nodes, level_chunks[l][k]); });
+          graph.depend(up_done[l+1], task);
+          graph.depend(p2l_done, task);
+          graph.depend(task, m2l_done[l]);
+        }
+      }
+      // L2L of a level reads the M2L of the level above and writes the children, which the M2L of the level writes
+      level_done = p2l_done;
+      for (int l=0; l<=depth; l++) {
+        if (level_chunks[l].empty()) continue;
+        int done = graph.add([]() {});
+        for (size_t k=0; k<level_chunks[l].size(); k++) {
+          int task = graph.add([&, l, k]() {
+            for (size_t i=0; i<level_chunks[l][k].size(); i++)
+              L2L_node(level_chunks[l][k][i]);
+          });
+          graph.depend(level_done, task);
+          graph.depend(m2l_done[l], task);
+          graph.depend(task, done);
+        }
+        level_done = done;
+      }
+      // M2P, P2P and L2P of each chunk write the same targets, so they run in turn
+      for (int c=0; c<nchunks; c++) {
+        int m2p = graph.add([&, c]() { M2P(leaf_chunks[c]); });
+        graph.depend(up_done[0], m2p);
+        int l2p = graph.add([&, c]() {
+          if (l2p_matrix.empty())
+            L2P(leaf_chunks[c]);
+          else
+            L2P_cached(leaf_chunks[c], chunk_begin[c]);
+        });
+        graph.depend(level_done, l2p);
+        int p2p = graph.add([&, c]() { P2P_chunk(c); });
+        if (c % 2 == 0) {
+          graph.depend(p2p, m2p);
+          graph.depend(m2p, l2p);
+        } else {
+          graph.depend(m2p, p2p);
+          graph.depend(p2p, l2p);
+        }
+      }
+      graph.run();
+      stop("Task Graph", verbose);
+    }
+
+    /**
+     * @brief Evaluate the near field (P2P) and the far field (P2M, M2M, P2L, M2L, L2L) concurrently on two groups
+     * of threads, then M2P and L2P, which write the same targets as P2P, with all threads. P2P is compute-bound
+     * while M2L is bandwidth-bound, so they share the cores better than they use them in turn. The share of threads
+     * of each group is set from the times of the groups in the previous call, assuming that the time of a group
+     * scales with its threads, so repeated evaluations converge to groups finishing together.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param verbose Whether to print the time of each group and the share of threads.
+     */
+    void evaluate_concurrent(Nodes<T>& nodes, NodePtrs<T>& leafs, bool verbose=true) {
+      int nthreads = omp_get_max_threads();
+      if (nthreads < 2) {
+        upward_pass(nodes, leafs, verbose);
+        downward_pass(nodes, leafs, verbose);
+        return;
+      }
+      int nnear = std::max(1, std::min(nthreads-1, int(near_thread_fraction*nthreads + 0.5)));
+      int nfar = nthreads - nnear;
+      int max_levels = omp_get_max_active_levels();
+      omp_set_max_active_levels(std::max(max_levels, 2));
+      double near_time = 0, far_time = 0;
+      // timers belong to the calling thread, so the groups running on other threads are timed with omp_get_wtime()
+      start("Near/Far Concurrent");
+#pragma omp parallel num_threads(2)
+      {
+        int tid = omp_get_thread_num();
+        bool is_single = omp_get_num_threads() == 1;
+        if (tid == 0) {
+          double t0 = omp_get_wtime();
+          omp_set_num_threads(nnear);
+          P2P(leafs);
+          near_time = omp_get_wtime() - t0;
+        }
+        if (tid == 1 || is_single) {
+          double t0 = omp_get_wtime();
+          omp_set_num_threads(is_single ? nthreads : nfar);
+          if (p2m_matrix.empty())
+            P2M(leafs);
+          else
+            P2M_cached(leafs);
+          M2M_levels(nodes);
+          P2L(nodes);
+          M2L(nodes);
+          L2L_levels(nodes);
+          far_time = omp_get_wtime() - t0;
+        }
+      }
+      stop("Near/Far Concurrent", verbose);
+      omp_set_max_active_levels(max_levels);
       start("M2P");
       M2P(leafs);
       stop("M2P", verbose);
+      start("L2P");
+      if (l2p_matrix.empty())
+        L2P(leafs);
+      else
+        L2P_cached(leafs);
+      stop("L2P", verbose);
+      if (verbose) {
+        print("Near-Field Threads", nnear);
+        print("Near-Field Time", near_time);
+        print("Far-Field Time", far_time);
+      }
+      double near_work = near_time * nnear, far_work = far_time * nfar;
+      if (near_work + far_work > 0)
+        near_thread_fraction = near_work / (near_work + far_work);
+    }
+
+    /**
+     * @brief Place the tree data on the NUMA nodes of the threads using it. The OpenMP threads are pinned to the
+     * nodes in contiguous groups and the loops switch to a contiguous executor, so the leaves are split into
+     * contiguous tree-ordered ranges, one per node. The per-leaf data (bodies, equivalent charges and cached
+     * operators) is then reallocated by the thread running the leaf, and the data of the non-leaf nodes by the
+     * thread running the node in the loops over all nodes, so the first-touch policy places it on that thread's node.
+     * The buffers of M2L() are then kept across passes, so they stay where the threads of the next pass place them.
+     * Without libnuma the threads are not pinned and only the reallocation is done. An executor set by
+     * set_executor() is kept with a warning, its threads are neither pinned nor given contiguous ranges.
+     * Call it after the setup functions that allocate per-node data (tree, lists, caches) and before the passes.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param verbose Whether to print the placement and the remote access fraction of each phase.
+     */
+    void numa_setup(Nodes<T>& nodes, NodePtrs<T>& leafs, bool verbose=true) {
+      bool is_pinned = false;
+      if (dynamic_cast<OpenMPExecutor*>(executor.get())) {
+        int nthreads = executor->num_threads();
+        is_pinned = pin_threads(nthreads);
+        executor = std::make_shared<OpenMPExecutor>(nthreads, true);
+      } else {
+        std::cerr << "numa_setup: keeping the executor set by set_executor(), "
+                  << "the data is placed by its threads without pinning them" << std::endl;
+      }
+      keeps_m2l_buffers = true;
+      std::vector<T>().swap(m2l_up_equiv);   // placed again by the next pass
+      std::vector<T>().swap(m2l_dn_equiv);
+      AlignedVec().swap(m2l_fft_in);
+      AlignedVec().swap(m2l_fft_out);
+      parallel_for(leafs.size(), [&](size_t i) {
+        Node<T>* leaf = leafs[i];
+        first_touch(leaf->src_coord);
+        first_touch(leaf->src_value);
+        first_touch(leaf->trg_coord);
+        first_touch(leaf->trg_value);
+        first_touch(leaf->src_coord_soa);
+        first_touch(leaf->trg_coord_soa);
+        first_touch(leaf->up_equiv);
+        first_touch(leaf->dn_equiv);
+        first_touch(leaf->P2P_list);
+        first_touch(leaf->M2P_list);
+        if (p2p_matrix.size() == leafs.size()) {
+          first_touch(p2p_matrix[i]);
+          first_touch(p2p_matrix_single[i]);
+        }
+        if (p2m_matrix.size() == leafs.size()) {
+          first_touch(p2m_matrix[i]);
+          first_touch(l2p_matrix[i]);
+        }
+      });
+      parallel_for(nodes.size(), [&](size_t i) {
+        if (nodes[i].is_leaf) return;
+        first_touch(nodes[i].up_equiv);
+        first_touch(nodes[i].dn_equiv);
+        first_touch(nodes[i].M2L_list);
+        first_touch(nodes[i].P2L_list);
+      });
+      if (verbose) {
+        print("NUMA Nodes", double(numa_cpu_nodes().size()));
+        print("NUMA Threads Pinned", double(is_pinned));
+        if (numa_is_available()) numa_remote_fraction(nodes, leafs, verbose);
+      }
+    }
+
+    /**
+     * @brief Fraction of the bytes accessed by each phase that are on another NUMA node than the accessing
+     * thread, assuming the contiguous executor set by numa_setup(). The kept buffers of M2L() are counted once
+     * a pass has placed them, with the transforms sized for the largest level, except for the Hadamard product,
+     * whose loop over frequencies reads every chunk from every thread. Available with libnuma.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param verbose Whether to print the fractions.
+     * @return Fractions of P2M, P2P, M2L and L2P, -1 if the page locations are unknown.
+     */
+    std::map<std::string, double> numa_remote_fraction(Nodes<T>& nodes, NodePtrs<T>& leafs, bool verbose=true) {
+      int nthreads = executor->num_threads();
+      RemoteAccessCounter p2m, p2p, m2l, l2p;
+      for (size_t i=0; i<leafs.size(); i++) {
+        Node<T>* leaf = leafs[i];
+        int node = numa_node_of_thread(contiguous_owner(i, leafs.size(), nthreads), nthreads);
+        p2m.add(leaf->src_coord.data(), leaf->src_coord.size()*sizeof(real_t), node);
+        p2m.add(leaf->src_value.data(), leaf->src_value.size()*sizeof(T), node);
+        p2m.add(leaf->up_equiv.data(), leaf->up_equiv.size()*sizeof(T), node);
+        p2p.add(leaf->trg_coord_soa.data(), leaf->trg_coord_soa.size()*sizeof(real_t), node);
+        p2p.add(leaf->trg_value.data(), leaf->trg_value.size()*sizeof(T), node);
+        for (size_t j=0; j<leaf->P2P_list.size(); j++) {
+          Node<T>* source = leaf->P2P_list[j];
+          p2p.add(source->src_coord_soa.data(), source->src_coord_soa.size()*sizeof(real_t), node);
+          p2p.add(source->src_value.data(), source->src_value.size()*sizeof(T), node);
+        }
+        l2p.add(leaf->dn_equiv.data(), leaf->dn_equiv.size()*sizeof(T), node);
+        l2p.add(leaf->trg_coord.data(), leaf->trg_coord.size()*sizeof(real_t), node);
+        l2p.add(leaf->trg_value.data(), leaf->trg_value.size()*sizeof(T), node);
+      }
+      for (size_t i=0; i<nodes.size(); i++) {
+        int node = numa_node_of_thread(contiguous_owner(i, nodes.size(), nthreads), nthreads);
+        m2l.add(nodes[i].up_equiv.data(), nodes[i].up_equiv.size()*sizeof(T), node);
+        m2l.add(nodes[i].dn_equiv.data(), nodes[i].dn_equiv.size()*sizeof(T), node);
+      }
+      // M2L buffers, gathered by node and transformed by chunks of fft_size
+      size_t nequiv = nsurf * nrhs;
+      size_t ngather = std::min(m2l_up_equiv.capacity(), m2l_dn_equiv.capacity()) / nequiv;
+      for (size_t i=0; i<ngather; i++) {
+        int node = numa_node_of_thread(contiguous_owner(i, ngather, nthreads), nthreads);
+        m2l.add(m2l_up_equiv.data()+i*nequiv, nequiv*sizeof(T), node);
+        m2l.add(m2l_dn_equiv.data()+i*nequiv, nequiv*sizeof(T), node);
+      }
+      size_t fft_size = 2 * NCHILD * nfreq;
+      for (const AlignedVec* fft : {&m2l_fft_in, &m2l_fft_out}) {
+        size_t nchunks = fft->capacity() / fft_size;
+        for (size_t i=0; i<nchunks; i++) {
+          int node = numa_node_of_thread(contiguous_owner(i, nchunks, nthreads), nthreads);
+          m2l.add(fft->data()+i*fft_size, fft_size*sizeof(real_t), node);
+        }
+      }
+      std::map<std::string, double> fractions;
+      fractions["P2M"] = p2m.fraction();
+      fractions["P2P"] = p2p.fraction();
+      fractions["M2L"] = m2l.fraction();
+      fractions["L2P"] = l2p.fraction();
+      if (verbose) {
+        for (auto& f : fractions)
+          print(f.first + " Remote Fraction", f.second);
+      }
+      return fractions;
+    }
+
+    //! Record the leaf and position of each source, required by evaluate_delta().
+    void delta_setup(NodePtrs<T>& leafs) {
+      size_t nsrcs = 0;
+      for (size_t i=0; i<leafs.size(); i++) {
+        for (size_t j=0; j<leafs[i]->isrcs.size(); j++)
+          nsrcs = std::max(nsrcs, size_t(leafs[i]->isrcs[j]+1));
+      }
+      src_location.assign(nsrcs, std::make_pair((Node<T>*)nullptr, -1));
+      for (size_t i=0; i<leafs.size(); i++) {
+        for (size_t j=0; j<leafs[i]->isrcs.size(); j++)
+          src_location[leafs[i]->isrcs[j]] = std::make_pair(leafs[i], int(j));
+      }
+    }
+
+    /**
+     * @brief Update the potentials and gradients of a previous evaluation after the charges of some sources change.
+     * Since the FMM is linear, only the field induced by the charge increments is evaluated and added to trg_value:
+     * P2M and M2M run on the affected leaves and their ancestors, and M2L, P2L, M2P and P2P only on the interactions
+     * whose source is affected. L2L and L2P still visit every node that receives a far-field contribution.
+     * The charges stored in the leaves are updated as well, and the increments of the expansions are added to the
+     * expansions of the previous evaluation, so that query() and later updates see the new charges.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes.
+     * @param ibodies Initial numbering of the sources whose charges change.
+     * @param dq Charge increments, dq[i*nrhs+r] is the increment of the r-th charge of source ibodies[i].
+     */
+    void evaluate_delta(Nodes<T>& nodes, NodePtrs<T>& leafs, const std::vector<int>& ibodies,
+                        const std::vector<T>& dq, bool verbose=true) {
+      // gather the changed sources of each affected leaf, which temporarily replace the leaf's sources
+      std::map<Node<T>*, std::vector<int>> changed;
+      for (size_t i=0; i<ibodies.size(); i++) {
+        assert(size_t(ibodies[i]) < src_location.size() && src_location[ibodies[i]].first);
+        changed[src_location[ibodies[i]].first].push_back(i);
+      }
+      NodePtrs<T> src_leafs;
+      std::vector<RealVec> src_coords;
+      std::vector<std::vector<T>> src_values;
+      std::vector<AlignedVec> src_soas(changed.size());
+      for (auto it=changed.begin(); it!=changed.end(); ++it) {
+        Node<T>* leaf = it->first;
+        RealVec coord;
+        std::vector<T> value;
+        for (size_t i=0; i<it->second.size(); i++) {
+          int ichanged = it->second[i];
+          int j = src_location[ibodies[ichanged]].second;
+          for (int d=0; d<3; d++)
+            coord.push_back(leaf->src_coord[3*j+d]);
+          for (int r=0; r<nrhs; r++) {
+            value.push_back(dq[ichanged*nrhs+r]);
+            leaf->src_value[j*nrhs+r] += dq[ichanged*nrhs+r];
+          }
+        }
+        src_leafs.push_back(leaf);
+        src_coords.push_back(coord);
+        src_values.push_back(value);
+      }
+      for (size_t i=0; i<src_leafs.size(); i++) {
+        std::swap(src_leafs[i]->src_coord, src_coords[i]);
+        std::swap(src_leafs[i]->src_value, src_values[i]);
+        std::swap(src_leafs[i]->src_coord_soa, src_soas[i]);
+        src_leafs[i]->src_coord_soa = transpose_coord(src_leafs[i]->src_coord);
+      }
+
+      // mark the affected leaves and their ancestors, whose upward equivalent charges are nonzero
+      int max_level = 0;
+      for (size_t i=0; i<nodes.size(); i++)
+        max_level = std::max(max_level, nodes[i].level);
+      std::vector<bool> is_source(nodes.size(), false);
+      std::vector<NodePtrs<T>> src_nonleafs(max_level+1);   // affected non-leaf nodes of each level
+      for (size_t i=0; i<src_leafs.size(); i++) {
+        Node<T>* node = src_leafs[i];
+        is_source[node->idx] = true;
+        while (node->parent && !is_source[node->parent->idx]) {
+          node = node->parent;
+          is_source[node->idx] = true;
+          src_nonleafs[node->level].push_back(node);
+        }
+      }
+      // the increments are computed in the expansions of these nodes, whose values are set aside meanwhile:
+      // the affected nodes and the unaffected children of affected non-leaves, which M2M reads as zero
+      NodePtrs<T> up_nodes(src_leafs);
+      for (int level=0; level<=max_level; level++) {
+        for (size_t i=0; i<src_nonleafs[level].size(); i++) {
+          Node<T>* node = src_nonleafs[level][i];
+          up_nodes.push_back(node);
+          for (int octant=0; octant<8; octant++) {
+            Node<T>* child = node->children[octant];
+            if (child && !is_source[child->idx])
+              up_nodes.push_back(child);
+          }
+        }
+      }
+      std::vector<std::vector<T>> up_saved(up_nodes.size());
+      for (size_t i=0; i<up_nodes.size(); i++) {
+        up_saved[i].assign(up_nodes[i]->up_equiv.size(), T(0.));
+        std::swap(up_nodes[i]->up_equiv, up_saved[i]);
+      }
+
+      start("P2M");
+      P2M(src_leafs);
+      stop("P2M", verbose);
+      start("M2M");
+      for (int level=max_level; level>=0; level--) {
+#pragma omp parallel for
+        for (size_t i=0; i<src_nonleafs[level].size(); i++)
+          M2M_node(src_nonleafs[level][i]);
+      }
+      stop("M2M", verbose);
+
+      // mark the nodes that receive a far-field contribution and their descendants
+      NodePtrs<T> m2l_targets;
+      std::vector<bool> is_target(nodes.size(), false);
+      for (size_t i=0; i<nodes.size(); i++) {
+        Node<T>* node = &nodes[i];
+        for (size_t j=0; j<node->M2L_list.size(); j++) {
+          if (node->M2L_list[j] && is_source[node->M2L_list[j]->idx]) {
+            m2l_targets.push_back(node);
+            for (int octant=0; octant<8; octant++) {
+              if (node->children[octant])
+                is_target[node->children[octant]->idx] = true;
+            }
+            break;
+          }
+        }
+        for (size_t j=0; j<node->P2L_list.size(); j++) {
+          if (is_source[node->P2L_list[j]->idx]) {
+            is_target[node->idx] = true;
+            break;
+          }
+        }
+      }
+      std::vector<NodePtrs<T>> trg_nonleafs(max_level+1);   // nodes of each level passing contributions to children
+      NodePtrs<T> trg_leafs;
+      NodePtrs<T> dn_nodes;
+      for (size_t i=0; i<nodes.size(); i++) {   // parents precede children in nodes
+        Node<T>* node = &nodes[i];
+        if (node->parent && is_target[node->parent->idx])
+          is_target[node->idx] = true;
+        if (!is_target[node->idx]) continue;
+        dn_nodes.push_back(node);
+        if (node->is_leaf)
+          trg_leafs.push_back(node);
+        else
+          trg_nonleafs[node->level].push_back(node);
+      }
+      std::vector<std::vector<T>> dn_saved(dn_nodes.size());
+      for (size_t i=0; i<dn_nodes.size(); i++) {
+        dn_saved[i].assign(dn_nodes[i]->dn_equiv.size(), T(0.));
+        std::swap(dn_nodes[i]->dn_equiv, dn_saved[i]);
+      }
+      // leaves evaluated with a cached L2P operator and leaves skipped by L2P keep downward check potentials
+      // until query_setup() converts them, their increments are kept as check potentials as well
+      std::vector<bool> keeps_check(nodes.size(), leaf_map.empty());
+      for (size_t i=0; i<leafs.size() && leaf_map.empty(); i++)
+        keeps_check[leafs[i]->idx] = i < l2p_matrix.size() && !l2p_matrix[i].empty();
+
+      start("P2L");
+      P2L(nodes, is_source);
+      stop("P2L", verbose);
+      start("M2P");
+      M2P(leafs, is_source);
+      stop("M2P", verbose);
       start("P2P");
-      P2P(leafs);
+      P2P(leafs, is_source);
       stop("P2P", verbose);
       start("M2L");
-      M2L(nodes);
+      M2L_subset(nodes, m2l_targets, is_source);
       stop("M2L", verbose);
       start("L2L");
-#pragma omp parallel
-#pragma omp single nowait
-      L2L(&nodes[0]);
+      for (int level=0; level<=max_level; level++) {
+#pragma omp parallel for
+        for (size_t i=0; i<trg_nonleafs[level].size(); i++)
+          L2L_node(trg_nonleafs[level][i]);
+      }
       stop("L2L", verbose);
       start("L2P");
-      L2P(leafs);
+      std::vector<std::vector<T>> dn_check(trg_leafs.size());
+      for (size_t i=0; i<trg_leafs.size(); i++) {
+        if (keeps_check[trg_leafs[i]->idx])
+          dn_check[i] = trg_leafs[i]->dn_equiv;
+      }
+      L2P(trg_leafs);
+      for (size_t i=0; i<trg_leafs.size(); i++) {
+        if (keeps_check[trg_leafs[i]->idx])
+          std::swap(trg_leafs[i]->dn_equiv, dn_check[i]);
+      }
       stop("L2P", verbose);
+
+      // add the increments to the expansions of the previous evaluation
+      for (size_t i=0; i<up_nodes.size(); i++) {
+        for (size_t k=0; k<up_saved[i].size(); k++)
+          up_nodes[i]->up_equiv[k] += up_saved[i][k];
+      }
+      for (size_t i=0; i<dn_nodes.size(); i++) {
+        for (size_t k=0; k<dn_saved[i].size(); k++)
+          dn_nodes[i]->dn_equiv[k] += dn_saved[i][k];
+      }
+      for (size_t i=0; i<src_leafs.size(); i++) {
+        std::swap(src_leafs[i]->src_coord, src_coords[i]);
+        std::swap(src_leafs[i]->src_value, src_values[i]);
+        std::swap(src_leafs[i]->src_coord_soa, src_soas[i]);
+      }
+    }
+
+    /**
+     * @brief Prepare query() after a completed downward pass: index the leaves by key and convert the
+     * downward check potentials of leaves skipped by L2P (leaves without sources and targets) to equivalent charges.
+     *
+     * @param nodes Vector of all nodes.
+     * @param leafs Vector of pointers to leaf nodes evaluated by the downward pass.
+     */
+    void query_setup(Nodes<T>& nodes, NodePtrs<T>& leafs) {
+      std::vector<bool> is_evaluated(nodes.size(), false);
+      for (size_t i=0; i<leafs.size(); i++)
+        is_evaluated[leafs[i]->idx] = true;
+      // leaves evaluated with a cached L2P operator still hold downward check potentials,
+      // convert them with L2P() on copies without targets
+      if (!l2p_matrix.empty()) {
+        Nodes<T> copies;
+        for (size_t i=0; i<leafs.size(); i++) {
+          if (l2p_matrix[i].empty()) continue;
+          Node<T> copy;
+          copy.idx = i;
+          copy.level = leafs[i]->level;
+          copy.x = leafs[i]->x;
+          copy.dn_equiv = leafs[i]->dn_equiv;
+          copies.push_back(copy);
+        }
+        NodePtrs<T> copy_ptrs;
+        for (size_t i=0; i<copies.size(); i++)
+          copy_ptrs.push_back(&copies[i]);
+        L2P(copy_ptrs);
+        for (size_t i=0; i<copies.size(); i++)
+          leafs[copies[i].idx]->dn_equiv = copies[i].dn_equiv;
+      }
+      NodePtrs<T> skipped_leafs;
+      leaf_map.clear();
+      for (size_t i=0; i<nodes.size(); i++) {
+        if (!nodes[i].is_leaf) continue;
+        leaf_map[nodes[i].key] = &nodes[i];
+        if (!is_evaluated[i])
+          skipped_leafs.push_back(&nodes[i]);
+      }
+      L2P(skipped_leafs);
+    }
+
+    //! Find the leaf that contains a point, points outside the root box are assigned to the closest leaf.
+    Node<T>* find_leaf(vec3 X) {
+      for (int level=depth; level>=0; level--) {
+        ivec3 iX = get3DIndex(X, level, x0, r0);
+        for (int d=0; d<3; d++)
+          iX[d] = std::min(std::max(iX[d], 0), (1 << level) - 1);
+        auto it = leaf_map.find(getKey(iX, level));
+        if (it != leaf_map.end())
+          return it->second;
+      }
+      return nullptr;
+    }
+
+    /**
+     * @brief Evaluate potentials (and gradients) at arbitrary points inside the root box after a completed pass,
+     * without rebuilding the tree. The points are grouped by the leaf that contains them, and each group is
+     * evaluated with the leaf's downward equivalent charges (L2P), M2P_list (M2P) and P2P_list (P2P).
+     * query_setup() must be called once after the downward pass. In non-adaptive trees, the interaction lists
+     * of leaves without targets are not built, so points must lie in leaves that contain targets.
+     *
+     * @param coord Vector of coordinates of query points.
+     * @return Vector of results in the layout of trg_value: ntrg_values() values per right-hand side per point.
+     */
+    std::vector<T> query(RealVec& coord) {
+      int npoints = coord.size() / 3;
+      int nvalues = ntrg_values() * nrhs;
+      std::vector<T> values(npoints*nvalues, T(0.));
+      // locate the leaf of each point and group the points by leaf
+      std::vector<Node<T>*> point_leaf(npoints);
+#pragma omp parallel for
+      for (int i=0; i<npoints; i++) {
+        vec3 X;
+        for (int d=0; d<3; d++) X[d] = coord[3*i+d];
+        point_leaf[i] = find_leaf(X);
+        assert(point_leaf[i]);
+      }
+      std::unordered_map<Node<T>*, std::vector<int>> groups;
+      for (int i=0; i<npoints; i++)
+        groups[point_leaf[i]].push_back(i);
+      NodePtrs<T> query_leafs;
+      std::vector<std::vector<int>> query_points;
+      for (auto it=groups.begin(); it!=groups.end(); ++it) {
+        query_leafs.push_back(it->first);
+        query_points.push_back(it->second);
+      }
+
+      real_t c[3] = {0.0};
+      std::vector<RealVec> up_equiv_surf(depth+1), dn_equiv_surf(depth+1);
+      for (int level=0; level<=depth; level++) {
+        up_equiv_surf[level] = surface(p, r0, level, c, 1.05);
+        dn_equiv_surf[level] = surface(p, r0, level, c, 2.95);
+      }
+#pragma omp parallel for schedule(dynamic)
+      for (size_t i=0; i<query_leafs.size(); i++) {
+        Node<T>* leaf = query_leafs[i];
+        std::vector<int>& ipoints = query_points[i];
+        RealVec trg_coord(3*ipoints.size());
+        for (size_t j=0; j<ipoints.size(); j++) {
+          for (int d=0; d<3; d++)
+            trg_coord[3*j+d] = coord[3*ipoints[j]+d];
+        }
+        std::vector<T> trg_value(nvalues*ipoints.size(), T(0.));
+        // L2P
+        RealVec equiv_coord(nsurf*3);
+        for (int k=0; k<nsurf; k++) {
+          for (int d=0; d<3; d++)
+            equiv_coord[3*k+d] = dn_equiv_surf[leaf->level][3*k+d] + leaf->x[d];
+        }
+        evaluate_P2P(equiv_coord, leaf->dn_equiv, trg_coord, trg_value);
+        // M2P
+        for (size_t j=0; j<leaf->M2P_list.size(); j++) {
+          Node<T>* source = leaf->M2P_list[j];
+          for (int k=0; k<nsurf; k++) {
+            for (int d=0; d<3; d++)
+              equiv_coord[3*k+d] = up_equiv_surf[source->level][3*k+d] + source->x[d];
+          }
+          evaluate_P2P(equiv_coord, source->up_equiv, trg_coord, trg_value);
+        }
+        // P2P
+        AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+        AlignedVec src_buffer;
+        for (size_t j=0; j<leaf->P2P_list.size(); j++) {
+          Node<T>* source = leaf->P2P_list[j];
+          evaluate_P2P(source_soa(source, src_buffer), source->src_value, SoACoord(trg, ipoints.size()), trg_value);
+        }
+        for (size_t j=0; j<ipoints.size(); j++) {
+          for (int v=0; v<nvalues; v++)
+            values[ipoints[j]*nvalues+v] = trg_value[j*nvalues+v];
+        }
+      }
+      return values;
     }
 
     /**
      * @brief Check FMM accuracy.
      *
      * @param leafs Vector of leaves.
-     * @return The relative error of potential and gradient in L2 norm.
+     * @return The relative error of potential and gradient in L2 norm, the gradient error is 0 in potential-only mode.
      */
     RealVec verify(NodePtrs<T>& leafs, bool sample=false) {
       Nodes<T> targets;  // vector of target nodes
@@ -225,7 +1719,7 @@ namespace exafmm_t {
         Node<T>* target = &targets2[i];
         std::fill(target->trg_value.begin(), target->trg_value.end(), 0.);
         for (size_t j=0; j<leafs.size(); j++) {
-          gradient_P2P(leafs[j]->src_coord, leafs[j]->src_value, target->trg_coord, target->trg_value);
+          evaluate_P2P(leafs[j]->src_coord, leafs[j]->src_value, target->trg_coord, target->trg_value);
         }
       }
 
@@ -247,21 +1741,23 @@ namespace exafmm_t {
       }
       */
 
-      // relative error in L2 norm
+      // relative error in L2 norm, accumulated over all right-hand sides
+      int nvalues = ntrg_values();
       double p_diff = 0, p_norm = 0, g_diff = 0, g_norm = 0;
       for (size_t i=0; i<targets.size(); i++) {
-        for (int j=0; j<targets[i].ntrgs; j++) {
-          p_norm += std::norm(targets2[i].trg_value[4*j+0]);
-          p_diff += std::norm(targets2[i].trg_value[4*j+0] - targets[i].trg_value[4*j+0]);
-          for (int d=1; d<4; d++) {
-            g_diff += std::norm(targets2[i].trg_value[4*j+d] - targets[i].trg_value[4*j+d]);
-            g_norm += std::norm(targets2[i].trg_value[4*j+d]);
+        for (int j=0; j<targets[i].ntrgs*nrhs; j++) {
+          p_norm += std::norm(targets2[i].trg_value[nvalues*j+0]);
+          p_diff += std::norm(targets2[i].trg_value[nvalues*j+0] - targets[i].trg_value[nvalues*j+0]);
+          for (int d=1; d<nvalues; d++) {
+            g_diff += std::norm(targets2[i].trg_value[nvalues*j+d] - targets[i].trg_value[nvalues*j+d]);
+            g_norm += std::norm(targets2[i].trg_value[nvalues*j+d]);
           }
         }
       }
-      RealVec err(2);
+      RealVec err(2, 0);
       err[0] = sqrt(p_diff/p_norm);   // potential error in L2 norm
-      err[1] = sqrt(g_diff/g_norm);   // gradient error in L2 norm
+      if (g_norm > 0)
+        err[1] = sqrt(g_diff/g_norm);   // gradient error in L2 norm
 
       return err;
     }
@@ -1,5 +1,6 @@
 #ifndef fmm_scale_invariant_h
 #define fmm_scale_invariant_h
+#include <algorithm>    // std::lower_bound
 #include <cstring>      // std::memset
 #include <fstream>      // std::ofstream
 #include <type_traits>  // std::is_same
@@ -42,15 +43,15 @@ namespace exafmm_t {
       matrix_UC2E_V.resize(nsurf_*nsurf_);
       matrix_DC2E_U.resize(nsurf_*nsurf_);
       matrix_DC2E_V.resize(nsurf_*nsurf_);
-      matrix_M2M.resize(REL_COORD[M2M_Type].size(), std::vector<T>(nsurf_*nsurf_));
-      matrix_L2L.resize(REL_COORD[L2L_Type].size(), std::vector<T>(nsurf_*nsurf_));
-      matrix_M2L.resize(REL_COORD[M2L_Type].size(), AlignedVec(size));    
+      matrix_M2M.resize(rel_coord(M2M_Type).size(), std::vector<T>(nsurf_*nsurf_));
+      matrix_L2L.resize(rel_coord(L2L_Type).size(), std::vector<T>(nsurf_*nsurf_));
+      matrix_M2L.resize(rel_coord(M2L_Type).size(), AlignedVec(size));    
     }
 
     //! Precompute M2M and L2L
     void precompute_M2M() {
       int& nsurf_ = this->nsurf;
-      int npos = REL_COORD[M2M_Type].size();  // number of relative positions
+      int npos = rel_coord(M2M_Type).size();  // number of relative positions
       int level = 0;
       real_t parent_coord[3] = {0, 0, 0};
       RealVec parent_up_check_surf = surface(this->p, this->r0, level, parent_coord, 2.95);
@@ -58,7 +59,7 @@ namespace exafmm_t {
 #pragma omp parallel for
       for (int i=0; i<npos; i++) {
         // compute kernel matrix
-        ivec3& coord = REL_COORD[M2M_Type][i];
+        const ivec3& coord = rel_coord(M2M_Type)[i];
         real_t child_coord[3] = {parent_coord[0] + coord[0]*s,
                                  parent_coord[1] + coord[1]*s,
                                  parent_coord[2] + coord[2]*s};
@@ -112,8 +113,8 @@ namespace exafmm_t {
     //! Check and load precomputation matrices
     void load_matrix() {
       size_t size_M2L = this->nfreq * 2 * NCHILD * NCHILD;
-      size_t file_size = (2*REL_COORD[M2M_Type].size()+4) * this->nsurf * this->nsurf * sizeof(T) 
-                       + REL_COORD[M2L_Type].size() * size_M2L * sizeof(real_t)
+      size_t file_size = (2*rel_coord(M2M_Type).size()+4) * this->nsurf * this->nsurf * sizeof(T) 
+                       + rel_coord(M2L_Type).size() * size_M2L * sizeof(real_t)
                        + 1 * sizeof(real_t);   // +1 denotes r0
       std::ifstream file(this->filename, std::ifstream::binary);
       if (file.good()) {
@@ -161,7 +162,9 @@ namespace exafmm_t {
 
     //! P2M operator
     void P2M(NodePtrs<T>& leafs) {
+      OpScope scope(P2M_Op, this->counters);
       int& nsurf_ = this->nsurf;
+      int& nrhs_ = this->nrhs;
       real_t c[3] = {0,0,0};
       std::vector<RealVec> up_check_surf;
       up_check_surf.resize(this->depth+1);
@@ -169,8 +172,7 @@ namespace exafmm_t {
         up_check_surf[level].resize(nsurf_*3);
         up_check_surf[level] = surface(this->p, this->r0, level, c, 2.95);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<leafs.size(); i++) {
+      this->parallel_for(leafs.size(), [&](size_t i) {
         Node<T>* leaf = leafs[i];
         int level = leaf->level;
         real_t scale = pow(0.5, level);  // scaling factor of UC2UE precomputation matrix
@@ -181,22 +183,26 @@ namespace exafmm_t {
           check_coord[3*k+1] = up_check_surf[level][3*k+1] + leaf->x[1];
           check_coord[3*k+2] = up_check_surf[level][3*k+2] + leaf->x[2];
         }
-        this->potential_P2P(leaf->src_coord, leaf->src_value,
-                            check_coord, leaf->up_equiv);
+        AlignedVec src_buffer;
+        AlignedVec check = transpose_coord(check_coord, TRG_PAD);
+        this->potential_P2P_multi(this->source_soa(leaf, src_buffer), leaf->src_value,
+                                  SoACoord(check, nsurf_), leaf->up_equiv, nrhs_);
         // convert upward check potential to upward equivalent charge
-        std::vector<T> buffer(nsurf_);
-        std::vector<T> equiv(nsurf_);
-        gemv(nsurf_, nsurf_, &matrix_UC2E_U[0], &(leaf->up_equiv[0]), &buffer[0]);
-        gemv(nsurf_, nsurf_, &matrix_UC2E_V[0], &buffer[0], &equiv[0]);
+        std::vector<T> buffer(nsurf_*nrhs_);
+        std::vector<T> equiv(nsurf_*nrhs_);
+        matmul(nsurf_, nrhs_, nsurf_, &matrix_UC2E_U[0], &(leaf->up_equiv[0]), &buffer[0]);
+        matmul(nsurf_, nrhs_, nsurf_, &matrix_UC2E_V[0], &buffer[0], &equiv[0]);
         // scale the check-to-equivalent conversion (precomputation)
-        for (int k=0; k<nsurf_; k++)
+        for (int k=0; k<nsurf_*nrhs_; k++)
           leaf->up_equiv[k] = scale * equiv[k];
-      }
+      });
     }
 
     //! L2P operator
     void L2P(NodePtrs<T>& leafs) {
+      OpScope scope(L2P_Op, this->counters);
       int& nsurf_ = this->nsurf;
+      int& nrhs_ = this->nrhs;
       real_t c[3] = {0.0};
       std::vector<RealVec> dn_equiv_surf;
       dn_equiv_surf.resize(this->depth+1);
@@ -204,18 +210,17 @@ namespace exafmm_t {
         dn_equiv_surf[level].resize(nsurf_*3);
         dn_equiv_surf[level] = surface(this->p, this->r0, level, c, 2.95);
       }
-#pragma omp parallel for
-      for (size_t i=0; i<leafs.size(); i++) {
+      this->parallel_for(leafs.size(), [&](size_t i) {
         Node<T>* leaf = leafs[i];
         int level = leaf->level;
         real_t scale = pow(0.5, level);
         // convert downward check potential to downward equivalent charge
-        std::vector<T> buffer(nsurf_);
-        std::vector<T> equiv(nsurf_);
-        gemv(nsurf_, nsurf_, &matrix_DC2E_U[0], &(leaf->dn_equiv[0]), &buffer[0]);
-        gemv(nsurf_, nsurf_, &matrix_DC2E_V[0], &buffer[0], &equiv[0]);
+        std::vector<T> buffer(nsurf_*nrhs_);
+        std::vector<T> equiv(nsurf_*nrhs_);
+        matmul(nsurf_, nrhs_, nsurf_, &matrix_DC2E_U[0], &(leaf->dn_equiv[0]), &buffer[0]);
+        matmul(nsurf_, nrhs_, nsurf_, &matrix_DC2E_V[0], &buffer[0], &equiv[0]);
         // scale the check-to-equivalent conversion (precomputation)
-        for (int k=0; k<nsurf_; k++)
+        for (int k=0; k<nsurf_*nrhs_; k++)
           leaf->dn_equiv[k] = scale * equiv[k];
         // calculate targets' potential & gradient induced by downward equivalent charge
         RealVec equiv_coord(nsurf_*3);
@@ -224,124 +229,124 @@ namespace exafmm_t {
           equiv_coord[3*k+1] = dn_equiv_surf[level][3*k+1] + leaf->x[1];
           equiv_coord[3*k+2] = dn_equiv_surf[level][3*k+2] + leaf->x[2];
         }
-        this->gradient_P2P(equiv_coord, leaf->dn_equiv,
-                           leaf->trg_coord, leaf->trg_value);
-      }
+        AlignedVec trg_buffer;
+        AlignedVec equiv_soa = transpose_coord(equiv_coord);
+        this->evaluate_P2P(SoACoord(equiv_soa, nsurf_), leaf->dn_equiv,
+                           this->target_soa(leaf, trg_buffer), leaf->trg_value);
+      });
     }
 
-    //! M2M operator
-    void M2M(Node<T>* node) {
+    //! M2M operator of a single non-leaf node, its children's upward equivalent charges must be ready
+    void M2M_node(Node<T>* node) {
+      OpScope scope(M2M_Op, this->counters);
       int& nsurf_ = this->nsurf;
-      if (node->is_leaf) return;
-      for (int octant=0; octant<8; octant++) {
-        if (node->children[octant])
-#pragma omp task untied
-          M2M(node->children[octant]);
-      }
-#pragma omp taskwait
+      int& nrhs_ = this->nrhs;
       // evaluate parent's upward equivalent charge from child's upward equivalent charge
       for (int octant=0; octant<8; octant++) {
         if (node->children[octant]) {
           Node<T>* child = node->children[octant];
-          std::vector<T> buffer(nsurf_);
-          gemv(nsurf_, nsurf_, &(matrix_M2M[octant][0]), &child->up_equiv[0], &buffer[0]);
-          for (int k=0; k<nsurf_; k++) {
+          std::vector<T> buffer(nsurf_*nrhs_);
+          matmul(nsurf_, nrhs_, nsurf_, &(matrix_M2M[octant][0]), &child->up_equiv[0], &buffer[0]);
+          for (int k=0; k<nsurf_*nrhs_; k++) {
             node->up_equiv[k] += buffer[k];
           }
         }
       }
     }
 
-    //! L2L operator
-    void L2L(Node<T>* node) {
+    //! L2L operator of a single non-leaf node, its downward check potential must be ready
+    void L2L_node(Node<T>* node) {
+      OpScope scope(L2L_Op, this->counters);
       int& nsurf_ = this->nsurf;
-      if (node->is_leaf) return;
+      int& nrhs_ = this->nrhs;
       // evaluate child's downward check potential from parent's downward check potential
       for (int octant=0; octant<8; octant++) {
         if (node->children[octant]) {
           Node<T>* child = node->children[octant];
-          std::vector<T> buffer(nsurf_);
-          gemv(nsurf_, nsurf_, &(matrix_L2L[octant][0]), &node->dn_equiv[0], &buffer[0]);
-          for (int k=0; k<nsurf_; k++)
+          std::vector<T> buffer(nsurf_*nrhs_);
+          matmul(nsurf_, nrhs_, nsurf_, &(matrix_L2L[octant][0]), &node->dn_equiv[0], &buffer[0]);
+          for (int k=0; k<nsurf_*nrhs_; k++)
             child->dn_equiv[k] += buffer[k];
         }
       }
-      for (int octant=0; octant<8; octant++) {
-        if (node->children[octant])
-#pragma omp task untied
-          L2L(node->children[octant]);
-      }
-#pragma omp taskwait
     }
 
-    void M2L_setup(NodePtrs<T> nonleafs) {
-      int& nsurf_ = this->nsurf;
-      int npos = REL_COORD[M2L_Type].size();  // number of M2L relative positions
+    /**
+     * @brief Compute the M2L setup data of target nodes.
+     *
+     * @param nonleafs Vector of pointers to target (non-leaf) nodes.
+     * @param is_source Whether a node (by index) is included as a source, all nodes are included if it is empty.
+     * @return M2L setup data, the offsets index the arrays of all nodes.
+     */
+    M2LData M2L_data(const NodePtrs<T>& nonleafs, const std::vector<bool>& is_source=std::vector<bool>()) const {
+      int nsurf_ = this->nsurf;
+      int nrhs_ = this->nrhs;
+      int npos = rel_coord(M2L_Type).size();  // number of M2L relative positions
 
       // construct lists of source nodes and target nodes for M2L operator
-      NodePtrs<T>& trg_nodes = nonleafs;
+      const NodePtrs<T>& trg_nodes = nonleafs;
       std::set<Node<T>*> src_nodes_;
       for (size_t i=0; i<trg_nodes.size(); i++) {
         NodePtrs<T>& M2L_list = trg_nodes[i]->M2L_list;
         for (int k=0; k<npos; k++) {
-          if (M2L_list[k]) {
+          if (M2L_list[k] && (is_source.empty() || is_source[M2L_list[k]->idx])) {
             src_nodes_.insert(M2L_list[k]);
           }
         }
       }
-      NodePtrs<T> src_nodes;
-      auto it = src_nodes_.begin(); 
-      for (; it!=src_nodes_.end(); it++) {
-        src_nodes.push_back(*it);
-      }
+      NodePtrs<T> src_nodes(src_nodes_.begin(), src_nodes_.end());   // sorted by address
 
       // prepare the indices of src_nodes & trg_nodes in all_up_equiv & all_dn_equiv
-      std::vector<size_t> fft_offset(src_nodes.size());
-      std::vector<size_t> ifft_offset(trg_nodes.size());
-      RealVec ifft_scale(trg_nodes.size());
+      M2LData data;
+      data.fft_offset.resize(src_nodes.size());
+      data.ifft_offset.resize(trg_nodes.size());
+      data.ifft_scale.resize(trg_nodes.size());
       for (size_t i=0; i<src_nodes.size(); i++) {
-        fft_offset[i] = src_nodes[i]->children[0]->idx * nsurf_;
+        data.fft_offset[i] = src_nodes[i]->children[0]->idx * nsurf_ * nrhs_;
       }
       for (size_t i=0; i<trg_nodes.size(); i++) {
         int level = trg_nodes[i]->level+1;
-        ifft_offset[i] = trg_nodes[i]->children[0]->idx * nsurf_;
-        ifft_scale[i] = powf(2.0, level);
+        data.ifft_offset[i] = trg_nodes[i]->children[0]->idx * nsurf_ * nrhs_;
+        data.ifft_scale[i] = powf(2.0, level);
       }
 
       // calculate interaction_offset_f & interaction_count_offset
-      std::vector<size_t> interaction_offset_f;
-      std::vector<size_t> interaction_count_offset;
-      for (size_t i=0; i<src_nodes.size(); i++) {
-        src_nodes[i]->idx_M2L = i;
-      }
       size_t nblk_trg = trg_nodes.size() * sizeof(real_t) / CACHE_SIZE;
       if (nblk_trg==0) nblk_trg = 1;
       size_t interaction_count_offset_ = 0;
-      size_t fft_size = 2 * NCHILD * this->nfreq;
+      size_t fft_size = 2 * NCHILD * this->nfreq * nrhs_;   // fft chunks of all right-hand sides of a node
       for (size_t iblk_trg=0; iblk_trg<nblk_trg; iblk_trg++) {
         size_t blk_start = (trg_nodes.size()* iblk_trg   ) / nblk_trg;
         size_t blk_end   = (trg_nodes.size()*(iblk_trg+1)) / nblk_trg;
         for (int k=0; k<npos; k++) {
           for (size_t i=blk_start; i<blk_end; i++) {
             NodePtrs<T>& M2L_list = trg_nodes[i]->M2L_list;
-            if (M2L_list[k]) {
-              interaction_offset_f.push_back(M2L_list[k]->idx_M2L * fft_size);
-              interaction_offset_f.push_back(        i           * fft_size);
+            if (M2L_list[k] && (is_source.empty() || is_source[M2L_list[k]->idx])) {
+              size_t isrc = std::lower_bound(src_nodes.begin(), src_nodes.end(), M2L_list[k]) - src_nodes.begin();
+              data.interaction_offset_f.push_back(isrc * fft_size);
+              data.interaction_offset_f.push_back(  i  * fft_size);
               interaction_count_offset_++;
             }
           }
-          interaction_count_offset.push_back(interaction_count_offset_);
+          data.interaction_count_offset.push_back(interaction_count_offset_);
         }
       }
-      m2ldata.fft_offset = fft_offset;
-      m2ldata.ifft_offset = ifft_offset;
-      m2ldata.ifft_scale = ifft_scale;
-      m2ldata.interaction_offset_f = interaction_offset_f;
-      m2ldata.interaction_count_offset = interaction_count_offset;
+      return data;
+    }
+
+    /**
+     * @brief Setup the M2L interactions of target nodes.
+     *
+     * @param nonleafs Vector of pointers to target (non-leaf) nodes.
+     * @param is_source Whether a node (by index) is included as a source, all nodes are included if it is empty.
+     */
+    void M2L_setup(NodePtrs<T> nonleafs, const std::vector<bool>& is_source=std::vector<bool>()) {
+      m2ldata = M2L_data(nonleafs, is_source);
     }
 
     void hadamard_product(std::vector<size_t>& interaction_count_offset, std::vector<size_t>& interaction_offset_f,
-                         AlignedVec& fft_in, AlignedVec& fft_out) {
+                         AlignedVec& fft_in, AlignedVec& fft_out, size_t nchunks_out) {
+      OpScope scope(M2L_Hadamard_Op, this->counters);
       size_t fft_size = 2 * NCHILD * this->nfreq;
       AlignedVec zero_vec0(fft_size, 0.);
       AlignedVec zero_vec1(fft_size, 0.);
@@ -349,37 +354,38 @@ namespace exafmm_t {
       size_t npos = matrix_M2L.size();
       size_t nblk_inter = interaction_count_offset.size();   // num of blocks of interactions
       size_t nblk_trg = nblk_inter / npos;                   // num of blocks based on trg_nodes
-      int BLOCK_SIZE = CACHE_SIZE * 2 / sizeof(real_t);
+      int nrhs_ = this->nrhs;
+      int BLOCK_SIZE = CACHE_SIZE * 2 / sizeof(real_t) * nrhs_;
       std::vector<real_t*> IN_(BLOCK_SIZE*nblk_inter);
       std::vector<real_t*> OUT_(BLOCK_SIZE*nblk_inter);
 
       // initialize fft_out with zero
-#pragma omp parallel for
-      for (size_t i=0; i<fft_out.capacity()/fft_size; ++i) {
+      this->parallel_for(nchunks_out, [&](size_t i) {
         std::memset(fft_out.data()+i*fft_size, 0, fft_size*sizeof(real_t));
-      }
+      });
 
-#pragma omp parallel for
-      for (size_t iblk_inter=0; iblk_inter<nblk_inter; iblk_inter++) {
+      this->parallel_for(nblk_inter, [&](size_t iblk_inter) {
         size_t interaction_count_offset0 = (iblk_inter==0 ? 0 : interaction_count_offset[iblk_inter-1]);
         size_t interaction_count_offset1 = interaction_count_offset[iblk_inter] ;
         size_t interact_count = interaction_count_offset1-interaction_count_offset0;
+        // each interaction is applied to the fft chunks of all right-hand sides, which are adjacent in fft_in & fft_out
         for (size_t j=0; j<interact_count; j++) {
-          IN_ [BLOCK_SIZE*iblk_inter+j] = &fft_in[interaction_offset_f[(interaction_count_offset0+j)*2+0]];
-          OUT_[BLOCK_SIZE*iblk_inter+j] = &fft_out[interaction_offset_f[(interaction_count_offset0+j)*2+1]];
+          for (int r=0; r<nrhs_; r++) {
+            IN_ [BLOCK_SIZE*iblk_inter+j*nrhs_+r] = &fft_in[interaction_offset_f[(interaction_count_offset0+j)*2+0] + r*fft_size];
+            OUT_[BLOCK_SIZE*iblk_inter+j*nrhs_+r] = &fft_out[interaction_offset_f[(interaction_count_offset0+j)*2+1] + r*fft_size];
+          }
         }
-        IN_ [BLOCK_SIZE*iblk_inter+interact_count] = &zero_vec0[0];
-        OUT_[BLOCK_SIZE*iblk_inter+interact_count] = &zero_vec1[0];
-      }
+        IN_ [BLOCK_SIZE*iblk_inter+interact_count*nrhs_] = &zero_vec0[0];
+        OUT_[BLOCK_SIZE*iblk_inter+interact_count*nrhs_] = &zero_vec1[0];
+      });
 
       for (size_t iblk_trg=0; iblk_trg<nblk_trg; iblk_trg++) {
-#pragma omp parallel for
-        for (int k=0; k<this->nfreq; k++) {
+        this->parallel_for(this->nfreq, [&](size_t k) {
           for (size_t ipos=0; ipos< npos; ipos++) {
             size_t iblk_inter = iblk_trg*npos+ipos;
             size_t interaction_count_offset0 = (iblk_inter==0 ? 0 : interaction_count_offset[iblk_inter-1]);
             size_t interaction_count_offset1 = interaction_count_offset[iblk_inter] ;
-            size_t interaction_count  = interaction_count_offset1 - interaction_count_offset0;
+            size_t interaction_count  = (interaction_count_offset1 - interaction_count_offset0) * nrhs_;
             real_t** IN = &IN_[BLOCK_SIZE*iblk_inter];
             real_t** OUT= &OUT_[BLOCK_SIZE*iblk_inter];
             real_t* M = &matrix_M2L[ipos][k*2*NCHILD*NCHILD]; // k-th freq's (row) offset in matrix_M2L[ipos]
@@ -392,10 +398,12 @@ namespace exafmm_t {
               matmult_8x8x2(M_, IN0, IN1, OUT0, OUT1);
             }
           }
-        }
+        });
       }
-      // add flop
-      add_flop((long long)(8*8*8)*(interaction_offset_f.size()/2)*this->nfreq);
+      // add flop, each interaction reads half of an 8x8 complex matrix shared by a pair, its input and updates its output
+      size_t ninteractions = (interaction_offset_f.size()/2) * this->nfreq * nrhs_;
+      add_flop((long long)(8*8*8)*ninteractions);
+      add_bytes((long long)sizeof(real_t)*(NCHILD*NCHILD+6*NCHILD)*ninteractions);
     }
     
     void fft_up_equiv(std::vector<size_t>& fft_offset,
@@ -404,39 +412,88 @@ namespace exafmm_t {
     void ifft_dn_check(std::vector<size_t>& ifft_offset, RealVec& ifft_scal,
                        AlignedVec& fft_out, RealVec& all_dn_equiv) {}
 
+    /**
+     * @brief FFT, Hadamard product and IFFT of M2L setup data on gathered equivalent charges, which are added to the
+     * gathered check potentials.
+     *
+     * @param data M2L setup data.
+     * @param all_up_equiv Gathered upward equivalent charges.
+     * @param all_dn_equiv Gathered downward check potentials.
+     * @param fft_in Buffer of the transformed charges.
+     * @param fft_out Buffer of the transformed check potentials.
+     * @param is_phase Whether the Hadamard product is recorded as a phase, which only one thread may do at a time.
+     */
+    void M2L_convolve(M2LData& data, std::vector<T>& all_up_equiv, std::vector<T>& all_dn_equiv,
+                      AlignedVec& fft_in, AlignedVec& fft_out, bool is_phase=true) {
+      size_t fft_size = 2 * NCHILD * this->nfreq * this->nrhs;
+      fft_in.reserve(data.fft_offset.size()*fft_size);
+      fft_out.reserve(data.ifft_offset.size()*fft_size);
+      {
+        ProfileScope scope("fft_up_equiv");
+        fft_up_equiv(data.fft_offset, all_up_equiv, fft_in);
+      }
+      if (is_phase) this->start_phase("hadamard_product");   // a phase of its own, to count the cache misses of its blocking
+      hadamard_product(data.interaction_count_offset, data.interaction_offset_f, fft_in, fft_out,
+                       data.ifft_offset.size()*this->nrhs);
+      if (is_phase) this->stop_phase("hadamard_product", false);
+      {
+        ProfileScope scope("ifft_dn_check");
+        ifft_dn_check(data.ifft_offset, data.ifft_scale, fft_out, all_dn_equiv);
+      }
+    }
+
     void M2L(Nodes<T>& nodes) {
-      int& nsurf_ = this->nsurf;
-      size_t fft_size = 2 * NCHILD * this->nfreq;
+      int nequiv = this->nsurf * this->nrhs;   // equivalent charges of all right-hand sides per node
       int nnodes = nodes.size();
 
       // allocate memory
-      std::vector<T> all_up_equiv, all_dn_equiv;
-      all_up_equiv.reserve(nnodes*nsurf_);   // use reserve() to avoid the overhead of calling constructor
-      all_dn_equiv.reserve(nnodes*nsurf_);   // use pointer instead of iterator to access elements 
+      std::vector<T> up_equiv, dn_equiv;
       AlignedVec fft_in, fft_out;
-      fft_in.reserve(m2ldata.fft_offset.size()*fft_size);
-      fft_out.reserve(m2ldata.ifft_offset.size()*fft_size);
+      std::vector<T>& all_up_equiv = this->m2l_buffer(this->m2l_up_equiv, up_equiv);
+      std::vector<T>& all_dn_equiv = this->m2l_buffer(this->m2l_dn_equiv, dn_equiv);
+      all_up_equiv.reserve(nnodes*nequiv);   // use reserve() to avoid the overhead of calling constructor
+      all_dn_equiv.reserve(nnodes*nequiv);   // use pointer instead of iterator to access elements 
 
       // gather all upward equivalent charges
-#pragma omp parallel for collapse(2)
-      for (int i=0; i<nnodes; i++) {
-        for (int j=0; j<nsurf_; j++) {
-          all_up_equiv[i*nsurf_+j] = nodes[i].up_equiv[j];
-          all_dn_equiv[i*nsurf_+j] = nodes[i].dn_equiv[j];
+      this->parallel_for(nnodes, [&](size_t i) {
+        for (int j=0; j<nequiv; j++) {
+          all_up_equiv[i*nequiv+j] = nodes[i].up_equiv[j];
+          all_dn_equiv[i*nequiv+j] = nodes[i].dn_equiv[j];
         }
-      }
+      });
 
-      fft_up_equiv(m2ldata.fft_offset, all_up_equiv, fft_in);
-      hadamard_product(m2ldata.interaction_count_offset, m2ldata.interaction_offset_f, fft_in, fft_out);
-      ifft_dn_check(m2ldata.ifft_offset, m2ldata.ifft_scale, fft_out, all_dn_equiv);
+      M2L_convolve(m2ldata, all_up_equiv, all_dn_equiv,
+                   this->m2l_buffer(this->m2l_fft_in, fft_in), this->m2l_buffer(this->m2l_fft_out, fft_out));
 
       // scatter all downward check potentials
-#pragma omp parallel for collapse(2)
-      for (int i=0; i<nnodes; i++) {
-        for (int j=0; j<nsurf_; j++) {
-          nodes[i].dn_equiv[j] = all_dn_equiv[i*nsurf_+j];
+      this->parallel_for(nnodes, [&](size_t i) {
+        for (int j=0; j<nequiv; j++) {
+          nodes[i].dn_equiv[j] = all_dn_equiv[i*nequiv+j];
         }
-      }
+      });
+    }
+
+    /**
+     * @brief M2L operator restricted to the given target nodes and the marked source nodes, the M2L setup of the
+     * whole tree is kept. Only the children of the sources and of the targets are gathered and scattered.
+     */
+    void M2L_subset(Nodes<T>& nodes, NodePtrs<T>& targets, const std::vector<bool>& is_source) {
+      M2LData data = M2L_data(targets, is_source);
+      std::vector<T> up_equiv, dn_equiv;
+      AlignedVec fft_in, fft_out;
+      std::vector<size_t> trg_children = this->M2L_gather(nodes, data, up_equiv, dn_equiv);
+      M2L_convolve(data, up_equiv, dn_equiv, fft_in, fft_out);
+      this->M2L_scatter(nodes, trg_children, dn_equiv);
+    }
+
+    void M2L_group(Nodes<T>& nodes, NodePtrs<T>& targets) {
+      M2LData data = M2L_data(targets);
+      if (data.interaction_offset_f.empty()) return;
+      std::vector<T> up_equiv, dn_equiv;
+      AlignedVec fft_in, fft_out;
+      std::vector<size_t> trg_children = this->M2L_gather(nodes, data, up_equiv, dn_equiv);
+      M2L_convolve(data, up_equiv, dn_equiv, fft_in, fft_out, false);
+      this->M2L_scatter(nodes, trg_children, dn_equiv);
     }
   };
 
@@ -444,7 +501,7 @@ namespace exafmm_t {
   /** Below are member function specializations
    */
   template <>
-  void FmmScaleInvariant<real_t>::precompute_check2equiv() {
+  inline void FmmScaleInvariant<real_t>::precompute_check2equiv() {
     int level = 0;
     real_t c[3] = {0, 0, 0};
     int& nsurf_ = this->nsurf;
@@ -476,7 +533,7 @@ namespace exafmm_t {
   }
 
   template <>
-  void FmmScaleInvariant<complex_t>::precompute_check2equiv() {
+  inline void FmmScaleInvariant<complex_t>::precompute_check2equiv() {
     int level = 0;
     real_t c[3] = {0, 0, 0};
     int& nsurf_ = this->nsurf;
@@ -515,24 +572,26 @@ namespace exafmm_t {
 
   //! member function specialization for real type
   template <>
-  void FmmScaleInvariant<real_t>::precompute_M2L() {
+  inline void FmmScaleInvariant<real_t>::precompute_M2L() {
     int n1 = this->p * 2;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
-    std::vector<RealVec> matrix_M2L_Helper(REL_COORD[M2L_Helper_Type].size(),
+    std::vector<RealVec> matrix_M2L_Helper(rel_coord(M2L_Helper_Type).size(),
                                            RealVec(2*nfreq_));
     // create fft plan
     RealVec fftw_in(nconv_);
     RealVec fftw_out(2*nfreq_);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_dft_r2c(3, dim, fftw_in.data(), reinterpret_cast<fft_complex*>(fftw_out.data()), FFTW_ESTIMATE);
+    lock.unlock();
     // compute M2L kernel matrix, perform DFT
     RealVec trg_coord(3,0);
 #pragma omp parallel for
-    for (size_t i=0; i<REL_COORD[M2L_Helper_Type].size(); ++i) {
+    for (size_t i=0; i<rel_coord(M2L_Helper_Type).size(); ++i) {
       real_t coord[3];
       for (int d=0; d<3; d++) {
-        coord[d] = REL_COORD[M2L_Helper_Type][i][d] * this->r0 / 0.5;  // relative coords
+        coord[d] = rel_coord(M2L_Helper_Type)[i][d] * this->r0 / 0.5;  // relative coords
       }
       RealVec conv_coord = convolution_grid(this->p, this->r0, 0, coord);   // convolution grid
       RealVec conv_value(nconv_);   // potentials on convolution grid
@@ -541,9 +600,9 @@ namespace exafmm_t {
     }
     // convert M2L_Helper to M2L and reorder data layout to improve locality
 #pragma omp parallel for
-    for (size_t i=0; i<REL_COORD[M2L_Type].size(); ++i) {
+    for (size_t i=0; i<rel_coord(M2L_Type).size(); ++i) {
       for (int j=0; j<NCHILD*NCHILD; j++) {   // loop over child's relative positions
-        int child_rel_idx = M2L_INDEX_MAP[i][j];
+        int child_rel_idx = m2l_index_map()[i][j];
         if (child_rel_idx != -1) {
           for (int k=0; k<nfreq_; k++) {   // loop over frequencies
             int new_idx = k*(2*NCHILD*NCHILD) + 2*j;
@@ -554,12 +613,14 @@ namespace exafmm_t {
       }
     }
     // destroy fftw plan
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   template <>
-  void FmmScaleInvariant<real_t>::fft_up_equiv(std::vector<size_t>& fft_offset,
+  inline void FmmScaleInvariant<real_t>::fft_up_equiv(std::vector<size_t>& fft_offset,
                                                RealVec& all_up_equiv, AlignedVec& fft_in) {
+    OpScope scope(M2L_FFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -570,42 +631,48 @@ namespace exafmm_t {
     AlignedVec fftw_in(nconv_ * NCHILD);
     AlignedVec fftw_out(fft_size);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft_r2c(3, dim, NCHILD,
                                           (real_t*)&fftw_in[0], nullptr, 1, nconv_,
                                           (fft_complex*)(&fftw_out[0]), nullptr, 1, nfreq_,
                                           FFTW_ESTIMATE);
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<fft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, false);   // flops of an execution of the plan
+    long long nbytes = sizeof(real_t)*NCHILD*nsurf_ + sizeof(real_t)*fft_size;   // read up_equiv, write fft_in
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(fft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer(fft_size, 0);
-      real_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's upward_equiv in all_up_equiv, size=8*nsurf_
+      real_t* up_equiv = &all_up_equiv[fft_offset[node_idx]];  // offset ptr of node's 8 child's upward_equiv in all_up_equiv, size=8*nsurf_*nrhs_
       // upward_equiv_fft (input of r2c) here should have a size of N3*NCHILD
       // the node_idx's chunk of fft_out has a size of 2*N3_*NCHILD
       // since it's larger than what we need,  we can use fft_out as fftw_in buffer here
-      real_t* up_equiv_f = &fft_in[fft_size*node_idx]; // offset ptr of node_idx in fft_in vector, size=fft_size
+      real_t* up_equiv_f = &fft_in[fft_size*idx_rhs]; // offset ptr of node_idx's r-th rhs in fft_in vector, size=fft_size
       std::memset(up_equiv_f, 0, fft_size*sizeof(real_t));  // initialize fft_in to 0
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          up_equiv_f[idx+j*nconv_] = up_equiv[j*nsurf_+k];
+          up_equiv_f[idx+j*nconv_] = up_equiv[(j*nsurf_+k)*nrhs_+r];
       }
       fft_execute_dft_r2c(plan, up_equiv_f, (fft_complex*)&buffer[0]);
-      // add flop
-      double add, mul, fma;
-      fft_flops(plan, &add, &mul, &fma);
-      add_flop((long long)(add + mul + 2*fma));
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nfreq_; k++) {
         for (int j=0; j<NCHILD; j++) {
           up_equiv_f[2*(NCHILD*k+j)+0] = buffer[2*(nfreq_*j+k)+0];
           up_equiv_f[2*(NCHILD*k+j)+1] = buffer[2*(nfreq_*j+k)+1];
         }
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
 
   template <>
-  void FmmScaleInvariant<real_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, RealVec& ifft_scal,
+  inline void FmmScaleInvariant<real_t>::ifft_dn_check(std::vector<size_t>& ifft_offset, RealVec& ifft_scal,
                        AlignedVec& fft_out, RealVec& all_dn_equiv) {
+    OpScope scope(M2L_IFFT_Op, this->counters);
     int& nsurf_ = this->nsurf;
     int& nconv_ = this->nconv;
     int& nfreq_ = this->nfreq;
@@ -616,32 +683,37 @@ namespace exafmm_t {
     AlignedVec fftw_in(fft_size);
     AlignedVec fftw_out(nconv_ * NCHILD);
     int dim[3] = {n1, n1, n1};
+    std::unique_lock<std::mutex> lock(fft_planner_mutex());   // the FFTW planner is not thread-safe
     fft_plan plan = fft_plan_many_dft_c2r(3, dim, NCHILD,
                                  (fft_complex*)&fftw_in[0], nullptr, 1, nfreq_,
                                  (real_t*)(&fftw_out[0]), nullptr, 1, nconv_,
                                  FFTW_ESTIMATE);
-#pragma omp parallel for
-    for (size_t node_idx=0; node_idx<ifft_offset.size(); node_idx++) {
+    lock.unlock();
+    long long nflop = fft_plan_flop(plan, n1*n1*n1, NCHILD, false);   // flops of an execution of the plan
+    long long nbytes = sizeof(real_t)*fft_size + 2*sizeof(real_t)*NCHILD*nsurf_;   // read fft_out, update dn_equiv
+    int& nrhs_ = this->nrhs;
+    this->parallel_for(ifft_offset.size()*nrhs_, [&](size_t idx_rhs) {
+      size_t node_idx = idx_rhs / nrhs_;
+      int r = idx_rhs % nrhs_;
       RealVec buffer0(fft_size, 0);
       RealVec buffer1(fft_size, 0);
-      real_t* dn_check_f = &fft_out[fft_size*node_idx];  // offset ptr for node_idx in fft_out vector, size=fft_size
-      real_t* dn_equiv = &all_dn_equiv[ifft_offset[node_idx]];  // offset ptr for node_idx's child's dn_equiv in all_dn_equiv, size=numChilds * nsurf_
+      real_t* dn_check_f = &fft_out[fft_size*idx_rhs];  // offset ptr for node_idx's r-th rhs in fft_out vector, size=fft_size
+      real_t* dn_equiv = &all_dn_equiv[ifft_offset[node_idx]];  // offset ptr for node_idx's child's dn_equiv in all_dn_equiv, size=numChilds * nsurf_ * nrhs_
       for (int k=0; k<nfreq_; k++)
         for (int j=0; j<NCHILD; j++) {
           buffer0[2*(nfreq_*j+k)+0] = dn_check_f[2*(NCHILD*k+j)+0];
           buffer0[2*(nfreq_*j+k)+1] = dn_check_f[2*(NCHILD*k+j)+1];
         }
       fft_execute_dft_c2r(plan, (fft_complex*)&buffer0[0], (real_t*)&buffer1[0]);
-      // add flop
-      double add, mul, fma;
-      fft_flops(plan, &add, &mul, &fma);
-      add_flop((long long)(add + mul + 2*fma));
+      add_flop(nflop);
+      add_bytes(nbytes);
       for (int k=0; k<nsurf_; k++) {
         size_t idx = map[k];
         for (int j=0; j<NCHILD; j++)
-          dn_equiv[nsurf_*j+k] += buffer1[idx+j*nconv_] * ifft_scal[node_idx];
+          dn_equiv[(nsurf_*j+k)*nrhs_+r] += buffer1[idx+j*nconv_] * ifft_scal[node_idx];
       }
-    }
+    });
+    lock.lock();
     fft_destroy_plan(plan);
   }
 }  // end namespace
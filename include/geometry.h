@@ -3,8 +3,6 @@
 #include "exafmm_t.h"
 
 namespace exafmm_t {
-  // Global variables REL_COORD, HASH_LUT, M2L_INDEX_MAP are now defined in exafmm_t.h.
-
   /**
    * @brief Given a box, calculate the coordinates of surface points.
    *
@@ -18,7 +16,7 @@ namespace exafmm_t {
    * 
    * @return Vector of coordinates of surface points. 
    */
-  RealVec surface(int p, real_t r0, int level, real_t * c, real_t alpha) {
+  inline RealVec surface(int p, real_t r0, int level, real_t * c, real_t alpha) {
     int n = 6*(p-1)*(p-1) + 2;
     RealVec coord(n*3);
     coord[0] = -1.0;
@@ -72,7 +70,7 @@ namespace exafmm_t {
    *
    * @return Vector of coordinates of convolution grid.
    */
-  RealVec convolution_grid(int p, real_t r0, int level, real_t * c) {
+  inline RealVec convolution_grid(int p, real_t r0, int level, real_t * c) {
     real_t d = 2 * r0 * powf(0.5, level);
     real_t a = d * 1.05;  // side length of upward equivalent/downward check box
     int n1 = p * 2;
@@ -98,7 +96,7 @@ namespace exafmm_t {
    * 
    * @return A mapping from upward equivalent surface point index to convolution grid index.
    */
-  std::vector<int> generate_surf2conv_up(int p) {
+  inline std::vector<int> generate_surf2conv_up(int p) {
     int n1 = 2*p;
     real_t c[3];
     for (int d=0; d<3; d++) c[d] = 0.5*(p-1);
@@ -119,7 +117,7 @@ namespace exafmm_t {
    * 
    * @return A mapping from downward check surface point index to convolution grid index.
    */
-  std::vector<int> generate_surf2conv_dn(int p) {
+  inline std::vector<int> generate_surf2conv_dn(int p) {
     int n1 = 2*p;
     real_t c[3];
     for (int d=0; d<3; d++) c[d] = 0.5*(p-1);
@@ -133,6 +131,60 @@ namespace exafmm_t {
     return map;
   }
 
+  /**
+   * @brief Transpose coordinates from AoS layout (x0,y0,z0,x1,...) to SoA layout (x0,x1,...,y0,y1,...,z0,z1,...).
+   * The number of points is padded to a multiple of npad by repeating the last point.
+   *
+   * @param coord Vector of coordinates in AoS layout.
+   * @param npad Padding size, the number of points is rounded up to a multiple of it.
+   * @return Vector of coordinates in SoA layout, each component takes one third of the vector.
+   */
+  inline AlignedVec transpose_coord(const RealVec& coord, int npad=1) {
+    int n = coord.size() / 3;
+    int n_pad = (n + npad - 1) / npad * npad;
+    AlignedVec soa(3*n_pad);
+    for (int i=0; i<n_pad; i++) {
+      int j = std::min(i, n-1);
+      for (int d=0; d<3; d++) {
+        soa[d*n_pad+i] = coord[3*j+d];
+      }
+    }
+    return soa;
+  }
+
+  const int TRG_PAD = 2 * NSIMD;   //!< Padding of targets in SoA layout, the P2P kernels evaluate two simdvecs of targets at a time
+
+  //! Coordinates in the SoA layout of transpose_coord(), as read by the P2P kernels.
+  struct SoACoord {
+    const real_t* x;   //!< x-coordinates of the padded points, followed by the y- and z-coordinates
+    int n;             //!< Number of points
+    int npad;          //!< Number of points with the padding, the distance between two components
+
+    SoACoord(const AlignedVec& soa, int n_) : x(soa.data()), n(n_), npad(soa.size()/3) {}
+
+    //! Coordinates in AoS layout without the padding.
+    RealVec aos() const {
+      RealVec coord(3*n);
+      for (int i=0; i<n; i++) {
+        for (int d=0; d<3; d++)
+          coord[3*i+d] = x[d*npad+i];
+      }
+      return coord;
+    }
+  };
+
+  /**
+   * @brief Build the SoA copies of the coordinates of a leaf, so that the P2P kernels do not transpose them
+   * on every call. Call it whenever src_coord or trg_coord of the leaf change.
+   *
+   * @param node Leaf node.
+   */
+  template <typename T>
+  void transpose_leaf(Node<T>* node) {
+    node->src_coord_soa = transpose_coord(node->src_coord);
+    node->trg_coord_soa = transpose_coord(node->trg_coord, TRG_PAD);
+  }
+
   /**
    * @brief Compute the hash value of a relative position (coordinates).
    *
@@ -140,7 +192,7 @@ namespace exafmm_t {
    *
    * @return Hash value of the relative position (x + 10y + 100z + 555).
    */
-  int hash(ivec3& coord) {
+  inline int hash(ivec3& coord) {
     const int n = 5;
     return ((coord[2]+n) * (2*n) + (coord[1]+n)) *(2*n) + (coord[0]+n);
   }
@@ -148,14 +200,15 @@ namespace exafmm_t {
   /**
    * @brief Compute the coordinates of possible relative positions for operator t.
    *
+   * @param tables Tables to fill.
    * @param max_r Max range.
    * @param min_r Min range.
    * @param step Step.
    * @param t Operator type (e.g. M2M, M2L)
    */
-  void init_rel_coord(int max_r, int min_r, int step, Mat_Type t) {
+  inline void init_rel_coord(RelCoordTables& tables, int max_r, int min_r, int step, Mat_Type t) {
     const int max_hash = 2000;
-    HASH_LUT[t].resize(max_hash, -1);
+    tables.hash_lut[t].resize(max_hash, -1);
     for (int k=-max_r; k<=max_r; k+=step) {
       for (int j=-max_r; j<=max_r; j+=step) {
         for (int i=-max_r; i<=max_r; i+=step) {
@@ -164,8 +217,8 @@ namespace exafmm_t {
             coord[0] = i;
             coord[1] = j;
             coord[2] = k;
-            REL_COORD[t].push_back(coord);
-            HASH_LUT[t][hash(coord)] = REL_COORD[t].size() - 1;
+            tables.rel_coord[t].push_back(coord);
+            tables.hash_lut[t][hash(coord)] = tables.rel_coord[t].size() - 1;
           }
         }
       }
@@ -173,45 +226,69 @@ namespace exafmm_t {
   }
 
   //! Generate a map that maps indices of M2L_Type to indices of M2L_Helper_Type
-  void generate_M2L_index_map() {
-    int npos = REL_COORD[M2L_Type].size();   // number of relative coords for M2L_Type
-    M2L_INDEX_MAP.resize(npos, std::vector<int>(NCHILD*NCHILD));
-#pragma omp parallel for
+  inline void generate_M2L_index_map(RelCoordTables& tables) {
+    int npos = tables.rel_coord[M2L_Type].size();   // number of relative coords for M2L_Type
+    tables.m2l_index_map.resize(npos, std::vector<int>(NCHILD*NCHILD));
     for (int i=0; i<npos; ++i) {
       for (int j1=0; j1<NCHILD; ++j1) {
         for (int j2=0; j2<NCHILD; ++j2) {
-          ivec3& parent_rel_coord = REL_COORD[M2L_Type][i];
+          ivec3& parent_rel_coord = tables.rel_coord[M2L_Type][i];
           ivec3  child_rel_coord;
           child_rel_coord[0] = parent_rel_coord[0]*2 - (j1/1)%2 + (j2/1)%2;
           child_rel_coord[1] = parent_rel_coord[1]*2 - (j1/2)%2 + (j2/2)%2;
           child_rel_coord[2] = parent_rel_coord[2]*2 - (j1/4)%2 + (j2/4)%2;
           int coord_hash = hash(child_rel_coord);
-          int child_rel_idx = HASH_LUT[M2L_Helper_Type][coord_hash];
+          int child_rel_idx = tables.hash_lut[M2L_Helper_Type][coord_hash];
           int j = j2*NCHILD + j1;
-          M2L_INDEX_MAP[i][j] = child_rel_idx;
+          tables.m2l_index_map[i][j] = child_rel_idx;
         }
       }
     }
   }
-  
-  //! Compute the relative positions for all operators and generate M2L index mapping.
-  void init_rel_coord() {
-    static bool is_initialized = false;
-    if (!is_initialized) {
-      REL_COORD.resize(Type_Count);
-      HASH_LUT.resize(Type_Count);
-      init_rel_coord(1, 1, 2, M2M_Type);
-      init_rel_coord(1, 1, 2, L2L_Type);
-      init_rel_coord(3, 3, 2, P2P0_Type);
-      init_rel_coord(1, 0, 1, P2P1_Type);
-      init_rel_coord(3, 3, 2, P2P2_Type);
-      init_rel_coord(3, 2, 1, M2L_Helper_Type);
-      init_rel_coord(1, 1, 1, M2L_Type);
-      init_rel_coord(5, 5, 2, M2P_Type);
-      init_rel_coord(5, 5, 2, P2L_Type);
-      generate_M2L_index_map();
-      is_initialized = true;
-    }
+
+  /**
+   * @brief Relative positions of all operators and the M2L index mapping. The tables are built on the
+   * first call (thread-safe static initialization) and never modified afterwards, so they can be read
+   * concurrently by any number of FMM instances.
+   */
+  inline const RelCoordTables& rel_coord_tables() {
+    static const RelCoordTables tables = []() {
+      RelCoordTables t;
+      t.rel_coord.resize(Type_Count);
+      t.hash_lut.resize(Type_Count);
+      init_rel_coord(t, 1, 1, 2, M2M_Type);
+      init_rel_coord(t, 1, 1, 2, L2L_Type);
+      init_rel_coord(t, 3, 3, 2, P2P0_Type);
+      init_rel_coord(t, 1, 0, 1, P2P1_Type);
+      init_rel_coord(t, 3, 3, 2, P2P2_Type);
+      init_rel_coord(t, 3, 2, 1, M2L_Helper_Type);
+      init_rel_coord(t, 1, 1, 1, M2L_Type);
+      init_rel_coord(t, 5, 5, 2, M2P_Type);
+      init_rel_coord(t, 5, 5, 2, P2L_Type);
+      generate_M2L_index_map(t);
+      return t;
+    }();
+    return tables;
+  }
+
+  //! Possible relative positions of operator t.
+  inline const std::vector<ivec3>& rel_coord(Mat_Type t) {
+    return rel_coord_tables().rel_coord[t];
+  }
+
+  //! Hash lookup table from a relative position to its index in rel_coord(t).
+  inline const std::vector<int>& hash_lut(Mat_Type t) {
+    return rel_coord_tables().hash_lut[t];
+  }
+
+  //! Map from [M2L relative position][octant pair] to the index of the M2L_Helper relative position.
+  inline const std::vector<std::vector<int>>& m2l_index_map() {
+    return rel_coord_tables().m2l_index_map;
+  }
+
+  //! Build the relative position tables ahead of the first use, calling it is optional.
+  inline void init_rel_coord() {
+    rel_coord_tables();
   }
 } // end namespace
 #endif
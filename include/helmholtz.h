@@ -1,5 +1,7 @@
 #ifndef helmholtz_h
 #define helmholtz_h
+#include <limits>       // std::numeric_limits
+#include <sstream>      // std::ostringstream
 #include "exafmm_t.h"
 #include "fmm.h"
 #include "geometry.h"
@@ -18,92 +20,117 @@ namespace exafmm_t {
     {
       wavek = wavek_;
       if (this->filename.empty()) {
-        this->filename = std::string("helmholtz_") + (std::is_same<real_t, float>::value ? "f" : "d")
-                       + std::string("_p") + std::to_string(p) + std::string(".dat");
+        // the matrices depend on the wave number, instances with different ones must not share a file
+        std::ostringstream name;
+        name.precision(std::numeric_limits<real_t>::max_digits10);
+        name << "helmholtz_" << (std::is_same<real_t, float>::value ? "f" : "d") << "_p" << p
+             << "_k" << wavek.real() << "_" << wavek.imag() << ".dat";
+        this->filename = name.str();
       }
     }
 
     /**
      * @brief Compute potentials at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
-    void potential_P2P(RealVec& src_coord, ComplexVec& src_value, RealVec& trg_coord, ComplexVec& trg_value) {
+    void potential_P2P(const SoACoord& src, ComplexVec& src_value, const SoACoord& trg, ComplexVec& trg_value) {
       simdvec zero((real_t)0);
       real_t newton_coef = 16;
       simdvec coef(real_t(1.0/(4*PI*newton_coef)));
       simdvec k_real(wavek.real()/newton_coef);
       simdvec k_imag(wavek.imag()/newton_coef);
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
-      int t;
-      const complex_t I(0, 1);
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
-        simdvec tv_real(zero);
-        simdvec tv_imag(zero);
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv0_real(zero), tv0_imag(zero);
+        simdvec tv1_real(zero), tv1_imag(zero);
         for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
-          sx -= tx;
-          simdvec sy(src_coord[3*s+1]);
-          sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
-          sz -= tz;
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
           simdvec sv_real(src_value[s].real());
           simdvec sv_imag(src_value[s].imag());
-          simdvec r2(zero);
-          r2 += sx * sx;
-          r2 += sy * sy;
-          r2 += sz * sz;
-          simdvec invr = rsqrt(r2);   // invr = newton_coef * 1/r
-          invr &= r2 > zero;
+          simdvec dx0 = sx - tx0;
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);   // invr = newton_coef * 1/r
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
 
-          simdvec r = r2 * invr;
-          simdvec kr_real = k_real * r;  // k_real * r
-          simdvec kr_imag = k_imag * r;  // k_imag * r
-          simdvec e_ikr = exp(-kr_imag); // exp(-k_imag*r)
-          // simdvec kr = k * r2 * invr;   // newton_coefs in k & invr cancel out
-          simdvec G_real = e_ikr * cos(kr_real) * invr;  // G = e^(ikr) / r
-          simdvec G_imag = e_ikr * sin(kr_real) * invr;  // invr carries newton_coef
-          tv_real += sv_real*G_real - sv_imag*G_imag;  // p += G * q
-          tv_imag += sv_real*G_imag + sv_imag*G_real;
+          simdvec r0 = r20 * invr0;        // newton_coefs in k & invr cancel out
+          simdvec r1 = r21 * invr1;
+          simdvec e_ikr0 = exp(-k_imag * r0);   // exp(-k_imag*r)
+          simdvec e_ikr1 = exp(-k_imag * r1);
+          simdvec kr_real0 = k_real * r0;
+          simdvec kr_real1 = k_real * r1;
+          simdvec G_real0 = e_ikr0 * cos(kr_real0) * invr0;  // G = e^(ikr) / r
+          simdvec G_imag0 = e_ikr0 * sin(kr_real0) * invr0;  // invr carries newton_coef
+          simdvec G_real1 = e_ikr1 * cos(kr_real1) * invr1;
+          simdvec G_imag1 = e_ikr1 * sin(kr_real1) * invr1;
+          tv0_real += sv_real*G_real0 - sv_imag*G_imag0;  // p += G * q
+          tv0_imag += sv_real*G_imag0 + sv_imag*G_real0;
+          tv1_real += sv_real*G_real1 - sv_imag*G_imag1;
+          tv1_imag += sv_real*G_imag1 + sv_imag*G_real1;
         }
-        tv_real *= coef;  // coef carries 1/(4*PI) and offsets newton_coef in invr
-        tv_imag *= coef;
-        for (int m=0; m<NSIMD && (t+m)<ntrgs; m++) {
-          trg_value[t+m] += complex_t(tv_real[m], tv_imag[m]);
+        tv0_real *= coef;  // coef carries 1/(4*PI) and offsets newton_coef in invr
+        tv0_imag *= coef;
+        tv1_real *= coef;
+        tv1_imag *= coef;
+        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+          trg_value[t+m] += complex_t(tv0_real[m], tv0_imag[m]);
         }
-      }
-      for (; t<ntrgs; t++) {
-        complex_t potential(0, 0);
-        for (int s=0; s<nsrcs; s++) {
-          vec3 dx;
-          for (int d=0; d<3; d++)
-            dx[d] = trg_coord[3*t+d] - src_coord[3*s+d];
-          real_t r2 = norm(dx);
-          if (r2 != 0) {
-            real_t r = std::sqrt(r2);
-            potential += std::exp(I * r * wavek) * src_value[s] / r;
-          }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[t+NSIMD+m] += complex_t(tv1_real[m], tv1_imag[m]);
         }
-        trg_value[t] += potential / (4*PI);
       }
+      add_flop((long long)ntrgs*(long long)nsrcs*(30+8*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+3*ntrgs)
+                + (long long)sizeof(complex_t)*(src_value.size()+2*trg_value.size()));
+    }
+
+    //! potential_P2P() with the coordinates in AoS layout, which are transposed first.
+    void potential_P2P(RealVec& src_coord, ComplexVec& src_value, RealVec& trg_coord, ComplexVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      potential_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
     }
 
     /**
      * @brief Compute potentials and gradients at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
-    void gradient_P2P(RealVec& src_coord, ComplexVec& src_value, RealVec& trg_coord, ComplexVec& trg_value) {
+    void gradient_P2P(const SoACoord& src, ComplexVec& src_value, const SoACoord& trg, ComplexVec& trg_value) {
       simdvec zero((real_t)0);
       simdvec one((real_t)1);
       real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
@@ -111,100 +138,116 @@ namespace exafmm_t {
       simdvec k_real(wavek.real()/newton_coef);
       simdvec k_imag(wavek.imag()/newton_coef);
       simdvec newton_offset(real_t(1.0/(newton_coef*newton_coef)));   // offset invr2 term
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
-      int t;
-      const complex_t I(0, 1);
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
-        simdvec tv0_real(zero);
-        simdvec tv0_imag(zero);
-        simdvec tv1_real(zero);
-        simdvec tv1_imag(zero);
-        simdvec tv2_real(zero);
-        simdvec tv2_imag(zero);
-        simdvec tv3_real(zero);
-        simdvec tv3_imag(zero);
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv00_real(zero), tv00_imag(zero), tv01_real(zero), tv01_imag(zero);
+        simdvec tv02_real(zero), tv02_imag(zero), tv03_real(zero), tv03_imag(zero);
+        simdvec tv10_real(zero), tv10_imag(zero), tv11_real(zero), tv11_imag(zero);
+        simdvec tv12_real(zero), tv12_imag(zero), tv13_real(zero), tv13_imag(zero);
         for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
-          sx -= tx;    // sx is negative dx
-          simdvec sy(src_coord[3*s+1]);
-          sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
-          sz -= tz;
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
           simdvec sv_real(src_value[s].real());
           simdvec sv_imag(src_value[s].imag());
-          simdvec r2(zero);
-          r2 += sx * sx;
-          r2 += sy * sy;
-          r2 += sz * sz;
-          simdvec invr = rsqrt(r2);
-          invr &= r2 > zero;
+          simdvec dx0 = sx - tx0;    // negative dx
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
 
-          simdvec r = r2 * invr;
-          simdvec kr_real = k_real * r;  // k_real * r
-          simdvec kr_imag = k_imag * r;  // k_imag * r
-          simdvec e_ikr = exp(-kr_imag); // exp(-k_imag*r)
-          // simdvec kr = k * r2 * invr;   // newton_coefs in k & invr cancel out
-          simdvec G_real = e_ikr * cos(kr_real) * invr;  // G = e^(ikr) / r
-          simdvec G_imag = e_ikr * sin(kr_real) * invr;  // invr carries newton_coef
-          simdvec potential_real = sv_real*G_real - sv_imag*G_imag;    // p = G * q
-          simdvec potential_imag = sv_real*G_imag + sv_imag*G_real;
-          tv0_real += potential_real;
-          tv0_imag += potential_imag;
+          simdvec r0 = r20 * invr0;        // newton_coefs in k & invr cancel out
+          simdvec r1 = r21 * invr1;
+          simdvec kr_real0 = k_real * r0;
+          simdvec kr_imag0 = k_imag * r0;
+          simdvec kr_real1 = k_real * r1;
+          simdvec kr_imag1 = k_imag * r1;
+          simdvec e_ikr0 = exp(-kr_imag0);   // exp(-k_imag*r)
+          simdvec e_ikr1 = exp(-kr_imag1);
+          simdvec G_real0 = e_ikr0 * cos(kr_real0) * invr0;  // G = e^(ikr) / r
+          simdvec G_imag0 = e_ikr0 * sin(kr_real0) * invr0;  // invr carries newton_coef
+          simdvec G_real1 = e_ikr1 * cos(kr_real1) * invr1;
+          simdvec G_imag1 = e_ikr1 * sin(kr_real1) * invr1;
+          simdvec potential_real0 = sv_real*G_real0 - sv_imag*G_imag0;    // p = G * q
+          simdvec potential_imag0 = sv_real*G_imag0 + sv_imag*G_real0;
+          simdvec potential_real1 = sv_real*G_real1 - sv_imag*G_imag1;
+          simdvec potential_imag1 = sv_real*G_imag1 + sv_imag*G_real1;
+          tv00_real += potential_real0;
+          tv00_imag += potential_imag0;
+          tv10_real += potential_real1;
+          tv10_imag += potential_imag1;
 
-          // coefg = (1+k_imag*r)/r2 - k_real/r*I (considering the negative sign in sx)
-          simdvec coefg_real = (one+kr_imag) * invr * invr * newton_offset;
-          simdvec coefg_imag = - k_real * invr;
+          // coefg = (1+k_imag*r)/r2 - k_real/r*I (considering the negative sign in dx)
+          simdvec coefg_real0 = (one+kr_imag0) * invr0 * invr0 * newton_offset;
+          simdvec coefg_imag0 = - k_real * invr0;
+          simdvec coefg_real1 = (one+kr_imag1) * invr1 * invr1 * newton_offset;
+          simdvec coefg_imag1 = - k_real * invr1;
           // gradient = coefg * potential * dx
-          simdvec gradient_real = coefg_real*potential_real - coefg_imag*potential_imag;
-          simdvec gradient_imag = coefg_real*potential_imag + coefg_imag*potential_real;
-          tv1_real += sx * gradient_real;
-          tv1_imag += sx * gradient_imag;
-          tv2_real += sy * gradient_real;
-          tv2_imag += sy * gradient_imag;
-          tv3_real += sz * gradient_real;
-          tv3_imag += sz * gradient_imag;
+          simdvec gradient_real0 = coefg_real0*potential_real0 - coefg_imag0*potential_imag0;
+          simdvec gradient_imag0 = coefg_real0*potential_imag0 + coefg_imag0*potential_real0;
+          simdvec gradient_real1 = coefg_real1*potential_real1 - coefg_imag1*potential_imag1;
+          simdvec gradient_imag1 = coefg_real1*potential_imag1 + coefg_imag1*potential_real1;
+          tv01_real += dx0 * gradient_real0;
+          tv01_imag += dx0 * gradient_imag0;
+          tv02_real += dy0 * gradient_real0;
+          tv02_imag += dy0 * gradient_imag0;
+          tv03_real += dz0 * gradient_real0;
+          tv03_imag += dz0 * gradient_imag0;
+          tv11_real += dx1 * gradient_real1;
+          tv11_imag += dx1 * gradient_imag1;
+          tv12_real += dy1 * gradient_real1;
+          tv12_imag += dy1 * gradient_imag1;
+          tv13_real += dz1 * gradient_real1;
+          tv13_imag += dz1 * gradient_imag1;
         }
-        tv0_real *= coef;
-        tv0_imag *= coef;
-        tv1_real *= coef;
-        tv1_imag *= coef;
-        tv2_real *= coef;
-        tv2_imag *= coef;
-        tv3_real *= coef;
-        tv3_imag *= coef;
-        for (int m=0; m<NSIMD && (t+m)<ntrgs; m++) {
-          trg_value[4*(t+m)+0] += complex_t(tv0_real[m], tv0_imag[m]);
-          trg_value[4*(t+m)+1] += complex_t(tv1_real[m], tv1_imag[m]);
-          trg_value[4*(t+m)+2] += complex_t(tv2_real[m], tv2_imag[m]);
-          trg_value[4*(t+m)+3] += complex_t(tv3_real[m], tv3_imag[m]);
+        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+          trg_value[4*(t+m)+0] += complex_t(tv00_real[m], tv00_imag[m]) * coef[m];
+          trg_value[4*(t+m)+1] += complex_t(tv01_real[m], tv01_imag[m]) * coef[m];
+          trg_value[4*(t+m)+2] += complex_t(tv02_real[m], tv02_imag[m]) * coef[m];
+          trg_value[4*(t+m)+3] += complex_t(tv03_real[m], tv03_imag[m]) * coef[m];
         }
-      }
-      for (; t<ntrgs; t++) {
-        complex_t potential(0, 0);
-        cvec3 gradient = complex_t(0., 0.);
-        for (int s=0; s<nsrcs; s++) {
-          vec3 dx;
-          for (int d=0; d<3; d++)
-            dx[d] = trg_coord[3*t+d] - src_coord[3*s+d];
-          real_t r2 = norm(dx);
-          if (r2 != 0) {
-            real_t r = std::sqrt(r2);
-            complex_t potential_ij = std::exp(I * r * wavek) * src_value[s] / r;
-            complex_t coefg = (I*wavek/r - 1/r2) * potential_ij;
-            potential += potential_ij;
-            for (int d=0; d<3; d++)
-              gradient[d] += coefg * dx[d];
-          }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[4*(t+NSIMD+m)+0] += complex_t(tv10_real[m], tv10_imag[m]) * coef[m];
+          trg_value[4*(t+NSIMD+m)+1] += complex_t(tv11_real[m], tv11_imag[m]) * coef[m];
+          trg_value[4*(t+NSIMD+m)+2] += complex_t(tv12_real[m], tv12_imag[m]) * coef[m];
+          trg_value[4*(t+NSIMD+m)+3] += complex_t(tv13_real[m], tv13_imag[m]) * coef[m];
         }
-        trg_value[4*t+0] += potential / (4*PI);
-        trg_value[4*t+1] += gradient[0] / (4*PI);
-        trg_value[4*t+2] += gradient[1] / (4*PI);
-        trg_value[4*t+3] += gradient[2] / (4*PI);
       }
+      add_flop((long long)ntrgs*(long long)nsrcs*(50+8*4));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+3*ntrgs)
+                + (long long)sizeof(complex_t)*(src_value.size()+2*trg_value.size()));
+    }
+
+    //! gradient_P2P() with the coordinates in AoS layout, which are transposed first.
+    void gradient_P2P(RealVec& src_coord, ComplexVec& src_value, RealVec& trg_coord, ComplexVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      gradient_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
     }
   };
 }  // end namespace exafmm_t
@@ -22,7 +22,7 @@ namespace exafmm_t {
    * @param i Hilbert key.
    * @return int Level.
    */
-  int getLevel(uint64_t i) {
+  inline int getLevel(uint64_t i) {
     int level = -1;
     uint64_t offset = 0;
     while (i >= offset) {
@@ -38,7 +38,7 @@ namespace exafmm_t {
    * @param i Hilbert key of a node with level offset.
    * @return uint64_t Parent's Hilbert key.
    */
-  uint64_t getParent(uint64_t i) {
+  inline uint64_t getParent(uint64_t i) {
     int level = getLevel(i);
     return (i - levelOffset(level)) / 8 + levelOffset(level-1);
   }
@@ -49,7 +49,7 @@ namespace exafmm_t {
    * @param i Hilbert key of a node with level offset.
    * @return uint64_t First child's Hilbert key.
    */
-  uint64_t getChild(uint64_t i) {
+  inline uint64_t getChild(uint64_t i) {
     int level = getLevel(i);
     return (i - levelOffset(level)) * 8 + levelOffset(level+1);
   }
@@ -62,22 +62,21 @@ namespace exafmm_t {
    * @return int Octant.
    */
   //! 
-  int getOctant(uint64_t key, bool offset=true) {
+  inline int getOctant(uint64_t key, bool offset=true) {
     int level = getLevel(key);
     if (offset) key -= levelOffset(level);
     return key & 7;
   }
 
   /**
-   * @brief Get Hilbert key from 3D index of a node.
-   * 
+   * @brief Transform the 3D index of a node into the transposed index of the Hilbert curve (Skilling's algorithm),
+   * interleaving its bits gives the position of the node along the curve.
+   *
    * @param iX 3D index of a node, an integer triplet.
    * @param level Level of the node.
-   * @param offset Whether to add level offset to the key, default to true.
-   * @return uint64_t Hilbert key.
+   * @return ivec3 Transposed Hilbert index.
    */
-  uint64_t getKey(ivec3 iX, int level, bool offset=true) {
-#if EXAFMM_HILBERT
+  inline ivec3 hilbertTranspose(ivec3 iX, int level) {
     int M = 1 << (level - 1);
     for (int Q=M; Q>1; Q>>=1) {
       int R = Q - 1;
@@ -95,24 +94,56 @@ namespace exafmm_t {
     for (int Q=M; Q>1; Q>>=1)
       if (iX[2] & Q) t ^= Q - 1;
     for (int d=0; d<3; d++) iX[d] ^= t;
-#endif
+    return iX;
+  }
+
+  //! Interleave the bits of a 3D index into a key without level offset.
+  inline uint64_t interleave(ivec3 iX, int level) {
     uint64_t i = 0;
     for (int l=0; l<level; l++) {
       i |= (iX[2] & (uint64_t)1 << l) << 2*l;
       i |= (iX[1] & (uint64_t)1 << l) << (2*l + 1);
       i |= (iX[0] & (uint64_t)1 << l) << (2*l + 2);
     }
+    return i;
+  }
+
+  /**
+   * @brief Get Hilbert key from 3D index of a node.
+   * 
+   * @param iX 3D index of a node, an integer triplet.
+   * @param level Level of the node.
+   * @param offset Whether to add level offset to the key, default to true.
+   * @return uint64_t Hilbert key.
+   */
+  inline uint64_t getKey(ivec3 iX, int level, bool offset=true) {
+#if EXAFMM_HILBERT
+    iX = hilbertTranspose(iX, level);
+#endif
+    uint64_t i = interleave(iX, level);
     if (offset) i += levelOffset(level);
     return i;
   }
 
+  /**
+   * @brief Get the position of a node along the Hilbert curve of its level, independent of EXAFMM_HILBERT,
+   * used to partition the domain into compact pieces.
+   *
+   * @param iX 3D index of a node, an integer triplet.
+   * @param level Level of the node.
+   * @return uint64_t Hilbert key without level offset.
+   */
+  inline uint64_t getHilbertKey(ivec3 iX, int level) {
+    return interleave(hilbertTranspose(iX, level), level);
+  }
+
   /**
    * @brief Get 3D index from a Hilbert key with level offset.
    * 
    * @param i Hilbert key with level offset.
    * @return ivec3 3D index, an integer triplet.
    */
-  ivec3 get3DIndex(uint64_t i) {
+  inline ivec3 get3DIndex(uint64_t i) {
     int level = getLevel(i);
     i -= levelOffset(level);
     ivec3 iX = 0;
@@ -148,7 +179,7 @@ namespace exafmm_t {
    * @param level Level.
    * @return ivec3 3D index, an integer triplet.
    */
-  ivec3 get3DIndex(uint64_t i, int level) {
+  inline ivec3 get3DIndex(uint64_t i, int level) {
     ivec3 iX = 0;
     for (int l=0; l<level; l++) {
       iX[2] |= (i & (uint64_t)1 << 3*l) >> 2*l;
@@ -184,7 +215,7 @@ namespace exafmm_t {
    * @param r0 Half of the side length of the bounding box.
    * @return ivec3 3D index, an integer triplet.
    */
-  ivec3 get3DIndex(vec3 X, int level, vec3 x0, real_t r0) {
+  inline ivec3 get3DIndex(vec3 X, int level, vec3 x0, real_t r0) {
     vec3 Xmin = x0 - r0;
     real_t dx = 2 * r0 / (1 << level);
     ivec3 iX;
@@ -203,7 +234,7 @@ namespace exafmm_t {
    * @param r0 Half of the side length of the bounding box.
    * @return vec3 3D coordinates.
    */
-  vec3 getCoordinates(ivec3 iX, int level, vec3 x0, real_t r0) {
+  inline vec3 getCoordinates(ivec3 iX, int level, vec3 x0, real_t r0) {
     vec3 Xmin = x0 - r0;
     real_t dx = 2 * r0 / (1 << level);
     vec3 X;
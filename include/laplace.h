@@ -24,92 +24,353 @@ namespace exafmm_t {
     /**
      * @brief Compute potentials at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
-    void potential_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+    void potential_P2P(const SoACoord& src, RealVec& src_value, const SoACoord& trg, RealVec& trg_value) {
       simdvec zero(real_t(0));
       real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
       simdvec coef(real_t(1.0/(4*PI*newton_coef)));
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
-      int t;
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
-        simdvec tv(zero);
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv0(zero);
+        simdvec tv1(zero);
         for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
-          sx -= tx;
-          simdvec sy(src_coord[3*s+1]);
-          sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
-          sz -= tz;
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
           simdvec sv(src_value[s]);
-          simdvec r2(zero);
-          r2 += sx * sx;
-          r2 += sy * sy;
-          r2 += sz * sz;
-          simdvec invr = rsqrt(r2);
-          invr &= r2 > zero;
-          tv += invr * sv;
+          simdvec dx0 = sx - tx0;
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
+          tv0 += invr0 * sv;
+          tv1 += invr1 * sv;
         }
-        tv *= coef;
+        tv0 *= coef;
+        tv1 *= coef;
         for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
-          trg_value[t+m] += tv[m];
+          trg_value[t+m] += tv0[m];
         }
-      }
-      for (; t<ntrgs; t++) {
-        real_t potential = 0;
-        for (int s=0; s<nsrcs; ++s) {
-          vec3 dx = 0;
-          for (int d=0; d<3; d++) {
-            dx[d] += trg_coord[3*t+d] - src_coord[3*s+d];
-          }
-          real_t r2 = norm(dx);
-          if (r2!=0) {
-            real_t invr = 1 / std::sqrt(r2);
-            potential += src_value[s] * invr;
-          }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[t+NSIMD+m] += tv1[m];
         }
-        trg_value[t] += potential / (4*PI);
       }
       add_flop((long long)ntrgs*(long long)nsrcs*(12+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! potential_P2P() with the coordinates in AoS layout, which are transposed first.
+    void potential_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      potential_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
     }
 
     /**
      * @brief Compute potentials and gradients at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
+    void gradient_P2P(const SoACoord& src, RealVec& src_value, const SoACoord& trg, RealVec& trg_value) {
+      simdvec zero(real_t(0));
+      real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
+      simdvec coefp(real_t(1.0/(4*PI*newton_coef)));
+      simdvec coefg(real_t(1.0/(4*PI*newton_coef*newton_coef*newton_coef)));
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv00(zero), tv01(zero), tv02(zero), tv03(zero);
+        simdvec tv10(zero), tv11(zero), tv12(zero), tv13(zero);
+        for (int s=0; s<nsrcs; s++) {
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
+          simdvec sv(src_value[s]);
+          simdvec dx0 = sx - tx0;
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
+          tv00 += sv * invr0;
+          tv10 += sv * invr1;
+          invr0 = sv * ((invr0*invr0) * invr0);
+          invr1 = sv * ((invr1*invr1) * invr1);
+          tv01 += invr0 * dx0;
+          tv02 += invr0 * dy0;
+          tv03 += invr0 * dz0;
+          tv11 += invr1 * dx1;
+          tv12 += invr1 * dy1;
+          tv13 += invr1 * dz1;
+        }
+        tv00 *= coefp;
+        tv01 *= coefg;
+        tv02 *= coefg;
+        tv03 *= coefg;
+        tv10 *= coefp;
+        tv11 *= coefg;
+        tv12 *= coefg;
+        tv13 *= coefg;
+        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+          trg_value[0+4*(t+m)] += tv00[m];
+          trg_value[1+4*(t+m)] += tv01[m];
+          trg_value[2+4*(t+m)] += tv02[m];
+          trg_value[3+4*(t+m)] += tv03[m];
+        }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[0+4*(t+NSIMD+m)] += tv10[m];
+          trg_value[1+4*(t+NSIMD+m)] += tv11[m];
+          trg_value[2+4*(t+NSIMD+m)] += tv12[m];
+          trg_value[3+4*(t+NSIMD+m)] += tv13[m];
+        }
+      }
+      add_flop((long long)ntrgs*(long long)nsrcs*(20+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! gradient_P2P() with the coordinates in AoS layout, which are transposed first.
     void gradient_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      gradient_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
+    }
+
+    /**
+     * @brief Compute potentials at targets induced by sources directly for multiple right-hand sides,
+     * the inverse distances are computed once per pair and applied to all charge vectors.
+     *
+     * @param src Coordinates of sources in SoA layout.
+     * @param src_value Vector of charges of sources, src_value[s*nrhs+r] is the r-th charge of source s.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
+     * @param trg_value Vector of potentials of targets, trg_value[t*nrhs+r] is the r-th potential of target t.
+     * @param nrhs Number of right-hand sides.
+     */
+    void potential_P2P_multi(const SoACoord& src, RealVec& src_value,
+                             const SoACoord& trg, RealVec& trg_value, int nrhs) {
+      if (nrhs == 1) {
+        potential_P2P(src, src_value, trg, trg_value);
+        return;
+      }
+      simdvec zero(real_t(0));
+      real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
+      simdvec coef(real_t(1.0/(4*PI*newton_coef)));
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % NSIMD == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      AlignedVec buffer(nrhs*NSIMD);   // one accumulator per right-hand side
+      simdvec* tv = reinterpret_cast<simdvec*>(&buffer[0]);
+      for (int t=0; t<ntrgs_pad; t+=NSIMD) {
+        simdvec tx(&tx_[t], (int)sizeof(real_t));
+        simdvec ty(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        for (int r=0; r<nrhs; r++)
+          tv[r] = zero;
+        for (int s=0; s<nsrcs; s++) {
+          simdvec dx = simdvec(sx_[s]) - tx;
+          simdvec dy = simdvec(sy_[s]) - ty;
+          simdvec dz = simdvec(sz_[s]) - tz;
+          simdvec r2 = dx * dx;
+          r2 += dy * dy;
+          r2 += dz * dz;
+          simdvec invr = rsqrt(r2);
+          invr &= r2 > zero;
+          real_t * sv = &src_value[s*nrhs];
+          for (int r=0; r<nrhs; r++)
+            tv[r] += invr * simdvec(sv[r]);
+        }
+        for (int r=0; r<nrhs; r++) {
+          tv[r] *= coef;
+          for (int m=0; m<NSIMD && t+m<ntrgs; m++)
+            trg_value[(t+m)*nrhs+r] += tv[r][m];
+        }
+      }
+      add_flop((long long)ntrgs*(long long)nsrcs*(10+2*nrhs+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! potential_P2P_multi() with the coordinates in AoS layout, which are transposed first.
+    void potential_P2P_multi(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value, int nrhs) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      potential_P2P_multi(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value, nrhs);
+    }
+
+    /**
+     * @brief Compute potentials and gradients at targets induced by sources directly for multiple right-hand sides,
+     * the inverse distances are computed once per pair and applied to all charge vectors.
+     *
+     * @param src Coordinates of sources in SoA layout.
+     * @param src_value Vector of charges of sources, src_value[s*nrhs+r] is the r-th charge of source s.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
+     * @param trg_value Vector of potentials and gradients of targets, trg_value[4*(t*nrhs+r)+d] is the r-th result of target t.
+     * @param nrhs Number of right-hand sides.
+     */
+    void gradient_P2P_multi(const SoACoord& src, RealVec& src_value,
+                            const SoACoord& trg, RealVec& trg_value, int nrhs) {
+      if (nrhs == 1) {
+        gradient_P2P(src, src_value, trg, trg_value);
+        return;
+      }
       simdvec zero(real_t(0));
       real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
       simdvec coefp(real_t(1.0/(4*PI*newton_coef)));
       simdvec coefg(real_t(1.0/(4*PI*newton_coef*newton_coef*newton_coef)));
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % NSIMD == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      AlignedVec buffer(4*nrhs*NSIMD);   // potential and gradient accumulators per right-hand side
+      simdvec* tv = reinterpret_cast<simdvec*>(&buffer[0]);
+      for (int t=0; t<ntrgs_pad; t+=NSIMD) {
+        simdvec tx(&tx_[t], (int)sizeof(real_t));
+        simdvec ty(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        for (int i=0; i<4*nrhs; i++)
+          tv[i] = zero;
+        for (int s=0; s<nsrcs; s++) {
+          simdvec dx = simdvec(sx_[s]) - tx;
+          simdvec dy = simdvec(sy_[s]) - ty;
+          simdvec dz = simdvec(sz_[s]) - tz;
+          simdvec r2 = dx * dx;
+          r2 += dy * dy;
+          r2 += dz * dz;
+          simdvec invr = rsqrt(r2);
+          invr &= r2 > zero;
+          simdvec invr3 = (invr*invr) * invr;
+          real_t * sv = &src_value[s*nrhs];
+          for (int r=0; r<nrhs; r++) {
+            simdvec q(sv[r]);
+            tv[4*r+0] += q * invr;
+            q *= invr3;
+            tv[4*r+1] += q * dx;
+            tv[4*r+2] += q * dy;
+            tv[4*r+3] += q * dz;
+          }
+        }
+        for (int r=0; r<nrhs; r++) {
+          tv[4*r+0] *= coefp;
+          tv[4*r+1] *= coefg;
+          tv[4*r+2] *= coefg;
+          tv[4*r+3] *= coefg;
+          for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+            for (int d=0; d<4; d++)
+              trg_value[4*((t+m)*nrhs+r)+d] += tv[4*r+d][m];
+          }
+        }
+      }
+      add_flop((long long)ntrgs*(long long)nsrcs*(12+9*nrhs+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! gradient_P2P_multi() with the coordinates in AoS layout, which are transposed first.
+    void gradient_P2P_multi(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value, int nrhs) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      gradient_P2P_multi(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value, nrhs);
+    }
+
+    /**
+     * @brief Compute potentials and gradients between two groups of bodies directly,
+     * each pair is evaluated once and contributes to both groups.
+     *
+     * @param coord0 Vector of coordinates of the first group.
+     * @param value0 Vector of charges of the first group.
+     * @param result0 Vector of potentials and gradients of the first group.
+     * @param coord1 Vector of coordinates of the second group.
+     * @param value1 Vector of charges of the second group.
+     * @param result1 Vector of potentials and gradients of the second group.
+     */
+    void gradient_P2P_mutual(RealVec& coord0, RealVec& value0, RealVec& result0,
+                             RealVec& coord1, RealVec& value1, RealVec& result1) {
+      simdvec zero(real_t(0));
+      real_t newton_coef = 16;   // comes from Newton's method in simd rsqrt function
+      simdvec coefp(real_t(1.0/(4*PI*newton_coef)));
+      simdvec coefg(real_t(1.0/(4*PI*newton_coef*newton_coef*newton_coef)));
+      int n0 = coord0.size() / 3;
+      int n1 = coord1.size() / 3;
+      // lane-wise partial sums of the second group, reduced after the loop
+      AlignedVec buffer(4*n1*NSIMD, 0);
+      simdvec* rv = reinterpret_cast<simdvec*>(&buffer[0]);
       int t;
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
+      for (t=0; t+NSIMD<=n0; t+=NSIMD) {
+        simdvec tx(&coord0[3*t+0], 3*(int)sizeof(real_t));
+        simdvec ty(&coord0[3*t+1], 3*(int)sizeof(real_t));
+        simdvec tz(&coord0[3*t+2], 3*(int)sizeof(real_t));
+        simdvec tq(&value0[t], (int)sizeof(real_t));
         simdvec tv0(zero);
         simdvec tv1(zero);
         simdvec tv2(zero);
         simdvec tv3(zero);
-        for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
+        for (int s=0; s<n1; s++) {
+          simdvec sx(coord1[3*s+0]);
           sx -= tx;
-          simdvec sy(src_coord[3*s+1]);
+          simdvec sy(coord1[3*s+1]);
           sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
+          simdvec sz(coord1[3*s+2]);
           sz -= tz;
           simdvec r2(zero);
           r2 += sx * sx;
@@ -118,49 +379,68 @@ namespace exafmm_t {
           simdvec invr = rsqrt(r2);
           invr &= r2 > zero;
           simdvec invr3 = (invr*invr) * invr;
-          simdvec sv(src_value[s]);
+          simdvec sv(value1[s]);
           tv0 += sv * invr;
           sv *= invr3;
           tv1 += sv * sx;
           tv2 += sv * sy;
           tv3 += sv * sz;
+          rv[4*s+0] += tq * invr;
+          simdvec qv = tq * invr3;
+          rv[4*s+1] -= qv * sx;
+          rv[4*s+2] -= qv * sy;
+          rv[4*s+3] -= qv * sz;
         }
         tv0 *= coefp;
         tv1 *= coefg;
         tv2 *= coefg;
         tv3 *= coefg;
-        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
-          trg_value[0+4*(t+m)] += tv0[m];
-          trg_value[1+4*(t+m)] += tv1[m];
-          trg_value[2+4*(t+m)] += tv2[m];
-          trg_value[3+4*(t+m)] += tv3[m];
+        for (int m=0; m<NSIMD; m++) {
+          result0[0+4*(t+m)] += tv0[m];
+          result0[1+4*(t+m)] += tv1[m];
+          result0[2+4*(t+m)] += tv2[m];
+          result0[3+4*(t+m)] += tv3[m];
         }
       }
-      for (; t<ntrgs; t++) {
+      real_t scalep = 1.0 / (4*PI*newton_coef);
+      real_t scaleg = 1.0 / (4*PI*newton_coef*newton_coef*newton_coef);
+      for (int s=0; s<n1; s++) {
+        result1[4*s+0] += sum(rv[4*s+0]) * scalep;
+        result1[4*s+1] += sum(rv[4*s+1]) * scaleg;
+        result1[4*s+2] += sum(rv[4*s+2]) * scaleg;
+        result1[4*s+3] += sum(rv[4*s+3]) * scaleg;
+      }
+      for (; t<n0; t++) {
         real_t potential = 0;
         vec3 gradient = 0;
-        for (int s=0; s<nsrcs; ++s) {
+        for (int s=0; s<n1; ++s) {
           vec3 dx = 0;
           for (int d=0; d<3; ++d) {
-            dx[d] = trg_coord[3*t+d] - src_coord[3*s+d];
+            dx[d] = coord0[3*t+d] - coord1[3*s+d];
           }
           real_t r2 = norm(dx);
           if (r2!=0) {
             real_t invr2 = 1.0 / r2;
-            real_t invr = src_value[s] * std::sqrt(invr2);
-            potential += invr;
+            real_t invr = std::sqrt(invr2);
+            potential += value1[s] * invr;
             dx *= invr2 * invr;
-            gradient[0] += dx[0];
-            gradient[1] += dx[1];
-            gradient[2] += dx[2];
+            gradient[0] += value1[s] * dx[0];
+            gradient[1] += value1[s] * dx[1];
+            gradient[2] += value1[s] * dx[2];
+            result1[4*s] += value0[t] * invr / (4*PI);
+            result1[4*s+1] += value0[t] * dx[0] / (4*PI);
+            result1[4*s+2] += value0[t] * dx[1] / (4*PI);
+            result1[4*s+3] += value0[t] * dx[2] / (4*PI);
           }
         }
-        trg_value[4*t] += potential / (4*PI) ;
-        trg_value[4*t+1] -= gradient[0] / (4*PI);
-        trg_value[4*t+2] -= gradient[1] / (4*PI);
-        trg_value[4*t+3] -= gradient[2] / (4*PI);
-      }   
-      add_flop((long long)ntrgs*(long long)nsrcs*(20+4*2));
+        result0[4*t] += potential / (4*PI);
+        result0[4*t+1] -= gradient[0] / (4*PI);
+        result0[4*t+2] -= gradient[1] / (4*PI);
+        result0[4*t+3] -= gradient[2] / (4*PI);
+      }
+      add_flop((long long)n0*(long long)n1*(20+4*2+8));
+      add_bytes((long long)sizeof(real_t)*(coord0.size()+value0.size()+2*result0.size()
+                                            +coord1.size()+value1.size()+2*result1.size()));
     }
   };
 }  // end namespace exafmm_t
@@ -44,11 +44,39 @@ extern "C" {
   void zgesvd_(char *JOBU, char *JOBVT, int *M, int *N, complex<double> *A, int *LDA,
                double *S, complex<double> *U, int *LDU, complex<double> *VT, int *LDVT,
                complex<double> *WORK, int *LWORK, double *RWORK, int *INFO);
+
+  void sgetrf_(int *m, int *n, float *a, int *lda, int *ipiv, int *info);
+
+  void dgetrf_(int *m, int *n, double *a, int *lda, int *ipiv, int *info);
+
+  void cgetrf_(int *M, int *N, complex<float> *A, int *LDA, int *IPIV, int *INFO);
+
+  void zgetrf_(int *M, int *N, complex<double> *A, int *LDA, int *IPIV, int *INFO);
+
+  void sgetrs_(char *trans, int *n, int *nrhs, float *a, int *lda, int *ipiv,
+               float *b, int *ldb, int *info);
+
+  void dgetrs_(char *trans, int *n, int *nrhs, double *a, int *lda, int *ipiv,
+               double *b, int *ldb, int *info);
+
+  void cgetrs_(char *TRANS, int *N, int *NRHS, complex<float> *A, int *LDA, int *IPIV,
+               complex<float> *B, int *LDB, int *INFO);
+
+  void zgetrs_(char *TRANS, int *N, int *NRHS, complex<double> *A, int *LDA, int *IPIV,
+               complex<double> *B, int *LDB, int *INFO);
+
+  void spotrf_(char *uplo, int *n, float *a, int *lda, int *info);
+
+  void dpotrf_(char *uplo, int *n, double *a, int *lda, int *info);
+
+  void spotrs_(char *uplo, int *n, int *nrhs, float *a, int *lda, float *b, int *ldb, int *info);
+
+  void dpotrs_(char *uplo, int *n, int *nrhs, double *a, int *lda, double *b, int *ldb, int *info);
 }
 
 namespace exafmm_t {
   //! blas gemv with row major data
-  void gemv(int m, int n, real_t* A, real_t* x, real_t* y) {
+  inline void gemv(int m, int n, real_t* A, real_t* x, real_t* y) {
     char trans = 'T';
     real_t alpha = 1.0, beta = 0.0;
     int incx = 1, incy = 1;
@@ -58,10 +86,11 @@ namespace exafmm_t {
     dgemv_(&trans, &n, &m, &alpha, A, &n, x, &incx, &beta, y, &incy);
 #endif
     add_flop((long long)(2*m*n));
+    add_bytes((long long)sizeof(real_t)*((long long)m*n+m+n));
   }
 
   // complex gemv by blas lib
-  void gemv(int m, int n, complex_t* A, complex_t* x, complex_t* y) {
+  inline void gemv(int m, int n, complex_t* A, complex_t* x, complex_t* y) {
     char trans = 'T';
     complex_t alpha(1., 0.), beta(0.,0.);
     int incx = 1, incy = 1;
@@ -70,10 +99,12 @@ namespace exafmm_t {
 #else
     zgemv_(&trans, &n, &m, &alpha, A, &n, x, &incx, &beta, y, &incy);
 #endif
+    add_flop((long long)(8*m*n));
+    add_bytes((long long)sizeof(complex_t)*((long long)m*n+m+n));
   }
   
   //! blas gemm with row major data
-  void gemm(int m, int n, int k, real_t* A, real_t* B, real_t* C) {
+  inline void gemm(int m, int n, int k, real_t* A, real_t* B, real_t* C) {
     char transA = 'N', transB = 'N';
     real_t alpha = 1.0, beta = 0.0;
 #if FLOAT
@@ -84,7 +115,7 @@ namespace exafmm_t {
   }
 
   // complex gemm by blas lib
-  void gemm(int m, int n, int k, complex_t* A, complex_t* B, complex_t* C) {
+  inline void gemm(int m, int n, int k, complex_t* A, complex_t* B, complex_t* C) {
     char transA = 'N', transB = 'N';
     complex_t alpha(1., 0.), beta(0.,0.);
 #if FLOAT
@@ -94,8 +125,30 @@ namespace exafmm_t {
 #endif
   }
 
+  //! C = A*B with row major data, B and C have n columns (one per right-hand side), it falls back to gemv when n is 1
+  inline void matmul(int m, int n, int k, real_t* A, real_t* B, real_t* C) {
+    if (n == 1) {
+      gemv(m, k, A, B, C);
+    } else {
+      gemm(m, n, k, A, B, C);
+      add_flop((long long)(2*m)*n*k);
+      add_bytes((long long)sizeof(real_t)*((long long)m*k+(long long)k*n+(long long)m*n));
+    }
+  }
+
+  // complex matmul by blas lib
+  inline void matmul(int m, int n, int k, complex_t* A, complex_t* B, complex_t* C) {
+    if (n == 1) {
+      gemv(m, k, A, B, C);
+    } else {
+      gemm(m, n, k, A, B, C);
+      add_flop((long long)(8*m)*n*k);
+      add_bytes((long long)sizeof(complex_t)*((long long)m*k+(long long)k*n+(long long)m*n));
+    }
+  }
+
   //! lapack svd with row major data: A = U*S*VT, A is m by n
-  void svd(int m, int n, real_t* A, real_t* S, real_t* U, real_t* VT) {
+  inline void svd(int m, int n, real_t* A, real_t* S, real_t* U, real_t* VT) {
     char JOBU = 'S', JOBVT = 'S';
     int INFO;
     int LWORK = std::max(3*std::min(m,n)+std::max(m,n), 5*std::min(m,n));
@@ -115,7 +168,7 @@ namespace exafmm_t {
   }
 
   //! lapack svd with row major data: A = U*S*VT, A is m by n
-  void svd(int m, int n, complex_t* A, real_t* S, complex_t* U, complex_t* VT) {
+  inline void svd(int m, int n, complex_t* A, real_t* S, complex_t* U, complex_t* VT) {
     char JOBU = 'S', JOBVT = 'S';
     int INFO;
     int LWORK = std::max(3*std::min(m,n)+std::max(m,n), 5*std::min(m,n));
@@ -135,7 +188,74 @@ namespace exafmm_t {
     }
   }
   
-  RealVec transpose(RealVec& vec, int m, int n) {
+  //! lapack lu factorization with row major data: A (n by n) is overwritten by its factors, returns info
+  inline int getrf(int n, real_t* A, int* ipiv) {
+    int INFO;
+#if FLOAT
+    sgetrf_(&n, &n, A, &n, ipiv, &INFO);
+#else
+    dgetrf_(&n, &n, A, &n, ipiv, &INFO);
+#endif
+    return INFO;
+  }
+
+  //! lapack lu factorization with row major data: A (n by n) is overwritten by its factors, returns info
+  inline int getrf(int n, complex_t* A, int* ipiv) {
+    int INFO;
+#if FLOAT
+    cgetrf_(&n, &n, A, &n, ipiv, &INFO);
+#else
+    zgetrf_(&n, &n, A, &n, ipiv, &INFO);
+#endif
+    return INFO;
+  }
+
+  //! solve A x = b using the factors from getrf, b is overwritten by x
+  inline void getrs(int n, real_t* A, int* ipiv, real_t* b) {
+    char TRANS = 'T';   // lapack factorized the column major A^T
+    int NRHS = 1, INFO;
+#if FLOAT
+    sgetrs_(&TRANS, &n, &NRHS, A, &n, ipiv, b, &n, &INFO);
+#else
+    dgetrs_(&TRANS, &n, &NRHS, A, &n, ipiv, b, &n, &INFO);
+#endif
+  }
+
+  //! solve A x = b using the factors from getrf, b is overwritten by x
+  inline void getrs(int n, complex_t* A, int* ipiv, complex_t* b) {
+    char TRANS = 'T';   // lapack factorized the column major A^T
+    int NRHS = 1, INFO;
+#if FLOAT
+    cgetrs_(&TRANS, &n, &NRHS, A, &n, ipiv, b, &n, &INFO);
+#else
+    zgetrs_(&TRANS, &n, &NRHS, A, &n, ipiv, b, &n, &INFO);
+#endif
+  }
+
+  //! lapack cholesky factorization of a symmetric positive definite A (n by n), returns info
+  inline int potrf(int n, real_t* A) {
+    char UPLO = 'L';
+    int INFO;
+#if FLOAT
+    spotrf_(&UPLO, &n, A, &n, &INFO);
+#else
+    dpotrf_(&UPLO, &n, A, &n, &INFO);
+#endif
+    return INFO;
+  }
+
+  //! solve A x = b using the factor from potrf, b is overwritten by x
+  inline void potrs(int n, real_t* A, real_t* b) {
+    char UPLO = 'L';
+    int NRHS = 1, INFO;
+#if FLOAT
+    spotrs_(&UPLO, &n, &NRHS, A, &n, b, &n, &INFO);
+#else
+    dpotrs_(&UPLO, &n, &NRHS, A, &n, b, &n, &INFO);
+#endif
+  }
+
+  inline RealVec transpose(RealVec& vec, int m, int n) {
     RealVec temp(vec.size());
     for(int i=0; i<m; i++) {
       for(int j=0; j<n; j++) {
@@ -145,7 +265,7 @@ namespace exafmm_t {
     return temp;
   }
 
-  ComplexVec transpose(ComplexVec& vec, int m, int n) {
+  inline ComplexVec transpose(ComplexVec& vec, int m, int n) {
     ComplexVec temp(vec.size());
     for(int i=0; i<m; i++) {
       for(int j=0; j<n; j++) {
@@ -155,7 +275,7 @@ namespace exafmm_t {
     return temp;
   }
 
-  ComplexVec conjugate_transpose(ComplexVec& vec, int m, int n) {
+  inline ComplexVec conjugate_transpose(ComplexVec& vec, int m, int n) {
     ComplexVec temp(vec.size());
     for(int i=0; i<m; i++) {
       for(int j=0; j<n; j++) {
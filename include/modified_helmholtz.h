@@ -1,5 +1,7 @@
 #ifndef modified_helmholtz_h
 #define modified_helmholtz_h
+#include <limits>       // std::numeric_limits
+#include <sstream>      // std::ostringstream
 #include "exafmm_t.h"
 #include "fmm.h"
 #include "geometry.h"
@@ -19,104 +21,234 @@ namespace exafmm_t {
     {
       wavek = wavek_;
       if (this->filename.empty()) {
-        this->filename = std::string("modified_helmholtz_") + (std::is_same<real_t, float>::value ? "f" : "d")
-                       + std::string("_p") + std::to_string(p) + std::string(".dat");
+        // the matrices depend on the wave number, instances with different ones must not share a file
+        std::ostringstream name;
+        name.precision(std::numeric_limits<real_t>::max_digits10);
+        name << "modified_helmholtz_" << (std::is_same<real_t, float>::value ? "f" : "d") << "_p" << p
+             << "_k" << wavek << ".dat";
+        this->filename = name.str();
       }
     }
     
     /**
      * @brief Compute potentials at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
-    void potential_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+    void potential_P2P(const SoACoord& src, RealVec& src_value, const SoACoord& trg, RealVec& trg_value) {
       simdvec zero(real_t(0));
       real_t newton_coef = 16;   // it comes from Newton's method in simd rsqrt function
       simdvec coef(real_t(1.0/(4*PI*newton_coef)));
       simdvec k(-wavek/newton_coef);
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
-      int t;
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
-        simdvec tv(zero);
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv0(zero);
+        simdvec tv1(zero);
         for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
-          sx -= tx;
-          simdvec sy(src_coord[3*s+1]);
-          sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
-          sz -= tz;
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
           simdvec sv(src_value[s]);
-          simdvec r2(zero);
-          r2 += sx * sx;
-          r2 += sy * sy;
-          r2 += sz * sz;
-          simdvec invr = rsqrt(r2);
-          invr &= r2 > zero;
-
-          tv += exp(k*r2*invr) * invr * sv;  // k has negative sign
+          simdvec dx0 = sx - tx0;
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
+          tv0 += exp(k*r20*invr0) * invr0 * sv;  // k has negative sign
+          tv1 += exp(k*r21*invr1) * invr1 * sv;
         }
-        tv *= coef;
-        for (int m=0; m<NSIMD && (t+m)<ntrgs; m++) {
-          trg_value[t+m] += tv[m];
+        tv0 *= coef;
+        tv1 *= coef;
+        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+          trg_value[t+m] += tv0[m];
         }
-      }
-      for (; t<ntrgs; t++) {
-        real_t potential = 0;
-        for (int s=0; s<nsrcs; s++) {
-          vec3 dx;
-          for (int d=0; d<3; d++)
-            dx[d] = trg_coord[3*t+d] - src_coord[3*s+d];
-          real_t r2 = norm(dx);
-          if (r2!=0) {
-            real_t r = std::sqrt(r2);
-            potential += std::exp(-wavek*r) * src_value[s] / r;
-          }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[t+NSIMD+m] += tv1[m];
         }
-        trg_value[t] += potential / (4*PI);
       }
+      add_flop((long long)ntrgs*(long long)nsrcs*(15+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! potential_P2P() with the coordinates in AoS layout, which are transposed first.
+    void potential_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      potential_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
     }
 
     /**
      * @brief Compute potentials and gradients at targets induced by sources directly.
      * 
-     * @param src_coord Vector of coordinates of sources.
+     * @param src Coordinates of sources in SoA layout.
      * @param src_value Vector of charges of sources.
-     * @param trg_coord Vector of coordinates of targets.
+     * @param trg Coordinates of targets in SoA layout, padded to a multiple of TRG_PAD.
      * @param trg_value Vector of potentials of targets.
      */
+    void gradient_P2P(const SoACoord& src, RealVec& src_value, const SoACoord& trg, RealVec& trg_value) {
+      simdvec zero(real_t(0));
+      simdvec one(real_t(1));
+      real_t newton_coef = 16;   // it comes from Newton's method in simd rsqrt function
+      simdvec coefp(real_t(1.0/(4*PI*newton_coef)));  // potential: r
+      simdvec coefg(real_t(1.0/(4*PI*newton_coef*newton_coef*newton_coef)));  // gradient: r3
+      simdvec k(-wavek/newton_coef);
+      int nsrcs = src.n;
+      int ntrgs = trg.n;
+      int ntrgs_pad = trg.npad;   // targets are padded instead of a scalar remainder loop
+      assert(ntrgs_pad % (2*NSIMD) == 0);
+      const real_t * sx_ = src.x;
+      const real_t * sy_ = sx_ + nsrcs;
+      const real_t * sz_ = sy_ + nsrcs;
+      const real_t * tx_ = trg.x;
+      for (int t=0; t<ntrgs_pad; t+=2*NSIMD) {
+        // two target simdvecs share each loaded source
+        simdvec tx0(&tx_[t], (int)sizeof(real_t));
+        simdvec ty0(&tx_[t+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz0(&tx_[t+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tx1(&tx_[t+NSIMD], (int)sizeof(real_t));
+        simdvec ty1(&tx_[t+NSIMD+ntrgs_pad], (int)sizeof(real_t));
+        simdvec tz1(&tx_[t+NSIMD+2*ntrgs_pad], (int)sizeof(real_t));
+        simdvec tv00(zero), tv01(zero), tv02(zero), tv03(zero);
+        simdvec tv10(zero), tv11(zero), tv12(zero), tv13(zero);
+        for (int s=0; s<nsrcs; s++) {
+          simdvec sx(sx_[s]);
+          simdvec sy(sy_[s]);
+          simdvec sz(sz_[s]);
+          simdvec sv(src_value[s]);
+          simdvec dx0 = sx - tx0;
+          simdvec dy0 = sy - ty0;
+          simdvec dz0 = sz - tz0;
+          simdvec dx1 = sx - tx1;
+          simdvec dy1 = sy - ty1;
+          simdvec dz1 = sz - tz1;
+          simdvec r20 = dx0 * dx0;
+          r20 += dy0 * dy0;
+          r20 += dz0 * dz0;
+          simdvec r21 = dx1 * dx1;
+          r21 += dy1 * dy1;
+          r21 += dz1 * dz1;
+          simdvec invr0 = rsqrt(r20);
+          invr0 &= r20 > zero;
+          simdvec invr1 = rsqrt(r21);
+          invr1 &= r21 > zero;
+
+          simdvec kr0 = (k * r20) * invr0;             // -k*r
+          simdvec kr1 = (k * r21) * invr1;
+          simdvec potential0 = exp(kr0) * invr0 * sv;  // exp(-kr) / r * q
+          simdvec potential1 = exp(kr1) * invr1 * sv;
+          tv00 += potential0;
+          tv10 += potential1;
+          potential0 *= (one - kr0) * invr0 * invr0;   // exp(-kr) * (kr+1) * q / r3
+          potential1 *= (one - kr1) * invr1 * invr1;
+          tv01 += potential0 * dx0;
+          tv02 += potential0 * dy0;
+          tv03 += potential0 * dz0;
+          tv11 += potential1 * dx1;
+          tv12 += potential1 * dy1;
+          tv13 += potential1 * dz1;
+        }
+        tv00 *= coefp;
+        tv01 *= coefg;
+        tv02 *= coefg;
+        tv03 *= coefg;
+        tv10 *= coefp;
+        tv11 *= coefg;
+        tv12 *= coefg;
+        tv13 *= coefg;
+        for (int m=0; m<NSIMD && t+m<ntrgs; m++) {
+          trg_value[0+4*(t+m)] += tv00[m];
+          trg_value[1+4*(t+m)] += tv01[m];
+          trg_value[2+4*(t+m)] += tv02[m];
+          trg_value[3+4*(t+m)] += tv03[m];
+        }
+        for (int m=0; m<NSIMD && t+NSIMD+m<ntrgs; m++) {
+          trg_value[0+4*(t+NSIMD+m)] += tv10[m];
+          trg_value[1+4*(t+NSIMD+m)] += tv11[m];
+          trg_value[2+4*(t+NSIMD+m)] += tv12[m];
+          trg_value[3+4*(t+NSIMD+m)] += tv13[m];
+        }
+      }
+      add_flop((long long)ntrgs*(long long)nsrcs*(27+4*2));
+      add_bytes((long long)sizeof(real_t)*(3*nsrcs+src_value.size()+3*ntrgs+2*trg_value.size()));
+    }
+
+    //! gradient_P2P() with the coordinates in AoS layout, which are transposed first.
     void gradient_P2P(RealVec& src_coord, RealVec& src_value, RealVec& trg_coord, RealVec& trg_value) {
+      AlignedVec src = transpose_coord(src_coord);
+      AlignedVec trg = transpose_coord(trg_coord, TRG_PAD);
+      gradient_P2P(SoACoord(src, src_coord.size()/3), src_value, SoACoord(trg, trg_coord.size()/3), trg_value);
+    }
+
+    /**
+     * @brief Compute potentials and gradients between two groups of bodies directly,
+     * each pair is evaluated once and contributes to both groups.
+     *
+     * @param coord0 Vector of coordinates of the first group.
+     * @param value0 Vector of charges of the first group.
+     * @param result0 Vector of potentials and gradients of the first group.
+     * @param coord1 Vector of coordinates of the second group.
+     * @param value1 Vector of charges of the second group.
+     * @param result1 Vector of potentials and gradients of the second group.
+     */
+    void gradient_P2P_mutual(RealVec& coord0, RealVec& value0, RealVec& result0,
+                             RealVec& coord1, RealVec& value1, RealVec& result1) {
       simdvec zero(real_t(0));
       simdvec one(real_t(1));
       real_t newton_coef = 16;   // it comes from Newton's method in simd rsqrt function
       simdvec coefp(real_t(1.0/(4*PI*newton_coef)));  // potential: r
       simdvec coefg(real_t(1.0/(4*PI*newton_coef*newton_coef*newton_coef)));  // gradient: r3
       simdvec k(-wavek/newton_coef);
-      int nsrcs = src_coord.size() / 3;
-      int ntrgs = trg_coord.size() / 3;
+      int n0 = coord0.size() / 3;
+      int n1 = coord1.size() / 3;
+      // lane-wise partial sums of the second group, reduced after the loop
+      AlignedVec buffer(4*n1*NSIMD, 0);
+      simdvec* rv = reinterpret_cast<simdvec*>(&buffer[0]);
       int t;
-      for (t=0; t+NSIMD<=ntrgs; t+=NSIMD) {
-        simdvec tx(&trg_coord[3*t+0], 3*(int)sizeof(real_t));
-        simdvec ty(&trg_coord[3*t+1], 3*(int)sizeof(real_t));
-        simdvec tz(&trg_coord[3*t+2], 3*(int)sizeof(real_t));
+      for (t=0; t+NSIMD<=n0; t+=NSIMD) {
+        simdvec tx(&coord0[3*t+0], 3*(int)sizeof(real_t));
+        simdvec ty(&coord0[3*t+1], 3*(int)sizeof(real_t));
+        simdvec tz(&coord0[3*t+2], 3*(int)sizeof(real_t));
+        simdvec tq(&value0[t], (int)sizeof(real_t));
         simdvec tv0(zero);
         simdvec tv1(zero);
         simdvec tv2(zero);
         simdvec tv3(zero);
-        for (int s=0; s<nsrcs; s++) {
-          simdvec sx(src_coord[3*s+0]);
+        for (int s=0; s<n1; s++) {
+          simdvec sx(coord1[3*s+0]);
           sx -= tx;
-          simdvec sy(src_coord[3*s+1]);
+          simdvec sy(coord1[3*s+1]);
           sy -= ty;
-          simdvec sz(src_coord[3*s+2]);
+          simdvec sz(coord1[3*s+2]);
           sz -= tz;
-          simdvec sv(src_value[s]);
+          simdvec sv(value1[s]);
           simdvec r2(zero);
           r2 += sx * sx;
           r2 += sy * sy;
@@ -127,48 +259,69 @@ namespace exafmm_t {
           simdvec invr2 = invr * invr;
 
           simdvec kr = (k * r2) * invr;     // -k*r
-          simdvec potential = exp(kr) * invr * sv;  // exp(-kr) / r * q
-          tv0 += potential;
+          simdvec kernel = exp(kr) * invr;  // exp(-kr) / r
+          tv0 += kernel * sv;
+          rv[4*s+0] += kernel * tq;
           simdvec krp1 = one - kr;          // k*r+1
-          potential *= krp1 * invr2;        // exp(-kr) * (kr+1) * q / r3
+          kernel *= krp1 * invr2;           // exp(-kr) * (kr+1) / r3
+          simdvec potential = kernel * sv;
           tv1 += potential * sx;
           tv2 += potential * sy;
           tv3 += potential * sz;
+          kernel *= tq;
+          rv[4*s+1] -= kernel * sx;
+          rv[4*s+2] -= kernel * sy;
+          rv[4*s+3] -= kernel * sz;
         }
         tv0 *= coefp;
         tv1 *= coefg;
         tv2 *= coefg;
         tv3 *= coefg;
-        for (int m=0; m<NSIMD && (t+m)<ntrgs; m++) {
-          trg_value[0+4*(t+m)] += tv0[m];
-          trg_value[1+4*(t+m)] += tv1[m];
-          trg_value[2+4*(t+m)] += tv2[m];
-          trg_value[3+4*(t+m)] += tv3[m];
+        for (int m=0; m<NSIMD; m++) {
+          result0[0+4*(t+m)] += tv0[m];
+          result0[1+4*(t+m)] += tv1[m];
+          result0[2+4*(t+m)] += tv2[m];
+          result0[3+4*(t+m)] += tv3[m];
         }
       }
-      for (; t<ntrgs; t++) {
+      real_t scalep = 1.0 / (4*PI*newton_coef);
+      real_t scaleg = 1.0 / (4*PI*newton_coef*newton_coef*newton_coef);
+      for (int s=0; s<n1; s++) {
+        result1[4*s+0] += sum(rv[4*s+0]) * scalep;
+        result1[4*s+1] += sum(rv[4*s+1]) * scaleg;
+        result1[4*s+2] += sum(rv[4*s+2]) * scaleg;
+        result1[4*s+3] += sum(rv[4*s+3]) * scaleg;
+      }
+      for (; t<n0; t++) {
         real_t potential = 0;
         vec3 gradient = 0;
-        for (int s=0; s<nsrcs; s++) {
+        for (int s=0; s<n1; s++) {
           vec3 dx;
           for (int d=0; d<3; d++)
-            dx[d] = trg_coord[3*t+d] - src_coord[3*s+d];
+            dx[d] = coord0[3*t+d] - coord1[3*s+d];
           real_t r2 = norm(dx);
           if (r2!=0) {
             real_t r = std::sqrt(r2);
-            real_t kernel = std::exp(-wavek*r) / r * src_value[s];
-            potential += kernel;
+            real_t kernel = std::exp(-wavek*r) / r;
             real_t dpdr = - kernel * (wavek*r+1) / r;
-            gradient[0] += dpdr / r * dx[0];
-            gradient[1] += dpdr / r * dx[1];
-            gradient[2] += dpdr / r * dx[2];
+            potential += kernel * value1[s];
+            gradient[0] += dpdr / r * dx[0] * value1[s];
+            gradient[1] += dpdr / r * dx[1] * value1[s];
+            gradient[2] += dpdr / r * dx[2] * value1[s];
+            result1[4*s+0] += kernel * value0[t] / (4*PI);
+            result1[4*s+1] -= dpdr / r * dx[0] * value0[t] / (4*PI);
+            result1[4*s+2] -= dpdr / r * dx[1] * value0[t] / (4*PI);
+            result1[4*s+3] -= dpdr / r * dx[2] * value0[t] / (4*PI);
           }
         }
-        trg_value[4*t+0] += potential / (4*PI);
-        trg_value[4*t+1] += gradient[0] / (4*PI);
-        trg_value[4*t+2] += gradient[1] / (4*PI);
-        trg_value[4*t+3] += gradient[2] / (4*PI);
+        result0[4*t+0] += potential / (4*PI);
+        result0[4*t+1] += gradient[0] / (4*PI);
+        result0[4*t+2] += gradient[1] / (4*PI);
+        result0[4*t+3] += gradient[2] / (4*PI);
       }
+      add_flop((long long)n0*(long long)n1*(27+4*2+8));
+      add_bytes((long long)sizeof(real_t)*(coord0.size()+value0.size()+2*result0.size()
+                                            +coord1.size()+value1.size()+2*result1.size()));
     }
   };
 }  // end namespace exafmm_t
@@ -0,0 +1,136 @@
+#ifndef numa_placement_h
+#define numa_placement_h
+#include <algorithm>    // std::fill
+#include <vector>
+#include <omp.h>
+#include <unistd.h>     // sysconf
+#if HAVE_NUMA
+#include <numa.h>
+#include <numaif.h>     // move_pages
+#endif
+
+namespace exafmm_t {
+  //! Whether libnuma is compiled in and the system supports NUMA.
+  inline bool numa_is_available() {
+#if HAVE_NUMA
+    return numa_available() >= 0;
+#else
+    return false;
+#endif
+  }
+
+  //! NUMA nodes that have CPUs, a single node 0 without libnuma.
+  inline const std::vector<int>& numa_cpu_nodes() {
+    static const std::vector<int> cpu_nodes = []() {
+      std::vector<int> ids;
+#if HAVE_NUMA
+      if (numa_is_available()) {
+        struct bitmask* cpus = numa_allocate_cpumask();
+        for (int n=0; n<=numa_max_node(); n++) {
+          if (numa_node_to_cpus(n, cpus) == 0 && numa_bitmask_weight(cpus) > 0)
+            ids.push_back(n);
+        }
+        numa_free_cpumask(cpus);
+      }
+#endif
+      if (ids.empty()) ids.push_back(0);
+      return ids;
+    }();
+    return cpu_nodes;
+  }
+
+  /**
+   * @brief NUMA node assigned to a thread: the threads of a team are split into contiguous groups, one per node,
+   * which matches the contiguous ranges of items assigned to the threads by a contiguous OpenMPExecutor.
+   *
+   * @param tid Thread number in the team.
+   * @param nthreads Number of threads in the team.
+   */
+  inline int numa_node_of_thread(int tid, int nthreads) {
+    const std::vector<int>& nodes = numa_cpu_nodes();
+    return nodes[size_t(tid) * nodes.size() / nthreads];
+  }
+
+  /**
+   * @brief Restrict each OpenMP thread of a team of nthreads to the CPUs of its NUMA node.
+   *
+   * @return Whether the threads are pinned, false without libnuma.
+   */
+  inline bool pin_threads(int nthreads) {
+    if (!numa_is_available()) return false;
+    bool is_pinned = true;
+#if HAVE_NUMA
+#pragma omp parallel num_threads(nthreads) reduction(&&:is_pinned)
+    is_pinned = numa_run_on_node(numa_node_of_thread(omp_get_thread_num(), omp_get_num_threads())) == 0;
+#else
+    (void)nthreads;
+#endif
+    return is_pinned;
+  }
+
+  //! Thread running item i of a loop of n items on nthreads threads with contiguous ranges.
+  inline int contiguous_owner(size_t i, size_t n, int nthreads) {
+    size_t t = i * nthreads / n;
+    while (n*(t+1)/nthreads <= i) t++;
+    while (n*t/nthreads > i) t--;
+    return int(t);
+  }
+
+  /**
+   * @brief Accumulate the memory accessed by the threads of a phase and measure the fraction of the bytes
+   * located on another NUMA node than the accessing thread, using the page locations returned by move_pages().
+   */
+  class RemoteAccessCounter {
+  public:
+    RemoteAccessCounter() : page_size(sysconf(_SC_PAGESIZE)) {}
+
+    /**
+     * @brief Record an access.
+     *
+     * @param data Address of the first byte.
+     * @param bytes Number of bytes.
+     * @param node NUMA node of the accessing thread.
+     */
+    void add(const void* data, size_t bytes, int node) {
+      if (bytes == 0) return;
+      size_t begin = reinterpret_cast<size_t>(data);
+      size_t end = begin + bytes;
+      for (size_t page=begin/page_size*page_size; page<end; page+=page_size) {
+        pages.push_back(reinterpret_cast<void*>(page));
+        page_bytes.push_back(std::min(end, page+page_size) - std::max(begin, page));
+        nodes.push_back(node);
+      }
+    }
+
+    //! Fraction of the recorded bytes on a remote node, -1 if the page locations are unknown.
+    double fraction() {
+      std::vector<int> status(pages.size(), -1);
+#if HAVE_NUMA
+      if (numa_is_available() && !pages.empty()) {
+        if (move_pages(0, pages.size(), pages.data(), nullptr, status.data(), 0) != 0)
+          std::fill(status.begin(), status.end(), -1);
+      }
+#endif
+      double remote = 0, total = 0;
+      for (size_t i=0; i<pages.size(); i++) {
+        if (status[i] < 0) continue;   // page not allocated or location unknown
+        total += page_bytes[i];
+        if (status[i] != nodes[i]) remote += page_bytes[i];
+      }
+      return total > 0 ? remote / total : -1;
+    }
+
+  private:
+    size_t page_size;
+    std::vector<void*> pages;        //!< Page of each access
+    std::vector<size_t> page_bytes;  //!< Bytes accessed in the page
+    std::vector<int> nodes;          //!< Node of the accessing thread
+  };
+
+  //! Reallocate a vector from the calling thread, so its pages are placed on the thread's node by the first-touch policy.
+  template <typename V>
+  void first_touch(V& v) {
+    V(v).swap(v);
+  }
+}  // end namespace exafmm_t
+#endif
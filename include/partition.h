@@ -0,0 +1,301 @@
+#ifndef partition_h
+#define partition_h
+#include <algorithm>    // std::sort, std::unique, std::upper_bound
+#include <cassert>
+#include <climits>      // INT_MAX
+#include <limits>
+#include <mpi.h>
+#include "exafmm_t.h"
+#include "hilbert.h"
+
+namespace exafmm_t {
+  //! MPI datatype of real_t.
+  inline MPI_Datatype mpi_real_type() {
+    return sizeof(real_t) == sizeof(double) ? MPI_DOUBLE : MPI_FLOAT;
+  }
+
+  /**
+   * @brief Compute the bounding box of the sources and targets of all ranks, the same box on every rank.
+   *
+   * @param sources Local sources.
+   * @param targets Local targets.
+   * @param x0 Coordinates of the center of the bounding box.
+   * @param r0 Half of the side length of the bounding box.
+   * @param comm Communicator.
+   */
+  template <typename T>
+  void get_global_bounds(const Bodies<T>& sources, const Bodies<T>& targets, vec3& x0, real_t& r0, MPI_Comm comm) {
+    real_t local[6], global[6];
+    for (int d=0; d<3; d++) {
+      local[d] = std::numeric_limits<real_t>::max();      // min coordinate
+      local[d+3] = std::numeric_limits<real_t>::max();    // negative of max coordinate
+    }
+    for (const Bodies<T>* bodies : {&sources, &targets}) {
+      for (size_t b=0; b<bodies->size(); ++b) {
+        for (int d=0; d<3; d++) {
+          local[d] = std::min(local[d], (*bodies)[b].X[d]);
+          local[d+3] = std::min(local[d+3], -(*bodies)[b].X[d]);
+        }
+      }
+    }
+    MPI_Allreduce(local, global, 6, mpi_real_type(), MPI_MIN, comm);
+    vec3 Xmin, Xmax;
+    for (int d=0; d<3; d++) {
+      Xmin[d] = global[d];
+      Xmax[d] = -global[d+3];
+    }
+    x0 = (Xmax + Xmin) / 2;
+    r0 = fmax(max(x0-Xmin), max(Xmax-x0));
+    r0 *= 1.00001;
+  }
+
+  //! Position of the cell containing X along the Hilbert curve of the given level.
+  inline uint64_t hilbert_cell(const vec3& X, int level, const vec3& x0, real_t r0) {
+    ivec3 iX = get3DIndex(X, level, x0, r0);
+    int n = 1 << level;
+    for (int d=0; d<3; d++)
+      iX[d] = std::max(0, std::min(n-1, iX[d]));
+    return getHilbertKey(iX, level);
+  }
+
+  const int PARTITION_LEVEL = 20;      //!< Level of the Hilbert keys of the bodies in partition()
+  const int PARTITION_SAMPLES = 256;   //!< Number of candidate splitters sampled on each rank by partition()
+
+  /**
+   * @brief Split a sequence of cells into contiguous ranges, one per rank, with the same total weight
+   * of the bodies in each range.
+   *
+   * @param weights Weight of each cell, summed over all ranks.
+   * @param nranks Number of ranks.
+   * @return Vector of nranks+1 cell indices, rank r owns the cells in [splitters[r], splitters[r+1]).
+   */
+  inline std::vector<uint64_t> split_cells(const std::vector<double>& weights, int nranks) {
+    double total = 0;
+    for (size_t c=0; c<weights.size(); c++) total += weights[c];
+    std::vector<uint64_t> splitters(nranks+1, weights.size());
+    splitters[0] = 0;
+    double sum = 0;
+    int r = 1;
+    for (size_t c=0; c<weights.size() && r<nranks; c++) {
+      while (r < nranks && sum >= total * r / nranks) splitters[r++] = c;
+      sum += weights[c];
+    }
+    return splitters;
+  }
+
+  /**
+   * @brief Split the Hilbert curve into contiguous ranges of keys, one per rank, with the same total weight of the
+   * bodies in each range. Each rank samples PARTITION_SAMPLES candidate splitters at evenly spaced weights of its
+   * bodies sorted along the curve, and the weights of the bodies between consecutive candidates are summed over all
+   * ranks, so a range misses its share by at most the weight between two candidates.
+   *
+   * @param keys Hilbert key of each local body.
+   * @param weights Weight of each local body.
+   * @param comm Communicator.
+   * @return Vector of nranks+1 keys, rank r owns the keys in [splitters[r], splitters[r+1]).
+   */
+  inline std::vector<uint64_t> sample_splitters(const std::vector<uint64_t>& keys, const std::vector<double>& weights,
+                                                MPI_Comm comm) {
+    int nranks;
+    MPI_Comm_size(comm, &nranks);
+    std::vector<size_t> order(keys.size());
+    for (size_t b=0; b<keys.size(); b++) order[b] = b;
+    std::sort(order.begin(), order.end(), [&](size_t a, size_t b) { return keys[a] < keys[b]; });
+    double total = 0;
+    for (size_t b=0; b<weights.size(); b++) total += weights[b];
+    std::vector<uint64_t> samples;
+    double sum = 0;
+    for (size_t b=0, s=1; b<order.size() && s<size_t(PARTITION_SAMPLES) && total>0; b++) {
+      sum += weights[order[b]];
+      for (; s<size_t(PARTITION_SAMPLES) && sum>=total*s/PARTITION_SAMPLES; s++)
+        samples.push_back(keys[order[b]]);
+    }
+    // candidates of all ranks
+    int nsamples = samples.size();
+    std::vector<int> counts(nranks), displs(nranks, 0);
+    MPI_Allgather(&nsamples, 1, MPI_INT, counts.data(), 1, MPI_INT, comm);
+    for (int r=1; r<nranks; r++) displs[r] = displs[r-1] + counts[r-1];
+    std::vector<uint64_t> candidates(displs[nranks-1] + counts[nranks-1]);
+    MPI_Allgatherv(samples.data(), nsamples, MPI_UINT64_T,
+                   candidates.data(), counts.data(), displs.data(), MPI_UINT64_T, comm);
+    std::sort(candidates.begin(), candidates.end());
+    candidates.erase(std::unique(candidates.begin(), candidates.end()), candidates.end());
+    // range c holds the keys in [candidates[c-1], candidates[c])
+    std::vector<double> local(candidates.size()+1, 0), global(local.size());
+    for (size_t b=0; b<keys.size(); b++)
+      local[std::upper_bound(candidates.begin(), candidates.end(), keys[b]) - candidates.begin()] += weights[b];
+    MPI_Allreduce(local.data(), global.data(), local.size(), MPI_DOUBLE, MPI_SUM, comm);
+    std::vector<uint64_t> ranges = split_cells(global, nranks);
+    std::vector<uint64_t> splitters(nranks+1);
+    for (int r=0; r<=nranks; r++) {
+      if (ranges[r] == 0) splitters[r] = 0;
+      else if (ranges[r] == global.size()) splitters[r] = uint64_t(1) << 3*PARTITION_LEVEL;
+      else splitters[r] = candidates[ranges[r]-1];
+    }
+    return splitters;
+  }
+
+  /**
+   * @brief Send a group of bodies to each rank.
+   *
+   * @param send Bodies sent to each rank.
+   * @param comm Communicator.
+   * @return Bodies received from all ranks, ordered by source rank.
+   */
+  template <typename T>
+  Bodies<T> alltoall_bodies(const std::vector<Bodies<T>>& send, MPI_Comm comm) {
+    int nranks;
+    MPI_Comm_size(comm, &nranks);
+    assert(send.size() == size_t(nranks));
+    Bodies<T> send_buffer;
+    std::vector<int> send_counts(nranks), recv_counts(nranks), send_displs(nranks, 0), recv_displs(nranks, 0);
+    for (int r=0; r<nranks; r++) {
+      assert(send[r].size() * sizeof(Body<T>) <= size_t(INT_MAX));
+      send_counts[r] = send[r].size() * sizeof(Body<T>);
+      send_buffer.insert(send_buffer.end(), send[r].begin(), send[r].end());
+    }
+    MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+    size_t nrecv = recv_counts[0];
+    for (int r=1; r<nranks; r++) {
+      send_displs[r] = send_displs[r-1] + send_counts[r-1];
+      recv_displs[r] = recv_displs[r-1] + recv_counts[r-1];
+      nrecv += recv_counts[r];
+    }
+    assert(nrecv <= size_t(INT_MAX));
+    Bodies<T> recv(nrecv / sizeof(Body<T>));
+    MPI_Alltoallv(send_buffer.data(), send_counts.data(), send_displs.data(), MPI_BYTE,
+                  recv.data(), recv_counts.data(), recv_displs.data(), MPI_BYTE, comm);
+    return recv;
+  }
+
+  /**
+   * @brief Non-blocking exchange of groups of trivially copyable elements between all ranks, e.g. bodies as the
+   * counterpart of alltoall_bodies() that lets the caller compute while the elements are in flight.
+   *
+   * @tparam V Element type.
+   */
+  template <typename V>
+  class VectorExchange {
+  public:
+    /**
+     * @brief Exchange the sizes of the groups and post the transfers of the elements.
+     *
+     * @param send_ Elements sent to each rank, kept until wait() returns.
+     * @param comm Communicator.
+     */
+    void post(std::vector<std::vector<V>>& send_, MPI_Comm comm) {
+      int nranks;
+      MPI_Comm_size(comm, &nranks);
+      assert(send_.size() == size_t(nranks));
+      send.swap(send_);
+      std::vector<int> send_counts(nranks), recv_counts(nranks);
+      for (int r=0; r<nranks; r++) {
+        assert(send[r].size() * sizeof(V) <= size_t(INT_MAX));
+        send_counts[r] = send[r].size() * sizeof(V);
+      }
+      MPI_Alltoall(send_counts.data(), 1, MPI_INT, recv_counts.data(), 1, MPI_INT, comm);
+      size_t nrecv = 0;
+      for (int r=0; r<nranks; r++) nrecv += recv_counts[r];
+      recv.resize(nrecv / sizeof(V));
+      requests.clear();
+      char* buffer = reinterpret_cast<char*>(recv.data());
+      for (int r=0; r<nranks; r++) {
+        if (recv_counts[r] == 0) continue;
+        requests.push_back(MPI_Request());
+        MPI_Irecv(buffer, recv_counts[r], MPI_BYTE, r, 0, comm, &requests.back());
+        buffer += recv_counts[r];
+      }
+      for (int r=0; r<nranks; r++) {
+        if (send_counts[r] == 0) continue;
+        requests.push_back(MPI_Request());
+        MPI_Isend(send[r].data(), send_counts[r], MPI_BYTE, r, 0, comm, &requests.back());
+      }
+    }
+
+    //! Progress the transfers, return whether they are complete.
+    bool test() {
+      int flag;
+      MPI_Testall(requests.size(), requests.data(), &flag, MPI_STATUSES_IGNORE);
+      return flag;
+    }
+
+    //! Wait for the transfers and return the elements received from all ranks, ordered by source rank.
+    std::vector<V>& wait() {
+      MPI_Waitall(requests.size(), requests.data(), MPI_STATUSES_IGNORE);
+      requests.clear();
+      std::vector<std::vector<V>>().swap(send);
+      return recv;
+    }
+
+  private:
+    std::vector<std::vector<V>> send;     //!< Elements sent to each rank
+    std::vector<V> recv;                  //!< Elements received
+    std::vector<MPI_Request> requests;    //!< Pending transfers
+  };
+
+  template <typename T> using BodyExchange = VectorExchange<Body<T>>;   //!< Non-blocking exchange of bodies
+
+  /**
+   * @brief Send each body to the rank owning its cell and return the bodies received.
+   *
+   * @param bodies Local bodies.
+   * @param cells Hilbert key of each body.
+   * @param splitters Key ranges of the ranks returned by sample_splitters().
+   * @param comm Communicator.
+   * @return Bodies owned by the calling rank.
+   */
+  template <typename T>
+  Bodies<T> exchange_bodies(const Bodies<T>& bodies, const std::vector<uint64_t>& cells,
+                            const std::vector<uint64_t>& splitters, MPI_Comm comm) {
+    int nranks;
+    MPI_Comm_size(comm, &nranks);
+    std::vector<size_t> order(bodies.size());
+    for (size_t b=0; b<bodies.size(); b++) order[b] = b;
+    std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return cells[a] < cells[b]; });
+    std::vector<Bodies<T>> send(nranks);
+    for (size_t b=0; b<order.size(); b++) {
+      int owner = std::upper_bound(splitters.begin(), splitters.end(), cells[order[b]]) - splitters.begin() - 1;
+      send[owner].push_back(bodies[order[b]]);
+    }
+    return alltoall_bodies(send, comm);
+  }
+
+  /**
+   * @brief Partition the sources and targets of all ranks into contiguous pieces of the Hilbert curve
+   * with the same total weight, so each rank owns a compact subdomain.
+   *
+   * @param sources Local sources, replaced by the sources owned by the calling rank.
+   * @param targets Local targets, replaced by the targets owned by the calling rank.
+   * @param x0 Center of the global bounding box, see get_global_bounds().
+   * @param r0 Radius of the global bounding box.
+   * @param comm Communicator.
+   * @param source_weights Weight of each local source, 1 for all sources if empty.
+   * @param target_weights Weight of each local target, 1 for all targets if empty.
+   * @return Key ranges of the ranks at PARTITION_LEVEL, see sample_splitters().
+   */
+  template <typename T>
+  std::vector<uint64_t> partition(Bodies<T>& sources, Bodies<T>& targets, const vec3& x0, real_t r0, MPI_Comm comm,
+                                  const std::vector<double>& source_weights=std::vector<double>(),
+                                  const std::vector<double>& target_weights=std::vector<double>()) {
+    assert(source_weights.empty() || source_weights.size() == sources.size());
+    assert(target_weights.empty() || target_weights.size() == targets.size());
+    std::vector<uint64_t> source_cells(sources.size()), target_cells(targets.size());
+    std::vector<uint64_t> keys;
+    std::vector<double> weights;
+    for (size_t b=0; b<sources.size(); b++) {
+      source_cells[b] = hilbert_cell(sources[b].X, PARTITION_LEVEL, x0, r0);
+      keys.push_back(source_cells[b]);
+      weights.push_back(source_weights.empty() ? 1 : source_weights[b]);
+    }
+    for (size_t b=0; b<targets.size(); b++) {
+      target_cells[b] = hilbert_cell(targets[b].X, PARTITION_LEVEL, x0, r0);
+      keys.push_back(target_cells[b]);
+      weights.push_back(target_weights.empty() ? 1 : target_weights[b]);
+    }
+    std::vector<uint64_t> splitters = sample_splitters(keys, weights, comm);
+    sources = exchange_bodies(sources, source_cells, splitters, comm);
+    targets = exchange_bodies(targets, target_cells, splitters, comm);
+    return splitters;
+  }
+}  // end namespace exafmm_t
+#endif
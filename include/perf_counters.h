@@ -0,0 +1,253 @@
+#ifndef perf_counters_h
+#define perf_counters_h
+#include <atomic>
+#include <cerrno>
+#include <cstdlib>      // std::getenv, std::strtoull
+#include <cstring>      // std::strerror, std::memset
+#include <mutex>
+#include <string>
+#include <vector>
+#include <omp.h>
+#if defined(__linux__)
+#include <linux/perf_event.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+#endif
+
+namespace exafmm_t {
+  //! Hardware event counted by PerfCounters
+  typedef enum {
+    Instructions_Event = 0,
+    Cycles_Event = 1,
+    L1D_Miss_Event = 2,
+    LLC_Miss_Event = 3,
+    FP_Event = 4,
+    Event_Count = 5
+  } Perf_Event;
+
+  //! Name of a hardware event.
+  inline const char* event_name(int event) {
+    static const char* names[Event_Count] = {"Instructions", "Cycles", "L1 Misses", "LLC Misses", "FP Ops"};
+    return event >= 0 && event < Event_Count ? names[event] : "Unknown";
+  }
+
+  //! Snapshot of the hardware counters summed over the counted threads.
+  struct PerfValues {
+    double value[Event_Count];   //!< Counts, scaled up when the kernel multiplexed the counters
+    bool valid[Event_Count];     //!< Whether the event could be counted
+
+    PerfValues() {
+      for (int e=0; e<Event_Count; e++) {
+        value[e] = 0;
+        valid[e] = false;
+      }
+    }
+
+    //! Counts between two snapshots.
+    PerfValues operator-(const PerfValues& other) const {
+      PerfValues diff;
+      for (int e=0; e<Event_Count; e++) {
+        diff.value[e] = value[e] - other.value[e];
+        diff.valid[e] = valid[e] && other.valid[e];
+      }
+      return diff;
+    }
+
+    PerfValues& operator+=(const PerfValues& other) {
+      for (int e=0; e<Event_Count; e++) {
+        value[e] += other.value[e];
+        valid[e] = valid[e] || other.valid[e];
+      }
+      return *this;
+    }
+
+    //! Instructions per cycle, 0 if not counted.
+    double ipc() const {
+      return valid[Instructions_Event] && valid[Cycles_Event] && value[Cycles_Event] > 0
+             ? value[Instructions_Event] / value[Cycles_Event] : 0;
+    }
+  };
+
+  /**
+   * @brief Hardware counters of the threads of the OpenMP pool, read with perf_event_open on Linux.
+   * Each event of each thread is a separate counter of user-space events, so an event the CPU or the kernel
+   * does not provide leaves the others valid. There is no portable floating point event: its raw event code
+   * (the perf "config" value, e.g. 0x10c7 for double precision scalar operations on Intel) is read from the
+   * environment variable EXAFMM_PERF_FP_EVENT, and the event is not counted if it is unset.
+   * When perf_event_open is unavailable (other systems, containers, perf_event_paranoid > 2), enable() returns
+   * false, error() gives the reason, and read() returns invalid values.
+   */
+  class PerfCounters {
+  public:
+    PerfCounters() : is_enabled(false) {
+      for (int e=0; e<Event_Count; e++) is_counted[e] = false;
+    }
+
+    PerfCounters(const PerfCounters&) = delete;
+    PerfCounters& operator=(const PerfCounters&) = delete;
+
+    ~PerfCounters() {
+      disable();
+    }
+
+    /**
+     * @brief Open the counters on the calling thread and the threads of an OpenMP parallel region. Threads
+     * created later, e.g. by a larger OpenMP pool or by another executor, are not counted.
+     *
+     * @return Whether at least one event is counted.
+     */
+    bool enable() {
+      disable();
+      std::lock_guard<std::mutex> lock(mutex);
+      last_error.clear();
+      std::vector<std::vector<int>> thread_fds(omp_get_max_threads());
+#pragma omp parallel   // the calling thread is the master thread of the region
+      {
+        int t = omp_get_thread_num();
+        if (t < int(thread_fds.size()))
+          thread_fds[t] = open_thread();
+      }
+      for (size_t t=0; t<thread_fds.size(); t++) {
+        if (thread_fds[t].size() == Event_Count) fds.push_back(thread_fds[t]);
+      }
+      for (int e=0; e<Event_Count; e++) {
+        is_counted[e] = !fds.empty();
+        for (size_t t=0; t<fds.size(); t++) is_counted[e] = is_counted[e] && fds[t][e] >= 0;
+      }
+      bool is_any_counted = false;
+      for (int e=0; e<Event_Count; e++) is_any_counted = is_any_counted || is_counted[e];
+      if (!is_any_counted && last_error.empty()) last_error = "no event available";
+      is_enabled = is_any_counted;
+      return is_any_counted;
+    }
+
+    //! Close the counters.
+    void disable() {
+      std::lock_guard<std::mutex> lock(mutex);
+#if defined(__linux__)
+      for (size_t t=0; t<fds.size(); t++) {
+        for (int e=0; e<Event_Count; e++)
+          if (fds[t][e] >= 0) close(fds[t][e]);
+      }
+#endif
+      fds.clear();
+      is_enabled = false;
+    }
+
+    //! Whether the counters are open.
+    bool enabled() const {
+      return is_enabled;
+    }
+
+    //! Whether an event is counted.
+    bool counted(int event) const {
+      return is_enabled && is_counted[event];
+    }
+
+    //! Reason why the last enable() did not open all events, empty if it did.
+    std::string error() {
+      std::lock_guard<std::mutex> lock(mutex);
+      return last_error;
+    }
+
+    //! Counts of all counted threads since enable(), subtract two snapshots to count an interval.
+    PerfValues read() {
+      PerfValues values;
+      std::lock_guard<std::mutex> lock(mutex);
+      if (!is_enabled) return values;
+#if defined(__linux__)
+      for (int e=0; e<Event_Count; e++) {
+        if (!is_counted[e]) continue;
+        values.valid[e] = true;
+        for (size_t t=0; t<fds.size(); t++) {
+          unsigned long long data[3];   // value, time enabled, time running
+          if (::read(fds[t][e], data, sizeof(data)) != ssize_t(sizeof(data))) {
+            values.valid[e] = false;
+            continue;
+          }
+          double scale = data[2] > 0 ? double(data[1]) / data[2] : 1;
+          values.value[e] += data[0] * scale;
+        }
+      }
+#endif
+      return values;
+    }
+
+  private:
+    std::mutex mutex;
+    std::atomic<bool> is_enabled;
+    bool is_counted[Event_Count];
+    std::vector<std::vector<int>> fds;   //!< [thread][event] file descriptors, -1 if the event is not counted
+    std::string last_error;
+    std::mutex error_mutex;   //!< Protects last_error while the threads open their counters
+
+    //! Open the events on the calling thread, -1 for those that fail.
+    std::vector<int> open_thread() {
+      std::vector<int> thread_fds(Event_Count, -1);
+#if defined(__linux__)
+      for (int e=0; e<Event_Count; e++) {
+        unsigned int type;
+        unsigned long long config;
+        if (!event_config(e, type, config)) continue;
+        perf_event_attr attr;
+        std::memset(&attr, 0, sizeof(attr));
+        attr.size = sizeof(attr);
+        attr.type = type;
+        attr.config = config;
+        attr.exclude_kernel = 1;
+        attr.exclude_hv = 1;
+        attr.read_format = PERF_FORMAT_TOTAL_TIME_ENABLED | PERF_FORMAT_TOTAL_TIME_RUNNING;
+        thread_fds[e] = syscall(__NR_perf_event_open, &attr, 0, -1, -1, 0);   // calling thread, any cpu
+        if (thread_fds[e] < 0) {
+          std::lock_guard<std::mutex> lock(error_mutex);
+          last_error = std::string(event_name(e)) + ": perf_event_open: " + std::strerror(errno);
+        }
+      }
+#else
+      std::lock_guard<std::mutex> lock(error_mutex);
+      last_error = "perf_event_open is only available on Linux";
+#endif
+      return thread_fds;
+    }
+
+#if defined(__linux__)
+    //! Type and config of an event for perf_event_open, false if the event is not configured.
+    static bool event_config(int event, unsigned int& type, unsigned long long& config) {
+      switch (event) {
+      case Instructions_Event:
+        type = PERF_TYPE_HARDWARE;
+        config = PERF_COUNT_HW_INSTRUCTIONS;
+        return true;
+      case Cycles_Event:
+        type = PERF_TYPE_HARDWARE;
+        config = PERF_COUNT_HW_CPU_CYCLES;
+        return true;
+      case L1D_Miss_Event:
+        type = PERF_TYPE_HW_CACHE;
+        config = PERF_COUNT_HW_CACHE_L1D | (PERF_COUNT_HW_CACHE_OP_READ << 8) | (PERF_COUNT_HW_CACHE_RESULT_MISS << 16);
+        return true;
+      case LLC_Miss_Event:
+        type = PERF_TYPE_HARDWARE;
+        config = PERF_COUNT_HW_CACHE_MISSES;
+        return true;
+      case FP_Event: {
+        const char* raw = std::getenv("EXAFMM_PERF_FP_EVENT");
+        if (!raw || !*raw) return false;
+        type = PERF_TYPE_RAW;
+        config = std::strtoull(raw, nullptr, 0);
+        return true;
+      }
+      default:
+        return false;
+      }
+    }
+#endif
+  };
+
+  //! Hardware counters of the process, read around the phases of the passes when enabled.
+  inline PerfCounters& perf_counters() {
+    static PerfCounters instance;
+    return instance;
+  }
+}  // end namespace exafmm_t
+#endif
@@ -0,0 +1,307 @@
+#ifndef profiler_h
+#define profiler_h
+#include <atomic>
+#include <chrono>
+#include <fstream>
+#include <iomanip>      // std::setprecision
+#include <map>
+#include <memory>       // std::unique_ptr
+#include <mutex>
+#include <sstream>
+#include <string>
+#include <vector>
+
+namespace exafmm_t {
+  /**
+   * @brief Hierarchical profiler. Each thread keeps a stack of open scopes and accumulates the time and number of
+   * calls of each path of nested scopes, e.g. M2L / level 2 / hadamard_product. Every closed scope is also kept
+   * as an event with its start time and duration for the Chrome trace. Times come from a monotonic clock in
+   * nanoseconds, relative to the construction of the profiler. Threads only lock their own data, so scopes
+   * of different threads do not contend.
+   */
+  class Profiler {
+  public:
+    //! Accumulated time of a path of nested scopes in a thread.
+    struct Scope {
+      std::string name;              //!< Name of the scope
+      int parent;                    //!< Index of the enclosing scope, -1 for a top-level scope
+      std::map<std::string, int> children;   //!< Indices of the nested scopes by name
+      long long count;               //!< Number of calls
+      long long total;               //!< Total time in nanoseconds
+    };
+
+    //! Closed scope, for the trace.
+    struct Event {
+      int scope;                     //!< Index of the scope
+      long long begin;               //!< Start time in nanoseconds
+      long long duration;            //!< Duration in nanoseconds
+    };
+
+    //! Profiling data of a thread.
+    struct Thread {
+      int tid;                       //!< Index of the thread in the order of its first scope
+      std::mutex mutex;              //!< Protects the data against concurrent export and reset
+      std::vector<Scope> scopes;     //!< Scopes, a tree per top-level scope
+      std::map<std::string, int> roots;   //!< Indices of the top-level scopes by name
+      std::vector<std::pair<int, long long>> stack;   //!< Open scopes and their start times
+      std::vector<Event> events;     //!< Closed scopes in the order they close
+    };
+
+    Profiler() : id(next_id()++), epoch(std::chrono::steady_clock::now()), is_enabled(true), max_events(1<<20) {}
+
+    Profiler(const Profiler&) = delete;
+    Profiler& operator=(const Profiler&) = delete;
+
+    //! Enable or disable the profiler, scopes opened while disabled are ignored.
+    void enable(bool is_enabled_=true) {
+      is_enabled = is_enabled_;
+    }
+
+    //! Whether the profiler records scopes.
+    bool enabled() const {
+      return is_enabled;
+    }
+
+    //! Nanoseconds since the construction of the profiler.
+    long long now() const {
+      return std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - epoch).count();
+    }
+
+    /**
+     * @brief Open a scope nested in the innermost open scope of the calling thread.
+     *
+     * @return Whether the scope is recorded, false if the profiler is disabled.
+     */
+    bool begin(const std::string& name) {
+      if (!is_enabled) return false;
+      Thread& thread = this_thread();
+      std::lock_guard<std::mutex> lock(thread.mutex);
+      int parent = thread.stack.empty() ? -1 : thread.stack.back().first;
+      int scope = find_or_add(thread, parent, name);
+      thread.stack.push_back(std::make_pair(scope, now()));
+      return true;
+    }
+
+    /**
+     * @brief Close the innermost open scope of the calling thread with the given name, and the scopes left open in it.
+     * Nothing happens if no such scope is open.
+     */
+    void end(const std::string& name) {
+      long long time = now();
+      Thread& thread = this_thread();
+      std::lock_guard<std::mutex> lock(thread.mutex);
+      int depth = int(thread.stack.size()) - 1;
+      while (depth >= 0 && thread.scopes[thread.stack[depth].first].name != name) depth--;
+      if (depth < 0) return;
+      while (int(thread.stack.size()) > depth) {
+        std::pair<int, long long> open = thread.stack.back();
+        thread.stack.pop_back();
+        Scope& scope = thread.scopes[open.first];
+        scope.count++;
+        scope.total += time - open.second;
+        if (thread.events.size() < max_events) {
+          Event event = {open.first, open.second, time - open.second};
+          thread.events.push_back(event);
+        }
+      }
+    }
+
+    //! Discard the recorded scopes and events of all threads, open scopes stay open.
+    void reset() {
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t t=0; t<threads.size(); t++) {
+        Thread& thread = *threads[t];
+        std::lock_guard<std::mutex> thread_lock(thread.mutex);
+        thread.events.clear();
+        for (size_t s=0; s<thread.scopes.size(); s++) {
+          thread.scopes[s].count = 0;
+          thread.scopes[s].total = 0;
+        }
+      }
+    }
+
+    /**
+     * @brief Export the accumulated scopes of all threads as JSON: {"threads": [{"tid": t, "scopes": [...]}]},
+     * where each scope is {"name", "count", "total" (seconds), "self" (seconds outside the nested scopes), "children"}.
+     */
+    std::string to_json() {
+      std::ostringstream os;
+      os << std::setprecision(9);
+      os << "{\"threads\": [";
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t t=0; t<threads.size(); t++) {
+        Thread& thread = *threads[t];
+        std::lock_guard<std::mutex> thread_lock(thread.mutex);
+        os << (t ? ", " : "") << "{\"tid\": " << thread.tid << ", \"scopes\": [";
+        bool is_first = true;
+        for (std::map<std::string, int>::const_iterator it=thread.roots.begin(); it!=thread.roots.end(); ++it) {
+          if (!is_recorded(thread, it->second)) continue;
+          if (!is_first) os << ", ";
+          write_scope(os, thread, it->second);
+          is_first = false;
+        }
+        os << "]}";
+      }
+      os << "]}";
+      return os.str();
+    }
+
+    //! Export the closed scopes of all threads in the Chrome trace event format, viewable in chrome://tracing.
+    std::string to_chrome_trace() {
+      std::ostringstream os;
+      os << std::fixed << std::setprecision(3);   // microseconds
+      os << "{\"traceEvents\": [";
+      bool is_first = true;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t t=0; t<threads.size(); t++) {
+        Thread& thread = *threads[t];
+        std::lock_guard<std::mutex> thread_lock(thread.mutex);
+        for (size_t e=0; e<thread.events.size(); e++) {
+          const Event& event = thread.events[e];
+          os << (is_first ? "" : ",\n") << "{\"name\": \"" << escape(thread.scopes[event.scope].name)
+             << "\", \"ph\": \"X\", \"pid\": 0, \"tid\": " << thread.tid
+             << ", \"ts\": " << event.begin * 1e-3 << ", \"dur\": " << event.duration * 1e-3 << "}";
+          is_first = false;
+        }
+      }
+      os << "], \"displayTimeUnit\": \"ms\"}";
+      return os.str();
+    }
+
+    //! Write to_json() to a file.
+    void write_json(const std::string& filename) {
+      std::ofstream file(filename);
+      file << to_json() << std::endl;
+    }
+
+    //! Write to_chrome_trace() to a file.
+    void write_chrome_trace(const std::string& filename) {
+      std::ofstream file(filename);
+      file << to_chrome_trace() << std::endl;
+    }
+
+    //! Total time in seconds and number of calls of a path of scopes, e.g. {"M2L", "level 2"}, summed over all threads.
+    std::pair<double, long long> total(const std::vector<std::string>& path) {
+      double time = 0;
+      long long count = 0;
+      std::lock_guard<std::mutex> lock(mutex);
+      for (size_t t=0; t<threads.size(); t++) {
+        Thread& thread = *threads[t];
+        std::lock_guard<std::mutex> thread_lock(thread.mutex);
+        int scope = -1;
+        for (size_t i=0; i<path.size(); i++) {
+          scope = find(thread, scope, path[i]);
+          if (scope < 0) break;
+        }
+        if (scope < 0) continue;
+        time += thread.scopes[scope].total * 1e-9;
+        count += thread.scopes[scope].count;
+      }
+      return std::make_pair(time, count);
+    }
+
+  private:
+    long long id;                                   //!< Unique id of the profiler in the process
+    std::chrono::steady_clock::time_point epoch;    //!< Origin of the times
+    std::atomic<bool> is_enabled;
+    size_t max_events;                              //!< Maximum number of events kept per thread
+    std::mutex mutex;                               //!< Protects the list of threads
+    std::vector<std::unique_ptr<Thread>> threads;   //!< Data of the threads that opened a scope
+
+    static std::atomic<long long>& next_id() {
+      static std::atomic<long long> id(0);
+      return id;
+    }
+
+    //! Data of the calling thread in this profiler, registered at the first call.
+    Thread& this_thread() {
+      thread_local std::map<long long, Thread*> registry;   // by profiler id, as an address may be reused
+      Thread*& thread = registry[id];
+      if (!thread) {
+        std::lock_guard<std::mutex> lock(mutex);
+        threads.emplace_back(new Thread());
+        thread = threads.back().get();
+        thread->tid = threads.size() - 1;
+      }
+      return *thread;
+    }
+
+    static int find(const Thread& thread, int parent, const std::string& name) {
+      const std::map<std::string, int>& children = parent < 0 ? thread.roots : thread.scopes[parent].children;
+      std::map<std::string, int>::const_iterator it = children.find(name);
+      return it == children.end() ? -1 : it->second;
+    }
+
+    static int find_or_add(Thread& thread, int parent, const std::string& name) {
+      int scope = find(thread, parent, name);
+      if (scope >= 0) return scope;
+      Scope new_scope;
+      new_scope.name = name;
+      new_scope.parent = parent;
+      new_scope.count = 0;
+      new_scope.total = 0;
+      thread.scopes.push_back(new_scope);
+      scope = thread.scopes.size() - 1;
+      (parent < 0 ? thread.roots : thread.scopes[parent].children)[name] = scope;
+      return scope;
+    }
+
+    static std::string escape(const std::string& s) {
+      std::string escaped;
+      for (size_t i=0; i<s.size(); i++) {
+        if (s[i] == '"' || s[i] == '\\') escaped += '\\';
+        escaped += s[i];
+      }
+      return escaped;
+    }
+
+    //! Whether a scope or one of its nested scopes was closed since the last reset().
+    static bool is_recorded(const Thread& thread, int s) {
+      const Scope& scope = thread.scopes[s];
+      if (scope.count > 0) return true;
+      for (std::map<std::string, int>::const_iterator it=scope.children.begin(); it!=scope.children.end(); ++it)
+        if (is_recorded(thread, it->second)) return true;
+      return false;
+    }
+
+    static void write_scope(std::ostringstream& os, const Thread& thread, int s) {
+      const Scope& scope = thread.scopes[s];
+      long long self = scope.total;
+      for (std::map<std::string, int>::const_iterator it=scope.children.begin(); it!=scope.children.end(); ++it)
+        self -= thread.scopes[it->second].total;
+      os << "{\"name\": \"" << escape(scope.name) << "\", \"count\": " << scope.count
+         << ", \"total\": " << scope.total * 1e-9 << ", \"self\": " << self * 1e-9 << ", \"children\": [";
+      bool is_first = true;
+      for (std::map<std::string, int>::const_iterator it=scope.children.begin(); it!=scope.children.end(); ++it) {
+        if (!is_recorded(thread, it->second)) continue;
+        if (!is_first) os << ", ";
+        write_scope(os, thread, it->second);
+        is_first = false;
+      }
+      os << "]}";
+    }
+  };
+
+  //! Profiler of the process, used by start(), stop() and ProfileScope.
+  inline Profiler& profiler() {
+    static Profiler instance;
+    return instance;
+  }
+
+  //! Scope of the process profiler open during the lifetime of the object.
+  class ProfileScope {
+  public:
+    explicit ProfileScope(const std::string& name_) : name(name_), is_open(profiler().begin(name)) {}
+    ~ProfileScope() {
+      if (is_open) profiler().end(name);
+    }
+
+    ProfileScope(const ProfileScope&) = delete;
+    ProfileScope& operator=(const ProfileScope&) = delete;
+
+  private:
+    std::string name;
+    bool is_open;
+  };
+}  // end namespace exafmm_t
+#endif
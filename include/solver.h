@@ -0,0 +1,515 @@
+#ifndef solver_h
+#define solver_h
+#include <cstdlib>      // erand48
+#include "exafmm_t.h"
+#include "geometry.h"
+#include "timer.h"
+#if NON_ADAPTIVE
+#include "build_non_adaptive_tree.h"
+#else
+#include "build_tree.h"
+#endif
+#include "build_list.h"
+#include "math_wrapper.h"
+
+namespace exafmm_t {
+  /**
+   * @brief Iterative solver using the FMM as the matrix-vector product.
+   *
+   * The operator is A x = diagonal * x + G x, where G is the kernel matrix between bodies, which are both
+   * sources and targets. The solver owns the trees and FMM instances, so the tree, interaction lists,
+   * M2L data and operator caches are built once and reused by every matrix-vector product.
+   * Each FMM instance passed to the constructor is a level of accuracy, the first one being the most accurate.
+   * In relaxed mode, the cheapest level whose error is below relax_factor * tolerance / (relative residual)
+   * is used by each product, since the products of late iterations need less accuracy.
+   * After preconditioner_setup(), both solvers are right-preconditioned by the near-field blocks of the leaves.
+   *
+   * @tparam T Value type of sources and targets (real or complex).
+   * @tparam FmmT FMM class, e.g. LaplaceFmm.
+   */
+  template <typename T, typename FmmT>
+  class FmmSolver {
+  public:
+    //! Tree and FMM instance of one level of accuracy
+    struct Level {
+      FmmT fmm;            //!< FMM instance
+      Nodes<T> nodes;      //!< Vector of all nodes in the tree
+      NodePtrs<T> leafs;   //!< Vector of leaf pointers
+      NodePtrs<T> nonleafs;  //!< Vector of nonleaf pointers
+      real_t error;        //!< Relative error of the product against the first level
+      int nmatvec;         //!< Number of products evaluated with this level
+    };
+
+    int n;                 //!< Number of bodies
+    T diagonal;            //!< Coefficient of the identity term of the operator
+    std::vector<Level> levels;       //!< Levels of accuracy, the first one is the most accurate
+    bool is_relaxed;       //!< Whether to relax the accuracy of the products as the residual drops
+    real_t relax_factor;   //!< Safety factor of the relaxation
+    real_t tolerance;      //!< Relative tolerance of the current solve
+    int ilevel;            //!< Level used by the next product
+    std::vector<real_t> residuals;   //!< Relative residual after each iteration of the last solve
+    std::vector<std::vector<int>> block_index;   //!< [leaf] bodies of the preconditioner block, the leaf's own bodies first
+    std::vector<std::vector<T>> block_factor;    //!< [leaf] LU or Cholesky factors of the block
+    std::vector<std::vector<int>> block_ipiv;    //!< [leaf] pivots of the LU factors, empty for Cholesky factors
+
+    /**
+     * @brief Build the trees, interaction lists and M2L data of all levels.
+     *
+     * @param bodies Bodies, which are both sources and targets, in the numbering of the vectors passed to the solver.
+     * @param fmms FMM instances, one per level of accuracy, the first one being the most accurate.
+     * @param diagonal_ Coefficient of the identity term of the operator.
+     */
+    FmmSolver(const Bodies<T>& bodies, const std::vector<FmmT>& fmms, T diagonal_=T(0.)) :
+      n(bodies.size()), diagonal(diagonal_), levels(fmms.size()), is_relaxed(false),
+      relax_factor(0.1), tolerance(0), ilevel(0)
+    {
+      assert(!fmms.empty());
+      init_rel_coord();
+      for (size_t l=0; l<levels.size(); l++) {
+        Level& level = levels[l];
+        level.fmm = fmms[l];
+        level.fmm.is_potential_only = true;
+        level.fmm.nrhs = 1;
+        level.error = 0;
+        level.nmatvec = 0;
+        Bodies<T> sources = bodies;
+        Bodies<T> targets = bodies;
+        for (int i=0; i<n; i++) {
+          sources[i].ibody = i;
+          targets[i].ibody = i;
+        }
+        get_bounds(sources, targets, level.fmm.x0, level.fmm.r0);
+        level.nodes = build_tree(sources, targets, level.leafs, level.nonleafs, level.fmm);
+#if !NON_ADAPTIVE
+        balance_tree(level.nodes, sources, targets, level.leafs, level.nonleafs, level.fmm);
+#endif
+        set_colleagues(level.nodes);
+        build_list(level.nodes, level.fmm);
+        level.fmm.precompute();
+        level.fmm.M2L_setup(level.nonleafs);
+      }
+      if (levels.size() > 1) estimate_errors();
+    }
+
+    FmmSolver(const FmmSolver&) = delete;
+    FmmSolver& operator=(const FmmSolver&) = delete;
+
+    /**
+     * @brief Cache the P2P, P2M and L2P operators of the levels, the most accurate level first.
+     *
+     * @param budget Memory budget in bytes shared by all levels, 0 removes the caches.
+     * @return Memory used by the caches in bytes.
+     */
+    size_t cache_setup(size_t budget) {
+      size_t bytes = 0;
+      for (size_t l=0; l<levels.size(); l++) {
+        Level& level = levels[l];
+        bytes += level.fmm.P2P_cache_setup(level.leafs, budget-bytes, 0, false);
+        bytes += level.fmm.P2M_L2P_cache_setup(level.leafs, budget-bytes, 1<<30, false);
+      }
+      return bytes;
+    }
+
+    /**
+     * @brief Build and factorize the block-diagonal preconditioner from the near-field blocks of the leaves
+     * of the most accurate level. The block of a leaf is the operator restricted to the bodies of the leaf,
+     * optionally extended with the bodies of its colleague leaves (faces first, then edges and corners)
+     * up to max_size bodies, in which case only the rows of the leaf's own bodies are kept when applying it
+     * (restricted additive Schwarz). Real symmetric blocks use Cholesky when positive definite, the others LU.
+     * The blocks are independent, so they are built and factorized in parallel, once per geometry.
+     * A block whose LU factorization is singular is reported on std::cerr and left out of the preconditioner,
+     * which then passes the residual of its bodies through unchanged.
+     *
+     * @param with_colleagues Whether to extend the blocks with colleague leaves.
+     * @param max_size Maximum number of bodies of an extended block.
+     * @param verbose Whether to print the setup time and memory.
+     * @return Number of singular blocks.
+     */
+    int preconditioner_setup(bool with_colleagues=false, int max_size=512, bool verbose=true) {
+      start("Preconditioner Setup");
+      Level& level = levels[0];
+      NodePtrs<T>& leafs = level.leafs;
+      int nleafs = leafs.size();
+      block_index.assign(nleafs, std::vector<int>());
+      block_factor.assign(nleafs, std::vector<T>());
+      block_ipiv.assign(nleafs, std::vector<int>());
+      size_t bytes = 0;
+      int nsingular = 0;
+#pragma omp parallel for schedule(dynamic) reduction(+:bytes,nsingular)
+      for (int i=0; i<nleafs; i++) {
+        // gather the bodies of the block, colleagues sorted by the number of shared coordinates
+        NodePtrs<T> block_leafs(1, leafs[i]);
+        if (with_colleagues) {
+          for (int ndiff=1; ndiff<=3; ndiff++) {
+            for (int c=0; c<27; c++) {
+              Node<T>* colleague = leafs[i]->colleagues[c];
+              int diff = (c%3 != 1) + ((c/3)%3 != 1) + ((c/9)%3 != 1);
+              if (colleague && colleague->is_leaf && diff == ndiff) block_leafs.push_back(colleague);
+            }
+          }
+        }
+        std::vector<int>& index = block_index[i];
+        RealVec coord;
+        for (size_t l=0; l<block_leafs.size(); l++) {
+          Node<T>* leaf = block_leafs[l];
+          if (l > 0 && int(index.size()+leaf->ntrgs) > max_size) continue;
+          index.insert(index.end(), leaf->itrgs.begin(), leaf->itrgs.end());
+          coord.insert(coord.end(), leaf->trg_coord.begin(), leaf->trg_coord.end());
+        }
+        // assemble the block column by column with unit charges
+        int m = index.size();
+        std::vector<T>& A = block_factor[i];
+        A.resize(m*m);
+        RealVec src_coord(3);
+        std::vector<T> src_value(1, T(1.));
+        for (int b=0; b<m; b++) {
+          std::copy(coord.begin()+3*b, coord.begin()+3*(b+1), src_coord.begin());
+          std::vector<T> column(m, T(0.));
+          level.fmm.potential_P2P(src_coord, src_value, coord, column);
+          for (int a=0; a<m; a++)
+            A[a*m+b] = column[a];
+          A[b*m+b] += diagonal;
+        }
+        std::vector<T> copy = A;
+        if (!cholesky(m, A.data())) {
+          A = copy;
+          block_ipiv[i].resize(m);
+          if (getrf(m, A.data(), block_ipiv[i].data()) != 0) {   // info > 0: U(info,info) is exactly zero
+            nsingular++;
+            A.clear();
+            block_ipiv[i].clear();
+          }
+        }
+        bytes += A.size()*sizeof(T) + index.size()*sizeof(int) + block_ipiv[i].size()*sizeof(int);
+      }
+      stop("Preconditioner Setup", verbose);
+      if (verbose) print("Preconditioner Memory (MB)", bytes/1e6);
+      if (nsingular)
+        std::cerr << "preconditioner_setup: " << nsingular << " singular block(s) left out of the preconditioner" << std::endl;
+      return nsingular;
+    }
+
+    /**
+     * @brief Apply the preconditioner z = M^{-1} r, z must not be the same array as r.
+     *
+     * @param r Input vector of n values.
+     * @param z Output vector of n values.
+     */
+    void apply_preconditioner(const T* r, T* z) {
+      NodePtrs<T>& leafs = levels[0].leafs;
+#pragma omp parallel for schedule(dynamic)
+      for (size_t i=0; i<leafs.size(); i++) {
+        std::vector<int>& index = block_index[i];
+        int m = index.size();
+        std::vector<T> x(m);
+        for (int a=0; a<m; a++)
+          x[a] = r[index[a]];
+        if (!block_factor[i].empty()) {   // singular blocks are left out
+          if (block_ipiv[i].empty())
+            cholesky_solve(m, block_factor[i].data(), x.data());
+          else
+            getrs(m, block_factor[i].data(), block_ipiv[i].data(), x.data());
+        }
+        for (int a=0; a<leafs[i]->ntrgs; a++)
+          z[index[a]] = x[a];
+      }
+    }
+
+    /**
+     * @brief Matrix-vector product y = A x with the current level, y may be the same array as x.
+     *
+     * @param x Input vector of n values.
+     * @param y Output vector of n values.
+     */
+    void matvec(const T* x, T* y) {
+      Level& level = levels[ilevel];
+      FmmT& fmm = level.fmm;
+      NodePtrs<T>& leafs = level.leafs;
+      fmm.clear_values(level.nodes);
+#pragma omp parallel for
+      for (size_t i=0; i<leafs.size(); i++) {
+        std::vector<int>& isrcs = leafs[i]->isrcs;
+        for (size_t j=0; j<isrcs.size(); j++)
+          leafs[i]->src_value[j] = x[isrcs[j]];
+      }
+      fmm.upward_pass(level.nodes, leafs, false);
+      fmm.downward_pass(level.nodes, leafs, false);
+#pragma omp parallel for
+      for (size_t i=0; i<leafs.size(); i++) {
+        std::vector<int>& itrgs = leafs[i]->itrgs;
+        for (size_t j=0; j<itrgs.size(); j++)
+          y[itrgs[j]] = diagonal * x[itrgs[j]] + leafs[i]->trg_value[j];
+      }
+      level.nmatvec++;
+    }
+
+    /**
+     * @brief Solve A x = b with restarted GMRES.
+     *
+     * @param b Right-hand side, n values.
+     * @param x Initial guess on input, solution on output, n values.
+     * @param tol Relative tolerance of the residual.
+     * @param restart Number of iterations between restarts.
+     * @param maxiter Maximum number of iterations.
+     * @param verbose Whether to print the residual of each iteration.
+     * @return Number of iterations, or -1 if not converged.
+     */
+    int gmres(const T* b, T* x, real_t tol=1e-6, int restart=30, int maxiter=1000, bool verbose=true) {
+      tolerance = tol;
+      residuals.clear();
+      real_t bnorm = norm(b);
+      if (bnorm == 0) bnorm = 1;
+      std::vector<std::vector<T>> V(restart+1, std::vector<T>(n));
+      std::vector<std::vector<T>> H(restart+1, std::vector<T>(restart, T(0.)));
+      std::vector<real_t> cs(restart);
+      std::vector<T> sn(restart), g(restart+1), y(restart), u(n), z(n);
+      int iter = 0;
+      bool converged = false;
+      while (iter < maxiter && !converged) {
+        // true residual with the most accurate level
+        ilevel = 0;
+        std::vector<T>& r = V[0];
+        matvec(x, r.data());
+#pragma omp parallel for
+        for (int i=0; i<n; i++)
+          r[i] = b[i] - r[i];
+        real_t beta = norm(r.data());
+        if (iter == 0) residuals.push_back(beta/bnorm);
+        if (beta/bnorm < tol) {
+          converged = true;
+          break;
+        }
+        scale(T(1./beta), r.data());
+        std::fill(g.begin(), g.end(), T(0.));
+        g[0] = beta;
+        int j = 0;
+        for (; j<restart && iter<maxiter; j++, iter++) {
+          // Arnoldi with modified Gram-Schmidt
+          ilevel = select_level(std::abs(g[j])/bnorm);
+          matvec(precondition(V[j].data(), z), V[j+1].data());
+          for (int i=0; i<=j; i++) {
+            H[i][j] = dot(V[i].data(), V[j+1].data());
+            axpy(-H[i][j], V[i].data(), V[j+1].data());
+          }
+          real_t h = norm(V[j+1].data());
+          H[j+1][j] = h;
+          if (h != 0) scale(T(1./h), V[j+1].data());
+          // apply previous Givens rotations, then eliminate H[j+1][j]
+          for (int i=0; i<j; i++) {
+            T temp = cs[i] * H[i][j] + sn[i] * H[i+1][j];
+            H[i+1][j] = -conjugate(sn[i]) * H[i][j] + cs[i] * H[i+1][j];
+            H[i][j] = temp;
+          }
+          real_t a = std::abs(H[j][j]);
+          real_t rho = std::sqrt(a*a + h*h);
+          if (a == 0) {
+            cs[j] = 0;
+            sn[j] = T(1.);
+          } else {
+            cs[j] = a / rho;
+            sn[j] = H[j][j] / a * h / rho;
+          }
+          H[j][j] = cs[j] * H[j][j] + sn[j] * H[j+1][j];
+          H[j+1][j] = T(0.);
+          g[j+1] = -conjugate(sn[j]) * g[j];
+          g[j] = cs[j] * g[j];
+          real_t relres = std::abs(g[j+1]) / bnorm;
+          residuals.push_back(relres);
+          if (verbose) print("GMRES Residual", relres);
+          if (relres < tol) {
+            converged = true;
+            j++;
+            iter++;
+            break;
+          }
+        }
+        // x += M^{-1} V y, where H y = g
+        for (int i=j-1; i>=0; i--) {
+          y[i] = g[i];
+          for (int k=i+1; k<j; k++)
+            y[i] -= H[i][k] * y[k];
+          y[i] /= H[i][i];
+        }
+        std::fill(u.begin(), u.end(), T(0.));
+        for (int i=0; i<j; i++)
+          axpy(y[i], V[i].data(), u.data());
+        axpy(T(1.), precondition(u.data(), z), x);
+      }
+      return finish(b, x, bnorm, iter, converged, "GMRES", verbose);
+    }
+
+    /**
+     * @brief Solve A x = b with BiCGStab.
+     *
+     * @param b Right-hand side, n values.
+     * @param x Initial guess on input, solution on output, n values.
+     * @param tol Relative tolerance of the residual.
+     * @param maxiter Maximum number of iterations.
+     * @param verbose Whether to print the residual of each iteration.
+     * @return Number of iterations, or -1 if not converged.
+     */
+    int bicgstab(const T* b, T* x, real_t tol=1e-6, int maxiter=1000, bool verbose=true) {
+      tolerance = tol;
+      residuals.clear();
+      real_t bnorm = norm(b);
+      if (bnorm == 0) bnorm = 1;
+      std::vector<T> r(n), rhat(n), p(n, T(0.)), v(n, T(0.)), s(n), t(n), zp(n), zs(n);
+      ilevel = 0;
+      matvec(x, r.data());
+#pragma omp parallel for
+      for (int i=0; i<n; i++)
+        r[i] = b[i] - r[i];
+      rhat = r;
+      T rho = T(1.), alpha = T(1.), omega = T(1.);
+      real_t relres = norm(r.data()) / bnorm;
+      residuals.push_back(relres);
+      int iter = 0;
+      for (; iter<maxiter && relres>=tol; iter++) {
+        T rho_new = dot(rhat.data(), r.data());
+        T beta = (rho_new / rho) * (alpha / omega);
+        rho = rho_new;
+#pragma omp parallel for
+        for (int i=0; i<n; i++)
+          p[i] = r[i] + beta * (p[i] - omega * v[i]);
+        ilevel = select_level(relres);
+        const T* phat = precondition(p.data(), zp);
+        matvec(phat, v.data());
+        alpha = rho / dot(rhat.data(), v.data());
+#pragma omp parallel for
+        for (int i=0; i<n; i++)
+          s[i] = r[i] - alpha * v[i];
+        if (norm(s.data())/bnorm < tol) {
+          axpy(alpha, phat, x);
+          relres = norm(s.data()) / bnorm;
+          residuals.push_back(relres);
+          if (verbose) print("BiCGStab Residual", relres);
+          iter++;
+          break;
+        }
+        const T* shat = precondition(s.data(), zs);
+        matvec(shat, t.data());
+        omega = dot(t.data(), s.data()) / dot(t.data(), t.data());
+#pragma omp parallel for
+        for (int i=0; i<n; i++) {
+          x[i] += alpha * phat[i] + omega * shat[i];
+          r[i] = s[i] - omega * t[i];
+        }
+        relres = norm(r.data()) / bnorm;
+        residuals.push_back(relres);
+        if (verbose) print("BiCGStab Residual", relres);
+      }
+      return finish(b, x, bnorm, iter, relres < tol, "BiCGStab", verbose);
+    }
+
+  private:
+    //! Measure the error of each level against the first one with a random vector.
+    void estimate_errors() {
+      std::vector<T> x(n), y0(n), y(n);
+      unsigned short state[3] = {0x330E, 0, 0};   // own sequence, concurrent solvers do not share the state of std::rand()
+      for (int i=0; i<n; i++)
+        x[i] = T(real_t(erand48(state)) - 0.5);
+      ilevel = 0;
+      matvec(x.data(), y0.data());
+      real_t y0norm = norm(y0.data());
+      for (size_t l=1; l<levels.size(); l++) {
+        ilevel = l;
+        matvec(x.data(), y.data());
+        axpy(T(-1.), y0.data(), y.data());
+        levels[l].error = norm(y.data()) / y0norm;
+      }
+      ilevel = 0;
+    }
+
+    //! Return M^{-1} r stored in z, or r itself without a preconditioner.
+    const T* precondition(const T* r, std::vector<T>& z) {
+      if (block_factor.empty()) return r;
+      apply_preconditioner(r, z.data());
+      return z.data();
+    }
+
+    static bool cholesky(int m, real_t* A) {
+      return potrf(m, A) == 0;
+    }
+
+    static bool cholesky(int, complex_t*) {
+      return false;
+    }
+
+    static void cholesky_solve(int m, real_t* A, real_t* b) {
+      potrs(m, A, b);
+    }
+
+    static void cholesky_solve(int, complex_t*, complex_t*) {}
+
+    //! Cheapest level accurate enough for a product at the given relative residual.
+    int select_level(real_t relres) {
+      if (!is_relaxed || relres == 0) return 0;
+      real_t eps = relax_factor * tolerance / relres;
+      int l = 0;
+      for (size_t i=1; i<levels.size(); i++) {
+        if (levels[i].error <= eps) l = i;
+      }
+      return l;
+    }
+
+    //! Check the true residual with the most accurate level and report the solve.
+    int finish(const T* b, T* x, real_t bnorm, int iter, bool converged, std::string name, bool verbose) {
+      std::vector<T> r(n);
+      ilevel = 0;
+      matvec(x, r.data());
+      axpy(T(-1.), b, r.data());
+      real_t relres = norm(r.data()) / bnorm;
+      if (verbose) {
+        print(name + " Iterations", iter);
+        print(name + " True Residual", relres);
+        for (size_t l=0; l<levels.size(); l++)
+          print("Matvecs at P=" + std::to_string(levels[l].fmm.p), levels[l].nmatvec);
+      }
+      return converged ? iter : -1;
+    }
+
+    static real_t conjugate(real_t a) {
+      return a;
+    }
+
+    static complex_t conjugate(complex_t a) {
+      return std::conj(a);
+    }
+
+    T dot(const T* a, const T* b) {
+      T sum = T(0.);
+#pragma omp parallel
+      {
+        T partial = T(0.);
+#pragma omp for nowait
+        for (int i=0; i<n; i++)
+          partial += conjugate(a[i]) * b[i];
+#pragma omp critical
+        sum += partial;
+      }
+      return sum;
+    }
+
+    real_t norm(const T* a) {
+      real_t sum = 0;
+#pragma omp parallel for reduction(+:sum)
+      for (int i=0; i<n; i++)
+        sum += std::norm(a[i]);
+      return std::sqrt(sum);
+    }
+
+    //! y += alpha * x
+    void axpy(T alpha, const T* x, T* y) {
+#pragma omp parallel for
+      for (int i=0; i<n; i++)
+        y[i] += alpha * x[i];
+    }
+
+    void scale(T alpha, T* x) {
+#pragma omp parallel for
+      for (int i=0; i<n; i++)
+        x[i] *= alpha;
+    }
+  };
+}  // end namespace exafmm_t
+#endif
@@ -0,0 +1,69 @@
+#ifndef task_graph_h
+#define task_graph_h
+#include <functional>   // std::function
+#include <vector>
+
+namespace exafmm_t {
+  /**
+   * @brief Directed acyclic graph of tasks. Each task is spawned as an OpenMP task as soon as
+   * all its predecessors have completed, so independent work fills the cores instead of waiting
+   * at the barrier of a phase.
+   */
+  class TaskGraph {
+  public:
+    /**
+     * @brief Add a task to the graph.
+     *
+     * @param work Function executed by the task.
+     * @return Index of the task.
+     */
+    int add(std::function<void()> work) {
+      works.push_back(work);
+      successors.push_back(std::vector<int>());
+      npredecessors.push_back(0);
+      return works.size() - 1;
+    }
+
+    //! Make task after wait for task before.
+    void depend(int before, int after) {
+      successors[before].push_back(after);
+      npredecessors[after]++;
+    }
+
+    //! Number of tasks.
+    size_t size() const {
+      return works.size();
+    }
+
+    //! Execute all tasks in a parallel region and return after they complete.
+    void run() {
+      count = npredecessors;
+#pragma omp parallel
+#pragma omp single nowait
+      for (size_t i=0; i<works.size(); i++) {
+        if (npredecessors[i] == 0) spawn(i);
+      }
+    }
+
+  private:
+    std::vector<std::function<void()>> works;   //!< Work of each task
+    std::vector<std::vector<int>> successors;   //!< Tasks waiting for each task
+    std::vector<int> npredecessors;             //!< Number of tasks each task waits for
+    std::vector<int> count;                     //!< Number of predecessors not completed yet during run()
+
+    void spawn(int i) {
+#pragma omp task firstprivate(i) untied
+      {
+        works[i]();
+        for (size_t j=0; j<successors[i].size(); j++) {
+          int next = successors[i][j];
+          int remaining;
+#pragma omp atomic capture
+          remaining = --count[next];
+          if (remaining == 0) spawn(next);
+        }
+      }
+    }
+  };
+}  // end namespace exafmm_t
+#endif
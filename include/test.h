@@ -36,23 +36,6 @@ namespace exafmm_t {
       }
     }
 
-    //! Dummy M2M operator.
-    void M2M(Node<T>* node) {
-      if(node->is_leaf) return;
-      for(int octant=0; octant<8; ++octant) {  
-        if(node->children[octant])
-#pragma omp task untied
-          M2M(node->children[octant]);
-      }
-#pragma omp taskwait
-      for(int octant=0; octant<8; octant++) {
-        if(node->children[octant]) {
-          Node<T>* child = node->children[octant];
-          node->up_equiv[0] += child->up_equiv[0];
-        }
-      }
-    }
-
     //! Dummy M2L operator.
     void M2L(NodePtrs<T>& nonleafs) {
 #pragma omp parallel for schedule(dynamic)
@@ -118,23 +101,6 @@ namespace exafmm_t {
       }
     }
 
-    //! Dummy L2L operator.
-    void L2L(Node<T>* node) {
-      if(node->is_leaf) return;
-      for(int octant=0; octant<8; octant++) {
-        if(node->children[octant]) {
-          Node<T>* child = node->children[octant];
-          child->dn_equiv[0] += node->dn_equiv[0];
-        }
-      }
-      for(int octant=0; octant<8; ++octant) {
-        if(node->children[octant])
-#pragma omp task untied
-          L2L(node->children[octant]);
-      }
-#pragma omp taskwait
-    }
-
     //! Dummy L2P operator.
     void L2P(NodePtrs<T>& leafs) {
 #pragma omp parallel for
@@ -167,6 +133,30 @@ namespace exafmm_t {
                       RealVec& trg_coord, std::vector<T>& trg_value) {}
 
     void M2L(Nodes<T>& nodes) {}
+
+    void M2L_subset(Nodes<T>& nodes, NodePtrs<T>& targets, const std::vector<bool>& is_source) {}
+
+    void M2L_group(Nodes<T>& nodes, NodePtrs<T>& targets) {}
+
+    //! Dummy M2M operator of a single non-leaf node.
+    void M2M_node(Node<T>* node) {
+      for(int octant=0; octant<8; octant++) {
+        if(node->children[octant]) {
+          Node<T>* child = node->children[octant];
+          node->up_equiv[0] += child->up_equiv[0];
+        }
+      }
+    }
+
+    //! Dummy L2L operator of a single non-leaf node.
+    void L2L_node(Node<T>* node) {
+      for(int octant=0; octant<8; octant++) {
+        if(node->children[octant]) {
+          Node<T>* child = node->children[octant];
+          child->dn_equiv[0] += node->dn_equiv[0];
+        }
+      }
+    }
   };
 
   /**
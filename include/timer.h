@@ -1,22 +1,27 @@
 #ifndef timer_h
 #define timer_h
+#include <chrono>
 #include <iomanip>
 #include <iostream>
 #include <map>
 #include <string>
-#include <sys/time.h>
 #include <unistd.h>
+#include "counters.h"
+#include "profiler.h"
 
 namespace exafmm_t {
   static const int stringLength = 20;           //!< Length of formatted string
   static const int decimal = 7;                 //!< Decimal precision
   static const int wait = 100;                  //!< Waiting time between output of different ranks
   static const int dividerLength = stringLength + decimal + 9;  // length of output section divider
-  long long flop = 0;
-  timeval time;
-  std::map<std::string, timeval> timer;
 
-  void print(std::string s) {
+  //! Start times of the events of the calling thread, so threads running independent solves do not share timers.
+  inline std::map<std::string, std::chrono::steady_clock::time_point>& thread_timers() {
+    thread_local std::map<std::string, std::chrono::steady_clock::time_point> timer;
+    return timer;
+  }
+
+  inline void print(std::string s) {
     // if (!VERBOSE | (MPIRANK != 0)) return;
     s += " ";
     std::cout << "--- " << std::setw(stringLength) << std::left
@@ -34,7 +39,7 @@ namespace exafmm_t {
     std::cout << v << std::endl;
   }
 
-  void print_divider(std::string s) {
+  inline void print_divider(std::string s) {
     s.insert(0, " ");
     s.append(" ");
     int halfLength = (dividerLength - s.length()) / 2;
@@ -42,20 +47,17 @@ namespace exafmm_t {
               << std::string(dividerLength-halfLength-s.length(), '-') << std::endl;
   }
 
-  void add_flop(long long n) {
-#pragma omp atomic update
-    flop += n;
-  }
-
-  void start(std::string event) {
-    gettimeofday(&time, NULL);
-    timer[event] = time;
+  //! Start timing an event with a monotonic clock, and open a scope of the process profiler nested in the open ones.
+  inline void start(std::string event) {
+    profiler().begin(event);
+    thread_timers()[event] = std::chrono::steady_clock::now();
   }
 
-  double stop(std::string event, bool verbose=true) {
-    gettimeofday(&time, NULL);
-    double eventTime = time.tv_sec - timer[event].tv_sec +
-      (time.tv_usec - timer[event].tv_usec) * 1e-6;
+  //! Stop timing an event and close its profiler scope, return the elapsed time in seconds.
+  inline double stop(std::string event, bool verbose=true) {
+    std::chrono::steady_clock::time_point time = std::chrono::steady_clock::now();
+    profiler().end(event);
+    double eventTime = std::chrono::duration<double>(time - thread_timers()[event]).count();
     if (verbose)
       print(event, eventTime);
     return eventTime;
@@ -0,0 +1,187 @@
+#ifndef tree_statistics_h
+#define tree_statistics_h
+#include <algorithm>    // std::min, std::max
+#include <cmath>        // std::log2
+#include <string>
+#include <utility>      // std::pair
+#include <vector>
+#include "exafmm_t.h"
+#include "fmm_base.h"
+#include "timer.h"
+
+namespace exafmm_t {
+  //! Distribution of a count over nodes, e.g. the number of sources of the leaves, with power-of-two bins.
+  struct Distribution {
+    long long count;                 //!< Number of nodes
+    long long total;                 //!< Sum of the values
+    long long min;
+    long long max;
+    std::vector<long long> bins;     //!< bins[0] counts the value 0, bins[b] the values in [2^(b-1), 2^b)
+
+    Distribution() : count(0), total(0), min(0), max(0) {}
+
+    void add(long long value) {
+      min = count ? std::min(min, value) : value;
+      max = count ? std::max(max, value) : value;
+      count++;
+      total += value;
+      size_t b = 0;
+      while (b < 63 && (1LL << b) <= value) b++;
+      if (bins.size() <= b) bins.resize(b+1, 0);
+      bins[b]++;
+    }
+
+    double mean() const {
+      return count ? double(total) / count : 0;
+    }
+
+    //! Print the summary and the non-empty bins.
+    void print(const std::string& name) const {
+      exafmm_t::print(name + " min", min);
+      exafmm_t::print(name + " mean", mean());
+      exafmm_t::print(name + " max", max);
+      for (size_t b=0; b<bins.size(); b++) {
+        if (!bins[b]) continue;
+        std::string range = b <= 1 ? std::to_string(b) : std::to_string(1LL << (b-1)) + "-" + std::to_string((1LL << b) - 1);
+        exafmm_t::print("  " + range, bins[b]);
+      }
+    }
+  };
+
+  //! Estimated work of a phase of the evaluation.
+  struct PhaseWork {
+    std::string name;     //!< Phase, as in FmmBase::phase_counters
+    double pairs;         //!< Kernel evaluations between a source and a target or a surface point, 0 for translations
+    double flop;          //!< Flops with the flop counts of the kernels and operators
+  };
+
+  //! Statistics of a tree and of its interaction lists.
+  struct TreeStatistics {
+    int depth;                              //!< Deepest level
+    std::vector<long long> nodes;           //!< Number of nodes of each level
+    std::vector<long long> leafs;           //!< Number of leaves of each level with sources or targets
+    long long empty_leafs;                  //!< Number of leaves without sources and targets, which are not evaluated
+    Distribution leaf_sources;              //!< nsrcs of the non-empty leaves
+    Distribution leaf_targets;              //!< ntrgs of the non-empty leaves
+    Distribution P2P_lengths;               //!< Length of the P2P_list of the non-empty leaves
+    Distribution M2L_lengths;               //!< Number of nodes in the M2L_list of the non-leaves
+    Distribution M2P_lengths;               //!< Length of the M2P_list of the non-empty leaves
+    Distribution P2L_lengths;               //!< Length of the P2L_list of all nodes
+    std::vector<PhaseWork> work;            //!< Estimated work of each phase, in the order of the passes
+
+    //! Estimated flops of an evaluation.
+    double total_flop() const {
+      double total = 0;
+      for (size_t i=0; i<work.size(); i++) total += work[i].flop;
+      return total;
+    }
+
+    void print() const {
+      print_divider("Tree Statistics");
+      exafmm_t::print("Depth", depth);
+      for (size_t l=0; l<nodes.size(); l++)
+        exafmm_t::print("Level " + std::to_string(l) + " nodes/leafs",
+                        std::to_string(nodes[l]) + " / " + std::to_string(leafs[l]));
+      exafmm_t::print("Empty leafs", empty_leafs);
+      leaf_sources.print("Leaf sources");
+      leaf_targets.print("Leaf targets");
+      print_divider("Interaction Lists");
+      P2P_lengths.print("P2P list");
+      M2L_lengths.print("M2L list");
+      M2P_lengths.print("M2P list");
+      P2L_lengths.print("P2L list");
+      print_divider("Estimated Work");
+      double total = total_flop();
+      for (size_t i=0; i<work.size(); i++) {
+        exafmm_t::print(work[i].name + " flop", work[i].flop);
+        exafmm_t::print(work[i].name + " share", total > 0 ? work[i].flop / total : 0);
+      }
+      exafmm_t::print("Total flop", total);
+    }
+  };
+
+  //! Flops of the kernel on one source and one target per right-hand side, as counted by add_flop().
+  template <typename T>
+  long long kernel_pair_flop(FmmBase<T>& fmm, bool is_potential) {
+    RealVec src_coord(3, 0), trg_coord(3, 1);
+    std::vector<T> src_value(fmm.nrhs, T(1)), trg_value(4*fmm.nrhs, T(0));
+    CounterRegistry registry;   // not counted with the work of other threads
+    OpScope scope(Other_Op, registry);
+    if (is_potential)
+      fmm.potential_P2P_multi(src_coord, src_value, trg_coord, trg_value, fmm.nrhs);
+    else
+      fmm.evaluate_P2P(src_coord, src_value, trg_coord, trg_value);
+    return registry.read().total_flop();
+  }
+
+  /**
+   * @brief Collect the statistics of a tree after build_list(), without evaluating it, e.g. to see how ncrit
+   * and balancing change the cost. The work of each phase is estimated from the interaction lists: kernel
+   * evaluations cost the flops that the kernel counts for one pair, check-to-equivalent conversions and
+   * M2M/L2L translations are matrix-vector products on the surfaces, and M2L is the Hadamard product of
+   * each pair of non-leaves in the M2L lists plus 2.5 N log2(N) per FFT of a child, halved for real data.
+   * The flops of the kernel are measured on one pair with the counters, so concurrent counts would
+   * be included.
+   *
+   * @param nodes Tree with its interaction lists.
+   * @param fmm FMM instance of the tree.
+   */
+  template <typename T>
+  TreeStatistics tree_statistics(Nodes<T>& nodes, FmmBase<T>& fmm) {
+    TreeStatistics stats;
+    stats.depth = 0;
+    stats.empty_leafs = 0;
+    for (size_t i=0; i<nodes.size(); i++) stats.depth = std::max(stats.depth, nodes[i].level);
+    stats.nodes.assign(stats.depth+1, 0);
+    stats.leafs.assign(stats.depth+1, 0);
+
+    double pot_pair = kernel_pair_flop(fmm, true);    // sources to a check surface
+    double eval_pair = kernel_pair_flop(fmm, false);  // equivalent surface or sources to targets
+    double matvec = (fmm.is_real ? 2. : 8.) * fmm.nsurf * fmm.nsurf * fmm.nrhs;
+    double fft = (fmm.is_real ? 1.25 : 2.5) * fmm.nconv * std::log2(double(fmm.nconv));
+    double hadamard = 8. * 8 * 8 * fmm.nfreq * fmm.nrhs;
+    double nsurf = fmm.nsurf;
+    double P2M = 0, P2L = 0, M2P = 0, P2P = 0, L2P = 0;   // kernel evaluations
+    double M2L_flop = 0, nnonleafs = 0;
+    for (size_t i=0; i<nodes.size(); i++) {
+      Node<T>& node = nodes[i];
+      stats.nodes[node.level]++;
+      stats.P2L_lengths.add(node.P2L_list.size());
+      for (size_t j=0; j<node.P2L_list.size(); j++) P2L += node.P2L_list[j]->nsrcs * nsurf;
+      if (node.is_leaf && !node.nsrcs && !node.ntrgs) {
+        stats.empty_leafs++;
+      } else if (node.is_leaf) {
+        stats.leafs[node.level]++;
+        stats.leaf_sources.add(node.nsrcs);
+        stats.leaf_targets.add(node.ntrgs);
+        stats.P2P_lengths.add(node.P2P_list.size());
+        stats.M2P_lengths.add(node.M2P_list.size());
+        for (size_t j=0; j<node.P2P_list.size(); j++) P2P += double(node.ntrgs) * node.P2P_list[j]->nsrcs;
+        M2P += node.M2P_list.size() * nsurf * node.ntrgs;
+        P2M += node.nsrcs * nsurf;
+        L2P += nsurf * node.ntrgs;
+      } else {
+        long long nM2L = 0;
+        for (size_t j=0; j<node.M2L_list.size(); j++) nM2L += node.M2L_list[j] != nullptr;
+        stats.M2L_lengths.add(nM2L);
+        M2L_flop += nM2L * hadamard;
+        nnonleafs++;
+      }
+    }
+    M2L_flop += 2 * NCHILD * nnonleafs * fft;   // FFT of the children of the sources, inverse FFT of the targets
+    double nleafs = stats.leaf_sources.count;
+    PhaseWork work[] = {
+      {"P2M", P2M, P2M * pot_pair + 2 * nleafs * matvec},
+      {"M2M", 0, NCHILD * nnonleafs * matvec},
+      {"P2L", P2L, P2L * pot_pair},
+      {"M2P", M2P, M2P * eval_pair},
+      {"P2P", P2P, P2P * eval_pair},
+      {"M2L", 0, M2L_flop},
+      {"L2L", 0, NCHILD * nnonleafs * matvec},
+      {"L2P", L2P, L2P * eval_pair + 2 * nleafs * matvec}
+    };
+    stats.work.assign(work, work+8);
+    return stats;
+  }
+}  // end namespace exafmm_t
+#endif
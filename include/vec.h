@@ -652,6 +652,9 @@ namespace exafmm_t {
     friend vec max(const vec & v, const vec & w) {
       return vec(_mm512_max_ps(v.data,w.data));
     }
+    friend float sum(const vec & v) {
+      return _mm512_reduce_add_ps(v.data);
+    }
     friend vec rsqrt(const vec & v) {
 #if EXAFMM_RSQRT_APPROX
       vec three = 3.0;
@@ -799,6 +802,9 @@ namespace exafmm_t {
     friend vec max(const vec & v, const vec & w) {
       return vec(_mm512_max_pd(v.data,w.data));
     }
+    friend double sum(const vec & v) {
+      return _mm512_reduce_add_pd(v.data);
+    }
     friend vec rsqrt(const vec & v) {
 #if EXAFMM_RSQRT_APPROX
 #ifdef __MIC__
@@ -157,6 +157,7 @@ Tree<real_t> setup_laplace(Bodies<real_t>& sources, Bodies<real_t>& targets, exa
   exafmm_t::init_rel_coord();
   build_list<real_t>(tree, fmm);
   fmm.M2L_setup(tree.nonleafs);
+  fmm.P2P_setup(tree.leafs);
   fmm.precompute();
   return tree;
 }
@@ -175,6 +176,7 @@ Tree<real_t> setup_modified_helmholtz(Bodies<real_t>& sources, Bodies<real_t>& t
   exafmm_t::init_rel_coord();
   build_list<real_t>(tree, fmm);
   fmm.M2L_setup(tree.nonleafs);
+  fmm.P2P_setup(tree.leafs);
   fmm.precompute();
   return tree;
 }
@@ -185,13 +187,14 @@ Tree<real_t> setup_modified_helmholtz(Bodies<real_t>& sources, Bodies<real_t>& t
  * @param tree The octree.
  * @param fmm Laplace FMM instance.
  * @param verbose Turn on verbose mode if true, default to false.
- * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array.
+ * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array (n_trg-by-1 in potential-only mode).
  */
 py::array_t<real_t> evaluate_laplace(Tree<real_t>& tree, exafmm_t::LaplaceFmm& fmm, bool verbose=false) {
   fmm.upward_pass(tree.nodes, tree.leafs, verbose);
   fmm.downward_pass(tree.nodes, tree.leafs, verbose);
 
-  auto trg_value = py::array_t<real_t>({tree.nodes[0].ntrgs, 4});
+  int nvalues = fmm.ntrg_values();   // 1 in potential-only mode
+  auto trg_value = py::array_t<real_t>({tree.nodes[0].ntrgs, nvalues});
   auto r = trg_value.mutable_unchecked<2>();  // access function
 
 #pragma omp parallel for
@@ -199,10 +202,8 @@ py::array_t<real_t> evaluate_laplace(Tree<real_t>& tree, exafmm_t::LaplaceFmm& f
     Node<real_t>* leaf = tree.leafs[i];
     std::vector<int> & itrgs = leaf->itrgs;
     for (size_t j=0; j<itrgs.size(); ++j) {
-      r(itrgs[j], 0) = leaf->trg_value[4*j+0];
-      r(itrgs[j], 1) = leaf->trg_value[4*j+1];
-      r(itrgs[j], 2) = leaf->trg_value[4*j+2];
-      r(itrgs[j], 3) = leaf->trg_value[4*j+3];
+      for (int d=0; d<nvalues; ++d)
+        r(itrgs[j], d) = leaf->trg_value[nvalues*j+d];
     }
   }
   return trg_value;
@@ -214,13 +215,14 @@ py::array_t<real_t> evaluate_laplace(Tree<real_t>& tree, exafmm_t::LaplaceFmm& f
  * @param tree The octree.
  * @param fmm Helmholtz FMM instance.
  * @param verbose Turn on verbose mode if true, default to false.
- * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array.
+ * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array (n_trg-by-1 in potential-only mode).
  */
 py::array_t<complex_t> evaluate_helmholtz(Tree<complex_t>& tree, exafmm_t::HelmholtzFmm& fmm, bool verbose=false) {
   fmm.upward_pass(tree.nodes, tree.leafs, verbose);
   fmm.downward_pass(tree.nodes, tree.leafs, verbose);
   
-  auto trg_value = py::array_t<complex_t>({tree.nodes[0].ntrgs, 4});
+  int nvalues = fmm.ntrg_values();   // 1 in potential-only mode
+  auto trg_value = py::array_t<complex_t>({tree.nodes[0].ntrgs, nvalues});
   auto r = trg_value.mutable_unchecked<2>();  // access function
 
 #pragma omp parallel for
@@ -228,10 +230,8 @@ py::array_t<complex_t> evaluate_helmholtz(Tree<complex_t>& tree, exafmm_t::Helmh
     Node<complex_t>* leaf = tree.leafs[i];
     std::vector<int> & itrgs = leaf->itrgs;
     for (size_t j=0; j<itrgs.size(); ++j) {
-      r(itrgs[j], 0) = leaf->trg_value[4*j+0];
-      r(itrgs[j], 1) = leaf->trg_value[4*j+1];
-      r(itrgs[j], 2) = leaf->trg_value[4*j+2];
-      r(itrgs[j], 3) = leaf->trg_value[4*j+3];
+      for (int d=0; d<nvalues; ++d)
+        r(itrgs[j], d) = leaf->trg_value[nvalues*j+d];
     }
   }
   return trg_value;
@@ -243,13 +243,14 @@ py::array_t<complex_t> evaluate_helmholtz(Tree<complex_t>& tree, exafmm_t::Helmh
  * @param tree The octree.
  * @param fmm The modified Helmholtz FMM instance.
  * @param verbose Turn on verbose mode if true, default to false.
- * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array.
+ * @return trg_value Potential and gradient of targets, an n_trg-by-4 numpy array (n_trg-by-1 in potential-only mode).
  */
 py::array_t<real_t> evaluate_modified_helmholtz(Tree<real_t>& tree, exafmm_t::ModifiedHelmholtzFmm& fmm, bool verbose=false) {
   fmm.upward_pass(tree.nodes, tree.leafs, verbose);
   fmm.downward_pass(tree.nodes, tree.leafs, verbose);
 
-  auto trg_value = py::array_t<real_t>({tree.nodes[0].ntrgs, 4});
+  int nvalues = fmm.ntrg_values();   // 1 in potential-only mode
+  auto trg_value = py::array_t<real_t>({tree.nodes[0].ntrgs, nvalues});
   auto r = trg_value.mutable_unchecked<2>();  // access function
 
 #pragma omp parallel for
@@ -257,10 +258,8 @@ py::array_t<real_t> evaluate_modified_helmholtz(Tree<real_t>& tree, exafmm_t::Mo
     Node<real_t>* leaf = tree.leafs[i];
     std::vector<int> & itrgs = leaf->itrgs;
     for (size_t j=0; j<itrgs.size(); ++j) {
-      r(itrgs[j], 0) = leaf->trg_value[4*j+0];
-      r(itrgs[j], 1) = leaf->trg_value[4*j+1];
-      r(itrgs[j], 2) = leaf->trg_value[4*j+2];
-      r(itrgs[j], 3) = leaf->trg_value[4*j+3];
+      for (int d=0; d<nvalues; ++d)
+        r(itrgs[j], d) = leaf->trg_value[nvalues*j+d];
     }
   }
   return trg_value;
@@ -443,37 +442,55 @@ PYBIND11_MODULE(exafmm, m) {
           &exafmm_t::LaplaceFmm::verify,
           py::arg("leafs"),
           py::arg("sample") = true)
+     .def_readonly("potential_only", &exafmm_t::LaplaceFmm::is_potential_only)
      .def(py::init<>())
-     .def(py::init<int, int, std::string>(),
+     .def(py::init([](int p, int ncrit, std::string filename, bool potential_only) {
+            exafmm_t::LaplaceFmm fmm(p, ncrit, filename);
+            fmm.is_potential_only = potential_only;   // fixed before setup() sizes trg_value
+            return fmm;
+          }),
           py::arg("p"),
           py::arg("ncrit"),
-          py::arg("filename") = std::string());
+          py::arg("filename") = std::string(),
+          py::arg("potential_only") = false);
 
   py::class_<exafmm_t::HelmholtzFmm>(m1, "HelmholtzFmm")
      .def("verify",
           &exafmm_t::HelmholtzFmm::verify,
           py::arg("leafs"),
           py::arg("sample") = true)
+     .def_readonly("potential_only", &exafmm_t::HelmholtzFmm::is_potential_only)
      .def_readwrite("wavek", &exafmm_t::HelmholtzFmm::wavek)
      .def(py::init<>())
-     .def(py::init<int, int, complex_t, std::string>(),
+     .def(py::init([](int p, int ncrit, complex_t wavek, std::string filename, bool potential_only) {
+            exafmm_t::HelmholtzFmm fmm(p, ncrit, wavek, filename);
+            fmm.is_potential_only = potential_only;   // fixed before setup() sizes trg_value
+            return fmm;
+          }),
           py::arg("p"),
           py::arg("ncrit"),
           py::arg("wavek"),
-          py::arg("filename") = std::string());
+          py::arg("filename") = std::string(),
+          py::arg("potential_only") = false);
 
   py::class_<exafmm_t::ModifiedHelmholtzFmm>(m2, "ModifiedHelmholtzFmm")
      .def("verify",
           &exafmm_t::ModifiedHelmholtzFmm::verify,
           py::arg("leafs"),
           py::arg("sample") = true)
+     .def_readonly("potential_only", &exafmm_t::ModifiedHelmholtzFmm::is_potential_only)
      .def_readwrite("wavek", &exafmm_t::ModifiedHelmholtzFmm::wavek)
      .def(py::init<>())
-     .def(py::init<int, int, real_t, std::string>(),
+     .def(py::init([](int p, int ncrit, real_t wavek, std::string filename, bool potential_only) {
+            exafmm_t::ModifiedHelmholtzFmm fmm(p, ncrit, wavek, filename);
+            fmm.is_potential_only = potential_only;   // fixed before setup() sizes trg_value
+            return fmm;
+          }),
           py::arg("p"),
           py::arg("ncrit"),
           py::arg("wavek"),
-          py::arg("filename") = std::string());
+          py::arg("filename") = std::string(),
+          py::arg("potential_only") = false);
 
 
   // init_sources function
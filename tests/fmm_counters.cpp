@@ -0,0 +1,125 @@
+#include <thread>
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+// build the tree of the test problem and precompute its matrices
+template <typename T, typename FmmT>
+Nodes<T> setup(FmmT& fmm, Args& args, NodePtrs<T>& leafs) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  return nodes;
+}
+
+// check that the counts of each phase are attributed to its operators, including those of the worker threads
+template <typename T, typename FmmT>
+void test_phases(FmmT& fmm, Args& args, std::string name) {
+  NodePtrs<T> leafs;
+  Nodes<T> nodes = setup<T>(fmm, args, leafs);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+
+  std::map<std::string, int> phase_ops = {{"P2M", P2M_Op}, {"M2M", M2M_Op}, {"P2P", P2P_Op},
+                                          {"L2L", L2L_Op}, {"L2P", L2P_Op}};
+  for (auto it=phase_ops.begin(); it!=phase_ops.end(); ++it) {
+    PhaseCounters& phase = fmm.phase_counters[it->first];
+    print(name + " " + it->first + " GFLOP/s", phase.gflops());
+    print(name + " " + it->first + " GB/s", phase.gbytes());
+    assert(phase.counters.flop[it->second] > 0 && phase.counters.bytes[it->second] > 0);
+    assert(phase.counters.total_flop() == phase.counters.flop[it->second]);
+    assert(phase.counters.total_bytes() == phase.counters.bytes[it->second]);
+  }
+  // the FFT flops are estimated if the FFT library does not report them
+  Counters& m2l = fmm.phase_counters["M2L"].counters;
+  assert(m2l.flop[M2L_FFT_Op] > 0 && m2l.flop[M2L_Hadamard_Op] > 0 && m2l.flop[M2L_IFFT_Op] > 0);
+  assert(m2l.bytes[M2L_FFT_Op] > 0 && m2l.bytes[M2L_Hadamard_Op] > 0 && m2l.bytes[M2L_IFFT_Op] > 0);
+  assert(m2l.total_flop() == m2l.flop[M2L_FFT_Op] + m2l.flop[M2L_Hadamard_Op] + m2l.flop[M2L_IFFT_Op]);
+  print(name + " M2L GFLOP/s", fmm.phase_counters["M2L"].gflops());
+  print(name + " M2L GB/s", fmm.phase_counters["M2L"].gbytes());
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  test_phases<real_t>(laplace, args, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10), "helmholtz_counters_test.dat");
+  test_phases<complex_t>(helmholtz, args, "Helmholtz");
+
+  // concurrent evaluations of two instances only count their own operators
+  {
+    LaplaceFmm fmm0(args.P, args.ncrit), fmm1(args.P, args.ncrit);
+    NodePtrs<real_t> leafs0, leafs1;
+    Nodes<real_t> nodes0 = setup<real_t>(fmm0, args, leafs0);
+    Nodes<real_t> nodes1 = setup<real_t>(fmm1, args, leafs1);
+    std::thread thread([&]() {
+      fmm1.upward_pass(nodes1, leafs1, false);
+      fmm1.downward_pass(nodes1, leafs1, false);
+    });
+    fmm0.upward_pass(nodes0, leafs0, false);
+    fmm0.downward_pass(nodes0, leafs0, false);
+    thread.join();
+    for (auto it=laplace.phase_counters.begin(); it!=laplace.phase_counters.end(); ++it) {
+      Counters& serial = it->second.counters;
+      Counters& counts0 = fmm0.phase_counters[it->first].counters;
+      Counters& counts1 = fmm1.phase_counters[it->first].counters;
+      for (int op=0; op<Op_Count; ++op) {
+        assert(counts0.flop[op] == serial.flop[op] && counts1.flop[op] == serial.flop[op]);
+        assert(counts0.bytes[op] == serial.bytes[op] && counts1.bytes[op] == serial.bytes[op]);
+      }
+    }
+  }
+
+  // counts of concurrent threads are summed, and kept after the threads exit
+  Counters begin = read_counters();
+  std::vector<std::thread> threads;
+  for (int t=0; t<4; ++t) {
+    threads.emplace_back([]() {
+      OpScope scope(P2P_Op);
+      for (int i=0; i<1000; ++i) {
+        add_flop(2);
+        add_bytes(3);
+      }
+    });
+  }
+  for (size_t t=0; t<threads.size(); ++t) threads[t].join();
+  Counters counts = read_counters() - begin;
+  assert(counts.flop[P2P_Op] == 8000 && counts.bytes[P2P_Op] == 12000);
+  assert(counts.total_flop() == 8000);
+
+  // the counters of exited threads are reused by new threads
+  size_t nthreads = counter_registry().size();
+  for (int t=0; t<4; ++t) {
+    std::thread thread([]() { add_flop(1); });
+    thread.join();
+  }
+  assert(counter_registry().size() == nthreads);
+  assert((read_counters() - begin).flop[Other_Op] == 4);
+
+  // scopes restore the operator of the enclosing scope
+  {
+    OpScope outer(M2M_Op);
+    { OpScope inner(L2L_Op); }
+    assert(current_op() == M2M_Op);
+  }
+  assert(current_op() == Other_Op);
+
+  reset_flop();
+  add_flop(5);
+  assert(get_flop() == 5);
+  return 0;
+}
@@ -0,0 +1,101 @@
+#include <cstdlib>      // std::rand
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+template <typename T>
+T random_value() {
+  return T(real_t(std::rand()) / RAND_MAX - 0.5);
+}
+
+// evaluate with the given charges and return the results in the initial numbering of targets,
+// followed by the results of query() at the targets
+template <typename T, typename FmmT>
+std::vector<T> evaluate(FmmT& fmm, Bodies<T>& sources, Bodies<T>& targets, std::vector<T>& charges,
+                        std::vector<int>& ibodies, std::vector<T>& dq) {
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.set_charges(leafs, charges);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  if (!ibodies.empty()) {
+    fmm.delta_setup(leafs);
+    fmm.evaluate_delta(nodes, leafs, ibodies, dq, false);
+  }
+  std::vector<T> results(targets.size()*4);
+  for (size_t i=0; i<leafs.size(); ++i) {
+    for (size_t j=0; j<leafs[i]->itrgs.size(); ++j) {
+      for (int d=0; d<4; ++d)
+        results[4*leafs[i]->itrgs[j]+d] = leafs[i]->trg_value[4*j+d];
+    }
+  }
+  // query() reads the expansions, which must include the charge increments
+  fmm.query_setup(nodes, leafs);
+  RealVec coord(3*targets.size());
+  for (size_t i=0; i<targets.size(); ++i) {
+    for (int d=0; d<3; ++d)
+      coord[3*targets[i].ibody+d] = targets[i].X[d];
+  }
+  std::vector<T> queried = fmm.query(coord);
+  results.insert(results.end(), queried.begin(), queried.end());
+  return results;
+}
+
+// update a few charges with evaluate_delta() and compare against a full evaluation with the updated charges
+template <typename T, typename FmmT>
+double test_delta(FmmT& fmm, Args& args) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  std::vector<T> charges(sources.size());
+  for (size_t i=0; i<charges.size(); ++i)
+    charges[i] = random_value<T>();
+  std::vector<int> ibodies;
+  std::vector<T> dq;
+  for (size_t i=0; i<sources.size(); i+=50) {   // change 2% of the charges
+    ibodies.push_back(std::rand() % sources.size());
+    dq.push_back(random_value<T>());
+  }
+  std::vector<T> results = evaluate(fmm, sources, targets, charges, ibodies, dq);
+
+  for (size_t i=0; i<ibodies.size(); ++i)
+    charges[ibodies[i]] += dq[i];
+  ibodies.clear();
+  std::vector<T> ref = evaluate(fmm, sources, targets, charges, ibodies, dq);
+
+  double diff = 0, norm = 0;
+  for (size_t i=0; i<ref.size(); ++i) {
+    norm += std::norm(ref[i]);
+    diff += std::norm(ref[i] - results[i]);
+  }
+  return std::sqrt(diff/norm);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  std::srand(0);
+  init_rel_coord();
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-10;
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  double err = test_delta<real_t>(laplace, args);
+  print("Laplace Delta Error", err);
+  assert(err < threshold);
+
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  err = test_delta<complex_t>(helmholtz, args);
+  print("Helmholtz Delta Error", err);
+  assert(err < threshold);
+  return 0;
+}
@@ -0,0 +1,77 @@
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+// compare the passes on a thread pool and on a limited number of OpenMP threads against the default executor
+template <typename T, typename FmmT>
+void test_executor(FmmT& fmm, Args& args, std::shared_ptr<Executor> pool, std::string name) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+
+  start("OpenMP Executor");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("OpenMP Executor");
+  std::vector<T> ref = gather_values(leafs);
+
+  fmm.set_executor(pool);
+  fmm.clear_values(nodes);
+  start("Thread Pool Executor");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("Thread Pool Executor");
+  std::vector<T> res = gather_values(leafs);
+  double err = rel_error(ref, res);
+  print(name + " Thread Pool Error", err);
+  assert(err < threshold);
+
+  fmm.set_num_threads(1);
+  assert(fmm.executor->num_threads() == 1);
+  fmm.clear_values(nodes);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  res = gather_values(leafs);
+  err = rel_error(ref, res);
+  print(name + " Single Thread Error", err);
+  assert(err < threshold);
+  fmm.set_num_threads(0);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+
+  // nested loops on the pool visit every pair of indices exactly once
+  std::shared_ptr<Executor> pool = std::make_shared<ThreadPoolExecutor>(4);
+  std::vector<int> count(100*100, 0);
+  pool->parallel_for(100, [&](size_t i) {
+    pool->parallel_for(100, [&](size_t j) {
+      count[i*100+j]++;
+    });
+  });
+  for (size_t i=0; i<count.size(); ++i)
+    assert(count[i] == 1);
+
+  // one pool shared by two FMM instances
+  LaplaceFmm laplace(args.P, args.ncrit);
+  test_executor<real_t>(laplace, args, pool, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  test_executor<complex_t>(helmholtz, args, pool, "Helmholtz");
+  return 0;
+}
@@ -23,6 +23,7 @@ int main(int argc, char **argv) {
   start("Total");
   complex_t wavek(5, 10);
   HelmholtzFmm fmm(args.P, args.ncrit, wavek);
+  fmm.is_potential_only = args.potential_only;
 #if NON_ADAPTIVE
   fmm.depth = args.maxlevel;
 #endif
@@ -60,7 +61,8 @@ int main(int argc, char **argv) {
   RealVec err = fmm.verify(leafs, sample);
   print_divider("Error");
   print("Potential Error L2", err[0]);
-  print("Gradient Error L2", err[1]);
+  if (!args.potential_only)
+    print("Gradient Error L2", err[1]);
 
   print_divider("Tree");
   print("Root Center x", fmm.x0[0]);
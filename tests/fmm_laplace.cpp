@@ -11,6 +11,9 @@ using namespace exafmm_t;
 
 int main(int argc, char **argv) {
   Args args(argc, argv);
+#if POTENTIAL_ONLY
+  args.potential_only = 1;
+#endif
   print_divider("Parameters");
   args.print();
 
@@ -22,6 +25,7 @@ int main(int argc, char **argv) {
 
   start("Total");
   LaplaceFmm fmm(args.P, args.ncrit);
+  fmm.is_potential_only = args.potential_only;
 #if NON_ADAPTIVE
   fmm.depth = args.maxlevel;
 #endif
@@ -63,13 +67,14 @@ int main(int argc, char **argv) {
   }
 #endif
   stop("Total");
-  print("Evaluation Gflop", (float)flop/1e9);
+  print("Evaluation Gflop", (float)get_flop()/1e9);
 
   bool sample = (args.numBodies >= 10000);
   RealVec err = fmm.verify(leafs, sample);
   print_divider("Error");
   print("Potential Error L2", err[0]);
-  print("Gradient Error L2", err[1]);
+  if (!args.potential_only)
+    print("Gradient Error L2", err[1]);
 
   print_divider("Tree");
   print("Root Center x", fmm.x0[0]);
@@ -22,6 +22,7 @@ int main(int argc, char **argv) {
 
   start("Total");
   ModifiedHelmholtzFmm fmm(args.P, args.ncrit, args.k);
+  fmm.is_potential_only = args.potential_only;
 #if NON_ADAPTIVE
   fmm.depth = args.maxlevel;
 #endif
@@ -59,7 +60,8 @@ int main(int argc, char **argv) {
   RealVec err = fmm.verify(leafs, sample);
   print_divider("Error");
   print("Potential Error L2", err[0]);
-  print("Gradient Error L2", err[1]);
+  if (!args.potential_only)
+    print("Gradient Error L2", err[1]);
 
   print_divider("Tree");
   print("Root Center x", fmm.x0[0]);
@@ -0,0 +1,128 @@
+#include <mpi.h>
+#include "dataset.h"
+#include "distributed_fmm.h"
+#include "helmholtz.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+// compare sampled local targets against direct summation over all sources
+template <typename T, typename FmmT>
+void check_error(DistributedFmm<T, FmmT>& dfmm, Bodies<T>& all_sources, Bodies<T>& targets,
+                 double threshold, std::string name) {
+  FmmT& fmm = dfmm.fmm;
+  int n = all_sources.size();
+  int nvalues = fmm.ntrg_values();
+  RealVec src_coord(3*n), trg_coord;
+  std::vector<T> src_value(n);
+  for (int i=0; i<n; ++i) {
+    for (int d=0; d<3; ++d) src_coord[3*i+d] = all_sources[i].X[d];
+    src_value[i] = all_sources[i].q;
+  }
+  std::vector<size_t> sample;
+  size_t stride = std::max(size_t(1), targets.size() / 100);
+  for (size_t i=0; i<targets.size(); i+=stride) {
+    sample.push_back(i);
+    for (int d=0; d<3; ++d) trg_coord.push_back(targets[i].X[d]);
+  }
+  std::vector<T> direct(nvalues*sample.size(), T(0.));
+  fmm.evaluate_P2P(src_coord, src_value, trg_coord, direct);
+  double local[4] = {0, 0, 0, 0}, global[4];
+  for (size_t j=0; j<sample.size(); ++j) {
+    Body<T>& target = targets[sample[j]];
+    local[0] += std::norm(target.p - direct[nvalues*j]);
+    local[1] += std::norm(direct[nvalues*j]);
+    for (int d=0; d<3 && nvalues>1; ++d) {
+      local[2] += std::norm(target.F[d] - direct[nvalues*j+d+1]);
+      local[3] += std::norm(direct[nvalues*j+d+1]);
+    }
+  }
+  MPI_Allreduce(local, global, 4, MPI_DOUBLE, MPI_SUM, MPI_COMM_WORLD);
+  double p_err = std::sqrt(global[0]/global[1]);
+  if (dfmm.rank == 0) {
+    print(name + " Ranks", dfmm.nranks);
+    print(name + " LET Sources", dfmm.nlet);
+    print(name + " Potential Error L2", p_err);
+  }
+  assert(p_err < threshold);
+  if (nvalues > 1) {
+    double g_err = std::sqrt(global[2]/global[3]);
+    if (dfmm.rank == 0) print(name + " Gradient Error L2", g_err);
+    assert(g_err < 10*threshold);
+  }
+}
+
+// check that the bodies of all ranks are the global bodies with their ids
+template <typename T>
+void check_bodies(Bodies<T>& all_bodies, Bodies<T>& bodies) {
+  long long count = bodies.size(), total;
+  MPI_Allreduce(&count, &total, 1, MPI_LONG_LONG, MPI_SUM, MPI_COMM_WORLD);
+  assert(total == (long long)all_bodies.size());
+  for (size_t i=0; i<bodies.size(); ++i)
+    assert(all_bodies[bodies[i].ibody].X[0] == bodies[i].X[0]);
+}
+
+// evaluate a global problem distributed over all ranks, then repartition it with the measured costs and evaluate again
+template <typename T, typename FmmT>
+void test_distributed(const FmmT& fmm_, Args& args, double threshold, std::string name) {
+  int rank, nranks;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  MPI_Comm_size(MPI_COMM_WORLD, &nranks);
+  // every rank generates the global bodies and keeps a slice
+  int n = args.numBodies;
+  Bodies<T> all_sources = init_sources<T>(n, args.distribution, 0);
+  Bodies<T> all_targets = init_targets<T>(n, args.distribution, 5);
+  for (int i=0; i<n; ++i) {
+    all_sources[i].ibody = i;
+    all_targets[i].ibody = i;
+  }
+  int begin = size_t(n) * rank / nranks, end = size_t(n) * (rank+1) / nranks;
+  Bodies<T> sources(all_sources.begin()+begin, all_sources.begin()+end);
+  Bodies<T> targets(all_targets.begin()+begin, all_targets.begin()+end);
+
+  DistributedFmm<T, FmmT> dfmm(fmm_);
+  dfmm.partition(sources, targets);
+  check_bodies(all_sources, sources);
+  check_bodies(all_targets, targets);
+  dfmm.evaluate(sources, targets);
+  assert(dfmm.comm_time >= 0 && dfmm.overlap_time >= 0);
+  check_error(dfmm, all_sources, targets, threshold, name);
+
+  // the costs cover the evaluation, and the bodies stay in place below the threshold
+  double cost = 0;
+  for (size_t i=0; i<dfmm.costs.size(); ++i) cost += dfmm.costs[i];
+  assert(dfmm.costs.size() == targets.size() && (targets.empty() || cost > 0));
+  size_t nsources = sources.size();
+  assert(!dfmm.repartition(sources, targets, 1e30));
+  assert(sources.size() == nsources);
+  if (nranks > 1) {
+    double initial = dfmm.imbalance();
+    assert(dfmm.repartition(sources, targets, 0));
+    check_bodies(all_sources, sources);
+    check_bodies(all_targets, targets);
+    dfmm.evaluate(sources, targets);
+    check_error(dfmm, all_sources, targets, threshold, name + " Repartitioned");
+    double ratio = dfmm.imbalance();
+    if (rank == 0) print(name + " Repartitioned Imbalance", ratio);
+    // the count-balanced partition of a clustered distribution is imbalanced, the measured costs must improve it
+    if (args.distribution[0] == 'p') assert(ratio < initial);
+  }
+}
+
+int main(int argc, char **argv) {
+  MPI_Init(&argc, &argv);
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  int rank;
+  MPI_Comm_rank(MPI_COMM_WORLD, &rank);
+  double threshold = args.P >= 8 ? 1e-5 : 1e-3;
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  laplace.is_potential_only = args.potential_only;
+  test_distributed<real_t>(laplace, args, threshold, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10), "helmholtz_mpi.dat");
+  helmholtz.is_potential_only = args.potential_only;
+  test_distributed<complex_t>(helmholtz, args, threshold, "Helmholtz");
+  MPI_Finalize();
+  return 0;
+}
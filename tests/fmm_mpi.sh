@@ -0,0 +1,4 @@
+#!/bin/sh
+# run the distributed FMM test on 4 ranks, on a uniform and a clustered distribution
+${MPIRUN:-mpirun} -np 4 ./fmm_mpi -n 100000 &&
+${MPIRUN:-mpirun} -np 4 ./fmm_mpi -n 100000 -d p
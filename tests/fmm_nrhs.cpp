@@ -0,0 +1,97 @@
+#include <cstdlib>      // std::rand
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+template <typename T>
+T random_value() {
+  return T(real_t(std::rand()) / RAND_MAX - 0.5);
+}
+
+// evaluate all right-hand sides in one pass and compare against one pass per right-hand side
+template <typename T, typename FmmT>
+double test_nrhs(FmmT& fmm, Args& args, int nrhs) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  std::vector<T> charges(sources.size()*nrhs);
+  for (size_t i=0; i<charges.size(); ++i)
+    charges[i] = random_value<T>();
+
+  // results of the multi-rhs pass in the initial numbering of targets
+  std::vector<T> results(targets.size()*4*nrhs);
+  {
+    fmm.nrhs = nrhs;
+    NodePtrs<T> leafs, nonleafs;
+    get_bounds(sources, targets, fmm.x0, fmm.r0);
+    Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+    balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+    set_colleagues(nodes);
+    build_list(nodes, fmm);
+    fmm.precompute();
+    fmm.M2L_setup(nonleafs);
+    fmm.set_charges(leafs, charges);
+    fmm.upward_pass(nodes, leafs);
+    fmm.downward_pass(nodes, leafs);
+    for (size_t i=0; i<leafs.size(); ++i) {
+      for (size_t j=0; j<leafs[i]->itrgs.size(); ++j) {
+        for (int r=0; r<nrhs; ++r) {
+          for (int d=0; d<4; ++d)
+            results[4*(leafs[i]->itrgs[j]*nrhs+r)+d] = leafs[i]->trg_value[4*(j*nrhs+r)+d];
+        }
+      }
+    }
+  }
+
+  double diff = 0, norm = 0;
+  fmm.nrhs = 1;
+  for (int r=0; r<nrhs; ++r) {
+    std::vector<T> charges_r(sources.size());
+    for (size_t i=0; i<sources.size(); ++i)
+      charges_r[i] = charges[i*nrhs+r];
+    NodePtrs<T> leafs, nonleafs;
+    get_bounds(sources, targets, fmm.x0, fmm.r0);
+    Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+    balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+    set_colleagues(nodes);
+    build_list(nodes, fmm);
+    fmm.M2L_setup(nonleafs);
+    fmm.set_charges(leafs, charges_r);
+    fmm.upward_pass(nodes, leafs);
+    fmm.downward_pass(nodes, leafs);
+    for (size_t i=0; i<leafs.size(); ++i) {
+      for (size_t j=0; j<leafs[i]->itrgs.size(); ++j) {
+        for (int d=0; d<4; ++d) {
+          T ref = leafs[i]->trg_value[4*j+d];
+          norm += std::norm(ref);
+          diff += std::norm(ref - results[4*(leafs[i]->itrgs[j]*nrhs+r)+d]);
+        }
+      }
+    }
+  }
+  return std::sqrt(diff/norm);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  std::srand(0);
+  init_rel_coord();
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-10;
+  int nrhs = 3;
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  double err = test_nrhs<real_t>(laplace, args, nrhs);
+  print("Laplace Multi-RHS Error", err);
+  assert(err < threshold);
+
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  err = test_nrhs<complex_t>(helmholtz, args, nrhs);
+  print("Helmholtz Multi-RHS Error", err);
+  assert(err < threshold);
+  return 0;
+}
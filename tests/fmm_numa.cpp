@@ -0,0 +1,78 @@
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+// the passes after NUMA placement of the tree data reproduce the results of the default placement
+template <typename T, typename FmmT>
+void test_numa(FmmT& fmm, Args& args, std::string name) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.P2P_cache_setup(leafs, size_t(16) << 20, 0, false);
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+
+  start("Default Placement");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("Default Placement");
+  std::vector<T> ref = gather_values(leafs);
+
+  fmm.numa_setup(nodes, leafs);
+  fmm.clear_values(nodes);
+  start("NUMA Placement");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("NUMA Placement");
+  std::vector<T> res = gather_values(leafs);
+  double err = rel_error(ref, res);
+  print(name + " NUMA Error", err);
+  assert(err < threshold);
+
+  // the next pass reuses the M2L buffers placed by this one
+  assert(fmm.m2l_fft_out.capacity() > 0);
+  fmm.clear_values(nodes);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  res = gather_values(leafs);
+  err = rel_error(ref, res);
+  print(name + " NUMA Reuse Error", err);
+  assert(err < threshold);
+
+  std::map<std::string, double> fractions = fmm.numa_remote_fraction(nodes, leafs, false);
+  for (auto& f : fractions)
+    assert(f.second <= 1);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+
+  // contiguous ranges cover every item exactly once
+  for (int nthreads=1; nthreads<=5; ++nthreads) {
+    for (size_t n=1; n<50; ++n) {
+      for (size_t i=0; i<n; ++i) {
+        int t = contiguous_owner(i, n, nthreads);
+        assert(n*t/nthreads <= i && i < n*(t+1)/nthreads);
+      }
+    }
+  }
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  test_numa<real_t>(laplace, args, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  test_numa<complex_t>(helmholtz, args, "Helmholtz");
+  return 0;
+}
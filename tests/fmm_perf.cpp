@@ -0,0 +1,60 @@
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+  PerfCounters& perf = perf_counters();
+
+  // disabled counters read as invalid
+  PerfValues values = perf.read();
+  for (int e=0; e<Event_Count; e++) assert(!values.valid[e]);
+
+  bool is_available = perf.enable();
+  print("Hardware Counters", int(is_available));
+  if (!perf.error().empty()) std::cout << perf.error() << std::endl;
+  if (is_available) {
+    // a loop of known length retires at least one instruction per iteration
+    PerfValues begin = perf.read();
+    volatile double sum = 0;
+    for (int i=0; i<1000000; ++i) sum = sum + i;
+    PerfValues loop = perf.read() - begin;
+    if (perf.counted(Instructions_Event)) assert(loop.valid[Instructions_Event] && loop.value[Instructions_Event] >= 1e6);
+    if (perf.counted(Cycles_Event)) assert(loop.value[Cycles_Event] > 0);
+  }
+
+  // the phases are measured, or degrade to invalid values when the counters are unavailable
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, args.distribution, 0);
+  Bodies<real_t> targets = init_targets<real_t>(args.numBodies, args.distribution, 5);
+  LaplaceFmm fmm(args.P, args.ncrit);
+  NodePtrs<real_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<real_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.upward_pass(nodes, leafs);
+  fmm.downward_pass(nodes, leafs);
+  const char* phases[] = {"P2M", "M2M", "P2L", "M2P", "P2P", "M2L", "hadamard_product", "L2L", "L2P"};
+  for (int i=0; i<9; ++i) {
+    assert(fmm.phase_counters.count(phases[i]));
+    PerfValues& phase = fmm.phase_counters[phases[i]].perf;
+    for (int e=0; e<Event_Count; e++) {
+      assert(phase.valid[e] == perf.counted(e));
+      assert(phase.value[e] >= 0);
+    }
+  }
+  if (perf.counted(Instructions_Event))
+    assert(fmm.phase_counters["hadamard_product"].perf.value[Instructions_Event]
+           <= fmm.phase_counters["M2L"].perf.value[Instructions_Event]);
+  perf.disable();
+  assert(!perf.enabled() && !perf.read().valid[Instructions_Event]);
+  return 0;
+}
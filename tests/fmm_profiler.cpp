@@ -0,0 +1,116 @@
+#include <thread>
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+
+using namespace exafmm_t;
+
+// whether the braces and brackets of a JSON string are balanced outside of strings
+bool is_balanced(const std::string& json) {
+  std::string stack;
+  bool in_string = false;
+  for (size_t i=0; i<json.size(); ++i) {
+    char c = json[i];
+    if (in_string) {
+      if (c == '\\') i++;
+      else if (c == '"') in_string = false;
+    } else if (c == '"') {
+      in_string = true;
+    } else if (c == '{' || c == '[') {
+      stack.push_back(c);
+    } else if (c == '}' || c == ']') {
+      if (stack.empty() || stack.back() != (c == '}' ? '{' : '[')) return false;
+      stack.pop_back();
+    }
+  }
+  return stack.empty() && !in_string;
+}
+
+template <typename T, typename FmmT>
+void run_fmm(FmmT& fmm, Args& args) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+  Profiler& prof = profiler();
+
+  // nested scopes of the operators
+  start("Laplace");
+  LaplaceFmm laplace(args.P, args.ncrit);
+  run_fmm<real_t>(laplace, args);
+  stop("Laplace", false);
+  start("Helmholtz");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10), "helmholtz_profiler_test.dat");
+  run_fmm<complex_t>(helmholtz, args);
+  stop("Helmholtz", false);
+  std::pair<double, long long> m2l = prof.total({"Laplace", "M2L"});
+  std::pair<double, long long> hadamard = prof.total({"Laplace", "M2L", "hadamard_product"});
+  print("Laplace M2L", m2l.first);
+  print("Laplace Hadamard", hadamard.first);
+  assert(m2l.second == 1 && hadamard.second == 1);
+  assert(hadamard.first > 0 && hadamard.first <= m2l.first);
+  double levels = 0;
+  for (int l=0; l<helmholtz.depth; ++l) {
+    std::string level = "level " + std::to_string(l);
+    std::pair<double, long long> fft = prof.total({"Helmholtz", "M2L", level, "fft_up_equiv"});
+    assert(fft.second == 1);
+    levels += prof.total({"Helmholtz", "M2L", level}).first;
+  }
+  print("Helmholtz M2L", prof.total({"Helmholtz", "M2L"}).first);
+  print("Helmholtz M2L Levels", levels);
+  assert(levels <= prof.total({"Helmholtz", "M2L"}).first);
+  assert(prof.total({"M2L"}).second == 0);   // not a top-level scope
+
+  // scopes of concurrent threads are accumulated per thread
+  prof.reset();
+  std::vector<std::thread> threads;
+  for (int t=0; t<4; ++t) {
+    threads.emplace_back([]() {
+      for (int i=0; i<100; ++i) {
+        ProfileScope outer("outer");
+        ProfileScope inner("inner");
+      }
+    });
+  }
+  for (size_t t=0; t<threads.size(); ++t) threads[t].join();
+  assert(prof.total({"outer"}).second == 400);
+  assert(prof.total({"outer", "inner"}).second == 400);
+  assert(prof.total({"Laplace"}).second == 0);   // cleared by reset()
+
+  // an unmatched stop closes the scopes left open in the stopped one
+  start("open");
+  start("left open");
+  stop("open", false);
+  assert(prof.total({"open"}).second == 1 && prof.total({"open", "left open"}).second == 1);
+  stop("never started", false);
+
+  // disabled profiler
+  prof.enable(false);
+  { ProfileScope scope("disabled"); }
+  assert(prof.total({"disabled"}).second == 0);
+  prof.enable(true);
+
+  std::string json = prof.to_json();
+  std::string trace = prof.to_chrome_trace();
+  assert(is_balanced(json) && json.find("\"inner\"") != std::string::npos);
+  assert(is_balanced(trace) && trace.find("\"ph\": \"X\"") != std::string::npos);
+  prof.write_json("profile.json");
+  prof.write_chrome_trace("profile_trace.json");
+  return 0;
+}
@@ -0,0 +1,80 @@
+#include <cstdlib>      // std::rand
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  std::srand(0);
+
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, args.distribution, 0);
+  Bodies<real_t> targets = init_targets<real_t>(args.numBodies, args.distribution, 5);
+  LaplaceFmm fmm(args.P, args.ncrit);
+  NodePtrs<real_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<real_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  init_rel_coord();
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  fmm.query_setup(nodes, leafs);
+
+  // querying the targets of the pass reproduces their results
+  RealVec coord, ref;
+  for (size_t i=0; i<leafs.size(); ++i) {
+    coord.insert(coord.end(), leafs[i]->trg_coord.begin(), leafs[i]->trg_coord.end());
+    ref.insert(ref.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+  }
+  RealVec res = fmm.query(coord);
+  double err = rel_error(ref, res);
+  print("Query Targets Error", err);
+  assert(err < (std::is_same<float, real_t>::value ? 1e-5 : 1e-12));
+
+  // new points inside the root box are compared against direct summation
+  int nquery = 1000;
+  RealVec probe(3*nquery);
+  for (int i=0; i<nquery; ++i) {
+    for (int d=0; d<3; ++d)
+      probe[3*i+d] = fmm.x0[d] + fmm.r0 * (2*real_t(std::rand())/RAND_MAX - 1);
+  }
+  res = fmm.query(probe);
+  RealVec direct(4*nquery, 0);
+  for (size_t i=0; i<leafs.size(); ++i)
+    fmm.gradient_P2P(leafs[i]->src_coord, leafs[i]->src_value, probe, direct);
+  RealVec res_p(nquery), direct_p(nquery);
+  for (int i=0; i<nquery; ++i) {
+    res_p[i] = res[4*i];
+    direct_p[i] = direct[4*i];
+  }
+  err = rel_error(direct_p, res_p);
+  print("Query Potential Error", err);
+  assert(err < 1e-3);
+
+  // after an update of some charges, querying the targets reproduces their updated results
+  fmm.delta_setup(leafs);
+  std::vector<int> ibodies;
+  RealVec dq;
+  for (size_t i=0; i<sources.size(); i+=50) {
+    ibodies.push_back(std::rand() % sources.size());
+    dq.push_back(real_t(std::rand()) / RAND_MAX - 0.5);
+  }
+  fmm.evaluate_delta(nodes, leafs, ibodies, dq, false);
+  ref.clear();
+  for (size_t i=0; i<leafs.size(); ++i)
+    ref.insert(ref.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+  res = fmm.query(coord);
+  err = rel_error(ref, res);
+  print("Query After Delta Error", err);
+  assert(err < (std::is_same<float, real_t>::value ? 1e-5 : 1e-12));
+  return 0;
+}
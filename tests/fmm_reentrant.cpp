@@ -0,0 +1,64 @@
+#include <thread>
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+ComplexVec helmholtz_solve(Args& args, complex_t wavek, std::string filename);
+
+RealVec laplace_solve(Args& args) {
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, args.distribution, 0);
+  Bodies<real_t> targets = init_targets<real_t>(args.numBodies, args.distribution, 5);
+  LaplaceFmm fmm(args.P, args.ncrit, "laplace_reentrant_test.dat");
+  fmm.set_num_threads(2);
+  NodePtrs<real_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<real_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  start("Laplace Solve");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("Laplace Solve", false);
+  RealVec values;
+  for (size_t i=0; i<leafs.size(); ++i)
+    values.insert(values.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+  return values;
+}
+
+// independent solves running concurrently in separate threads reproduce the results of sequential solves
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+
+  RealVec laplace_ref = laplace_solve(args);
+  ComplexVec helmholtz_ref0 = helmholtz_solve(args, complex_t(5, 10), "helmholtz_reentrant_test0.dat");
+  ComplexVec helmholtz_ref1 = helmholtz_solve(args, complex_t(10, 5), "helmholtz_reentrant_test1.dat");
+
+  RealVec laplace_res;
+  ComplexVec helmholtz_res0, helmholtz_res1;
+  std::thread thread0([&]() { laplace_res = laplace_solve(args); });
+  std::thread thread1([&]() { helmholtz_res0 = helmholtz_solve(args, complex_t(5, 10), "helmholtz_reentrant_test0.dat"); });
+  std::thread thread2([&]() { helmholtz_res1 = helmholtz_solve(args, complex_t(10, 5), "helmholtz_reentrant_test1.dat"); });
+  thread0.join();
+  thread1.join();
+  thread2.join();
+
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+  double err = rel_error(laplace_ref, laplace_res);
+  print("Laplace Concurrent Error", err);
+  assert(err < threshold);
+  err = rel_error(helmholtz_ref0, helmholtz_res0);
+  print("Helmholtz 0 Concurrent Error", err);
+  assert(err < threshold);
+  err = rel_error(helmholtz_ref1, helmholtz_res1);
+  print("Helmholtz 1 Concurrent Error", err);
+  assert(err < threshold);
+  return 0;
+}
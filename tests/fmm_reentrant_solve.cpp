@@ -0,0 +1,30 @@
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+
+using namespace exafmm_t;
+
+// compiled as a separate translation unit to check that the headers can be included more than once in a program
+ComplexVec helmholtz_solve(Args& args, complex_t wavek, std::string filename) {
+  Bodies<complex_t> sources = init_sources<complex_t>(args.numBodies, args.distribution, 0);
+  Bodies<complex_t> targets = init_targets<complex_t>(args.numBodies, args.distribution, 5);
+  HelmholtzFmm fmm(args.P, args.ncrit, wavek, filename);
+  fmm.set_num_threads(2);
+  NodePtrs<complex_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<complex_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  start("Helmholtz Solve");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("Helmholtz Solve", false);
+  ComplexVec values;
+  for (size_t i=0; i<leafs.size(); ++i)
+    values.insert(values.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+  return values;
+}
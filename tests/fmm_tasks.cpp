@@ -0,0 +1,73 @@
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+// compare the task graph and concurrent near/far field evaluations against the phase by phase passes
+template <typename T, typename FmmT>
+void test_tasks(FmmT& fmm, Args& args, std::string name) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+
+  start("Phases");
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  stop("Phases");
+  std::vector<T> ref = gather_values(leafs);
+
+  fmm.clear_values(nodes);
+  start("Task Graph");
+  fmm.evaluate_tasks(nodes, leafs, 0, false);
+  stop("Task Graph");
+  std::vector<T> res = gather_values(leafs);
+  double err = rel_error(ref, res);
+  print(name + " Task Graph Error", err);
+  assert(err < threshold);
+
+  fmm.P2P_cache_setup(leafs, size_t(64) << 20, 0, false);
+  fmm.P2M_L2P_cache_setup(leafs, size_t(64) << 20, 1<<30, false);
+  fmm.clear_values(nodes);
+  fmm.evaluate_tasks(nodes, leafs, 7, false);
+  res = gather_values(leafs);
+  err = rel_error(ref, res);
+  print(name + " Cached Task Graph Error", err);
+  assert(err < threshold);
+
+  // repeated concurrent evaluations tune the share of near-field threads
+  for (int step=0; step<3; ++step) {
+    fmm.clear_values(nodes);
+    fmm.evaluate_concurrent(nodes, leafs, false);
+    res = gather_values(leafs);
+    err = rel_error(ref, res);
+    assert(err < threshold);
+    assert(fmm.near_thread_fraction > 0 && fmm.near_thread_fraction < 1);
+  }
+  print(name + " Concurrent Error", err);
+  print(name + " Near-Field Thread Share", fmm.near_thread_fraction);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(std::max(args.threads, 2));   // the near and far field groups need two threads
+  init_rel_coord();
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  test_tasks<real_t>(laplace, args, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  test_tasks<complex_t>(helmholtz, args, "Helmholtz");
+  return 0;
+}
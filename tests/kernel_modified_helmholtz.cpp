@@ -76,7 +76,7 @@ int main(int argc, char **argv) {
 #endif
 
   // M2M
-  fmm.M2M(root);
+  fmm.M2M_levels(nodes);
 #if DEBUG
   std::cout << "lvl 2 source node's upward equivalent charges" << std::endl;
   for (int i=0; i<fmm.nsurf; ++i) {
@@ -85,7 +85,7 @@ int main(int argc, char **argv) {
 #endif
 
   // set up M2L_list
-  target->parent->parent->M2L_list.resize(REL_COORD[M2L_Type].size(), nullptr);
+  target->parent->parent->M2L_list.resize(rel_coord(M2L_Type).size(), nullptr);
   target->parent->parent->M2L_list[0] = source->parent->parent;
   // M2L
   NodePtrs<real_t> nonleafs;
@@ -100,7 +100,7 @@ int main(int argc, char **argv) {
 #endif
 
   // L2L
-  fmm.L2L(root);
+  fmm.L2L_levels(nodes);
 #if DEBUG
   std::cout << "lvl 3 target node's downward check potentials" << std::endl;
   for (int i=0; i<fmm.nsurf; ++i) {
@@ -0,0 +1,61 @@
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+// compare FMM passes with cached P2M/L2P operators (all leaves, half of the memory) against the kernels
+template <typename T, typename FmmT>
+void test_cache(FmmT& fmm, Args& args, std::string name) {
+  Bodies<T> sources = init_sources<T>(args.numBodies, args.distribution, 0);
+  Bodies<T> targets = init_targets<T>(args.numBodies, args.distribution, 5);
+  NodePtrs<T> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<T> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  std::vector<T> ref = gather_values(leafs, true);
+
+  size_t budget = size_t(256) << 20;   // 256 MB
+  size_t bytes = fmm.P2M_L2P_cache_setup(leafs, budget);
+  fmm.clear_values(nodes);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  std::vector<T> res = gather_values(leafs, true);
+  double err = rel_error(ref, res);
+  print(name + " Cache Error", err);
+  assert(err < threshold);
+
+  fmm.P2M_L2P_cache_setup(leafs, bytes/2);
+  fmm.clear_values(nodes);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  res = gather_values(leafs, true);
+  err = rel_error(ref, res);
+  print(name + " Partial Cache Error", err);
+  assert(err < threshold);
+  fmm.P2M_L2P_cache_setup(leafs, 0);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  test_cache<real_t>(laplace, args, "Laplace");
+  HelmholtzFmm helmholtz(args.P, args.ncrit, complex_t(5, 10));
+  test_cache<complex_t>(helmholtz, args, "Helmholtz");
+  return 0;
+}
@@ -25,14 +25,13 @@ int main(int argc, char** argv) {
   set_colleagues(nodes);
   build_list(nodes, fmm);
 
-  Node<real_t>* root = nodes.data();
   fmm.P2M(leafs);
-  fmm.M2M(root);
+  fmm.M2M_levels(nodes);
   fmm.P2L(nodes);
   fmm.M2P(leafs);
   fmm.P2P(leafs);
   fmm.M2L(nonleafs);
-  fmm.L2L(root);
+  fmm.L2L_levels(nodes);
   fmm.L2P(leafs);
 
   print("number of sources", args.numBodies);
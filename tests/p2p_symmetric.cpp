@@ -0,0 +1,87 @@
+#include <algorithm>    // std::generate
+#include <cstdlib>      // std::rand
+#include <type_traits>  // std::is_same
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "laplace.h"
+#include "modified_helmholtz.h"
+#include "test_utils.h"
+
+using namespace exafmm_t;
+
+real_t random_real() {
+  return real_t(std::rand()) / RAND_MAX;
+}
+
+// compare the mutual kernel against two one-sided kernel calls
+template <typename FmmT>
+double test_mutual(FmmT& fmm, int n0, int n1) {
+  RealVec coord0(3*n0), coord1(3*n1), value0(n0), value1(n1);
+  std::generate(coord0.begin(), coord0.end(), random_real);
+  std::generate(coord1.begin(), coord1.end(), random_real);
+  std::generate(value0.begin(), value0.end(), random_real);
+  std::generate(value1.begin(), value1.end(), random_real);
+  RealVec result0(4*n0, 0), result1(4*n1, 0);
+  fmm.gradient_P2P(coord1, value1, coord0, result0);
+  fmm.gradient_P2P(coord0, value0, coord1, result1);
+  RealVec result0_mutual(4*n0, 0), result1_mutual(4*n1, 0);
+  fmm.gradient_P2P_mutual(coord0, value0, result0_mutual, coord1, value1, result1_mutual);
+  return std::max(rel_error(result0, result0_mutual), rel_error(result1, result1_mutual));
+}
+
+// compare symmetric P2P against one-sided P2P on a tree whose sources coincide with targets
+template <typename FmmT>
+double test_tree(FmmT& fmm, Args& args) {
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, args.distribution, 0);
+  Bodies<real_t> targets = sources;
+  NodePtrs<real_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<real_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+
+  fmm.P2P(leafs);
+  std::vector<RealVec> trg_values(leafs.size());
+  for (size_t i=0; i<leafs.size(); ++i) {
+    trg_values[i] = leafs[i]->trg_value;
+    std::fill(leafs[i]->trg_value.begin(), leafs[i]->trg_value.end(), 0);
+  }
+  bool is_symmetric = fmm.P2P_setup(leafs);
+  assert(is_symmetric);
+  print("Number of Colors", fmm.p2pdata.colors.size());
+  fmm.P2P(leafs);
+  RealVec ref, res;
+  for (size_t i=0; i<leafs.size(); ++i) {
+    ref.insert(ref.end(), trg_values[i].begin(), trg_values[i].end());
+    res.insert(res.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+  }
+  return rel_error(ref, res);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  std::srand(0);
+  init_rel_coord();
+  double threshold = std::is_same<float, real_t>::value ? 1e-5 : 1e-12;
+
+  LaplaceFmm laplace(args.P, args.ncrit);
+  ModifiedHelmholtzFmm modified_helmholtz(args.P, args.ncrit, args.k);
+
+  double err = test_mutual(laplace, 1003, 517);
+  print("Laplace Mutual Error", err);
+  assert(err < threshold);
+  err = test_mutual(modified_helmholtz, 1003, 517);
+  print("Modified Helmholtz Mutual Error", err);
+  assert(err < threshold);
+
+  err = test_tree(laplace, args);
+  print("Laplace Symmetric P2P Error", err);
+  assert(err < threshold);
+  err = test_tree(modified_helmholtz, args);
+  print("Modified Helmholtz Symmetric P2P Error", err);
+  assert(err < threshold);
+  return 0;
+}
@@ -0,0 +1,102 @@
+#include <cstdlib>      // std::rand
+#include "dataset.h"
+#include "helmholtz.h"
+#include "laplace.h"
+#include "solver.h"
+
+using namespace exafmm_t;
+
+template <typename T>
+T random_value() {
+  return T(real_t(std::rand()) / RAND_MAX - 0.5);
+}
+
+// relative residual of x computed with the most accurate level
+template <typename T, typename FmmT>
+double residual(FmmSolver<T, FmmT>& solver, std::vector<T>& b, std::vector<T>& x) {
+  std::vector<T> r(x.size());
+  solver.ilevel = 0;
+  solver.matvec(x.data(), r.data());
+  double diff = 0, norm = 0;
+  for (size_t i=0; i<b.size(); ++i) {
+    norm += std::norm(b[i]);
+    diff += std::norm(b[i]-r[i]);
+  }
+  return std::sqrt(diff/norm);
+}
+
+// solve with GMRES, BiCGStab, near-field preconditioners and relaxed GMRES with cached operators,
+// check the true residuals
+template <typename T, typename FmmT>
+void test_solver(std::vector<FmmT>& fmms, Args& args, T diagonal, std::string name) {
+  Bodies<T> bodies = init_sources<T>(args.numBodies, args.distribution, 0);
+  FmmSolver<T, FmmT> solver(bodies, fmms, diagonal);
+  std::vector<T> b(bodies.size());
+  for (size_t i=0; i<b.size(); ++i)
+    b[i] = random_value<T>();
+  real_t tol = 1e-6;
+
+  std::vector<T> x(b.size(), T(0.));
+  int iter = solver.gmres(b.data(), x.data(), tol, 30, 200, false);
+  double err = residual(solver, b, x);
+  print(name + " GMRES Iterations", iter);
+  print(name + " GMRES Residual", err);
+  assert(iter > 0 && err < 10*tol);
+  int iter_gmres = iter;
+
+  std::fill(x.begin(), x.end(), T(0.));
+  iter = solver.bicgstab(b.data(), x.data(), tol, 200, false);
+  err = residual(solver, b, x);
+  print(name + " BiCGStab Iterations", iter);
+  print(name + " BiCGStab Residual", err);
+  assert(iter > 0 && err < 10*tol);
+
+  // near-field preconditioner, leaf blocks then leaf and colleague blocks
+  int iter_plain = iter;
+  int nsingular = solver.preconditioner_setup(false, 0, false);
+  assert(nsingular == 0);
+  std::fill(x.begin(), x.end(), T(0.));
+  iter = solver.bicgstab(b.data(), x.data(), tol, 200, false);
+  err = residual(solver, b, x);
+  print(name + " Leaf Preconditioned BiCGStab Iterations", iter);
+  print(name + " Leaf Preconditioned BiCGStab Residual", err);
+  assert(iter > 0 && iter <= iter_plain && err < 10*tol);
+
+  nsingular = solver.preconditioner_setup(true, 512, false);
+  assert(nsingular == 0);
+  std::fill(x.begin(), x.end(), T(0.));
+  iter = solver.gmres(b.data(), x.data(), tol, 30, 200, false);
+  err = residual(solver, b, x);
+  print(name + " Colleague Preconditioned GMRES Iterations", iter);
+  print(name + " Colleague Preconditioned GMRES Residual", err);
+  assert(iter > 0 && iter <= iter_gmres && err < 10*tol);
+
+  solver.cache_setup(size_t(256) << 20);   // 256 MB
+  solver.is_relaxed = true;
+  int nmatvec = solver.levels[1].nmatvec;
+  std::fill(x.begin(), x.end(), T(0.));
+  iter = solver.gmres(b.data(), x.data(), tol, 30, 200, false);
+  err = residual(solver, b, x);
+  print(name + " Relaxed GMRES Iterations", iter);
+  print(name + " Relaxed GMRES Residual", err);
+  print(name + " Relaxed Matvecs", solver.levels[1].nmatvec - nmatvec);
+  assert(iter > 0 && err < 10*tol);
+  assert(solver.levels[1].nmatvec > nmatvec);
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  std::srand(0);
+
+  std::vector<LaplaceFmm> laplace;
+  laplace.push_back(LaplaceFmm(args.P+2, args.ncrit));
+  laplace.push_back(LaplaceFmm(args.P, args.ncrit));
+  test_solver<real_t>(laplace, args, real_t(args.numBodies/100), "Laplace");
+
+  std::vector<HelmholtzFmm> helmholtz;
+  helmholtz.push_back(HelmholtzFmm(args.P+2, args.ncrit, complex_t(5, 10)));
+  helmholtz.push_back(HelmholtzFmm(args.P, args.ncrit, complex_t(5, 10)));
+  test_solver<complex_t>(helmholtz, args, complex_t(args.numBodies/100, 0), "Helmholtz");
+  return 0;
+}
@@ -0,0 +1,40 @@
+#ifndef test_utils_h
+#define test_utils_h
+#include <algorithm>    // std::fill
+#include <cassert>
+#include <cmath>        // std::sqrt
+#include <vector>
+#include "exafmm_t.h"
+
+namespace exafmm_t {
+  //! Relative L2 error of a against the reference b, for real and complex values.
+  template <typename T>
+  double rel_error(const std::vector<T>& a, const std::vector<T>& b) {
+    assert(a.size() == b.size());
+    double diff = 0, norm = 0;
+    for (size_t i=0; i<a.size(); ++i) {
+      norm += std::norm(a[i]);
+      diff += std::norm(a[i]-b[i]);
+    }
+    return std::sqrt(diff/norm);
+  }
+
+  /**
+   * @brief Concatenate the target values of the leaves.
+   *
+   * @param leafs Vector of pointers to leaf nodes.
+   * @param reset Whether to zero the target values afterwards, so that the leaves can be evaluated again.
+   * @return Target values in the order of the leaves.
+   */
+  template <typename T>
+  std::vector<T> gather_values(NodePtrs<T>& leafs, bool reset=false) {
+    std::vector<T> values;
+    for (size_t i=0; i<leafs.size(); ++i) {
+      values.insert(values.end(), leafs[i]->trg_value.begin(), leafs[i]->trg_value.end());
+      if (reset)
+        std::fill(leafs[i]->trg_value.begin(), leafs[i]->trg_value.end(), T(0.));
+    }
+    return values;
+  }
+}
+#endif
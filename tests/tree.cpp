@@ -45,7 +45,7 @@ int main(int argc, char** argv) {
   // upward pass and check monopole
   Node<real_t> * root = nodes.data();
   fmm.P2M(leafs);
-  fmm.M2M(root);
+  fmm.M2M_levels(nodes);
   print("number of sources", args.numBodies);
   print("root's monopole", root->up_equiv[0]);
   assert(args.numBodies == root->up_equiv[0]);
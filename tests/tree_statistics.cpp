@@ -0,0 +1,66 @@
+#include "build_list.h"
+#include "build_tree.h"
+#include "dataset.h"
+#include "laplace.h"
+#include "tree_statistics.h"
+
+using namespace exafmm_t;
+
+// check the statistics of the tree of a distribution against the tree and the counts of an evaluation
+void test_statistics(Args& args, const char* distribution) {
+  Bodies<real_t> sources = init_sources<real_t>(args.numBodies, distribution, 0);
+  Bodies<real_t> targets = init_targets<real_t>(args.numBodies, distribution, 5);
+  LaplaceFmm fmm(args.P, args.ncrit);
+  NodePtrs<real_t> leafs, nonleafs;
+  get_bounds(sources, targets, fmm.x0, fmm.r0);
+  Nodes<real_t> nodes = build_tree(sources, targets, leafs, nonleafs, fmm);
+  balance_tree(nodes, sources, targets, leafs, nonleafs, fmm);
+  set_colleagues(nodes);
+  build_list(nodes, fmm);
+
+  TreeStatistics stats = tree_statistics(nodes, fmm);
+  stats.print();
+  assert(stats.depth == fmm.depth);
+  long long nnodes = 0, nleafs = 0;
+  for (int l=0; l<=stats.depth; ++l) {
+    nnodes += stats.nodes[l];
+    nleafs += stats.leafs[l];
+  }
+  assert(nnodes == (long long)nodes.size() && nleafs == (long long)leafs.size());
+  assert(nnodes == nleafs + stats.empty_leafs + (long long)nonleafs.size());
+  assert(stats.leaf_sources.total == args.numBodies && stats.leaf_targets.total == args.numBodies);
+  assert(stats.leaf_sources.max <= fmm.ncrit && stats.leaf_targets.max <= fmm.ncrit);
+  long long nbinned = 0;
+  for (size_t b=0; b<stats.leaf_sources.bins.size(); ++b) nbinned += stats.leaf_sources.bins[b];
+  assert(nbinned == stats.leaf_sources.count);
+  assert(stats.P2P_lengths.count == nleafs && stats.M2P_lengths.count == nleafs);
+  assert(stats.M2L_lengths.count == (long long)nonleafs.size() && stats.P2L_lengths.count == nnodes);
+  // the adaptive tree of a clustered distribution has leaves of different levels next to each other
+  if (distribution[0] == 'p')
+    assert(stats.P2L_lengths.total > 0 && stats.M2P_lengths.total > 0);
+
+  // the estimates are the flops counted by an evaluation, except for the FFTs of M2L counted by the FFT library
+  fmm.precompute();
+  fmm.M2L_setup(nonleafs);
+  fmm.upward_pass(nodes, leafs, false);
+  fmm.downward_pass(nodes, leafs, false);
+  for (size_t i=0; i<stats.work.size(); ++i) {
+    double counted = fmm.phase_counters[stats.work[i].name].counters.total_flop();
+    print(stats.work[i].name + " counted/estimated", stats.work[i].flop > 0 ? counted / stats.work[i].flop : 0);
+    if (stats.work[i].name == "M2L")
+      assert(counted > 0 && stats.work[i].flop > 0);
+    else
+      assert(std::abs(counted - stats.work[i].flop) <= 1e-9 * stats.work[i].flop);
+    if (distribution[0] == 'p' && (stats.work[i].name == "P2L" || stats.work[i].name == "M2P"))
+      assert(counted > 0);
+  }
+}
+
+int main(int argc, char **argv) {
+  Args args(argc, argv);
+  omp_set_num_threads(args.threads);
+  init_rel_coord();
+  test_statistics(args, args.distribution);
+  if (args.distribution[0] != 'p') test_statistics(args, "p");
+  return 0;
+}